@@ -26,6 +26,7 @@
 #include "TelepathyQt/_gen/cli-account-manager.moc.hpp"
 #include "TelepathyQt/_gen/cli-account-manager-body.hpp"
 
+#include "TelepathyQt/account-set-internal.h"
 #include "TelepathyQt/debug-internal.h"
 
 #include <TelepathyQt/AccountCapabilityFilter>
@@ -84,6 +85,9 @@ struct TP_QT_NO_EXPORT AccountManager::Private
     QHash<QString, AccountPtr> incompleteAccounts;
     QHash<QString, AccountPtr> accounts;
     QStringList supportedAccountProperties;
+
+    // Shared by all AccountSets, created on demand
+    AccountIndex *accountIndex;
 };
 
 static const int maxReintrospectionRetries = 5;
@@ -101,7 +105,8 @@ AccountManager::Private::Private(AccountManager *parent,
       chanFactory(chanFactory),
       contactFactory(contactFactory),
       reintrospectionRetries(0),
-      gotInitialAccounts(false)
+      gotInitialAccounts(false),
+      accountIndex(0)
 {
     debug() << "Creating new AccountManager:" << parent->busName();
 
@@ -1176,4 +1181,13 @@ void AccountManager::onAccountRemoved(const QDBusObjectPath &objectPath)
  * \param account The newly created account.
  */
 
+AccountIndex *AccountManager::accountIndex() const
+{
+    if (!mPriv->accountIndex) {
+        mPriv->accountIndex = new AccountIndex(const_cast<AccountManager *>(this));
+    }
+
+    return mPriv->accountIndex;
+}
+
 } // Tp
@@ -48,6 +48,7 @@
 namespace Tp
 {
 
+class AccountIndex;
 class PendingAccount;
 
 class TP_QT_EXPORT AccountManager : public StatelessDBusProxy,
@@ -145,8 +146,11 @@ private Q_SLOTS:
     TP_QT_NO_EXPORT void onAccountRemoved(const QDBusObjectPath &objectPath);
 
 private:
+    friend class AccountSet;
     friend class PendingAccount;
 
+    TP_QT_NO_EXPORT AccountIndex *accountIndex() const;
+
     struct Private;
     friend struct Private;
     Private *mPriv;
@@ -22,61 +22,112 @@
 
 #include <TelepathyQt/AccountPropertyFilter>
 
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QVariantMap>
+
 namespace Tp
 {
 
 class ConnectionCapabilities;
 
-struct TP_QT_NO_EXPORT AccountSet::Private
+/*
+ * Tracks the accounts of an AccountManager on behalf of all of its AccountSets, so that each
+ * account is watched only once no matter how many sets there are.
+ *
+ * Accounts are bucketed by the value of the properties simple property filters refer to, and
+ * sets using such filters are only told about changes to those properties, and only when the
+ * account moves to another bucket.
+ */
+class TP_QT_NO_EXPORT AccountIndex : public QObject
 {
-    class AccountWrapper;
+    Q_OBJECT
+    Q_DISABLE_COPY(AccountIndex)
+
+public:
+    class Subscriber
+    {
+    public:
+        virtual ~Subscriber() {}
+
+        virtual void accountAdded(const AccountPtr &account) = 0;
+        virtual void accountRemoved(const AccountPtr &account) = 0;
+        virtual void accountChanged(const AccountPtr &account) = 0;
+    };
+
+    AccountIndex(AccountManager *accountManager);
+    ~AccountIndex();
+
+    QList<AccountPtr> accounts() const { return mAccounts.values(); }
+
+    static bool canIndex(const QVariantMap &properties);
+    bool matches(const AccountPtr &account, const QVariantMap &properties) const;
+    QList<AccountPtr> matchingAccounts(const QVariantMap &properties) const;
+
+    void subscribe(Subscriber *subscriber, const QVariantMap &properties);
+    void subscribeToCapabilities(Subscriber *subscriber);
+    void subscribeToAll(Subscriber *subscriber);
+    void unsubscribe(Subscriber *subscriber);
+
+private Q_SLOTS:
+    void onNewAccount(const Tp::AccountPtr &account);
+    void onAccountRemoved();
+    void onAccountPropertyChanged(const QString &propertyName);
+    void onAccountCapabilitiesChanged();
+
+private:
+    typedef QHash<QString /* value */, QSet<QString> /* account paths */> Buckets;
+
+    static QString valueKey(const QVariant &value);
+
+    void addAccount(const AccountPtr &account);
+    void indexAccount(const QString &propertyName, const AccountPtr &account);
+    const QSet<QString> *bucket(const QString &propertyName, const QVariant &value) const;
+    void removeFromBucket(const QString &propertyName, const QString &value,
+            const QString &path);
+    void notify(const QList<Subscriber *> &subscribers, const AccountPtr &account);
+
+    QHash<QString, AccountPtr> mAccounts;
 
+    QHash<QString /* property */, Buckets> mBuckets;
+    QHash<QString /* property */, QHash<QString /* account path */, QString> > mValues;
+
+    QSet<Subscriber *> mSubscribers;
+    QHash<Subscriber *, QStringList> mSubscribedProperties;
+    QHash<QString /* property */, QList<Subscriber *> > mPropertySubscribers;
+    QList<Subscriber *> mCapabilitySubscribers;
+    QList<Subscriber *> mAllSubscribers;
+};
+
+struct TP_QT_NO_EXPORT AccountSet::Private : public AccountIndex::Subscriber
+{
     Private(AccountSet *parent, const AccountManagerPtr &accountManager,
             const AccountFilterConstPtr &filter);
     Private(AccountSet *parent, const AccountManagerPtr &accountManager,
             const QVariantMap &filter);
+    ~Private();
 
     void init();
-    void connectSignals();
+    void subscribe();
     void insertAccounts();
-    void insertAccount(const AccountPtr &account);
-    void removeAccount(const AccountPtr &account);
-    void wrapAccount(const AccountPtr &account);
     void filterAccount(const AccountPtr &account);
-    bool accountMatchFilter(AccountWrapper *account);
+    bool accountMatchFilter(const AccountPtr &account);
+
+    // AccountIndex::Subscriber
+    void accountAdded(const AccountPtr &account);
+    void accountRemoved(const AccountPtr &account);
+    void accountChanged(const AccountPtr &account);
 
     AccountSet *parent;
     AccountManagerPtr accountManager;
     AccountFilterConstPtr filter;
-    QHash<QString, AccountWrapper *> wrappers;
+    AccountIndex *index;
+    QVariantMap indexedProperties; // Set if the filter can be evaluated using the index
     QHash<QString, AccountPtr> accounts;
     bool ready;
 };
 
-class TP_QT_NO_EXPORT AccountSet::Private::AccountWrapper : public QObject
-{
-    Q_OBJECT
-
-public:
-    AccountWrapper(const AccountPtr &account, QObject *parent = 0);
-    ~AccountWrapper();
-
-    AccountPtr account() const { return mAccount; }
-
-Q_SIGNALS:
-    void accountRemoved(const Tp::AccountPtr &account);
-    void accountPropertyChanged(const Tp::AccountPtr &account,
-            const QString &propertyName);
-    void accountCapabilitiesChanged(const Tp::AccountPtr &account,
-            const Tp::ConnectionCapabilities &capabilities);
-
-private Q_SLOTS:
-    TP_QT_NO_EXPORT void onAccountRemoved();
-    TP_QT_NO_EXPORT void onAccountPropertyChanged(const QString &propertyName);
-    TP_QT_NO_EXPORT void onAccountCapalitiesChanged(const Tp::ConnectionCapabilities &capabilities);
-
-private:
-    AccountPtr mAccount;
-};
-
 } // Tp
@@ -29,20 +29,322 @@
 #include "TelepathyQt/debug-internal.h"
 
 #include <TelepathyQt/Account>
+#include <TelepathyQt/AccountCapabilityFilter>
 #include <TelepathyQt/AccountFilter>
 #include <TelepathyQt/AccountManager>
 #include <TelepathyQt/ConnectionCapabilities>
 #include <TelepathyQt/ConnectionManager>
 
+#include <QMetaObject>
+#include <QMetaProperty>
+
 namespace Tp
 {
 
+AccountIndex::AccountIndex(AccountManager *accountManager)
+    : QObject(accountManager)
+{
+    connect(accountManager,
+            SIGNAL(newAccount(Tp::AccountPtr)),
+            SLOT(onNewAccount(Tp::AccountPtr)));
+
+    foreach (const AccountPtr &account, accountManager->allAccounts()) {
+        addAccount(account);
+    }
+}
+
+AccountIndex::~AccountIndex()
+{
+}
+
+/*
+ * Return whether a property filter can be evaluated by looking up buckets, which requires all
+ * of its values to be of the same simple type as the corresponding Account property, so that
+ * comparing their string representation is the same as comparing the values.
+ */
+bool AccountIndex::canIndex(const QVariantMap &properties)
+{
+    if (properties.isEmpty()) {
+        return false;
+    }
+
+    const QMetaObject &metaObject = Account::staticMetaObject;
+    for (QVariantMap::const_iterator i = properties.constBegin();
+            i != properties.constEnd(); ++i) {
+        int propertyIndex = metaObject.indexOfProperty(i.key().toLatin1().constData());
+        if (propertyIndex < 0) {
+            return false;
+        }
+
+        int type = metaObject.property(propertyIndex).userType();
+        if (i.value().userType() != type || valueKey(i.value()).isNull()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Return whether \a account matches the property filter \a properties, which must have been
+ * subscribed to.
+ */
+bool AccountIndex::matches(const AccountPtr &account, const QVariantMap &properties) const
+{
+    for (QVariantMap::const_iterator i = properties.constBegin();
+            i != properties.constEnd(); ++i) {
+        const QSet<QString> *accounts = bucket(i.key(), i.value());
+        if (!accounts || !accounts->contains(account->objectPath())) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+QList<AccountPtr> AccountIndex::matchingAccounts(const QVariantMap &properties) const
+{
+    // Only the smallest of the buckets needs to be checked against the others
+    const QSet<QString> *smallest = 0;
+    for (QVariantMap::const_iterator i = properties.constBegin();
+            i != properties.constEnd(); ++i) {
+        const QSet<QString> *accounts = bucket(i.key(), i.value());
+        if (!accounts) {
+            return QList<AccountPtr>();
+        }
+
+        if (!smallest || accounts->size() < smallest->size()) {
+            smallest = accounts;
+        }
+    }
+
+    QList<AccountPtr> ret;
+    if (!smallest) {
+        return ret;
+    }
+
+    foreach (const QString &path, *smallest) {
+        AccountPtr account = mAccounts.value(path);
+        if (matches(account, properties)) {
+            ret << account;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Subscribe to changes to the properties of the property filter \a properties, for which
+ * canIndex() must have returned true.
+ */
+void AccountIndex::subscribe(Subscriber *subscriber, const QVariantMap &properties)
+{
+    Q_ASSERT(!mSubscribers.contains(subscriber));
+    mSubscribers.insert(subscriber);
+
+    QStringList propertyNames = properties.keys();
+    foreach (const QString &propertyName, propertyNames) {
+        if (!mBuckets.contains(propertyName)) {
+            // First subscriber interested in this property, index all accounts by it
+            mBuckets.insert(propertyName, Buckets());
+            foreach (const AccountPtr &account, mAccounts) {
+                indexAccount(propertyName, account);
+            }
+        }
+
+        mPropertySubscribers[propertyName].append(subscriber);
+    }
+    mSubscribedProperties.insert(subscriber, propertyNames);
+}
+
+void AccountIndex::subscribeToCapabilities(Subscriber *subscriber)
+{
+    Q_ASSERT(!mSubscribers.contains(subscriber));
+    mSubscribers.insert(subscriber);
+    mCapabilitySubscribers.append(subscriber);
+}
+
+void AccountIndex::subscribeToAll(Subscriber *subscriber)
+{
+    Q_ASSERT(!mSubscribers.contains(subscriber));
+    mSubscribers.insert(subscriber);
+    mAllSubscribers.append(subscriber);
+}
+
+void AccountIndex::unsubscribe(Subscriber *subscriber)
+{
+    if (!mSubscribers.remove(subscriber)) {
+        return;
+    }
+
+    foreach (const QString &propertyName, mSubscribedProperties.take(subscriber)) {
+        QList<Subscriber *> &subscribers = mPropertySubscribers[propertyName];
+        subscribers.removeOne(subscriber);
+        if (subscribers.isEmpty()) {
+            // Nobody filters by this property anymore, stop tracking its value
+            mPropertySubscribers.remove(propertyName);
+            mBuckets.remove(propertyName);
+            mValues.remove(propertyName);
+        }
+    }
+    mCapabilitySubscribers.removeOne(subscriber);
+    mAllSubscribers.removeOne(subscriber);
+}
+
+void AccountIndex::onNewAccount(const AccountPtr &account)
+{
+    if (mAccounts.contains(account->objectPath())) {
+        return;
+    }
+
+    addAccount(account);
+    foreach (Subscriber *subscriber, mSubscribers.toList()) {
+        if (mSubscribers.contains(subscriber)) {
+            subscriber->accountAdded(account);
+        }
+    }
+}
+
+void AccountIndex::onAccountRemoved()
+{
+    AccountPtr account(qobject_cast<Account *>(sender()));
+    QString path = account->objectPath();
+    if (!mAccounts.remove(path)) {
+        return;
+    }
+
+    account->disconnect(this);
+    for (QHash<QString, QHash<QString, QString> >::iterator i = mValues.begin();
+            i != mValues.end(); ++i) {
+        removeFromBucket(i.key(), i->take(path), path);
+    }
+
+    foreach (Subscriber *subscriber, mSubscribers.toList()) {
+        if (mSubscribers.contains(subscriber)) {
+            subscriber->accountRemoved(account);
+        }
+    }
+}
+
+void AccountIndex::onAccountPropertyChanged(const QString &propertyName)
+{
+    AccountPtr account(qobject_cast<Account *>(sender()));
+
+    if (mBuckets.contains(propertyName)) {
+        QString oldValue = mValues[propertyName].value(account->objectPath());
+        indexAccount(propertyName, account);
+        if (mValues[propertyName].value(account->objectPath()) != oldValue) {
+            notify(mPropertySubscribers.value(propertyName), account);
+        }
+    }
+
+    notify(mAllSubscribers, account);
+}
+
+void AccountIndex::onAccountCapabilitiesChanged()
+{
+    AccountPtr account(qobject_cast<Account *>(sender()));
+    notify(mCapabilitySubscribers, account);
+    notify(mAllSubscribers, account);
+}
+
+QString AccountIndex::valueKey(const QVariant &value)
+{
+    switch (value.type()) {
+        case QVariant::Bool:
+        case QVariant::Int:
+        case QVariant::UInt:
+        case QVariant::String:
+            // Null and empty strings compare equal, so give them the same (non-null) key
+            return value.toString() + QLatin1Char('.');
+        default:
+            return QString();
+    }
+}
+
+void AccountIndex::addAccount(const AccountPtr &account)
+{
+    mAccounts.insert(account->objectPath(), account);
+    for (QHash<QString, Buckets>::const_iterator i = mBuckets.constBegin();
+            i != mBuckets.constEnd(); ++i) {
+        indexAccount(i.key(), account);
+    }
+
+    connect(account.data(),
+            SIGNAL(removed()),
+            SLOT(onAccountRemoved()));
+    connect(account.data(),
+            SIGNAL(propertyChanged(QString)),
+            SLOT(onAccountPropertyChanged(QString)));
+    connect(account.data(),
+            SIGNAL(capabilitiesChanged(Tp::ConnectionCapabilities)),
+            SLOT(onAccountCapabilitiesChanged()));
+}
+
+/*
+ * Move \a account to the bucket for the current value of its property \a propertyName.
+ */
+void AccountIndex::indexAccount(const QString &propertyName, const AccountPtr &account)
+{
+    QString path = account->objectPath();
+    QString value = valueKey(account->property(propertyName.toLatin1().constData()));
+    QString &oldValue = mValues[propertyName][path];
+    if (value == oldValue) {
+        return;
+    }
+
+    removeFromBucket(propertyName, oldValue, path);
+    if (!value.isNull()) {
+        mBuckets[propertyName][value].insert(path);
+    }
+    oldValue = value;
+}
+
+const QSet<QString> *AccountIndex::bucket(const QString &propertyName,
+        const QVariant &value) const
+{
+    QHash<QString, Buckets>::const_iterator buckets = mBuckets.constFind(propertyName);
+    if (buckets == mBuckets.constEnd()) {
+        return 0;
+    }
+
+    Buckets::const_iterator i = buckets->constFind(valueKey(value));
+    return i != buckets->constEnd() ? &i.value() : 0;
+}
+
+void AccountIndex::removeFromBucket(const QString &propertyName, const QString &value,
+        const QString &path)
+{
+    if (value.isNull()) {
+        return;
+    }
+
+    Buckets &buckets = mBuckets[propertyName];
+    Buckets::iterator i = buckets.find(value);
+    if (i != buckets.end()) {
+        i->remove(path);
+        if (i->isEmpty()) {
+            buckets.erase(i);
+        }
+    }
+}
+
+void AccountIndex::notify(const QList<Subscriber *> &subscribers, const AccountPtr &account)
+{
+    // Subscribers may go away as a result of the signals emitted by the ones before them
+    foreach (Subscriber *subscriber, subscribers) {
+        if (mSubscribers.contains(subscriber)) {
+            subscriber->accountChanged(account);
+        }
+    }
+}
+
 AccountSet::Private::Private(AccountSet *parent,
         const AccountManagerPtr &accountManager,
         const AccountFilterConstPtr &filter)
     : parent(parent),
       accountManager(accountManager),
       filter(filter),
+      index(0),
       ready(false)
 {
     init();
@@ -53,6 +355,7 @@ AccountSet::Private::Private(AccountSet *parent,
         const QVariantMap &filterMap)
     : parent(parent),
       accountManager(accountManager),
+      index(0),
       ready(false)
 {
     AccountPropertyFilterPtr propertyFilter = AccountPropertyFilter::create();
@@ -64,73 +367,55 @@ AccountSet::Private::Private(AccountSet *parent,
     init();
 }
 
+AccountSet::Private::~Private()
+{
+    if (index) {
+        index->unsubscribe(this);
+    }
+}
+
 void AccountSet::Private::init()
 {
     if (filter->isValid()) {
-        connectSignals();
+        index = accountManager->accountIndex();
+        subscribe();
         insertAccounts();
         ready = true;
     }
 }
 
-void AccountSet::Private::connectSignals()
+void AccountSet::Private::subscribe()
 {
-    parent->connect(accountManager.data(),
-            SIGNAL(newAccount(Tp::AccountPtr)),
-            SLOT(onNewAccount(Tp::AccountPtr)));
+    AccountPropertyFilterConstPtr propertyFilter =
+        AccountPropertyFilterConstPtr::dynamicCast(filter);
+    if (propertyFilter && AccountIndex::canIndex(propertyFilter->filter())) {
+        indexedProperties = propertyFilter->filter();
+        index->subscribe(this, indexedProperties);
+    } else if (AccountCapabilityFilterConstPtr::dynamicCast(filter)) {
+        index->subscribeToCapabilities(this);
+    } else {
+        index->subscribeToAll(this);
+    }
 }
 
 void AccountSet::Private::insertAccounts()
 {
-    foreach (const Tp::AccountPtr &account, accountManager->allAccounts()) {
-        insertAccount(account);
+    if (!indexedProperties.isEmpty()) {
+        foreach (const AccountPtr &account, index->matchingAccounts(indexedProperties)) {
+            accounts.insert(account->objectPath(), account);
+        }
+        return;
     }
-}
-
-void AccountSet::Private::insertAccount(const Tp::AccountPtr &account)
-{
-    QString accountPath = account->objectPath();
-    Q_ASSERT(!wrappers.contains(accountPath));
-    wrapAccount(account);
-    filterAccount(account);
-}
-
-void AccountSet::Private::removeAccount(const Tp::AccountPtr &account)
-{
-    QString accountPath = account->objectPath();
-    Q_ASSERT(wrappers.contains(accountPath));
-    accounts.remove(accountPath);
 
-    AccountWrapper *wrapper = wrappers.take(accountPath);
-    Q_ASSERT(wrapper->disconnect(parent));
-    wrapper->deleteLater();
-
-    emit parent->accountRemoved(account);
-}
-
-void AccountSet::Private::wrapAccount(const AccountPtr &account)
-{
-    AccountWrapper *wrapper = new AccountWrapper(account, parent);
-    parent->connect(wrapper,
-            SIGNAL(accountRemoved(Tp::AccountPtr)),
-            SLOT(onAccountRemoved(Tp::AccountPtr)));
-    parent->connect(wrapper,
-            SIGNAL(accountPropertyChanged(Tp::AccountPtr,QString)),
-            SLOT(onAccountChanged(Tp::AccountPtr)));
-    parent->connect(wrapper,
-            SIGNAL(accountCapabilitiesChanged(Tp::AccountPtr,Tp::ConnectionCapabilities)),
-            SLOT(onAccountChanged(Tp::AccountPtr)));
-    wrappers.insert(account->objectPath(), wrapper);
+    foreach (const AccountPtr &account, index->accounts()) {
+        filterAccount(account);
+    }
 }
 
 void AccountSet::Private::filterAccount(const AccountPtr &account)
 {
-    QString accountPath = account->objectPath();
-    Q_ASSERT(wrappers.contains(accountPath));
-    AccountWrapper *wrapper = wrappers[accountPath];
-
     /* account changed, let's check if it matches filter */
-    if (accountMatchFilter(wrapper)) {
+    if (accountMatchFilter(account)) {
         if (!accounts.contains(account->objectPath())) {
             accounts.insert(account->objectPath(), account);
             if (ready) {
@@ -147,50 +432,33 @@ void AccountSet::Private::filterAccount(const AccountPtr &account)
     }
 }
 
-bool AccountSet::Private::accountMatchFilter(AccountWrapper *wrapper)
+bool AccountSet::Private::accountMatchFilter(const AccountPtr &account)
 {
     if (!filter) {
         return true;
     }
 
-    return filter->matches(wrapper->account());
-}
-
-AccountSet::Private::AccountWrapper::AccountWrapper(
-        const AccountPtr &account, QObject *parent)
-    : QObject(parent),
-      mAccount(account)
-{
-    connect(account.data(),
-            SIGNAL(removed()),
-            SLOT(onAccountRemoved()));
-    connect(account.data(),
-            SIGNAL(propertyChanged(QString)),
-            SLOT(onAccountPropertyChanged(QString)));
-    connect(account.data(),
-            SIGNAL(capabilitiesChanged(Tp::ConnectionCapabilities)),
-            SLOT(onAccountCapalitiesChanged(Tp::ConnectionCapabilities)));
-}
+    if (!indexedProperties.isEmpty()) {
+        return index->matches(account, indexedProperties);
+    }
 
-AccountSet::Private::AccountWrapper::~AccountWrapper()
-{
+    return filter->matches(account);
 }
 
-void AccountSet::Private::AccountWrapper::onAccountRemoved()
+void AccountSet::Private::accountAdded(const AccountPtr &account)
 {
-    emit accountRemoved(mAccount);
+    filterAccount(account);
 }
 
-void AccountSet::Private::AccountWrapper::onAccountPropertyChanged(
-        const QString &propertyName)
+void AccountSet::Private::accountRemoved(const AccountPtr &account)
 {
-    emit accountPropertyChanged(mAccount, propertyName);
+    accounts.remove(account->objectPath());
+    emit parent->accountRemoved(account);
 }
 
-void AccountSet::Private::AccountWrapper::onAccountCapalitiesChanged(
-        const ConnectionCapabilities &caps)
+void AccountSet::Private::accountChanged(const AccountPtr &account)
 {
-    emit accountCapabilitiesChanged(mAccount, caps);
+    filterAccount(account);
 }
 
 /**
@@ -400,19 +668,4 @@ QList<AccountPtr> AccountSet::accounts() const
  * \sa accounts()
  */
 
-void AccountSet::onNewAccount(const AccountPtr &account)
-{
-    mPriv->insertAccount(account);
-}
-
-void AccountSet::onAccountRemoved(const AccountPtr &account)
-{
-    mPriv->removeAccount(account);
-}
-
-void AccountSet::onAccountChanged(const AccountPtr &account)
-{
-    mPriv->filterAccount(account);
-}
-
 } // Tp
@@ -29,6 +29,7 @@
 #include "TelepathyQt/debug-internal.h"
 
 #include "TelepathyQt/connection-internal.h"
+#include "TelepathyQt/connection-manager-registry-internal.h"
 
 #include <TelepathyQt/AccountManager>
 #include <TelepathyQt/Channel>
@@ -4296,9 +4297,9 @@ void Account::Private::introspectProtocolInfo(Account::Private *self)
 {
     Q_ASSERT(!self->cm);
 
-    self->cm = ConnectionManager::create(
-            self->parent->dbusConnection(), self->cmName,
-            self->connFactory, self->chanFactory, self->contactFactory);
+    // Only the protocol info is needed from the CM, so share it with the other accounts using it
+    self->cm = ConnectionManagerRegistry::instance()->connectionManager(
+            self->parent->dbusConnection(), self->cmName);
     self->parent->connect(self->cm->becomeReady(),
             SIGNAL(finished(Tp::PendingOperation*)),
             SLOT(onConnectionManagerReady(Tp::PendingOperation*)));
@@ -4711,8 +4712,8 @@ void Account::gotAvatar(QDBusPendingCallWatcher *watcher)
         // actually used to trigger a rare bug)
         //
         // Anyway, the idea is to not do setIntrospectCompleted twice
-        if (!mPriv->readinessHelper->actualFeatures().contains(FeatureAvatar) &&
-                !mPriv->readinessHelper->missingFeatures().contains(FeatureAvatar)) {
+        if (!mPriv->readinessHelper->isSatisfied(FeatureAvatar) &&
+                !mPriv->readinessHelper->isMissing(FeatureAvatar)) {
             mPriv->readinessHelper->setIntrospectCompleted(FeatureAvatar, true);
         }
 
@@ -4721,8 +4722,8 @@ void Account::gotAvatar(QDBusPendingCallWatcher *watcher)
     } else {
         // check if the feature is already there, and for some reason retrieveAvatar
         // failed when called the second time
-        if (!mPriv->readinessHelper->actualFeatures().contains(FeatureAvatar) &&
-                !mPriv->readinessHelper->missingFeatures().contains(FeatureAvatar)) {
+        if (!mPriv->readinessHelper->isSatisfied(FeatureAvatar) &&
+                !mPriv->readinessHelper->isMissing(FeatureAvatar)) {
             mPriv->readinessHelper->setIntrospectCompleted(FeatureAvatar, false, reply.error());
         }
 
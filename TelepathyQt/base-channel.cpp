@@ -37,7 +37,9 @@
 #include <TelepathyQt/AbstractProtocolInterface>
 
 #include <QDateTime>
+#include <QSet>
 #include <QString>
+#include <QTimer>
 #include <QVariantMap>
 
 namespace Tp
@@ -235,7 +237,14 @@ void BaseChannel::setInitiatorID(const QString &initiatorID)
 
 void BaseChannel::setTargetID(const QString &targetID)
 {
+    if (mPriv->targetID == targetID) {
+        return;
+    }
+
     mPriv->targetID = targetID;
+    if (mPriv->connection) {
+        mPriv->connection->reindexChannel(this);
+    }
 }
 
 void BaseChannel::setRequested(bool requested)
@@ -455,37 +464,42 @@ void BaseChannelTextType::addReceivedMessage(const Tp::MessagePartList &msg)
     }
     MessagePart &header = message.front();
 
-    if (header.count(QLatin1String("pending-message-id")))
-        warning() << "pending-message-id will be overwritten";
+    /* Read the header fields needed for the Text interface in a single pass */
+    uint timestamp = 0;
+    uint handle = 0;
+    uint type = ChannelTextMessageTypeNormal;
+    for (MessagePart::ConstIterator i = header.constBegin(); i != header.constEnd(); ++i) {
+        if (i.key() == QLatin1String("pending-message-id"))
+            warning() << "pending-message-id will be overwritten";
+        else if (i.key() == QLatin1String("message-received"))
+            timestamp = i.value().variant().toUInt();
+        else if (i.key() == QLatin1String("message-sender"))
+            handle = i.value().variant().toUInt();
+        else if (i.key() == QLatin1String("message-type"))
+            type = i.value().variant().toUInt();
+    }
 
     /* Add pending-message-id to header */
     uint pendingMessageId = mPriv->pendingMessagesId++;
-    header[QLatin1String("pending-message-id")] = QDBusVariant(pendingMessageId);
+    header.insert(QLatin1String("pending-message-id"), QDBusVariant(pendingMessageId));
     mPriv->pendingMessages[pendingMessageId] = message;
 
-    uint timestamp = 0;
-    if (header.count(QLatin1String("message-received")))
-        timestamp = header[QLatin1String("message-received")].variant().toUInt();
-
-    uint handle = 0;
-    if (header.count(QLatin1String("message-sender")))
-        handle = header[QLatin1String("message-sender")].variant().toUInt();
-
-    uint type = ChannelTextMessageTypeNormal;
-    if (header.count(QLatin1String("message-type")))
-        type = header[QLatin1String("message-type")].variant().toUInt();
-
     //FIXME: flags are not parsed
     uint flags = 0;
 
     QString content;
-    for (MessagePartList::Iterator i = message.begin() + 1; i != message.end(); ++i)
-        if (i->count(QLatin1String("content-type"))
-                && i->value(QLatin1String("content-type")).variant().toString() == QLatin1String("text/plain")
-                && i->count(QLatin1String("content"))) {
-            content = i->value(QLatin1String("content")).variant().toString();
+    for (MessagePartList::ConstIterator i = message.constBegin() + 1; i != message.constEnd(); ++i) {
+        MessagePart::ConstIterator contentType = i->constFind(QLatin1String("content-type"));
+        if (contentType == i->constEnd()
+                || contentType.value().variant().toString() != QLatin1String("text/plain"))
+            continue;
+
+        MessagePart::ConstIterator text = i->constFind(QLatin1String("content"));
+        if (text != i->constEnd()) {
+            content = text.value().variant().toString();
             break;
         }
+    }
     if (content.length() > 0)
         QMetaObject::invokeMethod(mPriv->adaptee, "received",
                                   Qt::QueuedConnection,
@@ -1782,15 +1796,104 @@ BaseChannelGroupInterface::Adaptee::~Adaptee()
 }
 
 struct TP_QT_NO_EXPORT BaseChannelGroupInterface::Private {
+    // The member changes not signalled yet. Changes with the same details are merged, and
+    // contacts added and removed again meanwhile cancel out
+    struct MembersChange
+    {
+        MembersChange()
+            : actor(0),
+              changeReason(ChannelGroupChangeReasonNone)
+        {
+        }
+
+        bool isEmpty() const
+        {
+            return added.isEmpty() && removed.isEmpty();
+        }
+
+        // Record that handle was added, or removed if add is false, keeping the order of the
+        // changes. Return false if this cancelled out an opposite change instead.
+        bool record(uint handle, bool add)
+        {
+            QSet<uint> &opposite = add ? removedSet : addedSet;
+            if (opposite.remove(handle)) {
+                (add ? removed : added).removeOne(handle);
+                contactIds.remove(handle);
+                return false;
+            }
+
+            (add ? addedSet : removedSet).insert(handle);
+            (add ? added : removed).append(handle);
+            return true;
+        }
+
+        bool canMerge(uint otherActor, ChannelGroupChangeReason otherChangeReason,
+                const QString &otherMessage, const QString &otherError,
+                const QString &otherDebugMessage) const
+        {
+            return isEmpty() || (actor == otherActor && changeReason == otherChangeReason &&
+                    message == otherMessage && error == otherError &&
+                    debugMessage == otherDebugMessage);
+        }
+
+        Tp::UIntList added;
+        Tp::UIntList removed;
+        QSet<uint> addedSet;
+        QSet<uint> removedSet;
+        Tp::HandleIdentifierMap contactIds;
+        uint actor;
+        ChannelGroupChangeReason changeReason;
+        QString message;
+        QString error;
+        QString debugMessage;
+    };
+
     Private(BaseChannelGroupInterface *parent, ChannelGroupFlags initialFlags, uint selfHandle)
         : flags(initialFlags),
+          membersValid(true),
+          nextMemberSerial(0),
+          coalesceChanges(false),
           selfHandle(selfHandle),
           adaptee(new BaseChannelGroupInterface::Adaptee(parent)) {
+        flushTimer.setSingleShot(true);
+    }
+
+    // The members list is only rebuilt when asked for after members were removed, so that
+    // removing them one by one doesn't take quadratic time. It keeps the order the members were
+    // added in.
+    const Tp::UIntList &membersList() {
+        if (!membersValid) {
+            QMap<quint64, uint> ordered;
+            for (QHash<uint, quint64>::const_iterator i = memberSerials.constBegin();
+                    i != memberSerials.constEnd(); ++i) {
+                ordered.insert(i.value(), i.key());
+            }
+            members = ordered.values();
+            membersValid = true;
+        }
+        return members;
     }
+
     ChannelGroupFlags flags;
     Tp::HandleOwnerMap handleOwners;
     Tp::LocalPendingInfoList localPendingMembers;
+    void scheduleFlush(BaseChannelGroupInterface *interface) {
+        if (!coalesceChanges) {
+            interface->flushMembersChanges();
+        } else if (!pendingChange.isEmpty() && !flushTimer.isActive()) {
+            flushTimer.start();
+        }
+    }
+
+    // Member handle -> when it was added, relative to the other members
+    QHash<uint, quint64> memberSerials;
     Tp::UIntList members;
+    bool membersValid;
+    quint64 nextMemberSerial;
+    // Whether the changes are held back, see setMembersChangesLatency()
+    bool coalesceChanges;
+    MembersChange pendingChange;
+    QTimer flushTimer;
     Tp::UIntList remotePendingMembers;
     uint selfHandle;
     Tp::HandleIdentifierMap memberIdentifiers;
@@ -1822,7 +1925,7 @@ Tp::LocalPendingInfoList BaseChannelGroupInterface::Adaptee::localPendingMembers
 
 Tp::UIntList BaseChannelGroupInterface::Adaptee::members() const
 {
-    return mInterface->mPriv->members;
+    return mInterface->mPriv->membersList();
 }
 
 Tp::UIntList BaseChannelGroupInterface::Adaptee::remotePendingMembers() const
@@ -1886,7 +1989,7 @@ void BaseChannelGroupInterface::Adaptee::removeMembersWithReason(const Tp::UIntL
 
 void BaseChannelGroupInterface::Adaptee::getAllMembers(const Tp::Service::ChannelInterfaceGroupAdaptor::GetAllMembersContextPtr &context)
 {
-    context->setFinished(mInterface->mPriv->members, mInterface->mPriv->getLocalPendingMembers(), mInterface->mPriv->remotePendingMembers);
+    context->setFinished(mInterface->mPriv->membersList(), mInterface->mPriv->getLocalPendingMembers(), mInterface->mPriv->remotePendingMembers);
 }
 
 void BaseChannelGroupInterface::Adaptee::getGroupFlags(const Tp::Service::ChannelInterfaceGroupAdaptor::GetGroupFlagsContextPtr &context)
@@ -1914,7 +2017,7 @@ void BaseChannelGroupInterface::Adaptee::getLocalPendingMembersWithInfo(const Tp
 
 void BaseChannelGroupInterface::Adaptee::getMembers(const Tp::Service::ChannelInterfaceGroupAdaptor::GetMembersContextPtr &context)
 {
-    context->setFinished(mInterface->mPriv->members);
+    context->setFinished(mInterface->mPriv->membersList());
 }
 
 void BaseChannelGroupInterface::Adaptee::getRemotePendingMembers(const Tp::Service::ChannelInterfaceGroupAdaptor::GetRemotePendingMembersContextPtr &context)
@@ -1943,6 +2046,9 @@ BaseChannelGroupInterface::BaseChannelGroupInterface(ChannelGroupFlags initialFl
     : AbstractChannelInterface(TP_QT_IFACE_CHANNEL_INTERFACE_GROUP),
       mPriv(new Private(this, initialFlags, selfHandle))
 {
+    connect(&mPriv->flushTimer,
+            SIGNAL(timeout()),
+            SLOT(onMembersChangesTimeout()));
 }
 
 /**
@@ -1983,91 +2089,129 @@ void BaseChannelGroupInterface::setAddMembersCallback(const AddMembersCallback &
     mPriv->addMembersCB = cb;
 }
 
+/**
+ * Add the given contacts to the members of this group.
+ *
+ * Contacts which are already members are ignored. MembersChanged, and
+ * MembersChangedDetailed if the group has the ChannelGroupFlagMembersChangedDetailed
+ * flag, are emitted right away, unless the changes are coalesced as set with
+ * setMembersChangesLatency().
+ *
+ * \sa removeMembers(), flushMembersChanges(), setMembersChangesLatency()
+ */
 void BaseChannelGroupInterface::addMembers(const Tp::UIntList& handles, const QStringList& identifiers, uint actor, ChannelGroupChangeReason changeReason, const QString &message, const QString &error, const QString &debugMessage)
 {
     if (handles.size() != identifiers.size()) {
         debug() << "BaseChannelGroupInterface::addMembers: handles.size() != identifiers.size()";
         return;
     }
-    Tp::UIntList added;
-    Tp::HandleIdentifierMap contactIds;
+
+    if (!mPriv->pendingChange.canMerge(actor, changeReason, message, error, debugMessage)) {
+        flushMembersChanges();
+    }
+
+    Private::MembersChange &change = mPriv->pendingChange;
     for (int i = 0; i < handles.size(); ++i) {
         uint handle = handles[i];
-        if (mPriv->members.contains(handle))
+        if (mPriv->memberSerials.contains(handle))
             continue;
 
+        mPriv->memberSerials.insert(handle, mPriv->nextMemberSerial++);
+        if (mPriv->membersValid) {
+            mPriv->members.append(handle);
+        }
         mPriv->memberIdentifiers[handle] = identifiers[i];
-        mPriv->members.append(handle);
-        added.append(handle);
-        contactIds[handle] = identifiers[i];
-    }
-
-    if (added.isEmpty())
-        return;
-
-    QMetaObject::invokeMethod(mPriv->adaptee, "membersChanged",
-        Q_ARG(QString, message),
-        Q_ARG(Tp::UIntList, added),
-        Q_ARG(Tp::UIntList, Tp::UIntList()),
-        Q_ARG(Tp::UIntList, Tp::UIntList()),
-        Q_ARG(Tp::UIntList, Tp::UIntList()),
-        Q_ARG(uint, actor),
-        Q_ARG(uint, changeReason)); //Can simply use emit in Qt5
 
-    if (mPriv->flags & Tp::ChannelGroupFlagMembersChangedDetailed) {
-        QVariantMap details;
-        details.insert(QLatin1String("actor"), QVariant::fromValue(actor));
-        details.insert(QLatin1String("change-reason"), QVariant::fromValue((uint)changeReason));
-        details.insert(QLatin1String("contact-ids"), QVariant::fromValue(contactIds));
-        details.insert(QLatin1String("message"), QVariant::fromValue(message));
-        details.insert(QLatin1String("error"), QVariant::fromValue(error));
-        details.insert(QLatin1String("debug-message"), QVariant::fromValue(debugMessage));
-        QMetaObject::invokeMethod(mPriv->adaptee, "membersChangedDetailed",
-            Q_ARG(Tp::UIntList, added),
-            Q_ARG(Tp::UIntList, Tp::UIntList()),
-            Q_ARG(Tp::UIntList, Tp::UIntList()),
-            Q_ARG(Tp::UIntList, Tp::UIntList()),
-            Q_ARG(QVariantMap, details));
+        if (change.record(handle, true)) {
+            change.contactIds[handle] = identifiers[i];
+        }
     }
+
+    change.actor = actor;
+    change.changeReason = changeReason;
+    change.message = message;
+    change.error = error;
+    change.debugMessage = debugMessage;
+    mPriv->scheduleFlush(this);
 }
 
+/**
+ * Remove the given contacts from the members of this group.
+ *
+ * Contacts which are not members are ignored. The change is signalled as described in
+ * addMembers().
+ *
+ * \sa addMembers(), flushMembersChanges(), setMembersChangesLatency()
+ */
 void BaseChannelGroupInterface::removeMembers(const Tp::UIntList& handles, const QStringList &identifiers, uint actor, ChannelGroupChangeReason changeReason, const QString &message, const QString &error, const QString &debugMessage)
 {
-    Tp::UIntList removed;
-    Tp::HandleIdentifierMap contactIds;
+    if (!mPriv->pendingChange.canMerge(actor, changeReason, message, error, debugMessage)) {
+        flushMembersChanges();
+    }
+
+    Private::MembersChange &change = mPriv->pendingChange;
     for (int i = 0; i < handles.size(); ++i) {
         uint handle = handles[i];
-        if (!mPriv->members.contains(handle))
+        if (!mPriv->memberSerials.remove(handle))
             continue;
 
-        mPriv->memberIdentifiers.remove(handle);
-        mPriv->members.removeAll(handle);
-        removed.append(handle);
-        contactIds[handle] = identifiers[i];
+        mPriv->membersValid = false;
+        QString identifier = mPriv->memberIdentifiers.take(handle);
+        if (i < identifiers.size()) {
+            identifier = identifiers[i];
+        }
+
+        if (change.record(handle, false)) {
+            change.contactIds[handle] = identifier;
+        }
     }
 
-    if (removed.isEmpty())
+    change.actor = actor;
+    change.changeReason = changeReason;
+    change.message = message;
+    change.error = error;
+    change.debugMessage = debugMessage;
+    mPriv->scheduleFlush(this);
+}
+
+/**
+ * Emit the member change signals for the changes done since they were last emitted,
+ * without waiting for membersChangesLatency() to elapse.
+ *
+ * \sa addMembers(), removeMembers()
+ */
+void BaseChannelGroupInterface::flushMembersChanges()
+{
+    mPriv->flushTimer.stop();
+
+    Private::MembersChange change = mPriv->pendingChange;
+    mPriv->pendingChange = Private::MembersChange();
+    if (change.isEmpty()) {
         return;
+    }
+
+    const Tp::UIntList &added = change.added;
+    const Tp::UIntList &removed = change.removed;
 
     QMetaObject::invokeMethod(mPriv->adaptee, "membersChanged",
-        Q_ARG(QString, message),
-        Q_ARG(Tp::UIntList, Tp::UIntList()),
+        Q_ARG(QString, change.message),
+        Q_ARG(Tp::UIntList, added),
         Q_ARG(Tp::UIntList, removed),
         Q_ARG(Tp::UIntList, Tp::UIntList()),
         Q_ARG(Tp::UIntList, Tp::UIntList()),
-        Q_ARG(uint, actor),
-        Q_ARG(uint, changeReason)); //Can simply use emit in Qt5
+        Q_ARG(uint, change.actor),
+        Q_ARG(uint, change.changeReason)); //Can simply use emit in Qt5
 
     if (mPriv->flags & Tp::ChannelGroupFlagMembersChangedDetailed) {
         QVariantMap details;
-        details.insert(QLatin1String("actor"), QVariant::fromValue(actor));
-        details.insert(QLatin1String("change-reason"), QVariant::fromValue((uint)changeReason));
-        details.insert(QLatin1String("contact-ids"), QVariant::fromValue(contactIds));
-        details.insert(QLatin1String("message"), QVariant::fromValue(message));
-        details.insert(QLatin1String("error"), QVariant::fromValue(error));
-        details.insert(QLatin1String("debug-message"), QVariant::fromValue(debugMessage));
+        details.insert(QLatin1String("actor"), QVariant::fromValue(change.actor));
+        details.insert(QLatin1String("change-reason"), QVariant::fromValue((uint)change.changeReason));
+        details.insert(QLatin1String("contact-ids"), QVariant::fromValue(change.contactIds));
+        details.insert(QLatin1String("message"), QVariant::fromValue(change.message));
+        details.insert(QLatin1String("error"), QVariant::fromValue(change.error));
+        details.insert(QLatin1String("debug-message"), QVariant::fromValue(change.debugMessage));
         QMetaObject::invokeMethod(mPriv->adaptee, "membersChangedDetailed",
-            Q_ARG(Tp::UIntList, Tp::UIntList()),
+            Q_ARG(Tp::UIntList, added),
             Q_ARG(Tp::UIntList, removed),
             Q_ARG(Tp::UIntList, Tp::UIntList()),
             Q_ARG(Tp::UIntList, Tp::UIntList()),
@@ -2075,6 +2219,53 @@ void BaseChannelGroupInterface::removeMembers(const Tp::UIntList& handles, const
     }
 }
 
+/**
+ * Return for how long the member change signals are held back, so that the changes
+ * done meanwhile are signalled together.
+ *
+ * \return The latency in milliseconds, or -1 if the changes are not coalesced.
+ * \sa setMembersChangesLatency()
+ */
+int BaseChannelGroupInterface::membersChangesLatency() const
+{
+    return mPriv->coalesceChanges ? mPriv->flushTimer.interval() : -1;
+}
+
+/**
+ * Set for how long the member change signals are held back, so that the changes
+ * done meanwhile are signalled together.
+ *
+ * By default, or if \a msecs is negative, the changes are not coalesced and each call to
+ * addMembers() or removeMembers() emits its signals right away.
+ *
+ * Otherwise the signals are emitted at most \a msecs milliseconds after the first change
+ * they contain, once for all the changes done meanwhile with the same details. Contacts added
+ * and removed again meanwhile, or the other way around, are left out. With 0 the signals are
+ * emitted as soon as the event loop is entered, merging the changes done in the same event loop
+ * iteration.
+ *
+ * Pending changes are emitted when coalescing gets disabled.
+ *
+ * \param msecs The latency in milliseconds, or -1 to not coalesce the changes.
+ * \sa flushMembersChanges()
+ */
+void BaseChannelGroupInterface::setMembersChangesLatency(int msecs)
+{
+    if (msecs < 0) {
+        flushMembersChanges();
+        mPriv->coalesceChanges = false;
+        return;
+    }
+
+    mPriv->coalesceChanges = true;
+    mPriv->flushTimer.setInterval(msecs);
+}
+
+void BaseChannelGroupInterface::onMembersChangesTimeout()
+{
+    flushMembersChanges();
+}
+
 // Chan.I.Room2
 // The BaseChannelRoomInterface code is fully or partially generated by the TelepathyQt-Generator.
 struct TP_QT_NO_EXPORT BaseChannelRoomInterface::Private {
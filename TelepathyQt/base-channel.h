@@ -552,8 +552,14 @@ public:
     /* Adds a contact to this group. No-op if already in this group */
     void addMembers(const Tp::UIntList &handles, const QStringList &identifiers, uint actor = 0, ChannelGroupChangeReason changeReason = ChannelGroupChangeReasonNone, const QString &message = QString(), const QString &error = QString(), const QString &debugMessage = QString());
     void removeMembers(const Tp::UIntList &handles, const QStringList &identifiers = QStringList(), uint actor = 0, ChannelGroupChangeReason changeReason = ChannelGroupChangeReasonNone, const QString &message = QString(), const QString &error = QString(), const QString &debugMessage = QString());
+    void flushMembersChanges();
+
+    int membersChangesLatency() const;
+    void setMembersChangesLatency(int msecs);
 
 private Q_SLOTS:
+    TP_QT_NO_EXPORT void onMembersChangesTimeout();
+
 private:
     BaseChannelGroupInterface(ChannelGroupFlags initialFlags, uint selfHandle);
     void createAdaptor();
@@ -27,7 +27,10 @@
 #include <TelepathyQt/Types>
 
 #include <QDBusObjectPath>
+#include <QDBusPendingCallWatcher>
+#include <QHash>
 #include <QObject>
+#include <QSet>
 #include <QString>
 #include <QVariantMap>
 
@@ -57,6 +60,23 @@ private Q_SLOTS:
             const Tp::Service::ConnectionManagerAdaptor::ListProtocolsContextPtr &context);
     void requestConnection(const QString &protocolName, const QVariantMap &parameters,
             const Tp::Service::ConnectionManagerAdaptor::RequestConnectionContextPtr &context);
+    void onRequestNameFinished(QDBusPendingCallWatcher *watcher);
+
+private:
+    struct PendingRegistration
+    {
+        BaseConnectionPtr connection;
+        QString busName;
+        QString protocolName;
+        Tp::Service::ConnectionManagerAdaptor::RequestConnectionContextPtr context;
+    };
+
+    bool finishRequestConnection(const BaseConnectionPtr &connection, const QString &protocolName,
+            const Tp::Service::ConnectionManagerAdaptor::RequestConnectionContextPtr &context);
+
+    // Connections waiting for their bus name to be granted, and the bus names they wait for
+    QHash<QDBusPendingCallWatcher *, PendingRegistration> mPendingRegistrations;
+    QSet<QString> mPendingBusNames;
 
 public:
     BaseConnectionManager *mCM;
@@ -27,6 +27,7 @@
 #include "TelepathyQt/_gen/base-connection-manager-internal.moc.hpp"
 
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/dbus-service-internal.h"
 
 #include <TelepathyQt/BaseConnection>
 #include <TelepathyQt/BaseProtocol>
@@ -34,7 +35,9 @@
 #include <TelepathyQt/Constants>
 #include <TelepathyQt/Utils>
 
+#include <QDBusConnectionInterface>
 #include <QDBusObjectPath>
+#include <QDBusPendingReply>
 #include <QString>
 #include <QStringList>
 
@@ -47,12 +50,16 @@ struct TP_QT_NO_EXPORT BaseConnectionManager::Private
             const QString &name)
         : parent(parent),
           name(name),
+          sharedBusNameEnabled(false),
           adaptee(new BaseConnectionManager::Adaptee(dbusConnection, parent))
     {
     }
 
     BaseConnectionManager *parent;
     QString name;
+    bool sharedBusNameEnabled;
+    QString sharedBusName;
+    QString connectionObjectPathBase;
 
     BaseConnectionManager::Adaptee *adaptee;
     QHash<QString, BaseProtocolPtr> protocols;
@@ -154,16 +161,87 @@ void BaseConnectionManager::Adaptee::requestConnection(const QString &protocolNa
         return;
     }
 
+    // The shared bus name is already ours, but a connection with its own bus name needs to get it
+    // first. Don't block on the bus daemon for that, so that other requests can be served
+    // meanwhile.
+    QString busName = mCM->prepareRegistration(connection);
+    QDBusConnection bus = connection->dbusConnection();
+    if (!connection->isRegistered() && !OwnedBusNames::contains(bus, busName)) {
+        // Another request for the same connection is still waiting for the name, which it would
+        // get, leaving this one to fail to export the connection object after another round trip
+        if (mPendingBusNames.contains(busName)) {
+            context->setFinishedWithError(TP_QT_ERROR_NOT_AVAILABLE,
+                    QString(QLatin1String("Connection %1 is already being requested"))
+                        .arg(busName));
+            return;
+        }
+
+        QDBusPendingCall call = bus.interface()->asyncCall(QLatin1String("RequestName"),
+                busName, (uint) 4 /* DBUS_NAME_FLAG_DO_NOT_QUEUE */);
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, this);
+        PendingRegistration registration = { connection, busName, protocol->name(), context };
+        mPendingRegistrations.insert(watcher, registration);
+        mPendingBusNames.insert(busName);
+        connect(watcher,
+                SIGNAL(finished(QDBusPendingCallWatcher*)),
+                SLOT(onRequestNameFinished(QDBusPendingCallWatcher*)));
+        return;
+    }
+
+    finishRequestConnection(connection, protocol->name(), context);
+}
+
+void BaseConnectionManager::Adaptee::onRequestNameFinished(QDBusPendingCallWatcher *watcher)
+{
+    PendingRegistration registration = mPendingRegistrations.take(watcher);
+    const QString &busName = registration.busName;
+    mPendingBusNames.remove(busName);
+    QDBusPendingReply<uint> reply = *watcher;
+    watcher->deleteLater();
+
+    if (reply.isError()) {
+        warning() << "Unable to register service" << busName << "-" << reply.error().message();
+        registration.context->setFinishedWithError(reply.error().name(), reply.error().message());
+        return;
+    }
+
+    // DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER or DBUS_REQUEST_NAME_REPLY_ALREADY_OWNER
+    if (reply.value() != 1 && reply.value() != 4) {
+        warning() << "Unable to register service" << busName <<
+            "- name already registered by another process";
+        registration.context->setFinishedWithError(TP_QT_ERROR_INVALID_ARGUMENT,
+                QString(QLatin1String("Name %1 already in use by another process"))
+                    .arg(busName));
+        return;
+    }
+
+    QDBusConnection bus = registration.connection->dbusConnection();
+    OwnedBusNames::insert(bus, busName);
+    if (!finishRequestConnection(registration.connection, registration.protocolName,
+                registration.context) && reply.value() == 1) {
+        // Nothing got exported under the name just granted for it
+        OwnedBusNames::remove(bus, busName);
+        bus.unregisterService(busName);
+    }
+}
+
+bool BaseConnectionManager::Adaptee::finishRequestConnection(const BaseConnectionPtr &connection,
+        const QString &protocolName,
+        const Tp::Service::ConnectionManagerAdaptor::RequestConnectionContextPtr &context)
+{
+    // The bus name is ours at this point, so this only exports the object
+    DBusError error;
     if (!connection->registerObject(&error)) {
         context->setFinishedWithError(error.name(), error.message());
-        return;
+        return false;
     }
 
     mCM->addConnection(connection);
 
     emit newConnection(connection->busName(), QDBusObjectPath(connection->objectPath()),
-            protocol->name());
+            protocolName);
     context->setFinished(connection->busName(), QDBusObjectPath(connection->objectPath()));
+    return true;
 }
 
 /**
@@ -309,6 +387,132 @@ bool BaseConnectionManager::addProtocol(const BaseProtocolPtr &protocol)
     return true;
 }
 
+/**
+ * Return whether the connections made by this connection manager are exported under a shared bus
+ * name instead of each owning a bus name of its own.
+ *
+ * This is disabled by default.
+ *
+ * \return \c true if the connections share a bus name, \c false otherwise.
+ * \sa setSharedBusNameEnabled(), sharedBusName()
+ */
+bool BaseConnectionManager::isSharedBusNameEnabled() const
+{
+    return mPriv->sharedBusNameEnabled;
+}
+
+/**
+ * Set whether the connections made by this connection manager are exported under a shared bus
+ * name, instead of each owning a bus name of its own.
+ *
+ * With the shared bus name enabled, the connections and their channels are exported as objects
+ * under sharedBusName(), which is owned by the connection manager. Registering them then doesn't
+ * need any round trips to the bus daemon, which matters for connection managers hosting many
+ * connections.
+ *
+ * Note however that the Telepathy specification ties the bus name of a connection to its object
+ * path, and that some clients, such as account managers, derive the former from the latter.
+ * This mode is therefore only suitable for connections used by clients which are given the
+ * bus name explicitly, like the ones requesting the connections from the connection manager
+ * directly.
+ *
+ * This cannot be changed after the connection manager has been registered on the bus with
+ * registerObject().
+ *
+ * \param enabled Whether the connections should share a bus name.
+ * \sa isSharedBusNameEnabled(), setSharedBusName()
+ */
+void BaseConnectionManager::setSharedBusNameEnabled(bool enabled)
+{
+    if (isRegistered()) {
+        warning() << "Unable to change the bus name scheme - CM already registered";
+        return;
+    }
+
+    mPriv->sharedBusNameEnabled = enabled;
+}
+
+/**
+ * Return the bus name the connections are exported under when isSharedBusNameEnabled() is \c
+ * true.
+ *
+ * This defaults to the bus name of the connection manager itself.
+ *
+ * \return The shared bus name.
+ * \sa setSharedBusName()
+ */
+QString BaseConnectionManager::sharedBusName() const
+{
+    if (!mPriv->sharedBusName.isEmpty()) {
+        return mPriv->sharedBusName;
+    }
+
+    return TP_QT_CONNECTION_MANAGER_BUS_NAME_BASE + mPriv->name;
+}
+
+/**
+ * Set the bus name the connections are exported under when isSharedBusNameEnabled() is \c true.
+ *
+ * If it differs from the bus name of the connection manager, it is requested along with the
+ * latter in registerObject(). Passing an empty string restores the default, the bus name of the
+ * connection manager itself.
+ *
+ * This cannot be changed after the connection manager has been registered on the bus with
+ * registerObject().
+ *
+ * \param busName The shared bus name.
+ * \sa sharedBusName(), setSharedBusNameEnabled()
+ */
+void BaseConnectionManager::setSharedBusName(const QString &busName)
+{
+    if (isRegistered()) {
+        warning() << "Unable to change the shared bus name - CM already registered";
+        return;
+    }
+
+    mPriv->sharedBusName = busName;
+}
+
+/**
+ * Return the object path the objects of the connections made by this connection manager are
+ * exported under.
+ *
+ * If set, each connection is exported at \c <base>/<protocol>/<unique name>, with the dashes in
+ * the protocol name replaced by underscores and the unique name given by
+ * BaseConnection::uniqueName(). Otherwise, which is the default, the connections are exported at
+ * the object paths the Telepathy specification mandates, and this returns an empty string.
+ *
+ * \return The object path base, or an empty string for the default.
+ * \sa setConnectionObjectPathBase()
+ */
+QString BaseConnectionManager::connectionObjectPathBase() const
+{
+    return mPriv->connectionObjectPathBase;
+}
+
+/**
+ * Set the object path the objects of the connections made by this connection manager are
+ * exported under.
+ *
+ * Passing an empty string restores the default. See connectionObjectPathBase() for how the
+ * object paths of the connections are built.
+ *
+ * This cannot be changed after the connection manager has been registered on the bus with
+ * registerObject().
+ *
+ * \param objectPathBase The object path base, without a trailing slash.
+ * \sa connectionObjectPathBase()
+ */
+void BaseConnectionManager::setConnectionObjectPathBase(const QString &objectPathBase)
+{
+    if (isRegistered()) {
+        warning() << "Unable to change the connection object path base - CM already registered";
+        return;
+    }
+
+    mPriv->connectionObjectPathBase = objectPathBase;
+}
+
 /**
  * Register this connection manager on the bus.
  *
@@ -366,6 +570,22 @@ bool BaseConnectionManager::registerObject(const QString &busName, const QString
         }
     }
 
+    // A shared bus name other than ours is requested upfront, so that registering the connections
+    // never has to wait for it
+    if (isSharedBusNameEnabled() && sharedBusName() != busName
+            && !OwnedBusNames::contains(dbusConnection(), sharedBusName())) {
+        debug() << "Registering shared bus name" << sharedBusName() << "for CM" << objectPath;
+        if (!dbusConnection().registerService(sharedBusName())) {
+            error->set(TP_QT_ERROR_INVALID_ARGUMENT,
+                    QString(QLatin1String("Name %1 already in use by another process"))
+                        .arg(sharedBusName()));
+            warning() << "Unable to register service" << sharedBusName() <<
+                "- name already registered by another process";
+            return false;
+        }
+        OwnedBusNames::insert(dbusConnection(), sharedBusName());
+    }
+
     debug() << "Registering CM" << objectPath << "at bus name" << busName;
     // Only call DBusService::registerObject after registering the protocols as we don't want to
     // advertise isRegistered if some protocol cannot be registered
@@ -396,6 +616,14 @@ void BaseConnectionManager::addConnection(const BaseConnectionPtr &connection)
     emit newConnection(connection);
 }
 
+QString BaseConnectionManager::prepareRegistration(const BaseConnectionPtr &connection) const
+{
+    connection->setRegistrationScheme(
+            isSharedBusNameEnabled() ? sharedBusName() : QString(),
+            mPriv->connectionObjectPathBase);
+    return connection->registrationBusName();
+}
+
 void BaseConnectionManager::removeConnection()
 {
     BaseConnectionPtr connection = BaseConnectionPtr(
@@ -403,6 +631,14 @@ void BaseConnectionManager::removeConnection()
     Q_ASSERT(connection);
     Q_ASSERT(mPriv->connections.contains(connection));
     mPriv->connections.remove(connection);
+
+    // A connection's own bus name goes away with it, while the shared one stays with the CM
+    QString busName = connection->busName();
+    if (!busName.isEmpty() && !(isSharedBusNameEnabled() && busName == sharedBusName())) {
+        debug() << "Releasing bus name" << busName << "of disconnected connection";
+        OwnedBusNames::remove(connection->dbusConnection(), busName);
+        connection->dbusConnection().unregisterService(busName);
+    }
 }
 
 /**
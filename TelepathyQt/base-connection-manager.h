@@ -79,6 +79,13 @@ public:
     bool hasProtocol(const QString &protocolName) const;
     bool addProtocol(const BaseProtocolPtr &protocol);
 
+    bool isSharedBusNameEnabled() const;
+    void setSharedBusNameEnabled(bool enabled);
+    QString sharedBusName() const;
+    void setSharedBusName(const QString &busName);
+    QString connectionObjectPathBase() const;
+    void setConnectionObjectPathBase(const QString &objectPathBase);
+
     bool registerObject(DBusError *error = NULL);
 
     QList<BaseConnectionPtr> connections() const;
@@ -97,6 +104,7 @@ private Q_SLOTS:
 
 private:
     TP_QT_NO_EXPORT void addConnection(const BaseConnectionPtr &connection);
+    TP_QT_NO_EXPORT QString prepareRegistration(const BaseConnectionPtr &connection) const;
 
     class Adaptee;
     friend class Adaptee;
@@ -32,13 +32,68 @@
 #include <TelepathyQt/DBusObject>
 #include <TelepathyQt/Utils>
 #include <TelepathyQt/AbstractProtocolInterface>
+#include <QHash>
+#include <QPair>
 #include <QString>
+#include <QTimer>
 #include <QVariantMap>
 
 namespace Tp
 {
 
 struct TP_QT_NO_EXPORT BaseConnection::Private {
+    // Index of the channels by what the default matchChannel() compares, so ensureChannel()
+    // doesn't need to check every channel of the connection
+    struct ChannelIndex
+    {
+        struct Key
+        {
+            QString channelType;
+            uint targetHandleType;
+            uint targetHandle;
+            QString targetID;
+        };
+
+        void insert(const BaseChannelPtr &channel);
+        void remove(const BaseChannelPtr &channel);
+        QList<BaseChannelPtr> candidates(const QString &channelType,
+                const QVariantMap &request) const;
+
+        QHash<QString, QMultiHash<QPair<uint, uint>, BaseChannelPtr> > byHandle;
+        QHash<QString, QMultiHash<QPair<uint, QString>, BaseChannelPtr> > byID;
+        // The key each channel was indexed with, as the channel target may change later on
+        QHash<BaseChannel *, Key> keys;
+    };
+
+    // Columnar store of the contact attributes served by GetContactAttributes, with one column
+    // per contact attribute interface. Each cell is the fragment the interface contributes to the
+    // attributes of a contact, already keyed by the qualified attribute names, so serving a
+    // request only copies the fragments over
+    struct ContactAttributeStore
+    {
+        typedef QHash<uint, QVariantMap> Column;
+
+        ContactAttributeStore()
+            : coalesceChanges(false)
+        {
+            flushTimer.setSingleShot(true);
+        }
+
+        bool set(uint handle, const QString &interfaceName, const QVariantMap &attributes);
+        void remove(uint handle);
+        void clear();
+        QVariantMap attributes(uint handle, const QList<const Column *> &requested) const;
+
+        QHash<QString, Column> columns;
+        // Whether the change signals are left to the store, see setContactAttributeChangesLatency()
+        bool coalesceChanges;
+        // Contacts whose attributes changed since the change signals were last emitted, per column
+        QHash<QString, QSet<uint> > changes;
+        // Started by the first change after the last flush, so that the changes are held back
+        // for at most its interval
+        QTimer flushTimer;
+    };
+
     Private(BaseConnection *connection, const QDBusConnection &dbusConnection,
             const QString &cmName, const QString &protocolName,
             const QVariantMap &parameters)
@@ -52,12 +107,20 @@ struct TP_QT_NO_EXPORT BaseConnection::Private {
     {
     }
 
+    QString busNameForRegistration() const;
+    QString objectPathForRegistration() const;
+
     BaseConnection *connection;
     QString cmName;
     QString protocolName;
     QVariantMap parameters;
+    // Set by BaseConnectionManager when it exports its connections under a shared bus name
+    QString sharedBusName;
+    QString objectPathBase;
     QHash<QString, AbstractConnectionInterfacePtr> interfaces;
     QSet<BaseChannelPtr> channels;
+    ChannelIndex channelIndex;
+    ContactAttributeStore contactAttributes;
     uint selfHandle;
     QString selfID;
     uint status;
@@ -68,6 +131,164 @@ struct TP_QT_NO_EXPORT BaseConnection::Private {
     BaseConnection::Adaptee *adaptee;
 };
 
+QString BaseConnection::Private::busNameForRegistration() const
+{
+    if (!sharedBusName.isEmpty()) {
+        return sharedBusName;
+    }
+
+    QString escapedProtocolName = protocolName;
+    escapedProtocolName.replace(QLatin1Char('-'), QLatin1Char('_'));
+    return QString(QLatin1String("%1%2.%3.%4"))
+        .arg(TP_QT_CONNECTION_BUS_NAME_BASE, cmName, escapedProtocolName,
+             connection->uniqueName());
+}
+
+QString BaseConnection::Private::objectPathForRegistration() const
+{
+    QString escapedProtocolName = protocolName;
+    escapedProtocolName.replace(QLatin1Char('-'), QLatin1Char('_'));
+    if (!objectPathBase.isEmpty()) {
+        return QString(QLatin1String("%1/%2/%3"))
+            .arg(objectPathBase, escapedProtocolName, connection->uniqueName());
+    }
+
+    return QString(QLatin1String("%1%2/%3/%4"))
+        .arg(TP_QT_CONNECTION_OBJECT_PATH_BASE, cmName, escapedProtocolName,
+             connection->uniqueName());
+}
+
+void BaseConnection::Private::ChannelIndex::insert(const BaseChannelPtr &channel)
+{
+    Key key;
+    key.channelType = channel->channelType();
+    key.targetHandleType = channel->targetHandleType();
+    key.targetHandle = channel->targetHandle();
+    key.targetID = channel->targetID();
+
+    byHandle[key.channelType].insert(qMakePair(key.targetHandleType, key.targetHandle), channel);
+    byID[key.channelType].insert(qMakePair(key.targetHandleType, key.targetID), channel);
+    keys.insert(channel.data(), key);
+}
+
+void BaseConnection::Private::ChannelIndex::remove(const BaseChannelPtr &channel)
+{
+    QHash<BaseChannel *, Key>::iterator i = keys.find(channel.data());
+    if (i == keys.end()) {
+        return;
+    }
+
+    const Key &key = i.value();
+    QMultiHash<QPair<uint, uint>, BaseChannelPtr> &handles = byHandle[key.channelType];
+    handles.remove(qMakePair(key.targetHandleType, key.targetHandle), channel);
+    QMultiHash<QPair<uint, QString>, BaseChannelPtr> &ids = byID[key.channelType];
+    ids.remove(qMakePair(key.targetHandleType, key.targetID), channel);
+    if (handles.isEmpty()) {
+        byHandle.remove(key.channelType);
+        byID.remove(key.channelType);
+    }
+
+    keys.erase(i);
+}
+
+QList<BaseChannelPtr> BaseConnection::Private::ChannelIndex::candidates(
+        const QString &channelType, const QVariantMap &request) const
+{
+    QVariantMap::const_iterator targetHandleType =
+        request.constFind(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType"));
+    if (targetHandleType == request.constEnd()) {
+        return QList<BaseChannelPtr>();
+    }
+
+    QVariantMap::const_iterator targetHandle =
+        request.constFind(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle"));
+    if (targetHandle != request.constEnd()) {
+        return byHandle.value(channelType).values(
+                qMakePair(targetHandleType.value().toUInt(), targetHandle.value().toUInt()));
+    }
+
+    QVariantMap::const_iterator targetID =
+        request.constFind(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetID"));
+    if (targetID != request.constEnd()) {
+        return byID.value(channelType).values(
+                qMakePair(targetHandleType.value().toUInt(), targetID.value().toString()));
+    }
+
+    return QList<BaseChannelPtr>();
+}
+
+bool BaseConnection::Private::ContactAttributeStore::set(uint handle,
+        const QString &interfaceName, const QVariantMap &attributes)
+{
+    QVariantMap fragment;
+    QString prefix = interfaceName + QLatin1Char('/');
+    for (QVariantMap::const_iterator i = attributes.constBegin(); i != attributes.constEnd(); ++i) {
+        fragment.insert(prefix + i.key(), i.value());
+    }
+
+    Column &column = columns[interfaceName];
+    Column::iterator cell = column.find(handle);
+    if (cell == column.end()) {
+        column.insert(handle, fragment);
+        return true;
+    }
+
+    if (cell.value() == fragment) {
+        return false;
+    }
+
+    cell.value() = fragment;
+    return true;
+}
+
+void BaseConnection::Private::ContactAttributeStore::remove(uint handle)
+{
+    for (QHash<QString, Column>::iterator i = columns.begin(); i != columns.end(); ++i) {
+        i.value().remove(handle);
+    }
+
+    for (QHash<QString, QSet<uint> >::iterator i = changes.begin(); i != changes.end(); ++i) {
+        i.value().remove(handle);
+    }
+}
+
+void BaseConnection::Private::ContactAttributeStore::clear()
+{
+    columns.clear();
+    changes.clear();
+    flushTimer.stop();
+}
+
+QVariantMap BaseConnection::Private::ContactAttributeStore::attributes(uint handle,
+        const QList<const Column *> &requested) const
+{
+    // The first column is the one with the contact ID, which is always there, so its fragment
+    // is shared rather than copied key by key
+    QVariantMap ret = requested.first()->value(handle);
+    for (int i = 1; i < requested.size(); ++i) {
+        Column::const_iterator cell = requested.at(i)->constFind(handle);
+        if (cell == requested.at(i)->constEnd()) {
+            continue;
+        }
+
+        const QVariantMap &fragment = cell.value();
+        for (QVariantMap::const_iterator j = fragment.constBegin(); j != fragment.constEnd(); ++j) {
+            ret.insert(j.key(), j.value());
+        }
+    }
+    return ret;
+}
+
+struct TP_QT_NO_EXPORT AbstractConnectionInterface::Private
+{
+    Private()
+        : connection(0)
+    {
+    }
+
+    BaseConnection *connection;
+};
+
 BaseConnection::Adaptee::Adaptee(const QDBusConnection &dbusConnection,
                                  BaseConnection *connection)
     : QObject(connection),
@@ -244,6 +465,9 @@ BaseConnection::BaseConnection(const QDBusConnection &dbusConnection,
     : DBusService(dbusConnection),
       mPriv(new Private(this, dbusConnection, cmName, protocolName, parameters))
 {
+    connect(&mPriv->contactAttributes.flushTimer,
+            SIGNAL(timeout()),
+            SLOT(onContactAttributeChangesTimeout()));
 }
 
 /**
@@ -255,6 +479,10 @@ BaseConnection::~BaseConnection()
         channel->close();
     }
 
+    foreach (const AbstractConnectionInterfacePtr &iface, mPriv->interfaces) {
+        iface->mPriv->connection = 0;
+    }
+
     delete mPriv;
 }
 
@@ -359,6 +587,10 @@ void BaseConnection::setStatus(uint newStatus, uint reason)
     debug() << "BaseConnection::setStatus " << newStatus << " " << reason << " " << this;
     bool changed = (newStatus != mPriv->status);
     mPriv->status = newStatus;
+    if (changed && newStatus == Tp::ConnectionStatusDisconnected) {
+        // Nobody can ask for the attributes of the contacts of a disconnected connection
+        mPriv->contactAttributes.clear();
+    }
     if (changed)
         QMetaObject::invokeMethod(mPriv->adaptee, "statusChanged", Q_ARG(uint, newStatus), Q_ARG(uint, reason)); //Can simply use emit in Qt5
 }
@@ -489,6 +721,11 @@ Tp::ChannelDetailsList BaseConnection::channelsDetails()
  * suitable channel, then new channel with given request details will be created.
  * This method uses the matchChannel() method to check whether there exists a channel which confirms with the \a request.
  *
+ * Channels are indexed by their type and target, so the ones with the requested
+ * TargetHandleType and TargetHandle/TargetID are looked up and checked first, without
+ * going through all the channels of the connection. The other channels of the requested type are
+ * only checked when none of those matches, as a reimplemented matchChannel() may accept them.
+ *
  * If \a error is passed, any error that may occur will be stored there.
  *
  * \param request A dictionary containing the desirable properties.
@@ -507,8 +744,25 @@ Tp::BaseChannelPtr BaseConnection::ensureChannel(const QVariantMap &request, boo
 
     const QString channelType = request.value(TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType")).toString();
 
-    foreach(const BaseChannelPtr &channel, mPriv->channels) {
-        if (channel->channelType() != channelType) {
+    // Try the channels with the requested target first, which are the only ones the default
+    // matchChannel() can accept
+    QList<BaseChannelPtr> candidates = mPriv->channelIndex.candidates(channelType, request);
+    foreach (const BaseChannelPtr &channel, candidates) {
+        bool match = matchChannel(channel, request, error);
+
+        if (error->isValid()) {
+            return BaseChannelPtr();
+        }
+
+        if (match) {
+            yours = false;
+            return channel;
+        }
+    }
+
+    // Reimplementations of matchChannel() may accept other channels, so check the rest of them
+    foreach (const BaseChannelPtr &channel, mPriv->channels) {
+        if (channel->channelType() != channelType || candidates.contains(channel)) {
             continue;
         }
 
@@ -536,6 +790,7 @@ void BaseConnection::addChannel(BaseChannelPtr channel, bool suppressHandler)
     }
 
     mPriv->channels.insert(channel);
+    mPriv->channelIndex.insert(channel);
 
     BaseConnectionRequestsInterfacePtr reqIface =
         BaseConnectionRequestsInterfacePtr::dynamicCast(interface(TP_QT_IFACE_CONNECTION_INTERFACE_REQUESTS));
@@ -561,6 +816,22 @@ void BaseConnection::addChannel(BaseChannelPtr channel, bool suppressHandler)
                      SLOT(removeChannel()));
 }
 
+/*
+ * Called by BaseChannel when its target changes, so that ensureChannel() keeps finding it through
+ * the index.
+ */
+void BaseConnection::reindexChannel(BaseChannel *channel)
+{
+    // Channels not added yet may not even be referenced by a BaseChannelPtr
+    if (!mPriv->channelIndex.keys.contains(channel)) {
+        return;
+    }
+
+    BaseChannelPtr channelPtr(channel);
+    mPriv->channelIndex.remove(channelPtr);
+    mPriv->channelIndex.insert(channelPtr);
+}
+
 void BaseConnection::removeChannel()
 {
     BaseChannelPtr channel = BaseChannelPtr(
@@ -576,6 +847,7 @@ void BaseConnection::removeChannel()
     }
 
     mPriv->channels.remove(channel);
+    mPriv->channelIndex.remove(channel);
 }
 
 /**
@@ -641,12 +913,151 @@ bool BaseConnection::plugInterface(const AbstractConnectionInterfacePtr &interfa
 
     debug() << "Interface" << interface->interfaceName() << "plugged";
     mPriv->interfaces.insert(interface->interfaceName(), interface);
+    interface->mPriv->connection = this;
     return true;
 }
 
+/**
+ * Set the attributes of the contact with the given \a handle for the given contact
+ * attribute interface.
+ *
+ * The attributes are kept in the contact attribute store of this connection, which
+ * serves Connection.Interface.Contacts.GetContactAttributes unless a callback has
+ * been set with BaseConnectionContactsInterface::setGetContactAttributesCallback().
+ * They replace the attributes previously set for this contact and interface.
+ *
+ * The contact ID is stored with the TP_QT_IFACE_CONNECTION interface and the
+ * "contact-id" attribute. It is looked up with inspectHandles() for the contacts it
+ * hasn't been set for.
+ *
+ * If the interface is one of the Aliasing, Avatars or SimplePresence interfaces
+ * plugged into this connection and setContactAttributeChangesLatency() enabled
+ * coalescing the changes, the corresponding change signal is emitted once the latency
+ * elapsed, together with the other changes done meanwhile, and only if the attributes
+ * actually changed. flushContactAttributeChanges() emits them right away.
+ * Those interfaces store their attributes here on their own when plugged, see
+ * BaseConnectionAliasingInterface::aliasesChanged(),
+ * BaseConnectionAvatarsInterface::avatarUpdated() and
+ * BaseConnectionSimplePresenceInterface::setPresences().
+ *
+ * \param handle The handle of the contact.
+ * \param interfaceName The D-Bus name of the contact attribute interface,
+ * ex. TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING.
+ * \param attributes The attributes, keyed by their name without the interface name,
+ * ex. "alias".
+ * \sa removeContactAttributes(), contactAttributes()
+ */
+void BaseConnection::setContactAttributes(uint handle, const QString &interfaceName,
+        const QVariantMap &attributes)
+{
+    Private::ContactAttributeStore &store = mPriv->contactAttributes;
+    if (!store.set(handle, interfaceName, attributes) || interfaceName == TP_QT_IFACE_CONNECTION ||
+            !store.coalesceChanges) {
+        return;
+    }
+
+    store.changes[interfaceName].insert(handle);
+    if (!store.flushTimer.isActive()) {
+        store.flushTimer.start();
+    }
+}
+
+/**
+ * Remove all the attributes of the contacts with the given \a handles from the
+ * contact attribute store of this connection.
+ *
+ * Handles are never released, and the store is shared by all the clients, so this is
+ * only done when the connection is disconnected and for the contacts removed from the contact
+ * list with BaseConnectionContactListInterface::contactsChangedWithID(). Call it for any other
+ * contact whose attributes are not going to be updated anymore.
+ *
+ * \param handles The handles of the contacts.
+ * \sa setContactAttributes()
+ */
+void BaseConnection::removeContactAttributes(const Tp::UIntList &handles)
+{
+    foreach (uint handle, handles) {
+        mPriv->contactAttributes.remove(handle);
+    }
+}
+
+/**
+ * Return the attributes of the contacts with the given \a handles for the given
+ * contact attribute \a interfaces, as returned by
+ * Connection.Interface.Contacts.GetContactAttributes.
+ *
+ * The contact ID is always included. Contacts whose ID isn't known and can't be
+ * looked up with inspectHandles() are omitted.
+ *
+ * \param handles The handles of the contacts.
+ * \param interfaces The D-Bus names of the contact attribute interfaces.
+ * \return The attributes of the contacts, keyed by their handle.
+ * \sa setContactAttributes()
+ */
+Tp::ContactAttributesMap BaseConnection::contactAttributes(const Tp::UIntList &handles,
+        const QStringList &interfaces)
+{
+    Private::ContactAttributeStore &store = mPriv->contactAttributes;
+    Private::ContactAttributeStore::Column &ids = store.columns[TP_QT_IFACE_CONNECTION];
+
+    Tp::UIntList unknown;
+    foreach (uint handle, handles) {
+        if (!ids.contains(handle)) {
+            unknown << handle;
+        }
+    }
+
+    if (!unknown.isEmpty()) {
+        DBusError error;
+        QStringList unknownIDs = inspectHandles(Tp::HandleTypeContact, unknown, &error);
+        if (error.isValid() && unknown.size() > 1) {
+            // Some of the handles are invalid, so look them up one by one to omit only those
+            unknownIDs.clear();
+            foreach (uint handle, unknown) {
+                DBusError handleError;
+                QStringList ids = inspectHandles(Tp::HandleTypeContact,
+                        Tp::UIntList() << handle, &handleError);
+                unknownIDs << (handleError.isValid() || ids.isEmpty() ? QString() : ids.first());
+            }
+        } else if (error.isValid() || unknownIDs.size() != unknown.size()) {
+            unknownIDs.clear();
+        }
+
+        QVariantMap attributes;
+        for (int i = 0; i < unknownIDs.size(); ++i) {
+            if (!unknownIDs.at(i).isEmpty()) {
+                attributes.insert(QLatin1String("contact-id"), unknownIDs.at(i));
+                store.set(unknown.at(i), TP_QT_IFACE_CONNECTION, attributes);
+            }
+        }
+    }
+
+    QList<const Private::ContactAttributeStore::Column *> requested;
+    requested << &ids;
+    foreach (const QString &interfaceName, interfaces) {
+        QHash<QString, Private::ContactAttributeStore::Column>::const_iterator column =
+            store.columns.constFind(interfaceName);
+        if (column != store.columns.constEnd() && interfaceName != TP_QT_IFACE_CONNECTION) {
+            requested << &column.value();
+        }
+    }
+
+    Tp::ContactAttributesMap ret;
+    foreach (uint handle, handles) {
+        if (ids.contains(handle)) {
+            ret.insert(handle, store.attributes(handle, requested));
+        }
+    }
+    return ret;
+}
+
 /**
  * Register this connection object on the bus.
  *
+ * The connection gets its own bus name, unless it was created by a BaseConnectionManager which
+ * exports its connections under a shared bus name, see
+ * BaseConnectionManager::setSharedBusNameEnabled().
+ *
  * If \a error is passed, any D-Bus error that may occur will
  * be stored there.
  *
@@ -671,14 +1082,9 @@ bool BaseConnection::registerObject(DBusError *error)
         return false;
     }
 
-    QString escapedProtocolName = mPriv->protocolName;
-    escapedProtocolName.replace(QLatin1Char('-'), QLatin1Char('_'));
-    QString name = uniqueName();
-    debug() << "cmName: " << mPriv->cmName << " escapedProtocolName: " << escapedProtocolName << " name:" << name;
-    QString busName = QString(QLatin1String("%1%2.%3.%4"))
-                      .arg(TP_QT_CONNECTION_BUS_NAME_BASE, mPriv->cmName, escapedProtocolName, name);
-    QString objectPath = QString(QLatin1String("%1%2/%3/%4"))
-                         .arg(TP_QT_CONNECTION_OBJECT_PATH_BASE, mPriv->cmName, escapedProtocolName, name);
+    debug() << "cmName: " << mPriv->cmName << " protocolName: " << mPriv->protocolName << " name:" << uniqueName();
+    QString busName = mPriv->busNameForRegistration();
+    QString objectPath = mPriv->objectPathForRegistration();
     debug() << "busName: " << busName << " objectName: " << objectPath;
     DBusError _error;
 
@@ -697,6 +1103,18 @@ bool BaseConnection::registerObject(DBusError *error)
     return ret;
 }
 
+void BaseConnection::setRegistrationScheme(const QString &sharedBusName,
+        const QString &objectPathBase)
+{
+    mPriv->sharedBusName = sharedBusName;
+    mPriv->objectPathBase = objectPathBase;
+}
+
+QString BaseConnection::registrationBusName() const
+{
+    return mPriv->busNameForRegistration();
+}
+
 /**
  * Return a unique name for this connection.
  *
@@ -774,12 +1192,26 @@ bool BaseConnection::matchChannel(const BaseChannelPtr &channel, const QVariantM
  */
 
 AbstractConnectionInterface::AbstractConnectionInterface(const QString &interfaceName)
-    : AbstractDBusServiceInterface(interfaceName)
+    : AbstractDBusServiceInterface(interfaceName),
+      mPriv(new Private)
 {
 }
 
 AbstractConnectionInterface::~AbstractConnectionInterface()
 {
+    delete mPriv;
+}
+
+/**
+ * Return the connection this interface has been plugged into with
+ * BaseConnection::plugInterface().
+ *
+ * \return A pointer to the connection, or \c 0 if this interface hasn't been
+ * plugged into a connection.
+ */
+BaseConnection *AbstractConnectionInterface::connection() const
+{
+    return mPriv->connection;
 }
 
 // Conn.I.Requests
@@ -1019,15 +1451,27 @@ void BaseConnectionContactsInterface::setGetContactAttributesCallback(const GetC
     mPriv->getContactAttributesCallback = cb;
 }
 
+/**
+ * Return the attributes of the contacts with the given \a handles for the given
+ * contact attribute \a interfaces.
+ *
+ * If no callback has been set with setGetContactAttributesCallback(), the attributes
+ * are served from the contact attribute store of the connection this interface is
+ * plugged into, see BaseConnection::setContactAttributes().
+ */
 ContactAttributesMap BaseConnectionContactsInterface::getContactAttributes(const Tp::UIntList &handles,
         const QStringList &interfaces,
         DBusError *error)
 {
-    if (!mPriv->getContactAttributesCallback.isValid()) {
+    if (mPriv->getContactAttributesCallback.isValid()) {
+        return mPriv->getContactAttributesCallback(handles, interfaces, error);
+    }
+
+    if (!connection()) {
         error->set(TP_QT_ERROR_NOT_IMPLEMENTED, QLatin1String("Not implemented"));
         return ContactAttributesMap();
     }
-    return mPriv->getContactAttributesCallback(handles, interfaces, error);
+    return connection()->contactAttributes(handles, interfaces);
 }
 
 // Conn.I.SimplePresence
@@ -1046,14 +1490,41 @@ struct TP_QT_NO_EXPORT BaseConnectionSimplePresenceInterface::Private {
         : maximumStatusMessageLength(0),
           adaptee(new BaseConnectionSimplePresenceInterface::Adaptee(parent)) {
     }
+
+    void updatePresences(BaseConnectionSimplePresenceInterface *interface,
+            const SimpleContactPresences &changed, Qt::ConnectionType type);
+
     SetPresenceCallback setPresenceCB;
     SimpleStatusSpecMap statuses;
     uint maximumStatusMessageLength;
     /* The current presences */
-    SimpleContactPresences presences;
+    QHash<uint, SimplePresence> presences;
     BaseConnectionSimplePresenceInterface::Adaptee *adaptee;
 };
 
+void BaseConnectionSimplePresenceInterface::Private::updatePresences(
+        BaseConnectionSimplePresenceInterface *interface,
+        const SimpleContactPresences &changed, Qt::ConnectionType type)
+{
+    BaseConnection *connection = interface->connection();
+    for (SimpleContactPresences::const_iterator i = changed.constBegin(); i != changed.constEnd(); ++i) {
+        presences.insert(i.key(), i.value());
+
+        if (connection) {
+            QVariantMap attributes;
+            attributes.insert(QLatin1String("presence"), QVariant::fromValue(i.value()));
+            connection->setContactAttributes(i.key(), interface->interfaceName(), attributes);
+        }
+    }
+
+    // When plugged into a connection coalescing the changes, PresencesChanged is emitted by
+    // its contact attribute store, together with the other changes done meanwhile
+    if (!connection || connection->contactAttributeChangesLatency() < 0) {
+        QMetaObject::invokeMethod(adaptee, "presencesChanged", type,
+                Q_ARG(Tp::SimpleContactPresences, changed)); //Can simply use emit in Qt5
+    }
+}
+
 /**
  * \class BaseConnectionSimplePresenceInterface
  * \ingroup servicecm
@@ -1102,12 +1573,20 @@ void BaseConnectionSimplePresenceInterface::createAdaptor()
 
 
 
+/**
+ * Set the presences of the given contacts and signal the change.
+ *
+ * If this interface is plugged into a connection, the presences are also stored as the
+ * "presence" contact attribute of its contact attribute store. If the connection
+ * coalesces the changes, see BaseConnection::setContactAttributeChangesLatency(),
+ * PresencesChanged is then emitted by the connection, once for all the presences set
+ * meanwhile.
+ *
+ * \param presences The presences of the contacts, keyed by their handle.
+ */
 void BaseConnectionSimplePresenceInterface::setPresences(const Tp::SimpleContactPresences &presences)
 {
-    foreach(uint handle, presences.keys()) {
-        mPriv->presences[handle] = presences[handle];
-    }
-    QMetaObject::invokeMethod(mPriv->adaptee, "presencesChanged", Q_ARG(Tp::SimpleContactPresences, presences)); //Can simply use emit in Qt5
+    mPriv->updatePresences(this, presences, Qt::DirectConnection);
 }
 
 void BaseConnectionSimplePresenceInterface::setSetPresenceCallback(const SetPresenceCallback &cb)
@@ -1117,10 +1596,12 @@ void BaseConnectionSimplePresenceInterface::setSetPresenceCallback(const SetPres
 
 SimpleContactPresences BaseConnectionSimplePresenceInterface::getPresences(const UIntList &contacts)
 {
+    static const Tp::SimplePresence unknownPresence = { /* type */ ConnectionPresenceTypeUnknown, /* status */ QLatin1String("unknown") };
+
     Tp::SimpleContactPresences presences;
     foreach(uint handle, contacts) {
-        static const Tp::SimplePresence unknownPresence = { /* type */ ConnectionPresenceTypeUnknown, /* status */ QLatin1String("unknown") };
-        presences[handle] = mPriv->presences.value(handle, unknownPresence);
+        QHash<uint, SimplePresence>::const_iterator i = mPriv->presences.constFind(handle);
+        presences.insert(handle, i != mPriv->presences.constEnd() ? i.value() : unknownPresence);
     }
 
     return presences;
@@ -1188,15 +1669,12 @@ void BaseConnectionSimplePresenceInterface::Adaptee::setPresence(const QString &
     presence.type = i->type;
     presence.status = status;
     presence.statusMessage = statusMessage;
-    mInterface->mPriv->presences[selfHandle] = presence;
 
     /* Emit PresencesChanged */
     SimpleContactPresences presences;
     presences[selfHandle] = presence;
     //emit after return
-    QMetaObject::invokeMethod(mInterface->mPriv->adaptee, "presencesChanged",
-                              Qt::QueuedConnection,
-                              Q_ARG(Tp::SimpleContactPresences, presences));
+    mInterface->mPriv->updatePresences(mInterface, presences, Qt::QueuedConnection);
     context->setFinished();
 }
 
@@ -1559,6 +2037,9 @@ void BaseConnectionContactListInterface::download(DBusError *error)
 
 void BaseConnectionContactListInterface::contactsChangedWithID(const Tp::ContactSubscriptionMap &changes, const Tp::HandleIdentifierMap &identifiers, const Tp::HandleIdentifierMap &removals)
 {
+    if (!removals.isEmpty() && connection()) {
+        connection()->removeContactAttributes(removals.keys());
+    }
     QMetaObject::invokeMethod(mPriv->adaptee, "contactsChangedWithID", Q_ARG(Tp::ContactSubscriptionMap, changes), Q_ARG(Tp::HandleIdentifierMap, identifiers), Q_ARG(Tp::HandleIdentifierMap, removals)); //Can simply use emit in Qt5
 }
 
@@ -2052,11 +2533,27 @@ void BaseConnectionAliasingInterface::setGetAliasesCallback(const BaseConnection
 
 Tp::AliasMap BaseConnectionAliasingInterface::getAliases(const Tp::UIntList &contacts, DBusError *error)
 {
-    if (!mPriv->getAliasesCB.isValid()) {
+    if (mPriv->getAliasesCB.isValid()) {
+        return mPriv->getAliasesCB(contacts, error);
+    }
+
+    if (!connection()) {
         error->set(TP_QT_ERROR_NOT_IMPLEMENTED, QLatin1String("Not implemented"));
         return Tp::AliasMap();
     }
-    return mPriv->getAliasesCB(contacts, error);
+
+    // Serve the aliases from the contact attribute store
+    QString aliasKey = interfaceName() + QLatin1String("/alias");
+    Tp::ContactAttributesMap attributes = connection()->contactAttributes(contacts,
+            QStringList() << interfaceName());
+    Tp::AliasMap aliases;
+    for (Tp::ContactAttributesMap::const_iterator i = attributes.constBegin(); i != attributes.constEnd(); ++i) {
+        QVariantMap::const_iterator alias = i.value().constFind(aliasKey);
+        if (alias != i.value().constEnd()) {
+            aliases.insert(i.key(), alias.value().toString());
+        }
+    }
+    return aliases;
 }
 
 void BaseConnectionAliasingInterface::setSetAliasesCallback(const BaseConnectionAliasingInterface::SetAliasesCallback &cb)
@@ -2073,8 +2570,31 @@ void BaseConnectionAliasingInterface::setAliases(const Tp::AliasMap &aliases, DB
     return mPriv->setAliasesCB(aliases, error);
 }
 
+/**
+ * Signal that the aliases of the given contacts have changed.
+ *
+ * If this interface is plugged into a connection, the aliases are also stored as the
+ * "alias" contact attribute of its contact attribute store, and returned by getAliases()
+ * if no callback has been set for it. If the connection coalesces the changes, see
+ * BaseConnection::setContactAttributeChangesLatency(), AliasesChanged is then emitted by
+ * the connection, once for all the aliases changed meanwhile.
+ *
+ * \param aliases The new aliases of the contacts.
+ */
 void BaseConnectionAliasingInterface::aliasesChanged(const Tp::AliasPairList &aliases)
 {
+    if (connection()) {
+        foreach (const Tp::AliasPair &pair, aliases) {
+            QVariantMap attributes;
+            attributes.insert(QLatin1String("alias"), pair.alias);
+            connection()->setContactAttributes(pair.handle, interfaceName(), attributes);
+        }
+
+        if (connection()->contactAttributeChangesLatency() >= 0) {
+            return;
+        }
+    }
+
     QMetaObject::invokeMethod(mPriv->adaptee, "aliasesChanged", Q_ARG(Tp::AliasPairList, aliases)); //Can simply use emit in Qt5
 }
 
@@ -2259,11 +2779,27 @@ void BaseConnectionAvatarsInterface::setGetKnownAvatarTokensCallback(const BaseC
 
 Tp::AvatarTokenMap BaseConnectionAvatarsInterface::getKnownAvatarTokens(const Tp::UIntList &contacts, DBusError *error)
 {
-    if (!mPriv->getKnownAvatarTokensCB.isValid()) {
+    if (mPriv->getKnownAvatarTokensCB.isValid()) {
+        return mPriv->getKnownAvatarTokensCB(contacts, error);
+    }
+
+    if (!connection()) {
         error->set(TP_QT_ERROR_NOT_IMPLEMENTED, QLatin1String("Not implemented"));
         return Tp::AvatarTokenMap();
     }
-    return mPriv->getKnownAvatarTokensCB(contacts, error);
+
+    // Serve the tokens from the contact attribute store
+    QString tokenKey = interfaceName() + QLatin1String("/token");
+    Tp::ContactAttributesMap attributes = connection()->contactAttributes(contacts,
+            QStringList() << interfaceName());
+    Tp::AvatarTokenMap tokens;
+    for (Tp::ContactAttributesMap::const_iterator i = attributes.constBegin(); i != attributes.constEnd(); ++i) {
+        QVariantMap::const_iterator token = i.value().constFind(tokenKey);
+        if (token != i.value().constEnd()) {
+            tokens.insert(i.key(), token.value().toString());
+        }
+    }
+    return tokens;
 }
 
 void BaseConnectionAvatarsInterface::setRequestAvatarsCallback(const BaseConnectionAvatarsInterface::RequestAvatarsCallback &cb)
@@ -2308,8 +2844,31 @@ void BaseConnectionAvatarsInterface::clearAvatar(DBusError *error)
     return mPriv->clearAvatarCB(error);
 }
 
+/**
+ * Signal that the avatar of the given \a contact has changed.
+ *
+ * If this interface is plugged into a connection, the token is also stored as the
+ * "token" contact attribute of its contact attribute store, and returned by
+ * getKnownAvatarTokens() if no callback has been set for it. If the connection
+ * coalesces the changes, see BaseConnection::setContactAttributeChangesLatency(),
+ * AvatarUpdated is then emitted by the connection, only once if the avatar changed
+ * several times meanwhile.
+ *
+ * \param contact The handle of the contact.
+ * \param newAvatarToken The token of the new avatar.
+ */
 void BaseConnectionAvatarsInterface::avatarUpdated(uint contact, const QString &newAvatarToken)
 {
+    if (connection()) {
+        QVariantMap attributes;
+        attributes.insert(QLatin1String("token"), newAvatarToken);
+        connection()->setContactAttributes(contact, interfaceName(), attributes);
+
+        if (connection()->contactAttributeChangesLatency() >= 0) {
+            return;
+        }
+    }
+
     QMetaObject::invokeMethod(mPriv->adaptee, "avatarUpdated", Q_ARG(uint, contact), Q_ARG(QString, newAvatarToken)); //Can simply use emit in Qt5
 }
 
@@ -2318,4 +2877,143 @@ void BaseConnectionAvatarsInterface::avatarRetrieved(uint contact, const QString
     QMetaObject::invokeMethod(mPriv->adaptee, "avatarRetrieved", Q_ARG(uint, contact), Q_ARG(QString, token), Q_ARG(QByteArray, avatar), Q_ARG(QString, type)); //Can simply use emit in Qt5
 }
 
+// Contact attribute store
+
+/**
+ * Emit the change signals for the contact attributes changed since they were last
+ * emitted, without waiting for contactAttributeChangesLatency() to elapse.
+ *
+ * This is useful before replying to a D-Bus method call whose reply must follow the
+ * change signals, for instance.
+ *
+ * \sa setContactAttributes(), setContactAttributeChangesLatency()
+ */
+void BaseConnection::flushContactAttributeChanges()
+{
+    Private::ContactAttributeStore &store = mPriv->contactAttributes;
+    store.flushTimer.stop();
+    if (store.changes.isEmpty()) {
+        return;
+    }
+
+    QHash<QString, QSet<uint> > changes = store.changes;
+    store.changes.clear();
+
+    for (QHash<QString, QSet<uint> >::const_iterator i = changes.constBegin(); i != changes.constEnd(); ++i) {
+        const QString &interfaceName = i.key();
+        const Private::ContactAttributeStore::Column &column = store.columns[interfaceName];
+        QString prefix = interfaceName + QLatin1Char('/');
+
+        if (interfaceName == TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE) {
+            BaseConnectionSimplePresenceInterfacePtr iface =
+                BaseConnectionSimplePresenceInterfacePtr::dynamicCast(interface(interfaceName));
+            if (!iface) {
+                continue;
+            }
+
+            QString key = prefix + QLatin1String("presence");
+            SimpleContactPresences presences;
+            foreach (uint handle, i.value()) {
+                Private::ContactAttributeStore::Column::const_iterator cell = column.constFind(handle);
+                if (cell != column.constEnd()) {
+                    presences.insert(handle, qvariant_cast<SimplePresence>(cell.value().value(key)));
+                }
+            }
+            if (!presences.isEmpty()) {
+                QMetaObject::invokeMethod(iface->mPriv->adaptee, "presencesChanged",
+                        Q_ARG(Tp::SimpleContactPresences, presences)); //Can simply use emit in Qt5
+            }
+        } else if (interfaceName == TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING) {
+            BaseConnectionAliasingInterfacePtr iface =
+                BaseConnectionAliasingInterfacePtr::dynamicCast(interface(interfaceName));
+            if (!iface) {
+                continue;
+            }
+
+            QString key = prefix + QLatin1String("alias");
+            AliasPairList aliases;
+            foreach (uint handle, i.value()) {
+                Private::ContactAttributeStore::Column::const_iterator cell = column.constFind(handle);
+                if (cell != column.constEnd()) {
+                    AliasPair pair = { handle, cell.value().value(key).toString() };
+                    aliases << pair;
+                }
+            }
+            if (!aliases.isEmpty()) {
+                QMetaObject::invokeMethod(iface->mPriv->adaptee, "aliasesChanged",
+                        Q_ARG(Tp::AliasPairList, aliases)); //Can simply use emit in Qt5
+            }
+        } else if (interfaceName == TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS) {
+            BaseConnectionAvatarsInterfacePtr iface =
+                BaseConnectionAvatarsInterfacePtr::dynamicCast(interface(interfaceName));
+            if (!iface) {
+                continue;
+            }
+
+            // There is no signal for the avatars of several contacts
+            QString key = prefix + QLatin1String("token");
+            foreach (uint handle, i.value()) {
+                Private::ContactAttributeStore::Column::const_iterator cell = column.constFind(handle);
+                if (cell != column.constEnd()) {
+                    QMetaObject::invokeMethod(iface->mPriv->adaptee, "avatarUpdated",
+                            Q_ARG(uint, handle),
+                            Q_ARG(QString, cell.value().value(key).toString())); //Can simply use emit in Qt5
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Return for how long the change signals of the contact attributes are held back,
+ * so that the changes done meanwhile are signalled together.
+ *
+ * \return The latency in milliseconds, or -1 if the changes are not coalesced.
+ * \sa setContactAttributeChangesLatency()
+ */
+int BaseConnection::contactAttributeChangesLatency() const
+{
+    const Private::ContactAttributeStore &store = mPriv->contactAttributes;
+    return store.coalesceChanges ? store.flushTimer.interval() : -1;
+}
+
+/**
+ * Set for how long the change signals of the contact attributes are held back,
+ * so that the changes done meanwhile are signalled together.
+ *
+ * This applies to the AliasesChanged, AvatarUpdated and PresencesChanged signals of
+ * the Aliasing, Avatars and SimplePresence interfaces plugged into this connection.
+ * By default, or if \a msecs is negative, the changes are not coalesced and each
+ * call to BaseConnectionAliasingInterface::aliasesChanged(),
+ * BaseConnectionAvatarsInterface::avatarUpdated() or
+ * BaseConnectionSimplePresenceInterface::setPresences() emits its signal right away.
+ *
+ * Otherwise the signals are emitted at most \a msecs milliseconds after the first
+ * change they contain, leaving out the contacts whose attributes were set to the
+ * values they already had. With 0 they are emitted as soon as the event loop is
+ * entered, merging the changes done in the same event loop iteration.
+ *
+ * Pending changes are emitted when coalescing gets disabled.
+ *
+ * \param msecs The latency in milliseconds, or -1 to not coalesce the changes.
+ * \sa flushContactAttributeChanges()
+ */
+void BaseConnection::setContactAttributeChangesLatency(int msecs)
+{
+    Private::ContactAttributeStore &store = mPriv->contactAttributes;
+    if (msecs < 0) {
+        flushContactAttributeChanges();
+        store.coalesceChanges = false;
+        return;
+    }
+
+    store.coalesceChanges = true;
+    store.flushTimer.setInterval(msecs);
+}
+
+void BaseConnection::onContactAttributeChangesTimeout()
+{
+    flushContactAttributeChanges();
+}
+
 }
@@ -108,6 +108,16 @@ public:
     bool plugInterface(const AbstractConnectionInterfacePtr &interface);
     bool registerObject(DBusError *error = NULL);
 
+    void setContactAttributes(uint handle, const QString &interfaceName,
+            const QVariantMap &attributes);
+    void removeContactAttributes(const Tp::UIntList &handles);
+    Tp::ContactAttributesMap contactAttributes(const Tp::UIntList &handles,
+            const QStringList &interfaces);
+    void flushContactAttributeChanges();
+
+    int contactAttributeChangesLatency() const;
+    void setContactAttributeChangesLatency(int msecs);
+
     virtual QString uniqueName() const;
 
 Q_SIGNALS:
@@ -115,6 +125,7 @@ Q_SIGNALS:
 
 private Q_SLOTS:
     TP_QT_NO_EXPORT void removeChannel();
+    TP_QT_NO_EXPORT void onContactAttributeChangesTimeout();
 
 protected:
     BaseConnection(const QDBusConnection &dbusConnection,
@@ -127,6 +138,13 @@ protected:
     virtual bool matchChannel(const Tp::BaseChannelPtr &channel, const QVariantMap &request, Tp::DBusError *error);
 
 private:
+    friend class BaseConnectionManager;
+    friend class BaseChannel;
+    TP_QT_NO_EXPORT void reindexChannel(BaseChannel *channel);
+    TP_QT_NO_EXPORT void setRegistrationScheme(const QString &sharedBusName,
+            const QString &objectPathBase);
+    TP_QT_NO_EXPORT QString registrationBusName() const;
+
     class Adaptee;
     friend class Adaptee;
     struct Private;
@@ -143,6 +161,9 @@ public:
     AbstractConnectionInterface(const QString &interfaceName);
     virtual ~AbstractConnectionInterface();
 
+protected:
+    BaseConnection *connection() const;
+
 private:
     friend class BaseConnection;
 
@@ -273,6 +294,8 @@ protected:
 private:
     void createAdaptor();
 
+    friend class BaseConnection;
+
     class Adaptee;
     friend class Adaptee;
     struct Private;
@@ -504,6 +527,8 @@ protected:
 private:
     void createAdaptor();
 
+    friend class BaseConnection;
+
     class Adaptee;
     friend class Adaptee;
     struct Private;
@@ -560,6 +585,8 @@ protected:
 private:
     void createAdaptor();
 
+    friend class BaseConnection;
+
     class Adaptee;
     friend class Adaptee;
     struct Private;
@@ -48,23 +48,194 @@
 #include <TelepathyQt/StreamedMediaChannel>
 #include <TelepathyQt/TextChannel>
 
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
 namespace Tp
 {
 
+namespace
+{
+
+// Whether the ChannelType and TargetHandleType of \a channelClass don't rule out \a spec
+bool mayMatch(const ChannelClassSpec &spec, const ChannelClassSpec &channelClass)
+{
+    static const QString channelType = TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType");
+    static const QString targetHandleType =
+        TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType");
+
+    if (spec.hasProperty(channelType) &&
+            spec.property(channelType) != channelClass.property(channelType)) {
+        return false;
+    }
+
+    if (spec.hasProperty(targetHandleType) &&
+            spec.property(targetHandleType) != channelClass.property(targetHandleType)) {
+        return false;
+    }
+
+    return true;
+}
+
+// The values a channel class has for the properties some registered spec cares about, in the
+// order of ChannelFactory::Private::indexedProperties, invalid for the ones it doesn't have
+struct Signature
+{
+    QVariantList values;
+
+    bool operator==(const Signature &other) const
+    {
+        return values == other.values;
+    }
+};
+
+uint qHash(const Signature &signature)
+{
+    uint ret = 0;
+    foreach (const QVariant &value, signature.values) {
+        // all D-Bus types should be convertible to QString, and the ones which aren't just share
+        // a hash value
+        ret = 31 * ret + qHash(value.isValid() ? value.toString() : QString());
+    }
+    return ret;
+}
+
+}
+
 struct TP_QT_NO_EXPORT ChannelFactory::Private
 {
     Private();
 
+    struct Resolved
+    {
+        ConstructorConstPtr ctor;
+        Features features;
+    };
+
+    // The registered specs which don't rule out a given ChannelType and TargetHandleType, by
+    // index, together with what was resolved for the channel classes seen for them so far
+    struct Bucket
+    {
+        QList<int> features;
+        QList<int> ctors;
+        QHash<Signature, Resolved> resolved;
+    };
+
+    typedef QPair<QString, int> BucketKey;
+
+    void invalidateIndex();
+    Bucket &bucketFor(const ChannelClassSpec &channelClass);
+    const Resolved &resolve(const ChannelClassSpec &channelClass);
+
     QList<ChannelClassFeatures> features;
 
     typedef QPair<ChannelClassSpec, ConstructorConstPtr> CtorPair;
     QList<CtorPair> ctors;
+
+    bool indexValid;
+    QStringList indexedProperties;
+    QHash<BucketKey, Bucket> buckets;
+
+    // Channel classes seldom differ in a property taking arbitrary values (such as the service of
+    // a tube), but bound the memo of each bucket in case they do
+    static const int maxResolvedPerBucket = 64;
 };
 
 ChannelFactory::Private::Private()
+    : indexValid(false)
 {
 }
 
+void ChannelFactory::Private::invalidateIndex()
+{
+    indexValid = false;
+    indexedProperties.clear();
+    buckets.clear();
+}
+
+ChannelFactory::Private::Bucket &ChannelFactory::Private::bucketFor(
+        const ChannelClassSpec &channelClass)
+{
+    if (!indexValid) {
+        // Only the properties some registered spec cares about can make a difference to what is
+        // resolved for a channel class
+        QSet<QString> properties;
+        foreach (const ChannelClassFeatures &pair, features) {
+            properties.unite(pair.first.allProperties().keys().toSet());
+        }
+        foreach (const CtorPair &pair, ctors) {
+            properties.unite(pair.first.allProperties().keys().toSet());
+        }
+        indexedProperties = properties.toList();
+        indexValid = true;
+    }
+
+    BucketKey key(channelClass.channelType(),
+            channelClass.hasProperty(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType")) ?
+                int(channelClass.targetHandleType()) : -1);
+
+    QHash<BucketKey, Bucket>::iterator i = buckets.find(key);
+    if (i != buckets.end()) {
+        return *i;
+    }
+
+    Bucket &bucket = buckets[key];
+    for (int j = 0; j < features.size(); ++j) {
+        if (mayMatch(features[j].first, channelClass)) {
+            bucket.features.append(j);
+        }
+    }
+    for (int j = 0; j < ctors.size(); ++j) {
+        if (mayMatch(ctors[j].first, channelClass)) {
+            bucket.ctors.append(j);
+        }
+    }
+    return bucket;
+}
+
+const ChannelFactory::Private::Resolved &ChannelFactory::Private::resolve(
+        const ChannelClassSpec &channelClass)
+{
+    Bucket &bucket = bucketFor(channelClass);
+
+    // Immutable properties contain lots of per-channel values (target ID, initiator etc), leave
+    // out the ones which aren't part of any registered spec so that channels of the same class
+    // share the memo entry
+    const QVariantMap &properties = channelClass.allProperties();
+    Signature signature;
+    signature.values.reserve(indexedProperties.size());
+    foreach (const QString &propName, indexedProperties) {
+        signature.values.append(properties.value(propName));
+    }
+
+    QHash<Signature, Resolved>::const_iterator i = bucket.resolved.constFind(signature);
+    if (i != bucket.resolved.constEnd()) {
+        return *i;
+    }
+
+    if (bucket.resolved.size() >= maxResolvedPerBucket) {
+        bucket.resolved.clear();
+    }
+
+    // The registered specs only have indexed properties, so checking them against the channel
+    // class itself gives the same result as against its signature
+    Resolved resolved;
+    foreach (int j, bucket.features) {
+        if (features[j].first.isSubsetOf(channelClass)) {
+            resolved.features.unite(features[j].second);
+        }
+    }
+    foreach (int j, bucket.ctors) {
+        if (ctors[j].first.isSubsetOf(channelClass)) {
+            resolved.ctor = ctors[j].second;
+            break;
+        }
+    }
+
+    return *bucket.resolved.insert(signature, resolved);
+}
+
 /**
  * \class ChannelFactory
  * \ingroup utils
@@ -546,19 +717,13 @@ void ChannelFactory::setFallbackConstructor(const ConstructorConstPtr &ctor)
 
 Features ChannelFactory::featuresFor(const ChannelClassSpec &channelClass) const
 {
-    Features features;
-
-    foreach (const ChannelClassFeatures &pair, mPriv->features) {
-        if (pair.first.isSubsetOf(channelClass)) {
-            features.unite(pair.second);
-        }
-    }
-
-    return features;
+    return mPriv->resolve(channelClass).features;
 }
 
 void ChannelFactory::addFeaturesFor(const ChannelClassSpec &channelClass, const Features &features)
 {
+    mPriv->invalidateIndex();
+
     QList<ChannelClassFeatures>::iterator i;
     for (i = mPriv->features.begin(); i != mPriv->features.end(); ++i) {
         if (channelClass.allProperties().size() > i->first.allProperties().size()) {
@@ -578,16 +743,11 @@ void ChannelFactory::addFeaturesFor(const ChannelClassSpec &channelClass, const
 
 ChannelFactory::ConstructorConstPtr ChannelFactory::constructorFor(const ChannelClassSpec &cc) const
 {
-    QList<Private::CtorPair>::iterator i;
-    for (i = mPriv->ctors.begin(); i != mPriv->ctors.end(); ++i) {
-        if (i->first.isSubsetOf(cc)) {
-            return i->second;
-        }
-    }
+    ConstructorConstPtr ctor = mPriv->resolve(cc).ctor;
 
-    // If this is reached, we didn't have a proper fallback constructor
-    Q_ASSERT(false);
-    return ConstructorConstPtr();
+    // If this is hit, we didn't have a proper fallback constructor
+    Q_ASSERT(!ctor.isNull());
+    return ctor;
 }
 
 void ChannelFactory::setConstructorFor(const ChannelClassSpec &channelClass,
@@ -600,6 +760,8 @@ void ChannelFactory::setConstructorFor(const ChannelClassSpec &channelClass,
         return;
     }
 
+    mPriv->invalidateIndex();
+
     QList<Private::CtorPair>::iterator i;
     for (i = mPriv->ctors.begin(); i != mPriv->ctors.end(); ++i) {
         if (channelClass.allProperties().size() > i->first.allProperties().size()) {
@@ -29,8 +29,11 @@
 #include <TelepathyQt/AbstractClientHandler>
 #include <TelepathyQt/Channel>
 #include <TelepathyQt/ChannelClassSpecList>
+#include <TelepathyQt/ClientRegistrar>
 #include <TelepathyQt/Types>
 
+#include <QElapsedTimer>
+
 #include "TelepathyQt/fake-handler-manager-internal.h"
 
 namespace Tp
@@ -38,6 +41,95 @@ namespace Tp
 
 class PendingOperation;
 
+/*
+ * State shared by the observer and handler adaptors of a ClientRegistrar in streaming dispatch
+ * mode: the account and connection proxies being made ready, so that concurrent invocations for
+ * the same account or connection wait for the same operation, and the latency histograms.
+ */
+class TP_QT_NO_EXPORT StreamingDispatcher : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(StreamingDispatcher)
+
+public:
+    // Bucket 0 counts latencies under 1 ms, bucket i those in [2^(i-1), 2^i) ms, and the last one
+    // everything slower
+    static const int histogramBuckets = 16;
+
+    StreamingDispatcher(ClientRegistrar *registrar);
+    ~StreamingDispatcher();
+
+    bool isEnabled() const { return mEnabled; }
+    void setEnabled(bool enabled) { mEnabled = enabled; }
+
+    AccountPtr account(const QString &objectPath, PendingOperation **readyOp);
+    ConnectionPtr connection(const QString &objectPath, PendingOperation **readyOp);
+
+    void recordLatency(ClientRegistrar::DispatchStage stage, qint64 msecs);
+    QList<uint> histogram(ClientRegistrar::DispatchStage stage) const;
+    void resetHistograms();
+
+private Q_SLOTS:
+    void onProxyReady(Tp::PendingOperation *op);
+
+private:
+    void track(const QString &objectPath, PendingOperation *op);
+
+    ClientRegistrar *mRegistrar;
+    bool mEnabled;
+
+    QHash<QString, WeakPtr<Account> > mAccounts;
+    QHash<QString, WeakPtr<Connection> > mConnections;
+    QHash<QString /* object path */, PendingOperation *> mPendingProxies;
+    QHash<PendingOperation *, QString> mPendingProxyPaths;
+
+    QHash<int, QList<uint> > mHistograms;
+};
+
+/*
+ * Tracks the readiness of the proxies of a single ObserveChannels or HandleChannels invocation in
+ * streaming dispatch mode, announcing each channel as soon as it, the channels before it and the
+ * proxies it's delivered along with are ready.
+ */
+class TP_QT_NO_EXPORT StreamedInvocation : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(StreamedInvocation)
+
+public:
+    StreamedInvocation(StreamingDispatcher *dispatcher, QObject *parent);
+    ~StreamedInvocation();
+
+    void addChannel(const ChannelPtr &channel, PendingOperation *readyOp);
+    void start(const QList<PendingOperation *> &sharedOps);
+
+Q_SIGNALS:
+    void channelReady(const Tp::ChannelPtr &channel);
+    void channelFailed(const Tp::ChannelPtr &channel);
+    void sharedProxiesFinished(const QString &errorName, const QString &errorMessage);
+    void finished();
+
+private Q_SLOTS:
+    void onSharedOpFinished(Tp::PendingOperation *op);
+    void onChannelOpFinished(Tp::PendingOperation *op);
+
+private:
+    void addSharedOp(PendingOperation *op);
+    void deliverReadyChannels();
+
+    StreamingDispatcher *mDispatcher;
+    QElapsedTimer mTimer;
+    bool mStarted;
+    bool mFailed;
+    bool mSharedOpsReported;
+    QString mErrorName, mErrorMessage;
+    QSet<PendingOperation *> mSharedOps;
+    QHash<PendingOperation *, ChannelPtr> mChannelOps;
+    // The channels still to be delivered, in order, and the ones of them which are ready
+    QList<ChannelPtr> mChannels;
+    QSet<ChannelPtr> mReadyChannels;
+};
+
 class TP_QT_NO_EXPORT ClientAdaptor : public QDBusAbstractAdaptor
 {
     Q_OBJECT
@@ -124,16 +216,27 @@ public Q_SLOTS: // Methods
             const QDBusMessage &message);
 
 private Q_SLOTS:
+    void onConnectionOwnerResolved(Tp::PendingOperation *);
     void onReadyOpFinished(Tp::PendingOperation *);
+    void onStreamedChannelReady(const Tp::ChannelPtr &channel);
+    void onStreamedInvocationFinished();
 
 private:
     struct InvocationData : RefCounted
     {
-        InvocationData() : readyOp(0) {}
+        InvocationData() : readyOp(0), streamed(0) {}
 
         PendingOperation *readyOp;
         QString error, message;
 
+        // The arguments, kept until the proxies can be prepared
+        QDBusObjectPath accountPath;
+        QDBusObjectPath connectionPath;
+        ChannelDetailsList channelDetailsList;
+        QDBusObjectPath dispatchOperationPath;
+        ObjectPathList requestsSatisfied;
+        QVariantMap observerInfoMap;
+
         MethodInvocationContextPtr<> ctx;
         AccountPtr acc;
         ConnectionPtr conn;
@@ -141,8 +244,15 @@ private:
         ChannelDispatchOperationPtr dispatchOp;
         QList<ChannelRequestPtr> chanReqs;
         AbstractClientObserver::ObserverInfo observerInfo;
+
+        // Only set in streaming dispatch mode
+        StreamedInvocation *streamed;
+        QElapsedTimer timer;
     };
     QLinkedList<SharedPtr<InvocationData> > mInvocations;
+    QHash<StreamedInvocation *, SharedPtr<InvocationData> > mStreamedInvocations;
+
+    void prepareProxies(const SharedPtr<InvocationData> &invocation);
 
     ClientRegistrar *mRegistrar;
     QDBusConnection mBus;
@@ -190,6 +300,7 @@ public Q_SLOTS: // Methods
             const QDBusMessage &message);
 
 private Q_SLOTS:
+    void onConnectionOwnerResolved(Tp::PendingOperation *);
     void onReadyOpFinished(Tp::PendingOperation *);
 
 private:
@@ -200,12 +311,19 @@ private:
         PendingOperation *readyOp;
         QString error, message;
 
+        // The arguments, kept until the proxies can be prepared
+        ChannelDetailsList channelDetailsList;
+        QDBusObjectPath dispatchOperationPath;
+        QVariantMap properties;
+
         MethodInvocationContextPtr<> ctx;
         QList<ChannelPtr> chans;
         ChannelDispatchOperationPtr dispatchOp;
     };
     QLinkedList<SharedPtr<InvocationData> > mInvocations;
 
+    void prepareProxies(const SharedPtr<InvocationData> &invocation);
+
 private:
     ClientRegistrar *mRegistrar;
     QDBusConnection mBus;
@@ -280,16 +398,30 @@ public Q_SLOTS: // Methods
             const QDBusMessage &message);
 
 private Q_SLOTS:
+    void onConnectionOwnerResolved(Tp::PendingOperation *);
     void onReadyOpFinished(Tp::PendingOperation *);
+    void onStreamedChannelReady(const Tp::ChannelPtr &channel);
+    void onStreamedChannelFailed(const Tp::ChannelPtr &channel);
+    void onStreamedSharedProxiesFinished(const QString &errorName, const QString &errorMessage);
+    void onStreamedInvocationFinished();
 
 private:
     struct InvocationData : RefCounted
     {
-        InvocationData() : readyOp(0) {}
+        InvocationData() : readyOp(0), userActionTime(0), streamed(0) {}
 
         PendingOperation *readyOp;
         QString error, message;
 
+        // The arguments, kept until the proxies can be prepared
+        QDBusObjectPath accountPath;
+        QDBusObjectPath connectionPath;
+        ChannelDetailsList channelDetailsList;
+        ObjectPathList requestsSatisfied;
+        qulonglong userActionTime;
+        QVariantMap handlerInfoMap;
+        QDBusMessage dbusMessage;
+
         MethodInvocationContextPtr<> ctx;
         AccountPtr acc;
         ConnectionPtr conn;
@@ -297,10 +429,17 @@ private:
         QList<ChannelRequestPtr> chanReqs;
         QDateTime time;
         AbstractClientHandler::HandlerInfo handlerInfo;
+
+        // Only set in streaming dispatch mode
+        StreamedInvocation *streamed;
+        QElapsedTimer timer;
     };
     QLinkedList<SharedPtr<InvocationData> > mInvocations;
+    QHash<StreamedInvocation *, SharedPtr<InvocationData> > mStreamedInvocations;
 
 private:
+    void prepareProxies(const SharedPtr<InvocationData> &invocation);
+
     static void onContextFinished(const MethodInvocationContextPtr<> &context,
             const QList<ChannelPtr> &channels, ClientHandlerAdaptor *self);
 
@@ -28,6 +28,7 @@
 
 #include "TelepathyQt/channel-factory.h"
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/name-owner-cache-internal.h"
 #include "TelepathyQt/request-temporary-handler-internal.h"
 
 #include <TelepathyQt/Account>
@@ -84,6 +85,333 @@ private:
     void *mFinishedCbData;
 };
 
+// In streaming dispatch mode the D-Bus method has been replied to before the client is invoked
+// with a channel, so the context given to the client has nothing to reply to: its reply goes to a
+// bus connection which doesn't exist and is dropped. Errors are logged instead, as they can't reach
+// the channel dispatcher anymore.
+class StreamedInvocationContext : public MethodInvocationContext<>
+{
+    Q_DISABLE_COPY(StreamedInvocationContext)
+
+public:
+    static MethodInvocationContextPtr<> create(const char *methodName, const ChannelPtr &channel,
+            HandleChannelsInvocationContext::FinishedCb finishedCb = 0,
+            void *finishedCbData = 0)
+    {
+        return SharedPtr<MethodInvocationContext<> >(
+                    new StreamedInvocationContext(methodName, channel,
+                        finishedCb, finishedCbData));
+    }
+
+private:
+    StreamedInvocationContext(const char *methodName, const ChannelPtr &channel,
+            HandleChannelsInvocationContext::FinishedCb finishedCb, void *finishedCbData)
+        : MethodInvocationContext<>(QDBusConnection(QLatin1String("tp-qt-streamed-dispatch")),
+                QDBusMessage()),
+          mMethodName(methodName),
+          mChannel(channel),
+          mFinishedCb(finishedCb),
+          mFinishedCbData(finishedCbData)
+    {
+    }
+
+    void onFinished()
+    {
+        if (isError()) {
+            warning().nospace() << "Streamed " << mMethodName << " of channel " <<
+                mChannel->objectPath() << " failed with " << errorName() << ": " <<
+                errorMessage() << " - the channel dispatcher was already replied to";
+        }
+
+        if (mFinishedCb) {
+            mFinishedCb(MethodInvocationContextPtr<>(this), QList<ChannelPtr>() << mChannel,
+                    mFinishedCbData);
+        }
+    }
+
+    const char *mMethodName;
+    ChannelPtr mChannel;
+    HandleChannelsInvocationContext::FinishedCb mFinishedCb;
+    void *mFinishedCbData;
+};
+
+namespace
+{
+
+// Start looking up the owner of the connection at connectionPath, if it isn't known already, so
+// that constructing the Connection proxy doesn't have to block on it. Returns 0 if known already,
+// or if there is no cache to keep it in.
+PendingOperation *resolveConnectionOwner(const QDBusConnection &bus,
+        const QDBusObjectPath &connectionPath)
+{
+    QString connectionBusName = connectionPath.path().mid(1).replace(
+            QLatin1String("/"), QLatin1String("."));
+    NameOwnerCache *cache = NameOwnerCache::instance();
+    if (!cache || !cache->cachedOwner(bus, connectionBusName).isEmpty()) {
+        return 0;
+    }
+    return cache->resolve(bus, connectionBusName);
+}
+
+// Get the account and connection proxies of an invocation in streaming dispatch mode, adding the
+// operations they are still to be made ready with to readyOps
+template<class InvocationData>
+void prepareSharedProxies(StreamingDispatcher *dispatcher, InvocationData *invocation,
+        QList<PendingOperation *> &readyOps)
+{
+    dispatcher->recordLatency(ClientRegistrar::DispatchStageConnectionOwner,
+            invocation->timer.elapsed());
+    invocation->readyOp = 0;
+
+    PendingOperation *readyOp;
+    invocation->acc = dispatcher->account(invocation->accountPath.path(), &readyOp);
+    if (readyOp) {
+        readyOps.append(readyOp);
+    }
+
+    invocation->conn = dispatcher->connection(invocation->connectionPath.path(), &readyOp);
+    if (readyOp) {
+        readyOps.append(readyOp);
+    }
+}
+
+}
+
+StreamingDispatcher::StreamingDispatcher(ClientRegistrar *registrar)
+    : QObject(registrar),
+      mRegistrar(registrar),
+      mEnabled(false)
+{
+}
+
+StreamingDispatcher::~StreamingDispatcher()
+{
+}
+
+/*
+ * Return the account proxy for \a objectPath, setting \a readyOp to the operation it should be
+ * waited for with, or to 0 if it's ready already.
+ */
+AccountPtr StreamingDispatcher::account(const QString &objectPath, PendingOperation **readyOp)
+{
+    AccountFactoryConstPtr accFactory = mRegistrar->accountFactory();
+    AccountPtr account(mAccounts.value(objectPath));
+    *readyOp = mPendingProxies.value(objectPath);
+    if (account && (*readyOp || (account->isValid() && account->isReady(accFactory->features())))) {
+        return account;
+    }
+
+    PendingReady *accReady = accFactory->proxy(TP_QT_ACCOUNT_MANAGER_BUS_NAME,
+            objectPath,
+            mRegistrar->connectionFactory(),
+            mRegistrar->channelFactory(),
+            mRegistrar->contactFactory());
+    account = AccountPtr::qObjectCast(accReady->proxy());
+    mAccounts.insert(objectPath, WeakPtr<Account>(account));
+    track(objectPath, accReady);
+    *readyOp = accReady;
+    return account;
+}
+
+/*
+ * Return the connection proxy for \a objectPath, setting \a readyOp to the operation it should be
+ * waited for with, or to 0 if it's ready already.
+ */
+ConnectionPtr StreamingDispatcher::connection(const QString &objectPath,
+        PendingOperation **readyOp)
+{
+    ConnectionFactoryConstPtr connFactory = mRegistrar->connectionFactory();
+    ConnectionPtr connection(mConnections.value(objectPath));
+    *readyOp = mPendingProxies.value(objectPath);
+    if (connection &&
+            (*readyOp || (connection->isValid() && connection->isReady(connFactory->features())))) {
+        return connection;
+    }
+
+    QString busName = objectPath.mid(1).replace(QLatin1String("/"), QLatin1String("."));
+    PendingReady *connReady = connFactory->proxy(busName, objectPath,
+            mRegistrar->channelFactory(), mRegistrar->contactFactory());
+    connection = ConnectionPtr::qObjectCast(connReady->proxy());
+    mConnections.insert(objectPath, WeakPtr<Connection>(connection));
+    track(objectPath, connReady);
+    *readyOp = connReady;
+    return connection;
+}
+
+void StreamingDispatcher::recordLatency(ClientRegistrar::DispatchStage stage, qint64 msecs)
+{
+    int bucket = 0;
+    while (msecs > 0 && bucket < histogramBuckets - 1) {
+        msecs >>= 1;
+        ++bucket;
+    }
+
+    QList<uint> &buckets = mHistograms[stage];
+    if (buckets.isEmpty()) {
+        buckets = histogram(stage);
+    }
+    ++buckets[bucket];
+}
+
+QList<uint> StreamingDispatcher::histogram(ClientRegistrar::DispatchStage stage) const
+{
+    QList<uint> ret = mHistograms.value(stage);
+    while (ret.size() < histogramBuckets) {
+        ret.append(0);
+    }
+    return ret;
+}
+
+void StreamingDispatcher::resetHistograms()
+{
+    mHistograms.clear();
+}
+
+void StreamingDispatcher::onProxyReady(Tp::PendingOperation *op)
+{
+    QString objectPath = mPendingProxyPaths.take(op);
+    if (mPendingProxies.value(objectPath) == op) {
+        mPendingProxies.remove(objectPath);
+    }
+
+    // Forget about the proxies which have gone away in the meantime
+    if (!mAccounts.value(objectPath) && !mConnections.value(objectPath)) {
+        mAccounts.remove(objectPath);
+        mConnections.remove(objectPath);
+    }
+}
+
+void StreamingDispatcher::track(const QString &objectPath, PendingOperation *op)
+{
+    mPendingProxies.insert(objectPath, op);
+    mPendingProxyPaths.insert(op, objectPath);
+    connect(op,
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(onProxyReady(Tp::PendingOperation*)));
+}
+
+StreamedInvocation::StreamedInvocation(StreamingDispatcher *dispatcher, QObject *parent)
+    : QObject(parent),
+      mDispatcher(dispatcher),
+      mStarted(false),
+      mFailed(false),
+      mSharedOpsReported(false)
+{
+}
+
+StreamedInvocation::~StreamedInvocation()
+{
+}
+
+void StreamedInvocation::addSharedOp(PendingOperation *op)
+{
+    mSharedOps.insert(op);
+    connect(op,
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(onSharedOpFinished(Tp::PendingOperation*)));
+}
+
+/*
+ * Add \a channel, to be delivered once \a readyOp finishes. Channels are delivered in the order
+ * they are added in.
+ */
+void StreamedInvocation::addChannel(const ChannelPtr &channel, PendingOperation *readyOp)
+{
+    mChannels.append(channel);
+    mChannelOps.insert(readyOp, channel);
+    connect(readyOp,
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(onChannelOpFinished(Tp::PendingOperation*)));
+}
+
+/*
+ * Start delivering the channels, once all of \a sharedOps, such as the ones making the account and
+ * connection ready, have finished.
+ */
+void StreamedInvocation::start(const QList<PendingOperation *> &sharedOps)
+{
+    foreach (PendingOperation *op, sharedOps) {
+        addSharedOp(op);
+    }
+
+    mStarted = true;
+    mTimer.start();
+
+    if (mSharedOps.isEmpty()) {
+        mDispatcher->recordLatency(ClientRegistrar::DispatchStageSharedProxies, 0);
+    }
+
+    deliverReadyChannels();
+}
+
+void StreamedInvocation::onSharedOpFinished(Tp::PendingOperation *op)
+{
+    mSharedOps.remove(op);
+
+    if (op->isError()) {
+        warning() << "Preparing proxies for streamed dispatch failed with" << op->errorName()
+            << op->errorMessage() << "- dropping the channels";
+        if (!mFailed) {
+            mFailed = true;
+            mErrorName = op->errorName();
+            mErrorMessage = op->errorMessage();
+        }
+    } else if (mSharedOps.isEmpty() && mStarted) {
+        mDispatcher->recordLatency(ClientRegistrar::DispatchStageSharedProxies, mTimer.elapsed());
+    }
+
+    deliverReadyChannels();
+}
+
+void StreamedInvocation::onChannelOpFinished(Tp::PendingOperation *op)
+{
+    ChannelPtr channel = mChannelOps.take(op);
+
+    if (op->isError()) {
+        warning() << "Preparing channel" << channel->objectPath() << "for streamed dispatch"
+            << "failed with" << op->errorName() << op->errorMessage() << "- dropping it";
+        mChannels.removeOne(channel);
+        emit channelFailed(channel);
+    } else {
+        mDispatcher->recordLatency(ClientRegistrar::DispatchStageChannel, mTimer.elapsed());
+        mReadyChannels.insert(channel);
+    }
+
+    deliverReadyChannels();
+}
+
+void StreamedInvocation::deliverReadyChannels()
+{
+    if (!mStarted) {
+        return;
+    }
+
+    if (mFailed) {
+        mChannels.clear();
+        mReadyChannels.clear();
+    } else if (mSharedOps.isEmpty()) {
+        // A channel which is ready waits for the ones before it
+        while (!mChannels.isEmpty() && mReadyChannels.contains(mChannels.first())) {
+            ChannelPtr channel = mChannels.takeFirst();
+            mReadyChannels.remove(channel);
+            emit channelReady(channel);
+        }
+    }
+
+    // Reported after delivering the channels which are ready already, so that the invocation is
+    // replied to once the client has been given those
+    if (!mSharedOpsReported && (mFailed || mSharedOps.isEmpty())) {
+        mSharedOpsReported = true;
+        emit sharedProxiesFinished(mErrorName, mErrorMessage);
+    }
+
+    // After a failure, there's no point in waiting for the remaining operations
+    if (mChannels.isEmpty() && (mFailed || mSharedOps.isEmpty())) {
+        mStarted = false;
+        emit finished();
+    }
+}
+
 ClientAdaptor::ClientAdaptor(ClientRegistrar *registrar, const QStringList &interfaces,
         QObject *parent)
     : QDBusAbstractAdaptor(parent),
@@ -121,36 +449,106 @@ void ClientObserverAdaptor::ObserveChannels(const QDBusObjectPath &accountPath,
     debug() << "ObserveChannels: account:" << accountPath.path() <<
         ", connection:" << connectionPath.path();
 
+    SharedPtr<InvocationData> invocation(new InvocationData());
+    invocation->accountPath = accountPath;
+    invocation->connectionPath = connectionPath;
+    invocation->channelDetailsList = channelDetailsList;
+    invocation->dispatchOperationPath = dispatchOperationPath;
+    invocation->requestsSatisfied = requestsSatisfied;
+    invocation->observerInfoMap = observerInfo;
+    invocation->ctx = MethodInvocationContextPtr<>(new MethodInvocationContext<>(mBus, message));
+
+    StreamingDispatcher *dispatcher = mRegistrar->streamingDispatcher();
+    if (dispatcher && dispatcher->isEnabled()) {
+        // Let the channel dispatcher carry on right away, the channels are given to the client
+        // one by one as they become ready
+        invocation->ctx->setFinished();
+        invocation->timer.start();
+        invocation->streamed = new StreamedInvocation(dispatcher, this);
+        connect(invocation->streamed,
+                SIGNAL(channelReady(Tp::ChannelPtr)),
+                SLOT(onStreamedChannelReady(Tp::ChannelPtr)));
+        connect(invocation->streamed,
+                SIGNAL(finished()),
+                SLOT(onStreamedInvocationFinished()));
+        mStreamedInvocations.insert(invocation->streamed, invocation);
+    } else {
+        mInvocations.append(invocation);
+    }
+
+    // Don't block on finding out who owns the connection, prepare the proxies once we know
+    invocation->readyOp = resolveConnectionOwner(mBus, connectionPath);
+    if (invocation->readyOp) {
+        connect(invocation->readyOp,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(onConnectionOwnerResolved(Tp::PendingOperation*)));
+        return;
+    }
+
+    prepareProxies(invocation);
+}
+
+void ClientObserverAdaptor::onConnectionOwnerResolved(Tp::PendingOperation *op)
+{
+    foreach (const SharedPtr<InvocationData> &invocation, mInvocations) {
+        if (invocation->readyOp == op) {
+            prepareProxies(invocation);
+            return;
+        }
+    }
+
+    foreach (const SharedPtr<InvocationData> &invocation, mStreamedInvocations) {
+        if (invocation->readyOp == op) {
+            prepareProxies(invocation);
+            return;
+        }
+    }
+}
+
+void ClientObserverAdaptor::prepareProxies(const SharedPtr<InvocationData> &invocation)
+{
+    const QDBusObjectPath &accountPath = invocation->accountPath;
+    const QDBusObjectPath &connectionPath = invocation->connectionPath;
+    const ChannelDetailsList &channelDetailsList = invocation->channelDetailsList;
+    const QDBusObjectPath &dispatchOperationPath = invocation->dispatchOperationPath;
+    const QVariantMap &observerInfo = invocation->observerInfoMap;
+
     AccountFactoryConstPtr accFactory = mRegistrar->accountFactory();
     ConnectionFactoryConstPtr connFactory = mRegistrar->connectionFactory();
     ChannelFactoryConstPtr chanFactory = mRegistrar->channelFactory();
     ContactFactoryConstPtr contactFactory = mRegistrar->contactFactory();
 
-    SharedPtr<InvocationData> invocation(new InvocationData());
-
     QList<PendingOperation *> readyOps;
 
-    PendingReady *accReady = accFactory->proxy(TP_QT_ACCOUNT_MANAGER_BUS_NAME,
-            accountPath.path(),
-            connFactory,
-            chanFactory,
-            contactFactory);
-    invocation->acc = AccountPtr::qObjectCast(accReady->proxy());
-    readyOps.append(accReady);
-
-    QString connectionBusName = connectionPath.path().mid(1).replace(
-            QLatin1String("/"), QLatin1String("."));
-    PendingReady *connReady = connFactory->proxy(connectionBusName, connectionPath.path(),
-            chanFactory, contactFactory);
-    invocation->conn = ConnectionPtr::qObjectCast(connReady->proxy());
-    readyOps.append(connReady);
+    if (invocation->streamed) {
+        prepareSharedProxies(mRegistrar->streamingDispatcher(), invocation.data(), readyOps);
+    } else {
+        PendingReady *accReady = accFactory->proxy(TP_QT_ACCOUNT_MANAGER_BUS_NAME,
+                accountPath.path(),
+                connFactory,
+                chanFactory,
+                contactFactory);
+        invocation->acc = AccountPtr::qObjectCast(accReady->proxy());
+        readyOps.append(accReady);
+
+        QString connectionBusName = connectionPath.path().mid(1).replace(
+                QLatin1String("/"), QLatin1String("."));
+        PendingReady *connReady = connFactory->proxy(connectionBusName, connectionPath.path(),
+                chanFactory, contactFactory);
+        invocation->conn = ConnectionPtr::qObjectCast(connReady->proxy());
+        readyOps.append(connReady);
+    }
 
     foreach (const ChannelDetails &channelDetails, channelDetailsList) {
         PendingReady *chanReady = chanFactory->proxy(invocation->conn,
                 channelDetails.channel.path(), channelDetails.properties);
         ChannelPtr channel = ChannelPtr::qObjectCast(chanReady->proxy());
         invocation->chans.append(channel);
-        readyOps.append(chanReady);
+        if (invocation->streamed) {
+            invocation->streamed->addChannel(channel, chanReady);
+        } else {
+            readyOps.append(chanReady);
+        }
     }
 
     // Yes, we don't give the choice of making CDO and CR ready or not - however, readifying them is
@@ -192,7 +590,7 @@ void ClientObserverAdaptor::ObserveChannels(const QDBusObjectPath &accountPath,
 
     ObjectImmutablePropertiesMap reqPropsMap = qdbus_cast<ObjectImmutablePropertiesMap>(
             observerInfo.value(QLatin1String("request-properties")));
-    foreach (const QDBusObjectPath &reqPath, requestsSatisfied) {
+    foreach (const QDBusObjectPath &reqPath, invocation->requestsSatisfied) {
         //don't load the channelRequest objects in requestsSatisfied if the properties are not supplied with the handler info
         //as the channelRequest is probably invalid
         //this works around https://bugs.freedesktop.org/show_bug.cgi?id=77986
@@ -205,15 +603,18 @@ void ClientObserverAdaptor::ObserveChannels(const QDBusObjectPath &accountPath,
         readyOps.append(channelRequest->becomeReady());
     }
 
-    invocation->ctx = MethodInvocationContextPtr<>(new MethodInvocationContext<>(mBus, message));
+    if (invocation->streamed) {
+        invocation->streamed->start(readyOps);
+        debug() << "Streaming ObserveChannels of" << channelDetailsList.size() << "channels"
+            << "to client" << mClient;
+        return;
+    }
 
     invocation->readyOp = new PendingComposite(readyOps, invocation->ctx);
     connect(invocation->readyOp,
             SIGNAL(finished(Tp::PendingOperation*)),
             SLOT(onReadyOpFinished(Tp::PendingOperation*)));
 
-    mInvocations.append(invocation);
-
     debug() << "Preparing proxies for ObserveChannels of" << channelDetailsList.size() << "channels"
         << "for client" << mClient;
 }
@@ -260,6 +661,30 @@ void ClientObserverAdaptor::onReadyOpFinished(Tp::PendingOperation *op)
     }
 }
 
+void ClientObserverAdaptor::onStreamedChannelReady(const Tp::ChannelPtr &channel)
+{
+    SharedPtr<InvocationData> invocation = mStreamedInvocations.value(
+            qobject_cast<StreamedInvocation *>(sender()));
+    mRegistrar->streamingDispatcher()->recordLatency(ClientRegistrar::DispatchStageDelivery,
+            invocation->timer.elapsed());
+
+    debug() << "Invoking application observeChannels with channel" << channel->objectPath()
+        << "on" << mClient;
+
+    MethodInvocationContextPtr<> ctx = StreamedInvocationContext::create("ObserveChannels",
+            channel);
+    mClient->observeChannels(ctx, invocation->acc, invocation->conn,
+            QList<ChannelPtr>() << channel, invocation->dispatchOp, invocation->chanReqs,
+            invocation->observerInfo);
+}
+
+void ClientObserverAdaptor::onStreamedInvocationFinished()
+{
+    StreamedInvocation *streamed = qobject_cast<StreamedInvocation *>(sender());
+    mStreamedInvocations.remove(streamed);
+    streamed->deleteLater();
+}
+
 ClientApproverAdaptor::ClientApproverAdaptor(ClientRegistrar *registrar,
         AbstractClientApprover *client,
         QObject *parent)
@@ -279,6 +704,47 @@ void ClientApproverAdaptor::AddDispatchOperation(const Tp::ChannelDetailsList &c
         const QVariantMap &properties,
         const QDBusMessage &message)
 {
+    QDBusObjectPath connectionPath = qdbus_cast<QDBusObjectPath>(
+            properties.value(
+                TP_QT_IFACE_CHANNEL_DISPATCH_OPERATION + QLatin1String(".Connection")));
+    debug() << "addDispatchOperation: connection:" << connectionPath.path();
+
+    SharedPtr<InvocationData> invocation(new InvocationData);
+    invocation->channelDetailsList = channelDetailsList;
+    invocation->dispatchOperationPath = dispatchOperationPath;
+    invocation->properties = properties;
+    invocation->ctx = MethodInvocationContextPtr<>(new MethodInvocationContext<>(mBus, message));
+
+    mInvocations.append(invocation);
+
+    // Don't block on finding out who owns the connection, prepare the proxies once we know
+    invocation->readyOp = resolveConnectionOwner(mBus, connectionPath);
+    if (invocation->readyOp) {
+        connect(invocation->readyOp,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(onConnectionOwnerResolved(Tp::PendingOperation*)));
+        return;
+    }
+
+    prepareProxies(invocation);
+}
+
+void ClientApproverAdaptor::onConnectionOwnerResolved(Tp::PendingOperation *op)
+{
+    foreach (const SharedPtr<InvocationData> &invocation, mInvocations) {
+        if (invocation->readyOp == op) {
+            prepareProxies(invocation);
+            break;
+        }
+    }
+}
+
+void ClientApproverAdaptor::prepareProxies(const SharedPtr<InvocationData> &invocation)
+{
+    const ChannelDetailsList &channelDetailsList = invocation->channelDetailsList;
+    const QDBusObjectPath &dispatchOperationPath = invocation->dispatchOperationPath;
+    const QVariantMap &properties = invocation->properties;
+
     AccountFactoryConstPtr accFactory = mRegistrar->accountFactory();
     ConnectionFactoryConstPtr connFactory = mRegistrar->connectionFactory();
     ChannelFactoryConstPtr chanFactory = mRegistrar->channelFactory();
@@ -289,7 +755,6 @@ void ClientApproverAdaptor::AddDispatchOperation(const Tp::ChannelDetailsList &c
     QDBusObjectPath connectionPath = qdbus_cast<QDBusObjectPath>(
             properties.value(
                 TP_QT_IFACE_CHANNEL_DISPATCH_OPERATION + QLatin1String(".Connection")));
-    debug() << "addDispatchOperation: connection:" << connectionPath.path();
     QString connectionBusName = connectionPath.path().mid(1).replace(
             QLatin1String("/"), QLatin1String("."));
     PendingReady *connReady = connFactory->proxy(connectionBusName, connectionPath.path(), chanFactory,
@@ -297,8 +762,6 @@ void ClientApproverAdaptor::AddDispatchOperation(const Tp::ChannelDetailsList &c
     ConnectionPtr connection = ConnectionPtr::qObjectCast(connReady->proxy());
     readyOps.append(connReady);
 
-    SharedPtr<InvocationData> invocation(new InvocationData);
-
     foreach (const ChannelDetails &channelDetails, channelDetailsList) {
         PendingReady *chanReady = chanFactory->proxy(connection, channelDetails.channel.path(),
                 channelDetails.properties);
@@ -311,14 +774,10 @@ void ClientApproverAdaptor::AddDispatchOperation(const Tp::ChannelDetailsList &c
             chanFactory, contactFactory);
     readyOps.append(invocation->dispatchOp->becomeReady());
 
-    invocation->ctx = MethodInvocationContextPtr<>(new MethodInvocationContext<>(mBus, message));
-
     invocation->readyOp = new PendingComposite(readyOps, invocation->ctx);
     connect(invocation->readyOp,
             SIGNAL(finished(Tp::PendingOperation*)),
             SLOT(onReadyOpFinished(Tp::PendingOperation*)));
-
-    mInvocations.append(invocation);
 }
 
 void ClientApproverAdaptor::onReadyOpFinished(Tp::PendingOperation *op)
@@ -398,13 +857,14 @@ void ClientHandlerAdaptor::HandleChannels(const QDBusObjectPath &accountPath,
     debug() << "HandleChannels: account:" << accountPath.path() <<
         ", connection:" << connectionPath.path();
 
-    AccountFactoryConstPtr accFactory = mRegistrar->accountFactory();
-    ConnectionFactoryConstPtr connFactory = mRegistrar->connectionFactory();
-    ChannelFactoryConstPtr chanFactory = mRegistrar->channelFactory();
-    ContactFactoryConstPtr contactFactory = mRegistrar->contactFactory();
-
     SharedPtr<InvocationData> invocation(new InvocationData());
-    QList<PendingOperation *> readyOps;
+    invocation->accountPath = accountPath;
+    invocation->connectionPath = connectionPath;
+    invocation->channelDetailsList = channelDetailsList;
+    invocation->requestsSatisfied = requestsSatisfied;
+    invocation->userActionTime = userActionTime_t;
+    invocation->handlerInfoMap = handlerInfo;
+    invocation->dbusMessage = message;
 
     RequestTemporaryHandler *tempHandler = dynamic_cast<RequestTemporaryHandler *>(mClient);
     if (tempHandler) {
@@ -413,34 +873,113 @@ void ClientHandlerAdaptor::HandleChannels(const QDBusObjectPath &accountPath,
         tempHandler->setDBusHandlerInvoked();
     }
 
-    PendingReady *accReady = accFactory->proxy(TP_QT_ACCOUNT_MANAGER_BUS_NAME,
-            accountPath.path(),
-            connFactory,
-            chanFactory,
-            contactFactory);
-    invocation->acc = AccountPtr::qObjectCast(accReady->proxy());
-    readyOps.append(accReady);
+    // The temporary handler needs to know whether handling the channels failed
+    StreamingDispatcher *dispatcher = mRegistrar->streamingDispatcher();
+    if (dispatcher && dispatcher->isEnabled() && !tempHandler) {
+        // The channels are given to the client one by one as they become ready, and the channel
+        // dispatcher is replied to as soon as the account and connection are, so that it can carry
+        // on or give the channels to another handler if they can't be made ready
+        message.setDelayedReply(true);
+        invocation->timer.start();
+        invocation->streamed = new StreamedInvocation(dispatcher, this);
+        connect(invocation->streamed,
+                SIGNAL(channelReady(Tp::ChannelPtr)),
+                SLOT(onStreamedChannelReady(Tp::ChannelPtr)));
+        connect(invocation->streamed,
+                SIGNAL(channelFailed(Tp::ChannelPtr)),
+                SLOT(onStreamedChannelFailed(Tp::ChannelPtr)));
+        connect(invocation->streamed,
+                SIGNAL(sharedProxiesFinished(QString,QString)),
+                SLOT(onStreamedSharedProxiesFinished(QString,QString)));
+        connect(invocation->streamed,
+                SIGNAL(finished()),
+                SLOT(onStreamedInvocationFinished()));
+        mStreamedInvocations.insert(invocation->streamed, invocation);
+    } else {
+        mInvocations.append(invocation);
+    }
 
-    QString connectionBusName = connectionPath.path().mid(1).replace(
-            QLatin1String("/"), QLatin1String("."));
-    PendingReady *connReady = connFactory->proxy(connectionBusName, connectionPath.path(),
-            chanFactory, contactFactory);
-    invocation->conn = ConnectionPtr::qObjectCast(connReady->proxy());
-    readyOps.append(connReady);
+    // Don't block on finding out who owns the connection, prepare the proxies once we know
+    invocation->readyOp = resolveConnectionOwner(mBus, connectionPath);
+    if (invocation->readyOp) {
+        // The invocation context is only created along with the channels
+        message.setDelayedReply(true);
+        connect(invocation->readyOp,
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(onConnectionOwnerResolved(Tp::PendingOperation*)));
+        return;
+    }
+
+    prepareProxies(invocation);
+}
+
+void ClientHandlerAdaptor::onConnectionOwnerResolved(Tp::PendingOperation *op)
+{
+    foreach (const SharedPtr<InvocationData> &invocation, mInvocations) {
+        if (invocation->readyOp == op) {
+            prepareProxies(invocation);
+            return;
+        }
+    }
+
+    foreach (const SharedPtr<InvocationData> &invocation, mStreamedInvocations) {
+        if (invocation->readyOp == op) {
+            prepareProxies(invocation);
+            return;
+        }
+    }
+}
+
+void ClientHandlerAdaptor::prepareProxies(const SharedPtr<InvocationData> &invocation)
+{
+    const QDBusObjectPath &accountPath = invocation->accountPath;
+    const QDBusObjectPath &connectionPath = invocation->connectionPath;
+    const ChannelDetailsList &channelDetailsList = invocation->channelDetailsList;
+    const QVariantMap &handlerInfo = invocation->handlerInfoMap;
+
+    AccountFactoryConstPtr accFactory = mRegistrar->accountFactory();
+    ConnectionFactoryConstPtr connFactory = mRegistrar->connectionFactory();
+    ChannelFactoryConstPtr chanFactory = mRegistrar->channelFactory();
+    ContactFactoryConstPtr contactFactory = mRegistrar->contactFactory();
+
+    QList<PendingOperation *> readyOps;
+
+    if (invocation->streamed) {
+        prepareSharedProxies(mRegistrar->streamingDispatcher(), invocation.data(), readyOps);
+    } else {
+        PendingReady *accReady = accFactory->proxy(TP_QT_ACCOUNT_MANAGER_BUS_NAME,
+                accountPath.path(),
+                connFactory,
+                chanFactory,
+                contactFactory);
+        invocation->acc = AccountPtr::qObjectCast(accReady->proxy());
+        readyOps.append(accReady);
+
+        QString connectionBusName = connectionPath.path().mid(1).replace(
+                QLatin1String("/"), QLatin1String("."));
+        PendingReady *connReady = connFactory->proxy(connectionBusName, connectionPath.path(),
+                chanFactory, contactFactory);
+        invocation->conn = ConnectionPtr::qObjectCast(connReady->proxy());
+        readyOps.append(connReady);
+    }
 
     foreach (const ChannelDetails &channelDetails, channelDetailsList) {
         PendingReady *chanReady = chanFactory->proxy(invocation->conn,
                 channelDetails.channel.path(), channelDetails.properties);
         ChannelPtr channel = ChannelPtr::qObjectCast(chanReady->proxy());
         invocation->chans.append(channel);
-        readyOps.append(chanReady);
+        if (invocation->streamed) {
+            invocation->streamed->addChannel(channel, chanReady);
+        } else {
+            readyOps.append(chanReady);
+        }
     }
 
     invocation->handlerInfo = AbstractClientHandler::HandlerInfo(handlerInfo);
 
     ObjectImmutablePropertiesMap reqPropsMap = qdbus_cast<ObjectImmutablePropertiesMap>(
     handlerInfo.value(QLatin1String("request-properties")));
-    foreach (const QDBusObjectPath &reqPath, requestsSatisfied) {
+    foreach (const QDBusObjectPath &reqPath, invocation->requestsSatisfied) {
         //don't load the channelRequest objects in requestsSatisfied if the properties are not supplied with the handler info
         //as the channelRequest is probably invalid
         //this works around https://bugs.freedesktop.org/show_bug.cgi?id=77986
@@ -454,11 +993,18 @@ void ClientHandlerAdaptor::HandleChannels(const QDBusObjectPath &accountPath,
     }
 
     // FIXME See http://bugs.freedesktop.org/show_bug.cgi?id=21690
-    if (userActionTime_t != 0) {
-        invocation->time = QDateTime::fromTime_t((uint) userActionTime_t);
+    if (invocation->userActionTime != 0) {
+        invocation->time = QDateTime::fromTime_t((uint) invocation->userActionTime);
+    }
+
+    if (invocation->streamed) {
+        invocation->streamed->start(readyOps);
+        debug() << "Streaming HandleChannels of" << channelDetailsList.size() << "channels"
+            << "to client" << mClient;
+        return;
     }
 
-    invocation->ctx = HandleChannelsInvocationContext::create(mBus, message,
+    invocation->ctx = HandleChannelsInvocationContext::create(mBus, invocation->dbusMessage,
                 invocation->chans,
                 reinterpret_cast<HandleChannelsInvocationContext::FinishedCb>(
                     &ClientHandlerAdaptor::onContextFinished),
@@ -469,8 +1015,6 @@ void ClientHandlerAdaptor::HandleChannels(const QDBusObjectPath &accountPath,
             SIGNAL(finished(Tp::PendingOperation*)),
             SLOT(onReadyOpFinished(Tp::PendingOperation*)));
 
-    mInvocations.append(invocation);
-
     debug() << "Preparing proxies for HandleChannels of" << channelDetailsList.size() << "channels"
         << "for client" << mClient;
 }
@@ -522,6 +1066,62 @@ void ClientHandlerAdaptor::onReadyOpFinished(Tp::PendingOperation *op)
     }
 }
 
+void ClientHandlerAdaptor::onStreamedChannelReady(const Tp::ChannelPtr &channel)
+{
+    SharedPtr<InvocationData> invocation = mStreamedInvocations.value(
+            qobject_cast<StreamedInvocation *>(sender()));
+    mRegistrar->streamingDispatcher()->recordLatency(ClientRegistrar::DispatchStageDelivery,
+            invocation->timer.elapsed());
+
+    debug() << "Invoking application handleChannels with channel" << channel->objectPath()
+        << "on" << mClient;
+
+    // The channels are still only registered as handled once the client says so
+    MethodInvocationContextPtr<> ctx = StreamedInvocationContext::create("HandleChannels",
+            channel,
+            reinterpret_cast<HandleChannelsInvocationContext::FinishedCb>(
+                &ClientHandlerAdaptor::onContextFinished),
+            this);
+    mClient->handleChannels(ctx, invocation->acc, invocation->conn,
+            QList<ChannelPtr>() << channel, invocation->chanReqs, invocation->time,
+            invocation->handlerInfo);
+}
+
+void ClientHandlerAdaptor::onStreamedChannelFailed(const Tp::ChannelPtr &channel)
+{
+    // The channel dispatcher is told the channels were handled as soon as the account and
+    // connection are ready, so it won't give a channel which couldn't be made ready to anybody
+    // else. Close it rather than leaving it around with no handler. The proxy may well have been
+    // invalidated by the failure, so don't go through Channel::requestClose(), which would then
+    // do nothing.
+    debug() << "Closing channel" << channel->objectPath()
+        << "which couldn't be prepared for streamed dispatch";
+    QDBusMessage close = QDBusMessage::createMethodCall(channel->busName(),
+            channel->objectPath(), TP_QT_IFACE_CHANNEL, QLatin1String("Close"));
+    channel->dbusConnection().asyncCall(close);
+}
+
+void ClientHandlerAdaptor::onStreamedSharedProxiesFinished(const QString &errorName,
+        const QString &errorMessage)
+{
+    SharedPtr<InvocationData> invocation = mStreamedInvocations.value(
+            qobject_cast<StreamedInvocation *>(sender()));
+
+    if (errorName.isEmpty()) {
+        mBus.send(invocation->dbusMessage.createReply());
+    } else {
+        // We guarantee that the proxies were ready, so none of the channels can be handled
+        mBus.send(invocation->dbusMessage.createErrorReply(errorName, errorMessage));
+    }
+}
+
+void ClientHandlerAdaptor::onStreamedInvocationFinished()
+{
+    StreamedInvocation *streamed = qobject_cast<StreamedInvocation *>(sender());
+    mStreamedInvocations.remove(streamed);
+    streamed->deleteLater();
+}
+
 void ClientHandlerAdaptor::onContextFinished(
         const MethodInvocationContextPtr<> &context,
         const QList<ChannelPtr> &channels, ClientHandlerAdaptor *self)
@@ -589,7 +1189,7 @@ struct TP_QT_NO_EXPORT ClientRegistrar::Private
             const ConnectionFactoryConstPtr &connFactory, const ChannelFactoryConstPtr &chanFactory,
             const ContactFactoryConstPtr &contactFactory)
         : bus(bus), accFactory(accFactory), connFactory(connFactory), chanFactory(chanFactory),
-        contactFactory(contactFactory)
+        contactFactory(contactFactory), streamingDispatcher(0)
     {
         if (accFactory->dbusConnection().name() != bus.name()) {
             warning() << "  The D-Bus connection in the account factory is not the proxy connection";
@@ -614,6 +1214,9 @@ struct TP_QT_NO_EXPORT ClientRegistrar::Private
     QHash<AbstractClientPtr, QString> clients;
     QHash<AbstractClientPtr, QObject*> clientObjects;
     QSet<QString> services;
+
+    // Created the first time streaming dispatch is enabled
+    StreamingDispatcher *streamingDispatcher;
 };
 
 /**
@@ -663,6 +1266,26 @@ struct TP_QT_NO_EXPORT ClientRegistrar::Private
  *
  * \endcode
  *
+ * \subsection cr_streaming_sec Streaming dispatch
+ *
+ * By default, AbstractClientObserver::observeChannels() and
+ * AbstractClientHandler::handleChannels() are only called once the account, the connection, all of
+ * the channels and the other objects passed to them are ready, and the channel dispatcher only
+ * gets a reply once the client has finished the invocation context.
+ *
+ * With setStreamingDispatchEnabled(), the client is invoked once for each channel, as soon as the
+ * channel, the channels before it in the dispatch and the shared objects (the account, the
+ * connection, and the dispatch operation and channel requests, if any) are ready. Concurrent
+ * invocations for the same account or connection wait for them to become ready together.
+ *
+ * Observers reply to the channel dispatcher right away. Handlers reply as soon as the shared
+ * objects are ready, after being invoked for the channels which are ready by then, or with the
+ * error preparing the shared objects failed with, in which case none of the channels are handled.
+ * Either way, the reply has been sent before the client finishes the invocation contexts it is
+ * given, so the errors set on them are only logged, and not reported back to the channel
+ * dispatcher. The latency of the individual stages can be examined with
+ * dispatchLatencyHistogram().
+ *
  * \sa AbstractClientObserver, AbstractClientApprover, AbstractClientHandler
  *
  * See \ref async_model, \ref shared_ptr
@@ -1047,4 +1670,91 @@ void ClientRegistrar::unregisterClients()
     }
 }
 
+/**
+ * Return whether the streaming dispatch mode is enabled.
+ *
+ * \return \c true if observers and handlers are invoked for each channel as soon as it is ready,
+ *         \c false otherwise.
+ * \sa setStreamingDispatchEnabled()
+ */
+bool ClientRegistrar::isStreamingDispatchEnabled() const
+{
+    return mPriv->streamingDispatcher && mPriv->streamingDispatcher->isEnabled();
+}
+
+/**
+ * Set whether the clients registered on this client registrar should be invoked for each channel
+ * as soon as it is ready, rather than for all of the channels of a dispatch at once.
+ *
+ * See \ref cr_streaming_sec for the differences between the two modes. The mode doesn't apply to
+ * approvers and to the temporary handlers used by Account::ensureAndHandleChannel() and friends,
+ * and the invocations already in progress are completed in the mode they were started in.
+ *
+ * \param enabled Whether the streaming dispatch mode should be enabled.
+ * \sa isStreamingDispatchEnabled(), dispatchLatencyHistogram()
+ */
+void ClientRegistrar::setStreamingDispatchEnabled(bool enabled)
+{
+    if (!mPriv->streamingDispatcher) {
+        if (!enabled) {
+            return;
+        }
+        mPriv->streamingDispatcher = new StreamingDispatcher(this);
+    }
+
+    mPriv->streamingDispatcher->setEnabled(enabled);
+}
+
+/**
+ * Return the histogram of the latencies of the given \a stage of the invocations done in the
+ * streaming dispatch mode.
+ *
+ * The stages are measured as follows:
+ * <ul>
+ *  <li>DispatchStageConnectionOwner: from receiving the invocation until the owner of the
+ *      connection bus name is known, once per invocation</li>
+ *  <li>DispatchStageSharedProxies: from then until the account, the connection, and the dispatch
+ *      operation and channel requests if any are ready, once per invocation</li>
+ *  <li>DispatchStageChannel: from the same point until each channel is ready, once per
+ *      channel</li>
+ *  <li>DispatchStageDelivery: from receiving the invocation until the client is invoked, once per
+ *      channel</li>
+ * </ul>
+ *
+ * The histogram has 16 buckets. The first one counts latencies under 1 ms, bucket \c i those
+ * from 2<sup>i-1</sup> ms included to 2<sup>i</sup> ms excluded, and the last one everything
+ * slower than that.
+ *
+ * \param stage The stage to return the histogram of.
+ * \return The number of latencies measured for each bucket.
+ * \sa resetDispatchLatencyHistograms()
+ */
+QList<uint> ClientRegistrar::dispatchLatencyHistogram(DispatchStage stage) const
+{
+    if (!mPriv->streamingDispatcher) {
+        QList<uint> ret;
+        for (int i = 0; i < StreamingDispatcher::histogramBuckets; ++i) {
+            ret << 0;
+        }
+        return ret;
+    }
+
+    return mPriv->streamingDispatcher->histogram(stage);
+}
+
+/**
+ * Reset the histograms returned by dispatchLatencyHistogram().
+ */
+void ClientRegistrar::resetDispatchLatencyHistograms()
+{
+    if (mPriv->streamingDispatcher) {
+        mPriv->streamingDispatcher->resetHistograms();
+    }
+}
+
+StreamingDispatcher *ClientRegistrar::streamingDispatcher() const
+{
+    return mPriv->streamingDispatcher;
+}
+
 } // Tp
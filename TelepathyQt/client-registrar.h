@@ -35,17 +35,27 @@
 #include <TelepathyQt/Types>
 
 #include <QDBusConnection>
+#include <QList>
 #include <QString>
 
 namespace Tp
 {
 
+class StreamingDispatcher;
+
 class TP_QT_EXPORT ClientRegistrar : public Object
 {
     Q_OBJECT
     Q_DISABLE_COPY(ClientRegistrar)
 
 public:
+    enum DispatchStage {
+        DispatchStageConnectionOwner,
+        DispatchStageSharedProxies,
+        DispatchStageChannel,
+        DispatchStageDelivery
+    };
+
     static ClientRegistrarPtr create(const QDBusConnection &bus);
     static ClientRegistrarPtr create(
             const AccountFactoryConstPtr &accountFactory =
@@ -78,13 +88,23 @@ public:
     bool unregisterClient(const AbstractClientPtr &client);
     void unregisterClients();
 
+    bool isStreamingDispatchEnabled() const;
+    void setStreamingDispatchEnabled(bool enabled);
+    QList<uint> dispatchLatencyHistogram(DispatchStage stage) const;
+    void resetDispatchLatencyHistograms();
+
 private:
+    friend class ClientHandlerAdaptor;
+    friend class ClientObserverAdaptor;
+
     ClientRegistrar(const QDBusConnection &bus,
             const AccountFactoryConstPtr &accountFactory,
             const ConnectionFactoryConstPtr &connectionFactory,
             const ChannelFactoryConstPtr &channelFactory,
             const ContactFactoryConstPtr &contactFactory);
 
+    TP_QT_NO_EXPORT StreamingDispatcher *streamingDispatcher() const;
+
     struct Private;
     friend struct Private;
     Private *mPriv;
@@ -0,0 +1,351 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "TelepathyQt/config-index-internal.h"
+
+#include "TelepathyQt/debug-internal.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+
+#include <stdio.h>
+
+namespace Tp
+{
+
+namespace
+{
+
+// "TPCI", followed by the format version
+const quint32 indexMagic = 0x54504349;
+const quint32 indexVersion = 1;
+
+qint64 modificationTime(const QFileInfo &fileInfo)
+{
+    return fileInfo.lastModified().toMSecsSinceEpoch();
+}
+
+}
+
+/*
+ * ConfigIndex keeps the parsed contents of the .manager and .profile files, keyed by file name and
+ * validated against the modification time and size of the file, in a binary index under
+ * $XDG_CACHE_HOME. This lets processes skip parsing files that haven't changed since some process
+ * last parsed them, which is the common case on startup.
+ *
+ * The index doesn't know anything about the format of what is stored in it, callers serialize
+ * their parsed data themselves and are expected to fall back to parsing the file when lookup()
+ * fails for any reason.
+ *
+ * The index file is mmapped when loaded, and the entries read from it refer to the mapping rather
+ * than to copies, so only the entries actually looked up are ever paged in. This is safe as the
+ * index is never modified in place: save() writes a new file and renames it over the old one, which
+ * leaves the mapped file untouched.
+ */
+
+struct TP_QT_NO_EXPORT ConfigIndexHolder
+{
+    ConfigIndexHolder()
+        : index(fileName())
+    {
+        index.load();
+    }
+
+    static QString fileName()
+    {
+        QString cacheDir = QString::fromLocal8Bit(qgetenv("XDG_CACHE_HOME"));
+        if (cacheDir.isEmpty()) {
+            cacheDir = QDir::homePath() + QLatin1String("/.cache");
+        }
+        return cacheDir + QLatin1String("/telepathy/qt/config-index");
+    }
+
+    ConfigIndex index;
+};
+
+namespace
+{
+
+struct DataDirsCache
+{
+    QMutex lock;
+    QByteArray xdgDataHomeEnv;
+    QByteArray xdgDataDirsEnv;
+    QHash<QString, QStringList> dirs;
+};
+
+}
+
+Q_GLOBAL_STATIC(ConfigIndexHolder, configIndexHolder)
+Q_GLOBAL_STATIC(DataDirsCache, dataDirsCache)
+
+static void syncConfigIndex()
+{
+    ConfigIndexHolder *holder = configIndexHolder();
+    if (holder) {
+        holder->index.sync();
+    }
+}
+
+/*
+ * Return the index, loading it on first use.
+ *
+ * Insertions are only written back by sync(), which the users of the index call once they are done
+ * loading a batch of files, and which is called one last time when the application exits.
+ */
+ConfigIndex *ConfigIndex::instance()
+{
+    static QBasicAtomicInt postRoutineAdded = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+    ConfigIndex *index = &configIndexHolder()->index;
+    if (postRoutineAdded.testAndSetOrdered(0, 1)) {
+        qAddPostRoutine(syncConfigIndex);
+    }
+    return index;
+}
+
+/*
+ * Return the directories in which to look for files in the telepathy \a subdir, in order of
+ * preference, according to the XDG base directory spec.
+ *
+ * The list is only rebuilt when XDG_DATA_HOME or XDG_DATA_DIRS change.
+ */
+QStringList ConfigIndex::dataDirs(const QString &subdir)
+{
+    DataDirsCache *cache = dataDirsCache();
+    QMutexLocker locker(&cache->lock);
+
+    QByteArray currentDataHomeEnv = qgetenv("XDG_DATA_HOME");
+    QByteArray currentDataDirsEnv = qgetenv("XDG_DATA_DIRS");
+    if (currentDataHomeEnv != cache->xdgDataHomeEnv ||
+            currentDataDirsEnv != cache->xdgDataDirsEnv) {
+        cache->xdgDataHomeEnv = currentDataHomeEnv;
+        cache->xdgDataDirsEnv = currentDataDirsEnv;
+        cache->dirs.clear();
+    }
+
+    QHash<QString, QStringList>::const_iterator i = cache->dirs.constFind(subdir);
+    if (i != cache->dirs.constEnd()) {
+        return *i;
+    }
+
+    QStringList ret;
+
+    QString xdgDataHome = QString::fromLocal8Bit(currentDataHomeEnv);
+    if (xdgDataHome.isEmpty()) {
+        ret << QDir::homePath() + QLatin1String("/.local/share/data/") + subdir + QLatin1Char('/');
+    } else {
+        ret << xdgDataHome + QLatin1Char('/') + subdir + QLatin1Char('/');
+    }
+
+    QString xdgDataDirs = QString::fromLocal8Bit(currentDataDirsEnv);
+    if (xdgDataDirs.isEmpty()) {
+        ret << QLatin1String("/usr/local/share/") + subdir + QLatin1Char('/');
+        ret << QLatin1String("/usr/share/") + subdir + QLatin1Char('/');
+    } else {
+        foreach (const QString &xdgDataDir, xdgDataDirs.split(QLatin1Char(':'))) {
+            ret << xdgDataDir + QLatin1Char('/') + subdir + QLatin1Char('/');
+        }
+    }
+
+    cache->dirs.insert(subdir, ret);
+    return ret;
+}
+
+ConfigIndex::ConfigIndex(const QString &fileName)
+    : mFileName(fileName),
+      mDirty(false),
+      mSaveFailed(false),
+      mHits(0)
+{
+}
+
+ConfigIndex::~ConfigIndex()
+{
+    // Not synced from here, as this runs during static destruction. The post routine added by
+    // instance() saves the index when the application exits.
+}
+
+/*
+ * Set \a data to what was stored for the file described by \a fileInfo, if the file hasn't changed
+ * since then.
+ *
+ * \a data may point into the mapped index file, it stays valid as long as the index, and is copied
+ * as usual if modified.
+ */
+bool ConfigIndex::lookup(const QFileInfo &fileInfo, QByteArray &data)
+{
+    QMutexLocker locker(&mLock);
+    QHash<QString, Entry>::const_iterator i = mEntries.constFind(fileInfo.absoluteFilePath());
+    if (i == mEntries.constEnd()) {
+        return false;
+    }
+
+    if (i->mtime != modificationTime(fileInfo) || i->size != fileInfo.size()) {
+        debug() << "Cached contents of" << fileInfo.absoluteFilePath() << "are out of date";
+        return false;
+    }
+
+    data = i->data;
+    ++mHits;
+    return true;
+}
+
+void ConfigIndex::insert(const QFileInfo &fileInfo, const QByteArray &data)
+{
+    QMutexLocker locker(&mLock);
+    Entry &entry = mEntries[fileInfo.absoluteFilePath()];
+    entry.mtime = modificationTime(fileInfo);
+    entry.size = fileInfo.size();
+    entry.data = data;
+    mDirty = true;
+}
+
+void ConfigIndex::remove(const QString &fileName)
+{
+    QMutexLocker locker(&mLock);
+    if (mEntries.remove(QFileInfo(fileName).absoluteFilePath())) {
+        mDirty = true;
+    }
+}
+
+/*
+ * Write the index back to disk if anything was inserted or removed since it was last loaded or
+ * saved.
+ */
+void ConfigIndex::sync()
+{
+    QMutexLocker locker(&mLock);
+    if (mDirty && !mSaveFailed) {
+        mSaveFailed = !save();
+    }
+}
+
+uint ConfigIndex::hits() const
+{
+    QMutexLocker locker(&mLock);
+    return mHits;
+}
+
+bool ConfigIndex::load()
+{
+    mLoadedFile.setFileName(mFileName);
+    if (!mLoadedFile.open(QIODevice::ReadOnly)) {
+        debug() << "No config index found at" << mFileName;
+        return false;
+    }
+
+    qint64 size = mLoadedFile.size();
+    uchar *mapped = mLoadedFile.map(0, size);
+    if (mapped) {
+        mLoadedContents = QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), size);
+    } else {
+        mLoadedContents = mLoadedFile.readAll();
+        mLoadedFile.close();
+    }
+
+    QDataStream in(mLoadedContents);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    quint32 magic, version, count;
+    in >> magic >> version;
+    if (magic != indexMagic || version != indexVersion) {
+        warning() << "Ignoring config index" << mFileName << "with unknown format version";
+        return false;
+    }
+
+    QHash<QString, Entry> entries;
+    in >> count;
+    entries.reserve(count);
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString fileName;
+        Entry entry;
+        quint32 dataSize;
+        in >> fileName >> entry.mtime >> entry.size >> dataSize;
+
+        // Refer to the data where it is instead of reading it the way QDataStream serializes
+        // QByteArrays, with 0xffffffff being a null one
+        if (dataSize != 0xffffffff) {
+            qint64 pos = in.device()->pos();
+            if (in.skipRawData(dataSize) != (int) dataSize) {
+                in.setStatus(QDataStream::ReadPastEnd);
+                break;
+            }
+            entry.data = QByteArray::fromRawData(mLoadedContents.constData() + pos, dataSize);
+        }
+
+        entries.insert(fileName, entry);
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        warning() << "Ignoring corrupted config index" << mFileName;
+        return false;
+    }
+
+    debug() << "Loaded" << entries.size() << "entries from config index" << mFileName;
+    mEntries = entries;
+    mDirty = false;
+    return true;
+}
+
+bool ConfigIndex::save()
+{
+    QFileInfo fileInfo(mFileName);
+    if (!QDir().mkpath(fileInfo.absolutePath())) {
+        warning() << "Unable to create config index directory" << fileInfo.absolutePath();
+        return false;
+    }
+
+    QTemporaryFile file(mFileName);
+    if (!file.open()) {
+        warning() << "Unable to write config index" << mFileName;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << indexMagic << indexVersion << quint32(mEntries.size());
+    for (QHash<QString, Entry>::const_iterator i = mEntries.constBegin();
+            i != mEntries.constEnd(); ++i) {
+        out << i.key() << i->mtime << i->size << i->data;
+    }
+
+    // rename() replaces the old index atomically, unlike QFile::rename() which refuses to
+    // overwrite it, and leaves the file it was loaded from, which may still be mapped, alone
+    if (!file.flush() || ::rename(QFile::encodeName(file.fileName()).constData(),
+                QFile::encodeName(mFileName).constData()) != 0) {
+        warning() << "Unable to write config index" << mFileName;
+        return false;
+    }
+    file.setAutoRemove(false);
+
+    debug() << "Saved" << mEntries.size() << "entries to config index" << mFileName;
+    mDirty = false;
+    return true;
+}
+
+} // Tp
@@ -0,0 +1,93 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef _TelepathyQt_config_index_internal_h_HEADER_GUARD_
+#define _TelepathyQt_config_index_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Global>
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+class QFileInfo;
+
+namespace Tp
+{
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+class TP_QT_NO_EXPORT ConfigIndex
+{
+    Q_DISABLE_COPY(ConfigIndex)
+
+public:
+    static ConfigIndex *instance();
+
+    static QStringList dataDirs(const QString &subdir);
+
+    ~ConfigIndex();
+
+    bool lookup(const QFileInfo &fileInfo, QByteArray &data);
+    void insert(const QFileInfo &fileInfo, const QByteArray &data);
+    void remove(const QString &fileName);
+    void sync();
+
+    // Number of successful lookups so far, for the tests
+    uint hits() const;
+
+private:
+    friend struct ConfigIndexHolder;
+
+    struct Entry
+    {
+        Entry() : mtime(0), size(0) {}
+
+        qint64 mtime;
+        qint64 size;
+        QByteArray data;
+    };
+
+    ConfigIndex(const QString &fileName);
+
+    bool load();
+    bool save();
+
+    mutable QMutex mLock;
+    QString mFileName;
+    // What the index was loaded from, the data of the entries loaded points into it
+    QFile mLoadedFile;
+    QByteArray mLoadedContents;
+    QHash<QString, Entry> mEntries;
+    bool mDirty;
+    bool mSaveFailed;
+    uint mHits;
+};
+
+#endif // DOXYGEN_SHOULD_SKIP_THIS
+
+} // Tp
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TelepathyQt/connection-manager-registry-internal.h"
+
+#include "TelepathyQt/_gen/connection-manager-registry-internal.moc.hpp"
+
+#include "TelepathyQt/debug-internal.h"
+
+#include <TelepathyQt/ChannelFactory>
+#include <TelepathyQt/ConnectionFactory>
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/ContactFactory>
+
+#include <QCoreApplication>
+#include <QDBusServiceWatcher>
+#include <QMutexLocker>
+#include <QThread>
+
+namespace Tp
+{
+
+/*
+ * ConnectionManagerRegistry shares ConnectionManager objects among the accounts using the same
+ * connection manager, so that its manager file is parsed, or its protocols introspected over D-Bus,
+ * only once rather than once per account.
+ *
+ * The registry only holds weak references, so a ConnectionManager goes away once no account uses
+ * it anymore. Entries are dropped when the connection manager's bus name gets a new owner, as the
+ * new process may support different protocols, except while the ConnectionManager is still being
+ * introspected (which is what activates the service in the first place). Entries whose
+ * ConnectionManager has gone away are pruned, along with their watches, the next time the registry
+ * is asked for a ConnectionManager on the same bus.
+ *
+ * The registry lives in the main thread, which is where its watchers deliver NameOwnerChanged, but
+ * may be used from any thread. A ConnectionManager is only shared within the thread it was created
+ * in.
+ */
+
+Q_GLOBAL_STATIC(ConnectionManagerRegistry, connectionManagerRegistry)
+
+ConnectionManagerRegistry *ConnectionManagerRegistry::instance()
+{
+    return connectionManagerRegistry();
+}
+
+ConnectionManagerRegistry::ConnectionManagerRegistry()
+    : QObject()
+{
+    if (QCoreApplication::instance()) {
+        moveToThread(QCoreApplication::instance()->thread());
+    }
+}
+
+ConnectionManagerRegistry::~ConnectionManagerRegistry()
+{
+}
+
+/*
+ * Return the ConnectionManager for \a name on \a bus, shared with anyone else who asked for it
+ * and is still holding a reference to it. The ConnectionManager is not necessarily ready yet.
+ *
+ * Only the protocol information of the returned object is meant to be used, as it's created with
+ * the default factories for \a bus.
+ */
+ConnectionManagerPtr ConnectionManagerRegistry::connectionManager(const QDBusConnection &bus,
+        const QString &name)
+{
+    QMutexLocker locker(&mLock);
+
+    BusId busId(bus.name(), bus.baseService());
+    Bus &busData = mBuses[busId];
+    QString busName = TP_QT_CONNECTION_MANAGER_BUS_NAME_BASE + name;
+
+    ConnectionManagerPtr cm(busData.managers.value(busName));
+    if (cm && cm->isValid()) {
+        if (cm->thread() == QThread::currentThread()) {
+            debug() << "Sharing ConnectionManager for" << name;
+            return cm;
+        }
+
+        // Don't hand out an object living in another thread, nor replace the shared one
+        return ConnectionManager::create(bus, name,
+                ConnectionFactory::create(bus), ChannelFactory::create(bus),
+                ContactFactory::create());
+    }
+
+    pruneExpired(busData);
+
+    if (!busData.watcher) {
+        // The first request may happen in any thread, but the signals must reach the main thread
+        busData.watcher = new QDBusServiceWatcher();
+        busData.watcher->moveToThread(thread());
+        busData.watcher->setParent(this);
+        busData.watcher->setConnection(bus);
+        busData.watcher->setWatchMode(QDBusServiceWatcher::WatchForOwnerChange);
+        connect(busData.watcher,
+                SIGNAL(serviceOwnerChanged(QString,QString,QString)),
+                SLOT(onServiceOwnerChanged(QString,QString,QString)));
+        mWatchers.insert(busData.watcher, busId);
+    }
+
+    if (!busData.managers.contains(busName)) {
+        busData.watcher->addWatchedService(busName);
+    }
+
+    cm = ConnectionManager::create(bus, name,
+            ConnectionFactory::create(bus), ChannelFactory::create(bus),
+            ContactFactory::create());
+    busData.managers.insert(busName, WeakPtr<ConnectionManager>(cm));
+    return cm;
+}
+
+void ConnectionManagerRegistry::onServiceOwnerChanged(const QString &busName,
+        const QString &oldOwner, const QString &newOwner)
+{
+    Q_UNUSED(oldOwner);
+
+    QMutexLocker locker(&mLock);
+    QDBusServiceWatcher *watcher = qobject_cast<QDBusServiceWatcher *>(sender());
+    if (!mWatchers.contains(watcher) || newOwner.isEmpty()) {
+        // Nothing to invalidate until a (possibly different) process owns the name
+        return;
+    }
+
+    Bus &busData = mBuses[mWatchers.value(watcher)];
+    ConnectionManagerPtr cm(busData.managers.value(busName));
+    if (cm && !cm->isReady()) {
+        return;
+    }
+
+    debug() << "Connection manager" << busName << "got a new owner, dropping it from the registry";
+    busData.managers.remove(busName);
+    watcher->removeWatchedService(busName);
+}
+
+void ConnectionManagerRegistry::pruneExpired(Bus &busData)
+{
+    QHash<QString, WeakPtr<ConnectionManager> >::iterator i = busData.managers.begin();
+    while (i != busData.managers.end()) {
+        if (i.value().isNull()) {
+            busData.watcher->removeWatchedService(i.key());
+            i = busData.managers.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+} // Tp
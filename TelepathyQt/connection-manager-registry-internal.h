@@ -0,0 +1,84 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_connection_manager_registry_internal_h_HEADER_GUARD_
+#define _TelepathyQt_connection_manager_registry_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/ConnectionManager>
+#include <TelepathyQt/Global>
+#include <TelepathyQt/SharedPtr>
+
+#include <QDBusConnection>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QString>
+
+class QDBusServiceWatcher;
+
+namespace Tp
+{
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+class TP_QT_NO_EXPORT ConnectionManagerRegistry : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ConnectionManagerRegistry)
+
+public:
+    static ConnectionManagerRegistry *instance();
+
+    ConnectionManagerRegistry();
+    ~ConnectionManagerRegistry();
+
+    ConnectionManagerPtr connectionManager(const QDBusConnection &bus, const QString &name);
+
+private Q_SLOTS:
+    void onServiceOwnerChanged(const QString &busName, const QString &oldOwner,
+            const QString &newOwner);
+
+private:
+    typedef QPair<QString, QString> BusId;
+
+    struct Bus
+    {
+        Bus() : watcher(0) {}
+
+        QDBusServiceWatcher *watcher;
+        QHash<QString /* busName */, WeakPtr<ConnectionManager> > managers;
+    };
+
+    void pruneExpired(Bus &busData);
+
+    // Guards the members below, as accounts may be made ready in any thread while the watchers
+    // deliver their signals to the main thread
+    QMutex mLock;
+    QHash<BusId, Bus> mBuses;
+    QHash<QDBusServiceWatcher *, BusId> mWatchers;
+};
+
+#endif // DOXYGEN_SHOULD_SKIP_THIS
+
+} // Tp
+
+#endif
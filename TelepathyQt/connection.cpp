@@ -180,6 +180,31 @@ struct TP_QT_NO_EXPORT Connection::Private::HandleContext
               releaseScheduled(false)
         {
         }
+
+        void ref(uint handle)
+        {
+            uint &count = refcounts[handle];
+            // Only a handle seen for the first time or which lost its last reference can be in
+            // toRelease, so skip the lookup there for the common case of adding a reference
+            if (!count++ && !toRelease.isEmpty()) {
+                toRelease.remove(handle);
+            }
+        }
+
+        // Returns true if this was the last reference to the handle
+        bool unref(uint handle)
+        {
+            QHash<uint, uint>::iterator i = refcounts.find(handle);
+            Q_ASSERT(i != refcounts.end());
+
+            if (--i.value()) {
+                return false;
+            }
+
+            refcounts.erase(i);
+            toRelease.insert(handle);
+            return true;
+        }
     };
 
     HandleContext()
@@ -187,9 +212,16 @@ struct TP_QT_NO_EXPORT Connection::Private::HandleContext
     {
     }
 
+    Type &type(uint handleType)
+    {
+        Q_ASSERT(handleType < (uint) NUM_HANDLE_TYPES);
+        return types[handleType];
+    }
+
     int refcount;
     QMutex lock;
-    QHash<uint, Type> types;
+    // Indexed by handle type, so no lookup is needed to get to the refcounts
+    Type types[NUM_HANDLE_TYPES];
 };
 
 Connection::Private::Private(Connection *parent,
@@ -341,8 +373,8 @@ Connection::Private::~Private()
         if (!immortalHandles) {
             debug() << "Destroying HandleContext";
 
-            foreach (uint handleType, handleContext->types.keys()) {
-                HandleContext::Type type = handleContext->types[handleType];
+            for (uint handleType = 0; handleType < (uint) NUM_HANDLE_TYPES; ++handleType) {
+                const HandleContext::Type &type = handleContext->types[handleType];
 
                 if (!type.refcounts.empty()) {
                     debug() << " Still had references to" <<
@@ -1987,11 +2019,17 @@ PendingHandles *ConnectionLowlevel::requestHandles(HandleType handleType, const
                 QLatin1String("The connection has been destroyed"));
     }
 
+    if ((uint) handleType >= (uint) NUM_HANDLE_TYPES) {
+        warning() << "Invalid handle type" << handleType;
+        return new PendingHandles(TP_QT_ERROR_INVALID_ARGUMENT,
+                QLatin1String("Invalid handle type"));
+    }
+
     ConnectionPtr conn(connection());
     if (!hasImmortalHandles()) {
         Connection::Private::HandleContext *handleContext = conn->mPriv->handleContext;
         QMutexLocker locker(&handleContext->lock);
-        handleContext->types[handleType].requestsInFlight++;
+        handleContext->type(handleType).requestsInFlight++;
     }
 
     PendingHandles *pending =
@@ -2039,16 +2077,23 @@ PendingHandles *ConnectionLowlevel::referenceHandles(HandleType handleType, cons
                 QLatin1String("The connection has been destroyed"));
     }
 
+    if ((uint) handleType >= (uint) NUM_HANDLE_TYPES) {
+        warning() << "Invalid handle type" << handleType;
+        return new PendingHandles(TP_QT_ERROR_INVALID_ARGUMENT,
+                QLatin1String("Invalid handle type"));
+    }
+
     ConnectionPtr conn(connection());
     UIntList alreadyHeld;
     UIntList notYetHeld;
     if (!hasImmortalHandles()) {
         Connection::Private::HandleContext *handleContext = conn->mPriv->handleContext;
         QMutexLocker locker(&handleContext->lock);
+        const Connection::Private::HandleContext::Type &type =
+            handleContext->type(handleType);
 
         foreach (uint handle, handles) {
-            if (handleContext->types[handleType].refcounts.contains(handle) ||
-                handleContext->types[handleType].toRelease.contains(handle)) {
+            if (type.refcounts.contains(handle) || type.toRelease.contains(handle)) {
                 alreadyHeld.push_back(handle);
             }
             else {
@@ -2195,7 +2240,7 @@ PendingContactAttributes *ConnectionLowlevel::contactAttributes(const UIntList &
     if (!hasImmortalHandles()) {
         Connection::Private::HandleContext *handleContext = conn->mPriv->handleContext;
         QMutexLocker locker(&handleContext->lock);
-        handleContext->types[HandleTypeContact].requestsInFlight++;
+        handleContext->type(HandleTypeContact).requestsInFlight++;
     }
 
     Client::ConnectionInterfaceContactsInterface *contactsInterface =
@@ -2310,11 +2355,22 @@ void Connection::refHandle(HandleType handleType, uint handle)
     Private::HandleContext *handleContext = mPriv->handleContext;
     QMutexLocker locker(&handleContext->lock);
 
-    if (handleContext->types[handleType].toRelease.contains(handle)) {
-        handleContext->types[handleType].toRelease.remove(handle);
+    handleContext->type(handleType).ref(handle);
+}
+
+void Connection::refHandles(HandleType handleType, const UIntList &handles)
+{
+    if (mPriv->immortalHandles || handles.isEmpty()) {
+        return;
     }
 
-    handleContext->types[handleType].refcounts[handle]++;
+    Private::HandleContext *handleContext = mPriv->handleContext;
+    QMutexLocker locker(&handleContext->lock);
+
+    Private::HandleContext::Type &type = handleContext->type(handleType);
+    for (UIntList::const_iterator i = handles.constBegin(); i != handles.constEnd(); ++i) {
+        type.ref(*i);
+    }
 }
 
 void Connection::unrefHandle(HandleType handleType, uint handle)
@@ -2326,24 +2382,46 @@ void Connection::unrefHandle(HandleType handleType, uint handle)
     Private::HandleContext *handleContext = mPriv->handleContext;
     QMutexLocker locker(&handleContext->lock);
 
-    Q_ASSERT(handleContext->types.contains(handleType));
-    Q_ASSERT(handleContext->types[handleType].refcounts.contains(handle));
-
-    if (!--handleContext->types[handleType].refcounts[handle]) {
-        handleContext->types[handleType].refcounts.remove(handle);
-        handleContext->types[handleType].toRelease.insert(handle);
-
-        if (!handleContext->types[handleType].releaseScheduled) {
-            if (!handleContext->types[handleType].requestsInFlight) {
-                debug() << "Lost last reference to at least one handle of type" <<
-                    handleType <<
-                    "and no requests in flight for that type - scheduling a release sweep";
-                QMetaObject::invokeMethod(this, "doReleaseSweep",
-                        Qt::QueuedConnection, Q_ARG(uint, handleType));
-                handleContext->types[handleType].releaseScheduled = true;
-            }
+    if (handleContext->type(handleType).unref(handle)) {
+        scheduleReleaseSweep(handleType);
+    }
+}
+
+void Connection::unrefHandles(HandleType handleType, const UIntList &handles)
+{
+    if (mPriv->immortalHandles || handles.isEmpty()) {
+        return;
+    }
+
+    Private::HandleContext *handleContext = mPriv->handleContext;
+    QMutexLocker locker(&handleContext->lock);
+
+    Private::HandleContext::Type &type = handleContext->type(handleType);
+    bool lostLastReference = false;
+    for (UIntList::const_iterator i = handles.constBegin(); i != handles.constEnd(); ++i) {
+        if (type.unref(*i)) {
+            lostLastReference = true;
         }
     }
+
+    if (lostLastReference) {
+        scheduleReleaseSweep(handleType);
+    }
+}
+
+// Must be called with the handle context lock held
+void Connection::scheduleReleaseSweep(HandleType handleType)
+{
+    Private::HandleContext::Type &type = mPriv->handleContext->type(handleType);
+
+    if (!type.releaseScheduled && !type.requestsInFlight) {
+        debug() << "Lost last reference to at least one handle of type" <<
+            handleType <<
+            "and no requests in flight for that type - scheduling a release sweep";
+        QMetaObject::invokeMethod(this, "doReleaseSweep",
+                Qt::QueuedConnection, Q_ARG(uint, handleType));
+        type.releaseScheduled = true;
+    }
 }
 
 void Connection::doReleaseSweep(uint handleType)
@@ -2355,26 +2433,26 @@ void Connection::doReleaseSweep(uint handleType)
     Private::HandleContext *handleContext = mPriv->handleContext;
     QMutexLocker locker(&handleContext->lock);
 
-    Q_ASSERT(handleContext->types.contains(handleType));
-    Q_ASSERT(handleContext->types[handleType].releaseScheduled);
+    Private::HandleContext::Type &type = handleContext->type(handleType);
+    Q_ASSERT(type.releaseScheduled);
 
     debug() << "Entering handle release sweep for type" << handleType;
-    handleContext->types[handleType].releaseScheduled = false;
+    type.releaseScheduled = false;
 
-    if (handleContext->types[handleType].requestsInFlight > 0) {
+    if (type.requestsInFlight > 0) {
         debug() << " There are requests in flight, deferring sweep to when they have been completed";
         return;
     }
 
-    if (handleContext->types[handleType].toRelease.isEmpty()) {
+    if (type.toRelease.isEmpty()) {
         debug() << " No handles to release - every one has been resurrected";
         return;
     }
 
-    debug() << " Releasing" << handleContext->types[handleType].toRelease.size() << "handles";
+    debug() << " Releasing" << type.toRelease.size() << "handles";
 
-    mPriv->baseInterface->ReleaseHandles(handleType, handleContext->types[handleType].toRelease.toList());
-    handleContext->types[handleType].toRelease.clear();
+    mPriv->baseInterface->ReleaseHandles(handleType, type.toRelease.toList());
+    type.toRelease.clear();
 }
 
 void Connection::handleRequestLanded(HandleType handleType)
@@ -2386,16 +2464,16 @@ void Connection::handleRequestLanded(HandleType handleType)
     Private::HandleContext *handleContext = mPriv->handleContext;
     QMutexLocker locker(&handleContext->lock);
 
-    Q_ASSERT(handleContext->types.contains(handleType));
-    Q_ASSERT(handleContext->types[handleType].requestsInFlight > 0);
+    Private::HandleContext::Type &type = handleContext->type(handleType);
+    Q_ASSERT(type.requestsInFlight > 0);
 
-    if (!--handleContext->types[handleType].requestsInFlight &&
-        !handleContext->types[handleType].toRelease.isEmpty() &&
-        !handleContext->types[handleType].releaseScheduled) {
+    if (!--type.requestsInFlight &&
+        !type.toRelease.isEmpty() &&
+        !type.releaseScheduled) {
         debug() << "All handle requests for type" << handleType <<
             "landed and there are handles of that type to release - scheduling a release sweep";
         QMetaObject::invokeMethod(this, "doReleaseSweep", Qt::QueuedConnection, Q_ARG(uint, handleType));
-        handleContext->types[handleType].releaseScheduled = true;
+        type.releaseScheduled = true;
     }
 }
 
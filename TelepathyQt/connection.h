@@ -234,7 +234,10 @@ private:
     friend class ReferencedHandles;
 
     TP_QT_NO_EXPORT void refHandle(HandleType handleType, uint handle);
+    TP_QT_NO_EXPORT void refHandles(HandleType handleType, const UIntList &handles);
     TP_QT_NO_EXPORT void unrefHandle(HandleType handleType, uint handle);
+    TP_QT_NO_EXPORT void unrefHandles(HandleType handleType, const UIntList &handles);
+    TP_QT_NO_EXPORT void scheduleReleaseSweep(HandleType handleType);
     TP_QT_NO_EXPORT void handleRequestLanded(HandleType handleType);
 
     struct Private;
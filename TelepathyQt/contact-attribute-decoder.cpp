@@ -0,0 +1,167 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TelepathyQt/contact-attribute-decoder.h"
+
+#include <TelepathyQt/Constants>
+
+namespace Tp
+{
+
+namespace
+{
+
+QString attributeInterface(ContactAttributeDecoder::Attribute attribute)
+{
+    switch (attribute) {
+        case ContactAttributeDecoder::ContactId:
+            return TP_QT_IFACE_CONNECTION;
+        case ContactAttributeDecoder::Subscribe:
+        case ContactAttributeDecoder::Publish:
+        case ContactAttributeDecoder::PublishRequest:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST;
+        case ContactAttributeDecoder::Alias:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING;
+        case ContactAttributeDecoder::AvatarToken:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS;
+        case ContactAttributeDecoder::Capabilities:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_CAPABILITIES;
+        case ContactAttributeDecoder::Info:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_INFO;
+        case ContactAttributeDecoder::Location:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_LOCATION;
+        case ContactAttributeDecoder::Presence:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE;
+        case ContactAttributeDecoder::Groups:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS;
+        case ContactAttributeDecoder::Addresses:
+        case ContactAttributeDecoder::Uris:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_ADDRESSING;
+        case ContactAttributeDecoder::ClientTypes:
+            return TP_QT_IFACE_CONNECTION_INTERFACE_CLIENT_TYPES;
+        default:
+            Q_ASSERT(false);
+            return QString();
+    }
+}
+
+const char *attributeSuffix(ContactAttributeDecoder::Attribute attribute)
+{
+    switch (attribute) {
+        case ContactAttributeDecoder::ContactId:
+            return "/contact-id";
+        case ContactAttributeDecoder::Subscribe:
+            return "/subscribe";
+        case ContactAttributeDecoder::Publish:
+            return "/publish";
+        case ContactAttributeDecoder::PublishRequest:
+            return "/publish-request";
+        case ContactAttributeDecoder::Alias:
+            return "/alias";
+        case ContactAttributeDecoder::AvatarToken:
+            return "/token";
+        case ContactAttributeDecoder::Capabilities:
+            return "/capabilities";
+        case ContactAttributeDecoder::Info:
+            return "/info";
+        case ContactAttributeDecoder::Location:
+            return "/location";
+        case ContactAttributeDecoder::Presence:
+            return "/presence";
+        case ContactAttributeDecoder::Groups:
+            return "/groups";
+        case ContactAttributeDecoder::Addresses:
+            return "/addresses";
+        case ContactAttributeDecoder::Uris:
+            return "/uris";
+        case ContactAttributeDecoder::ClientTypes:
+            return "/client-types";
+        default:
+            Q_ASSERT(false);
+            return "";
+    }
+}
+
+}
+
+ContactAttributeDecoder::Result::Result()
+{
+    for (int i = 0; i < NumAttributes; ++i) {
+        mValues[i] = 0;
+    }
+}
+
+/**
+ * Construct a decoder recognizing the attributes of all the interfaces known to Contact.
+ */
+ContactAttributeDecoder::ContactAttributeDecoder()
+{
+    for (int i = 0; i < NumAttributes; ++i) {
+        addAttribute((Attribute) i);
+    }
+}
+
+/**
+ * Construct a decoder recognizing only the attributes of the given \a interfaces, usually the
+ * ContactAttributeInterfaces of a connection.
+ *
+ * The contact identifier is always recognized, as it is part of every attributes map.
+ */
+ContactAttributeDecoder::ContactAttributeDecoder(const QStringList &interfaces)
+    : mInterfaces(interfaces)
+{
+    for (int i = 0; i < NumAttributes; ++i) {
+        Attribute attribute = (Attribute) i;
+        if (attribute == ContactId || interfaces.contains(attributeInterface(attribute))) {
+            addAttribute(attribute);
+        }
+    }
+}
+
+/**
+ * Look up all the recognized attributes in \a attributes in a single pass, storing pointers to
+ * their values in \a result.
+ *
+ * The values are not copied, so \a attributes must not be modified or destroyed while
+ * \a result is in use.
+ */
+void ContactAttributeDecoder::decode(const QVariantMap &attributes, Result &result) const
+{
+    for (QVariantMap::const_iterator i = attributes.constBegin();
+            i != attributes.constEnd(); ++i) {
+        QHash<QString, Attribute>::const_iterator attribute = mAttributes.constFind(i.key());
+        if (attribute != mAttributes.constEnd()) {
+            result.mValues[attribute.value()] = &i.value();
+        }
+    }
+}
+
+QString ContactAttributeDecoder::attributeName(Attribute attribute)
+{
+    return attributeInterface(attribute) + QLatin1String(attributeSuffix(attribute));
+}
+
+void ContactAttributeDecoder::addAttribute(Attribute attribute)
+{
+    mAttributes.insert(attributeName(attribute), attribute);
+}
+
+} // Tp
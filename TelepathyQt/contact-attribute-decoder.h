@@ -0,0 +1,93 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_contact_attribute_decoder_h_HEADER_GUARD_
+#define _TelepathyQt_contact_attribute_decoder_h_HEADER_GUARD_
+
+#include <TelepathyQt/Global>
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+namespace Tp
+{
+
+class TP_QT_NO_EXPORT ContactAttributeDecoder
+{
+public:
+    enum Attribute {
+        ContactId = 0,
+        Subscribe,
+        Publish,
+        PublishRequest,
+        Alias,
+        AvatarToken,
+        Capabilities,
+        Info,
+        Location,
+        Presence,
+        Groups,
+        Addresses,
+        Uris,
+        ClientTypes,
+        NumAttributes
+    };
+
+    class Result
+    {
+    public:
+        Result();
+
+        bool contains(Attribute attribute) const { return mValues[attribute] != 0; }
+        const QVariant *value(Attribute attribute) const { return mValues[attribute]; }
+
+    private:
+        friend class ContactAttributeDecoder;
+
+        // Points into the decoded map, which must outlive the result
+        const QVariant *mValues[NumAttributes];
+    };
+
+    ContactAttributeDecoder();
+    ContactAttributeDecoder(const QStringList &interfaces);
+
+    QStringList interfaces() const { return mInterfaces; }
+
+    void decode(const QVariantMap &attributes, Result &result) const;
+
+    static QString attributeName(Attribute attribute);
+
+private:
+    void addAttribute(Attribute attribute);
+
+    QStringList mInterfaces;
+    QHash<QString, Attribute> mAttributes;
+};
+
+} // Tp
+
+#endif /* DOXYGEN_SHOULD_SKIP_THIS */
+
+#endif
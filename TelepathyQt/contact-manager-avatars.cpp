@@ -0,0 +1,451 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TelepathyQt/contact-manager-internal.h"
+
+#include "TelepathyQt/debug-internal.h"
+
+#include <TelepathyQt/Utils>
+
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTemporaryFile>
+#include <QThread>
+
+#include <stdio.h>
+
+namespace Tp
+{
+
+namespace
+{
+
+// Maximum number of avatars whose location is remembered in memory
+const int maxCachedAvatars = 1000;
+
+// The mime types index is rewritten when it's read and has at least that many lines, more than
+// half of which are superseded
+const int minLinesToCompact = 64;
+
+QString mimeTypesFileName(const QString &path)
+{
+    return path + QLatin1String("/mime-types");
+}
+
+QBasicAtomicInt nextStoreId = Q_BASIC_ATOMIC_INITIALIZER(1);
+
+// The worker doing the disk I/O for all the avatar stores of the process, in a thread of its own
+struct SharedAvatarWorker
+{
+    SharedAvatarWorker()
+        : worker(0)
+    {
+    }
+
+    ~SharedAvatarWorker()
+    {
+        stop();
+        delete worker;
+    }
+
+    void stop()
+    {
+        // Let the worker finish the requests already queued, then stop
+        if (thread.isRunning()) {
+            QMetaObject::invokeMethod(worker, "finish", Qt::QueuedConnection);
+            thread.wait();
+        }
+    }
+
+    QMutex lock;
+    QThread thread;
+    QObject *worker;
+};
+
+Q_GLOBAL_STATIC(SharedAvatarWorker, sharedAvatarWorker)
+
+void stopSharedAvatarWorker()
+{
+    SharedAvatarWorker *shared = sharedAvatarWorker();
+    if (shared) {
+        QMutexLocker locker(&shared->lock);
+        shared->stop();
+    }
+}
+
+}
+
+/**
+ * \class ContactManager::AvatarStore
+ * \internal
+ *
+ * Keeps track of the avatars cached on disk for a ContactManager.
+ *
+ * The location and mime type of the most recently used avatars are kept in memory, everything else
+ * is looked up and written by a worker thread shared by all the stores of the process, so the
+ * filesystem is never touched from the thread the ContactManager lives in. Requests still queued
+ * when a store is deleted are carried out all the same, and the worker finishes whatever is left
+ * when the application exits.
+ *
+ * Avatars are stored in per connection manager and protocol directories, named after their
+ * escaped token. The mime types of all the avatars in a directory are kept in a single index file
+ * in it, to which a line consisting of the escaped token and the mime type is appended whenever
+ * an avatar is stored. When reading it shows that most of its lines are superseded, the index is
+ * rewritten with only the entries of the avatars still present. The mime type of each avatar is
+ * also written to a file next to it, which is where older versions look for it.
+ */
+
+ContactManager::AvatarStore::AvatarStore(QObject *parent)
+    : QObject(parent),
+      mId(nextStoreId.fetchAndAddOrdered(1)),
+      mWorker(sharedWorker()),
+      mAvatars(maxCachedAvatars)
+{
+    connect(mWorker,
+            SIGNAL(probed(uint,QString,QStringList,QStringList,QStringList)),
+            SLOT(onProbed(uint,QString,QStringList,QStringList,QStringList)));
+    connect(mWorker,
+            SIGNAL(stored(uint,QString,QString,QString,bool)),
+            SLOT(onStored(uint,QString,QString,QString,bool)));
+}
+
+ContactManager::AvatarStore::~AvatarStore()
+{
+}
+
+/*
+ * Return the worker shared by all the stores, starting it on first use. Its thread is stopped
+ * while the application is still around rather than during static destruction.
+ */
+ContactManager::AvatarStore::Worker *ContactManager::AvatarStore::sharedWorker()
+{
+    SharedAvatarWorker *shared = sharedAvatarWorker();
+    QMutexLocker locker(&shared->lock);
+    if (!shared->worker) {
+        Worker *worker = new Worker;
+        worker->moveToThread(&shared->thread);
+        shared->worker = worker;
+        shared->thread.start();
+        qAddPostRoutine(stopSharedAvatarWorker);
+    }
+    return static_cast<Worker *>(shared->worker);
+}
+
+QString ContactManager::AvatarStore::avatarFileName(const QString &path, const QString &token)
+{
+    return QString(QLatin1String("%1/%2")).arg(path).arg(escapeAsIdentifier(token));
+}
+
+/**
+ * Look up the avatar identified by \a token in \a path among the ones recently probed or stored,
+ * without touching the filesystem.
+ */
+bool ContactManager::AvatarStore::lookup(const QString &path, const QString &token,
+        AvatarData *avatar) const
+{
+    AvatarData *cached = mAvatars.object(avatarFileName(path, token));
+    if (!cached) {
+        return false;
+    }
+
+    *avatar = *cached;
+    return true;
+}
+
+/**
+ * Check which of the avatars identified by \a tokens are already present in \a path. probed()
+ * will be emitted once done.
+ */
+void ContactManager::AvatarStore::probe(const QString &path, const QStringList &tokens)
+{
+    QMetaObject::invokeMethod(mWorker, "probe", Qt::QueuedConnection,
+            Q_ARG(uint, mId), Q_ARG(QString, path), Q_ARG(QStringList, tokens));
+}
+
+/**
+ * Write the avatar identified by \a token to \a path, unless it is there already. stored() will be
+ * emitted once done.
+ */
+void ContactManager::AvatarStore::store(const QString &path, const QString &token,
+        const QByteArray &data, const QString &mimeType)
+{
+    QMetaObject::invokeMethod(mWorker, "store", Qt::QueuedConnection,
+            Q_ARG(uint, mId), Q_ARG(QString, path), Q_ARG(QString, token),
+            Q_ARG(QByteArray, data), Q_ARG(QString, mimeType));
+}
+
+void ContactManager::AvatarStore::onProbed(uint storeId, const QString &path,
+        const QStringList &tokens, const QStringList &mimeTypes,
+        const QStringList &missingTokens)
+{
+    if (storeId != mId) {
+        return;
+    }
+
+    for (int i = 0; i < tokens.size(); ++i) {
+        QString fileName = avatarFileName(path, tokens[i]);
+        mAvatars.insert(fileName, new AvatarData(fileName, mimeTypes[i]));
+    }
+
+    emit probed(path, tokens, mimeTypes, missingTokens);
+}
+
+void ContactManager::AvatarStore::onStored(uint storeId, const QString &path,
+        const QString &token, const QString &mimeType, bool success)
+{
+    if (storeId != mId) {
+        return;
+    }
+
+    if (success) {
+        QString fileName = avatarFileName(path, token);
+        mAvatars.insert(fileName, new AvatarData(fileName, mimeType));
+    }
+
+    emit stored(path, token, mimeType, success);
+}
+
+ContactManager::AvatarStore::Worker::Worker()
+    : QObject(0)
+{
+}
+
+ContactManager::AvatarStore::Worker::~Worker()
+{
+}
+
+void ContactManager::AvatarStore::Worker::finish()
+{
+    thread()->quit();
+}
+
+void ContactManager::AvatarStore::Worker::probe(uint storeId, const QString &path,
+        const QStringList &tokens)
+{
+    QStringList foundTokens;
+    QStringList foundMimeTypes;
+    QStringList missingTokens;
+    bool reloaded = false;
+
+    foreach (const QString &token, tokens) {
+        QString fileName = avatarFileName(path, token);
+        if (!QFile::exists(fileName)) {
+            missingTokens << token;
+            continue;
+        }
+
+        QString escapedToken = escapeAsIdentifier(token);
+        if (!mimeTypes(path).contains(escapedToken) && !reloaded) {
+            // Someone else may have stored it since the index was read
+            mimeTypes(path, true);
+            reloaded = true;
+        }
+
+        QHash<QString, QString> &index = mimeTypes(path);
+        if (!index.contains(escapedToken)) {
+            // Avatars cached by older versions have their mime type in a file next to them
+            QFile mimeTypeFile(fileName + QLatin1String(".mime"));
+            QString mimeType;
+            if (mimeTypeFile.open(QIODevice::ReadOnly)) {
+                mimeType = QString(QLatin1String(mimeTypeFile.readAll()));
+                mimeTypeFile.close();
+            }
+            addMimeType(path, token, mimeType);
+        }
+
+        foundTokens << token;
+        foundMimeTypes << index.value(escapedToken);
+    }
+
+    emit probed(storeId, path, foundTokens, foundMimeTypes, missingTokens);
+}
+
+void ContactManager::AvatarStore::Worker::store(uint storeId, const QString &path,
+        const QString &token, const QByteArray &data, const QString &mimeType)
+{
+    QString fileName = avatarFileName(path, token);
+
+    if (!QDir().mkpath(path)) {
+        warning() << "Unable to create avatar cache directory" << path;
+        emit stored(storeId, path, token, mimeType, false);
+        return;
+    }
+
+    debug() << "Write avatar in cache:" << fileName << "MimeType:" << mimeType;
+
+    // Older versions only read the mime type from there, and expect it once the avatar exists
+    QString mimeTypeFileName = fileName + QLatin1String(".mime");
+    if (!QFile::exists(mimeTypeFileName)) {
+        QTemporaryFile mimeTypeFile(mimeTypeFileName);
+        if (mimeTypeFile.open()) {
+            mimeTypeFile.write(mimeType.toLatin1());
+            mimeTypeFile.setAutoRemove(false);
+            if (!mimeTypeFile.rename(mimeTypeFileName)) {
+                mimeTypeFile.remove();
+            }
+        }
+    }
+
+    if (!QFile::exists(fileName)) {
+        QTemporaryFile avatarFile(fileName);
+        if (avatarFile.open()) {
+            avatarFile.write(data);
+            avatarFile.setAutoRemove(false);
+            if (!avatarFile.rename(fileName)) {
+                avatarFile.remove();
+            }
+        }
+    }
+
+    if (!QFile::exists(fileName)) {
+        warning() << "Unable to write avatar" << fileName;
+        emit stored(storeId, path, token, mimeType, false);
+        return;
+    }
+
+    if (mimeTypes(path).value(escapeAsIdentifier(token)) != mimeType) {
+        addMimeType(path, token, mimeType);
+    }
+
+    emit stored(storeId, path, token, mimeType, true);
+}
+
+QHash<QString, QString> &ContactManager::AvatarStore::Worker::mimeTypes(const QString &path,
+        bool reload)
+{
+    if (!reload && mMimeTypes.contains(path)) {
+        return mMimeTypes[path];
+    }
+
+    QHash<QString, QString> &index = mMimeTypes[path];
+    index.clear();
+
+    QFile file(mimeTypesFileName(path));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return index;
+    }
+
+    // Later lines take precedence, entries are only ever appended
+    int lines = 0;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine().trimmed();
+        ++lines;
+        int separator = line.indexOf(' ');
+        if (separator <= 0) {
+            continue;
+        }
+        index.insert(QString::fromLatin1(line.left(separator)),
+                QString::fromLatin1(line.mid(separator + 1)));
+    }
+    qint64 readSize = file.pos();
+    file.close();
+
+    if (lines >= minLinesToCompact && lines > 2 * index.size()) {
+        compact(path, index, readSize);
+    }
+
+    return index;
+}
+
+/*
+ * Rewrite the index of \a path with only the entries of \a index whose avatar is still present.
+ * \a readSize is how much of the index \a index was read from, anything appended after that is
+ * kept as well.
+ */
+void ContactManager::AvatarStore::Worker::compact(const QString &path,
+        QHash<QString, QString> &index, qint64 readSize)
+{
+    QHash<QString, QString>::iterator i = index.begin();
+    while (i != index.end()) {
+        if (!QFile::exists(QString(QLatin1String("%1/%2")).arg(path).arg(i.key()))) {
+            i = index.erase(i);
+            continue;
+        }
+        ++i;
+    }
+
+    QString fileName = mimeTypesFileName(path);
+    QTemporaryFile file(fileName);
+    if (!file.open()) {
+        warning() << "Unable to compact avatar mime types index" << fileName;
+        return;
+    }
+
+    for (i = index.begin(); i != index.end(); ++i) {
+        file.write(i.key().toLatin1() + ' ' + i.value().toLatin1() + '\n');
+    }
+
+    // Carry over what was appended since the index was read, as late as possible. Lines appended
+    // between this and the rename below are still lost, which only costs their avatars the mime
+    // type in the index until they're stored again.
+    QFile current(fileName);
+    if (current.open(QIODevice::ReadOnly) && current.seek(readSize)) {
+        QByteArray appended = current.readAll();
+        file.write(appended);
+
+        foreach (const QByteArray &rawLine, appended.split('\n')) {
+            QByteArray line = rawLine.trimmed();
+            int separator = line.indexOf(' ');
+            if (separator > 0) {
+                index.insert(QString::fromLatin1(line.left(separator)),
+                        QString::fromLatin1(line.mid(separator + 1)));
+            }
+        }
+    }
+    current.close();
+
+    if (!file.flush()) {
+        warning() << "Unable to compact avatar mime types index" << fileName;
+        return;
+    }
+
+    debug() << "Compacting avatar mime types index in" << path << "to" << index.size() <<
+        "entries";
+
+    // rename() replaces the old index atomically, unlike QFile::rename() which refuses to
+    // overwrite it, so readers always find either the old or the new one
+    if (::rename(QFile::encodeName(file.fileName()).constData(),
+                QFile::encodeName(fileName).constData()) == 0) {
+        file.setAutoRemove(false);
+    } else {
+        warning() << "Unable to compact avatar mime types index" << fileName;
+    }
+}
+
+void ContactManager::AvatarStore::Worker::addMimeType(const QString &path, const QString &token,
+        const QString &mimeType)
+{
+    QString escapedToken = escapeAsIdentifier(token);
+    mimeTypes(path).insert(escapedToken, mimeType);
+
+    // A single small append is atomic, so concurrent writers never interleave their lines
+    QFile file(mimeTypesFileName(path));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        warning() << "Unable to update avatar mime types index" << file.fileName();
+        return;
+    }
+    file.write(escapedToken.toLatin1() + ' ' + mimeType.toLatin1() + '\n');
+    file.close();
+}
+
+} // Tp
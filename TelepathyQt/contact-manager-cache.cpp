@@ -0,0 +1,283 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TelepathyQt/contact-manager-internal.h"
+
+#include "TelepathyQt/debug-internal.h"
+
+#include <TelepathyQt/Contact>
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+
+namespace Tp
+{
+
+namespace
+{
+
+// "TPCC", followed by the format version
+const quint32 cacheMagic = 0x54504343;
+const quint32 cacheVersion = 1;
+
+QString capabilitiesAttribute()
+{
+    return TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_CAPABILITIES + QLatin1String("/capabilities");
+}
+
+QString locationAttribute()
+{
+    return TP_QT_IFACE_CONNECTION_INTERFACE_LOCATION + QLatin1String("/location");
+}
+
+QString clientTypesAttribute()
+{
+    return TP_QT_IFACE_CONNECTION_INTERFACE_CLIENT_TYPES + QLatin1String("/client-types");
+}
+
+// Only values QDataStream knows how to write are kept, D-Bus specific types are not
+bool isStorable(const QVariant &value)
+{
+    if (value.userType() == QVariant::Map) {
+        foreach (const QVariant &v, value.toMap()) {
+            if (!isStorable(v)) {
+                return false;
+            }
+        }
+        return true;
+    } else if (value.userType() == QVariant::List) {
+        foreach (const QVariant &v, value.toList()) {
+            if (!isStorable(v)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    return value.isValid() && value.userType() < QMetaType::User;
+}
+
+}
+
+ContactManager::AttributeCache::AttributeCache(const QString &fileName)
+    : mFileName(fileName),
+      mDirty(false)
+{
+}
+
+ContactManager::AttributeCache::~AttributeCache()
+{
+    if (mDirty) {
+        save();
+    }
+}
+
+/**
+ * Return the contact features whose attributes are kept in the cache.
+ *
+ * Presence and the like change too often for a persisted value to be of any use, so only
+ * attributes that are expected to be the same across reconnections are cached.
+ */
+Features ContactManager::AttributeCache::features()
+{
+    return Features() << Contact::FeatureAlias
+        << Contact::FeatureAvatarToken
+        << Contact::FeatureCapabilities
+        << Contact::FeatureLocation
+        << Contact::FeatureClientTypes;
+}
+
+QStringList ContactManager::AttributeCache::attributeNames()
+{
+    return QStringList() << TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING + QLatin1String("/alias")
+        << TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token")
+        << capabilitiesAttribute()
+        << locationAttribute()
+        << clientTypesAttribute();
+}
+
+bool ContactManager::AttributeCache::load()
+{
+    QFile file(mFileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        debug() << "No contact attribute cache found at" << mFileName;
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != cacheMagic || version != cacheVersion) {
+        warning() << "Ignoring contact attribute cache" << mFileName <<
+            "with unknown format version";
+        return false;
+    }
+
+    QHash<QString, QVariantMap> entries;
+    in >> entries;
+    if (in.status() != QDataStream::Ok) {
+        warning() << "Ignoring corrupted contact attribute cache" << mFileName;
+        return false;
+    }
+
+    debug() << "Loaded cached attributes for" << entries.size() << "contacts from" << mFileName;
+    mEntries = entries;
+    mDirty = false;
+    return true;
+}
+
+bool ContactManager::AttributeCache::save()
+{
+    QFileInfo fileInfo(mFileName);
+    if (!QDir().mkpath(fileInfo.absolutePath())) {
+        warning() << "Unable to create contact attribute cache directory" <<
+            fileInfo.absolutePath();
+        return false;
+    }
+
+    QTemporaryFile file(mFileName);
+    if (!file.open()) {
+        warning() << "Unable to write contact attribute cache" << mFileName;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << cacheMagic << cacheVersion << mEntries;
+
+    // QFile::rename() doesn't overwrite existing files
+    QFile::remove(mFileName);
+    file.setAutoRemove(false);
+    if (!file.rename(mFileName)) {
+        file.remove();
+        warning() << "Unable to write contact attribute cache" << mFileName;
+        return false;
+    }
+
+    debug() << "Saved cached attributes for" << mEntries.size() << "contacts to" << mFileName;
+    mDirty = false;
+    return true;
+}
+
+/**
+ * Add the cached attributes for the contact with the given \a id to \a attributes, without
+ * overriding the ones already there.
+ */
+void ContactManager::AttributeCache::hydrate(const QString &id, QVariantMap &attributes) const
+{
+    QHash<QString, QVariantMap>::const_iterator entry = mEntries.constFind(id);
+    if (entry == mEntries.constEnd()) {
+        return;
+    }
+
+    for (QVariantMap::const_iterator i = entry->constBegin(); i != entry->constEnd(); ++i) {
+        if (attributes.contains(i.key())) {
+            continue;
+        }
+
+        if (i.key() == capabilitiesAttribute()) {
+            RequestableChannelClassList caps;
+            foreach (const QVariant &storedClass, i.value().toList()) {
+                QVariantList fields = storedClass.toList();
+                if (fields.size() != 2) {
+                    continue;
+                }
+
+                RequestableChannelClass rcc;
+                rcc.fixedProperties = fields[0].toMap();
+                rcc.allowedProperties = fields[1].toStringList();
+                caps << rcc;
+            }
+            attributes.insert(i.key(), QVariant::fromValue(caps));
+        } else {
+            attributes.insert(i.key(), i.value());
+        }
+    }
+}
+
+/**
+ * Store the cacheable subset of \a attributes for the contact with the given \a id.
+ *
+ * \return \c true if this changed what was cached for the contact, \c false otherwise.
+ */
+bool ContactManager::AttributeCache::update(const QString &id, const QVariantMap &attributes)
+{
+    QVariantMap entry;
+    foreach (const QString &name, attributeNames()) {
+        QVariantMap::const_iterator i = attributes.constFind(name);
+        if (i == attributes.constEnd()) {
+            continue;
+        }
+
+        QVariant value;
+        if (name == capabilitiesAttribute()) {
+            QVariantList storedClasses;
+            foreach (const RequestableChannelClass &rcc,
+                    qdbus_cast<RequestableChannelClassList>(i.value())) {
+                storedClasses << QVariant(QVariantList() << QVariant(rcc.fixedProperties) <<
+                        QVariant(rcc.allowedProperties));
+            }
+            value = storedClasses;
+        } else if (name == locationAttribute()) {
+            value = qdbus_cast<QVariantMap>(i.value());
+        } else if (name == clientTypesAttribute()) {
+            value = qdbus_cast<QStringList>(i.value());
+        } else {
+            value = qdbus_cast<QString>(i.value());
+        }
+
+        if (isStorable(value)) {
+            entry.insert(name, value);
+        }
+    }
+
+    QHash<QString, QVariantMap>::iterator current = mEntries.find(id);
+    if (current != mEntries.end() && current.value() == entry) {
+        return false;
+    }
+
+    mEntries.insert(id, entry);
+    mDirty = true;
+    return true;
+}
+
+/**
+ * Drop the cached attributes for all contacts but the ones with the given \a ids.
+ */
+void ContactManager::AttributeCache::retain(const QSet<QString> &ids)
+{
+    QHash<QString, QVariantMap>::iterator i = mEntries.begin();
+    while (i != mEntries.end()) {
+        if (!ids.contains(i.key())) {
+            i = mEntries.erase(i);
+            mDirty = true;
+        } else {
+            ++i;
+        }
+    }
+}
+
+} // Tp
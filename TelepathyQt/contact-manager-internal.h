@@ -23,17 +23,25 @@
 #ifndef _TelepathyQt_contact_manager_internal_h_HEADER_GUARD_
 #define _TelepathyQt_contact_manager_internal_h_HEADER_GUARD_
 
+#include <TelepathyQt/AvatarData>
 #include <TelepathyQt/ContactManager>
 #include <TelepathyQt/Global>
 #include <TelepathyQt/PendingOperation>
 #include <TelepathyQt/Types>
 
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
 #include <QList>
+#include <QVariantMap>
 #include <QObject>
 #include <QQueue>
+#include <QSet>
 #include <QString>
 #include <QStringList>
 
+class QTimer;
+
 namespace Tp
 {
 
@@ -122,6 +130,8 @@ private Q_SLOTS:
 
     void gotContactListGroupsProperties(Tp::PendingOperation *op);
     void onContactListContactsUpgraded(Tp::PendingOperation *op);
+    void gotSelfIdForCache(Tp::PendingOperation *op);
+    void onCachedContactsRevalidated(Tp::PendingOperation *op);
 
     void onNewChannels(const Tp::ChannelDetailsList &channelDetailsList);
     void onContactListGroupChannelReady(Tp::PendingOperation *op);
@@ -170,6 +180,16 @@ private:
     class ModifyFinishOp;
     class RemoveGroupOp;
 
+    // Which member set of a contact list channel a contact is in, shifted by
+    // ChannelInfo::Type * MembershipBits for each channel
+    enum Membership {
+        MembershipCurrent = 0x1,
+        MembershipLocalPending = 0x2,
+        MembershipRemotePending = 0x4,
+        MembershipMask = 0x7,
+        MembershipBits = 3
+    };
+
     void introspectContactBlocking();
     void introspectContactBlockingBlockedContacts();
     void introspectContactList();
@@ -186,6 +206,12 @@ private:
     void setContactListChannelsReady();
     void updateContactsBlockState();
     void updateContactsPresenceState();
+    uint membership(const ContactPtr &contact, uint type) const;
+    void setMembership(const ContactPtr &contact, uint type, uint membership);
+    void setMemberships(uint type, const ChannelPtr &channel);
+    void updateMemberships(uint type, const Contacts &added,
+            const Contacts &localPendingAdded, const Contacts &remotePendingAdded,
+            const Contacts &removed);
     void computeKnownContactsChanges(const Contacts &added,
             const Contacts &pendingAdded, const Contacts &remotePendingAdded,
             const Contacts &removed, const Channel::GroupMemberChangeDetails &details);
@@ -232,6 +258,8 @@ private:
     ChannelPtr publishChannel;
     ChannelPtr storedChannel;
     ChannelPtr denyChannel;
+    // The Membership bits of every contact in any of the contact list channels
+    QHash<ContactPtr, uint> contactListChannelMemberships;
 
     // Number of things left to do before the Groups feature is ready
     // 1 for Get("Channels") + 1 per channel not ready
@@ -247,6 +275,14 @@ private:
     Contacts contactListContacts;
     // Blocked contacts using the new ContactBlocking API
     Contacts blockedContacts;
+
+    // The persistent cache is keyed by the self ID, which may have to be looked up first
+    bool lookingUpSelfIdForCache;
+    bool selfIdForCacheLookedUp;
+
+    // Interfaces left out of GetContactListAttributes because their attributes were taken from
+    // the persistent cache, to be fetched again in the background
+    QStringList cachedInterfacesToRevalidate;
 };
 
 struct TP_QT_NO_EXPORT ContactManager::Roster::ChannelInfo
@@ -383,6 +419,165 @@ private:
     QSet<uint> mToRequest;
 };
 
+class TP_QT_NO_EXPORT ContactManager::AttributeCache
+{
+public:
+    AttributeCache(const QString &fileName);
+    ~AttributeCache();
+
+    static Features features();
+
+    QString fileName() const { return mFileName; }
+    bool isEmpty() const { return mEntries.isEmpty(); }
+
+    bool load();
+    bool save();
+
+    void hydrate(const QString &id, QVariantMap &attributes) const;
+    bool update(const QString &id, const QVariantMap &attributes);
+    void retain(const QSet<QString> &ids);
+
+private:
+    static QStringList attributeNames();
+
+    QString mFileName;
+    QHash<QString, QVariantMap> mEntries;
+    bool mDirty;
+};
+
+class TP_QT_NO_EXPORT ContactManager::PendingBatchedAttributes : public PendingOperation
+{
+    Q_OBJECT
+
+public:
+    PendingBatchedAttributes(const ConnectionPtr &conn, const UIntList &handles,
+            const QStringList &interfaces);
+    ~PendingBatchedAttributes();
+
+    UIntList handles() const { return mHandles; }
+    QStringList interfaces() const { return mInterfaces; }
+
+    UIntList validHandles() const { return mValidHandles; }
+    ContactAttributesMap attributes() const { return mAttributes; }
+
+    void setResult(const ReferencedHandles &batchHandles, const ContactAttributesMap &attributes);
+    void setError(const QString &errorName, const QString &errorMessage);
+
+private:
+    UIntList mHandles;
+    QStringList mInterfaces;
+    // Keeps the handles referenced until the requester had a chance to reference them itself
+    ReferencedHandles mBatchHandles;
+    UIntList mValidHandles;
+    ContactAttributesMap mAttributes;
+};
+
+class TP_QT_NO_EXPORT ContactManager::AttributesBatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    AttributesBatcher(ContactManager *manager);
+    ~AttributesBatcher();
+
+    int interval() const { return mInterval; }
+    void setInterval(int msec);
+    int maxBatchSize() const { return mMaxBatchSize; }
+    void setMaxBatchSize(int maxHandles) { mMaxBatchSize = maxHandles; }
+
+    uint requestCount() const { return mRequestCount; }
+    uint callCount() const { return mCallCount; }
+
+    PendingBatchedAttributes *request(const UIntList &handles, const QStringList &interfaces);
+
+public Q_SLOTS:
+    void flush();
+
+private Q_SLOTS:
+    void onAttributesFinished(Tp::PendingOperation *op);
+
+private:
+    ContactManager *mManager;
+    QTimer *mTimer;
+    int mInterval;
+    int mMaxBatchSize;
+    uint mRequestCount;
+    uint mCallCount;
+
+    QSet<uint> mQueuedHandles;
+    QSet<QString> mQueuedInterfaces;
+    QList<PendingBatchedAttributes *> mQueuedRequests;
+    QHash<PendingOperation *, QList<PendingBatchedAttributes *> > mRequestsInFlight;
+};
+
+class TP_QT_NO_EXPORT ContactManager::AvatarStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    AvatarStore(QObject *parent = 0);
+    ~AvatarStore();
+
+    static QString avatarFileName(const QString &path, const QString &token);
+
+    bool lookup(const QString &path, const QString &token, AvatarData *avatar) const;
+    void probe(const QString &path, const QStringList &tokens);
+    void store(const QString &path, const QString &token, const QByteArray &data,
+            const QString &mimeType);
+
+Q_SIGNALS:
+    void probed(const QString &path, const QStringList &tokens, const QStringList &mimeTypes,
+            const QStringList &missingTokens);
+    void stored(const QString &path, const QString &token, const QString &mimeType,
+            bool success);
+
+private Q_SLOTS:
+    void onProbed(uint storeId, const QString &path, const QStringList &tokens,
+            const QStringList &mimeTypes, const QStringList &missingTokens);
+    void onStored(uint storeId, const QString &path, const QString &token,
+            const QString &mimeType, bool success);
+
+private:
+    class Worker;
+
+    static Worker *sharedWorker();
+
+    // Identifies the requests made by this store to the worker shared by all of them
+    uint mId;
+    Worker *mWorker;
+    // Avatar file name -> avatar, only for avatars known to be on disk
+    mutable QCache<QString, AvatarData> mAvatars;
+};
+
+class TP_QT_NO_EXPORT ContactManager::AvatarStore::Worker : public QObject
+{
+    Q_OBJECT
+
+public:
+    Worker();
+    ~Worker();
+
+public Q_SLOTS:
+    void finish();
+    void probe(uint storeId, const QString &path, const QStringList &tokens);
+    void store(uint storeId, const QString &path, const QString &token, const QByteArray &data,
+            const QString &mimeType);
+
+Q_SIGNALS:
+    void probed(uint storeId, const QString &path, const QStringList &tokens,
+            const QStringList &mimeTypes, const QStringList &missingTokens);
+    void stored(uint storeId, const QString &path, const QString &token,
+            const QString &mimeType, bool success);
+
+private:
+    QHash<QString, QString> &mimeTypes(const QString &path, bool reload = false);
+    void addMimeType(const QString &path, const QString &token, const QString &mimeType);
+    void compact(const QString &path, QHash<QString, QString> &index, qint64 readSize);
+
+    // Avatar directory -> escaped token -> mime type, as read from the directory index
+    QHash<QString, QHash<QString, QString> > mMimeTypes;
+};
+
 } // Tp
 
 #endif
@@ -25,6 +25,7 @@
 #include "TelepathyQt/_gen/contact-manager-internal.moc.hpp"
 
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/trace-internal.h"
 
 #include <TelepathyQt/Connection>
 #include <TelepathyQt/ConnectionLowlevel>
@@ -61,7 +62,9 @@ ContactManager::Roster::Roster(ContactManager *contactManager)
       processingContactListChanges(false),
       contactListChannelsReady(0),
       featureContactListGroupsTodo(0),
-      groupsSetSuccess(false)
+      groupsSetSuccess(false),
+      lookingUpSelfIdForCache(false),
+      selfIdForCacheLookedUp(false)
 {
 }
 
@@ -213,6 +216,7 @@ void ContactManager::Roster::reset()
     publishChannel.reset();
     storedChannel.reset();
     denyChannel.reset();
+    contactListChannelMemberships.clear();
     contactListGroupChannels.clear();
     removedContactListGroupChannels.clear();
 }
@@ -594,19 +598,19 @@ PendingOperation *ContactManager::Roster::removeContacts(
          */
 
         if (storedChannel && storedChannel->groupCanRemoveContacts()) {
-            debug() << "Removing contacts from stored list";
+            TP_QT_TRACE(Roster, "Removing %1 contacts from stored list") << contacts.size();
             return storedChannel->groupRemoveContacts(contacts, message);
         }
 
         QList<PendingOperation*> operations;
 
         if (canRemovePresenceSubscription()) {
-            debug() << "Removing contacts from subscribe list";
+            TP_QT_TRACE(Roster, "Removing %1 contacts from subscribe list") << contacts.size();
             operations << removePresenceSubscription(contacts, message);
         }
 
         if (canRemovePresencePublication()) {
-            debug() << "Removing contacts from publish list";
+            TP_QT_TRACE(Roster, "Removing %1 contacts from publish list") << contacts.size();
             operations << removePresencePublication(contacts, message);
         }
 
@@ -817,6 +821,8 @@ void ContactManager::Roster::gotContactListContacts(QDBusPendingCallWatcher *wat
     gotContactListInitialContacts = true;
 
     ConnectionPtr conn(contactManager->connection());
+    ContactManager::AttributeCache *cache = contactManager->attributeCache();
+    QSet<QString> ids;
     ContactAttributesMap attrsMap = reply.value();
     ContactAttributesMap::const_iterator begin = attrsMap.constBegin();
     ContactAttributesMap::const_iterator end = attrsMap.constEnd();
@@ -824,6 +830,17 @@ void ContactManager::Roster::gotContactListContacts(QDBusPendingCallWatcher *wat
         uint bareHandle = i.key();
         QVariantMap attrs = i.value();
 
+        if (cache) {
+            QString id = qdbus_cast<QString>(attrs.value(
+                        TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")));
+            ids.insert(id);
+            if (!cachedInterfacesToRevalidate.isEmpty()) {
+                cache->hydrate(id, attrs);
+            } else {
+                cache->update(id, attrs);
+            }
+        }
+
         ContactPtr contact = contactManager->ensureContact(ReferencedHandles(conn,
                     HandleTypeContact, UIntList() << bareHandle),
                 conn->contactFactory()->features(), attrs);
@@ -831,6 +848,21 @@ void ContactManager::Roster::gotContactListContacts(QDBusPendingCallWatcher *wat
         contactListContacts.insert(contact);
     }
 
+    if (cache) {
+        cache->retain(ids);
+
+        if (!cachedInterfacesToRevalidate.isEmpty() && !attrsMap.isEmpty()) {
+            debug() << "Revalidating cached attributes for" << attrsMap.size() << "contacts";
+            PendingOperation *op = contactManager->requestContactAttributes(attrsMap.keys(),
+                    cachedInterfacesToRevalidate);
+            connect(op,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(onCachedContactsRevalidated(Tp::PendingOperation*)));
+        } else {
+            cache->save();
+        }
+    }
+
     if (contactManager->connection()->requestedFeatures().contains(
                 Connection::FeatureRosterGroups)) {
         groupsSetSuccess = true;
@@ -907,13 +939,13 @@ void ContactManager::Roster::onContactListStateChanged(uint state)
 void ContactManager::Roster::onContactListContactsChangedWithId(const Tp::ContactSubscriptionMap &changes,
         const Tp::HandleIdentifierMap &ids, const Tp::HandleIdentifierMap &removals)
 {
-    debug() << "Got ContactList.ContactsChangedWithID with" << changes.size() <<
-        "changes and" << removals.size() << "removals";
+    TP_QT_TRACE(Roster, "Got ContactList.ContactsChangedWithID with %1 changes and %2 removals") <<
+        changes.size() << removals.size();
 
     gotContactListContactsChangedWithId = true;
 
     if (!gotContactListInitialContacts) {
-        debug() << "Ignoring ContactList changes until initial contacts are retrieved";
+        TP_QT_TRACE(Roster, "Ignoring ContactList changes until initial contacts are retrieved");
         return;
     }
 
@@ -932,11 +964,11 @@ void ContactManager::Roster::onContactListContactsChanged(const Tp::ContactSubsc
         return;
     }
 
-    debug() << "Got ContactList.ContactsChanged with" << changes.size() <<
-        "changes and" << removals.size() << "removals";
+    TP_QT_TRACE(Roster, "Got ContactList.ContactsChanged with %1 changes and %2 removals") <<
+        changes.size() << removals.size();
 
     if (!gotContactListInitialContacts) {
-        debug() << "Ignoring ContactList changes until initial contacts are retrieved";
+        TP_QT_TRACE(Roster, "Ignoring ContactList changes until initial contacts are retrieved");
         return;
     }
 
@@ -977,7 +1009,7 @@ void ContactManager::Roster::onContactListBlockedContactsConstructed(Tp::Pending
             continue;
         }
 
-        debug() << "Contact" << contact->id() << "is now blocked";
+        TP_QT_TRACE(Roster, "Contact %1 is now blocked") << contact->id();
         blockedContacts.insert(contact);
         newBlockedContacts.insert(contact);
         contact->setBlocked(true);
@@ -994,7 +1026,7 @@ void ContactManager::Roster::onContactListBlockedContactsConstructed(Tp::Pending
             continue;
         }
 
-        debug() << "Contact" << contact->id() << "is now unblocked";
+        TP_QT_TRACE(Roster, "Contact %1 is now unblocked") << contact->id();
         blockedContacts.remove(contact);
         unblockedContacts.insert(contact);
         contact->setBlocked(false);
@@ -1257,6 +1289,7 @@ void ContactManager::Roster::onContactListChannelReady()
         updateContactsBlockState();
 
         if (denyChannel) {
+            setMemberships(ChannelInfo::TypeDeny, denyChannel);
             cachedAllKnownContacts.unite(denyChannel->groupContacts());
         }
 
@@ -1278,15 +1311,17 @@ void ContactManager::Roster::onContactListChannelReady()
 
         updateContactsBlockState();
 
-        // Refresh the cache for the current known contacts
-        foreach (const ChannelInfo &contactListChannel, contactListChannels) {
-            ChannelPtr channel = contactListChannel.channel;
-            if (!channel) {
-                continue;
+        // Refresh the cache for the current known contacts, from here on it's kept up to date by
+        // applying the changes to the channels' members
+        for (QHash<uint, ChannelInfo>::const_iterator i = contactListChannels.constBegin();
+                i != contactListChannels.constEnd(); ++i) {
+            if (i.value().channel) {
+                setMemberships(i.key(), i.value().channel);
             }
-            cachedAllKnownContacts.unite(channel->groupContacts());
-            cachedAllKnownContacts.unite(channel->groupLocalPendingContacts());
-            cachedAllKnownContacts.unite(channel->groupRemotePendingContacts());
+        }
+        for (QHash<ContactPtr, uint>::const_iterator i = contactListChannelMemberships.constBegin();
+                i != contactListChannelMemberships.constEnd(); ++i) {
+            cachedAllKnownContacts.insert(i.key());
         }
 
         updateContactsPresenceState();
@@ -1372,6 +1407,66 @@ void ContactManager::Roster::onContactListContactsUpgraded(PendingOperation *op)
     processContactListChanges();
 }
 
+void ContactManager::Roster::gotSelfIdForCache(PendingOperation *op)
+{
+    PendingContacts *pc = qobject_cast<PendingContacts*>(op);
+
+    lookingUpSelfIdForCache = false;
+    selfIdForCacheLookedUp = true;
+
+    if (pc->isError() || pc->contacts().isEmpty()) {
+        warning() << "Looking up the self ID failed, not using the contact attribute cache:" <<
+            pc->errorName() << '-' << pc->errorMessage();
+    } else {
+        contactManager->loadAttributeCache(pc->contacts().first()->id());
+    }
+
+    introspectContactListContacts();
+}
+
+void ContactManager::Roster::onCachedContactsRevalidated(PendingOperation *op)
+{
+    if (op->isError()) {
+        warning() << "Revalidating cached contact attributes failed:" << op->errorName() << '-'
+            << op->errorMessage();
+        return;
+    }
+
+    ContactManager::AttributeCache *cache = contactManager->attributeCache();
+    if (!cache) {
+        // The cache was disabled while revalidating
+        return;
+    }
+
+    ContactManager::PendingBatchedAttributes *pba =
+        qobject_cast<ContactManager::PendingBatchedAttributes *>(op);
+    Features features = contactManager->connection()->contactFactory()->features();
+    features.intersect(ContactManager::AttributeCache::features());
+
+    int changed = 0;
+    ContactAttributesMap attrsMap = pba->attributes();
+    ContactAttributesMap::const_iterator begin = attrsMap.constBegin();
+    ContactAttributesMap::const_iterator end = attrsMap.constEnd();
+    for (ContactAttributesMap::const_iterator i = begin; i != end; ++i) {
+        ContactPtr contact = contactManager->lookupContactByHandle(i.key());
+        if (!contact) {
+            continue;
+        }
+
+        // Only contacts whose attributes differ from the cached ones need to be touched
+        if (cache->update(contact->id(), i.value())) {
+            contactManager->ensureContact(contact->handle(), features, i.value());
+            ++changed;
+        }
+    }
+
+    debug() << "Cached attributes revalidated," << changed << "out of" << attrsMap.size() <<
+        "contacts changed";
+
+    cachedInterfacesToRevalidate.clear();
+    cache->save();
+}
+
 void ContactManager::Roster::onNewChannels(const Tp::ChannelDetailsList &channelDetailsList)
 {
     ConnectionPtr conn(contactManager->connection());
@@ -1459,13 +1554,17 @@ void ContactManager::Roster::onStoredChannelMembersChanged(
     }
 
     foreach (ContactPtr contact, groupMembersAdded) {
-        debug() << "Contact" << contact->id() << "on stored list";
+        TP_QT_TRACE(Roster, "Contact %1 on stored list") << contact->id();
     }
 
     foreach (ContactPtr contact, groupMembersRemoved) {
-        debug() << "Contact" << contact->id() << "removed from stored list";
+        TP_QT_TRACE(Roster, "Contact %1 removed from stored list") << contact->id();
     }
 
+    updateMemberships(ChannelInfo::TypeStored, groupMembersAdded,
+            groupLocalPendingMembersAdded, groupRemotePendingMembersAdded,
+            groupMembersRemoved);
+
     // Perform the needed computation for allKnownContactsChanged
     computeKnownContactsChanges(groupMembersAdded,
             groupLocalPendingMembersAdded, groupRemotePendingMembersAdded,
@@ -1484,20 +1583,24 @@ void ContactManager::Roster::onSubscribeChannelMembersChanged(
     }
 
     foreach (ContactPtr contact, groupMembersAdded) {
-        debug() << "Contact" << contact->id() << "on subscribe list";
+        TP_QT_TRACE(Roster, "Contact %1 on subscribe list") << contact->id();
         contact->setSubscriptionState(SubscriptionStateYes);
     }
 
     foreach (ContactPtr contact, groupRemotePendingMembersAdded) {
-        debug() << "Contact" << contact->id() << "added to subscribe list";
+        TP_QT_TRACE(Roster, "Contact %1 added to subscribe list") << contact->id();
         contact->setSubscriptionState(SubscriptionStateAsk);
     }
 
     foreach (ContactPtr contact, groupMembersRemoved) {
-        debug() << "Contact" << contact->id() << "removed from subscribe list";
+        TP_QT_TRACE(Roster, "Contact %1 removed from subscribe list") << contact->id();
         contact->setSubscriptionState(SubscriptionStateNo);
     }
 
+    updateMemberships(ChannelInfo::TypeSubscribe, groupMembersAdded,
+            groupLocalPendingMembersAdded, groupRemotePendingMembersAdded,
+            groupMembersRemoved);
+
     // Perform the needed computation for allKnownContactsChanged
     computeKnownContactsChanges(groupMembersAdded,
             groupLocalPendingMembersAdded, groupRemotePendingMembersAdded,
@@ -1516,17 +1619,17 @@ void ContactManager::Roster::onPublishChannelMembersChanged(
     }
 
     foreach (ContactPtr contact, groupMembersAdded) {
-        debug() << "Contact" << contact->id() << "on publish list";
+        TP_QT_TRACE(Roster, "Contact %1 on publish list") << contact->id();
         contact->setPublishState(SubscriptionStateYes);
     }
 
     foreach (ContactPtr contact, groupLocalPendingMembersAdded) {
-        debug() << "Contact" << contact->id() << "added to publish list";
+        TP_QT_TRACE(Roster, "Contact %1 added to publish list") << contact->id();
         contact->setPublishState(SubscriptionStateAsk, details.message());
     }
 
     foreach (ContactPtr contact, groupMembersRemoved) {
-        debug() << "Contact" << contact->id() << "removed from publish list";
+        TP_QT_TRACE(Roster, "Contact %1 removed from publish list") << contact->id();
         contact->setPublishState(SubscriptionStateNo);
     }
 
@@ -1534,6 +1637,10 @@ void ContactManager::Roster::onPublishChannelMembersChanged(
         emit contactManager->presencePublicationRequested(groupLocalPendingMembersAdded);
     }
 
+    updateMemberships(ChannelInfo::TypePublish, groupMembersAdded,
+            groupLocalPendingMembersAdded, groupRemotePendingMembersAdded,
+            groupMembersRemoved);
+
     // Perform the needed computation for allKnownContactsChanged
     computeKnownContactsChanges(groupMembersAdded,
             groupLocalPendingMembersAdded, groupRemotePendingMembersAdded,
@@ -1556,15 +1663,18 @@ void ContactManager::Roster::onDenyChannelMembersChanged(
     }
 
     foreach (ContactPtr contact, groupMembersAdded) {
-        debug() << "Contact" << contact->id() << "added to deny list";
+        TP_QT_TRACE(Roster, "Contact %1 added to deny list") << contact->id();
         contact->setBlocked(true);
     }
 
     foreach (ContactPtr contact, groupMembersRemoved) {
-        debug() << "Contact" << contact->id() << "removed from deny list";
+        TP_QT_TRACE(Roster, "Contact %1 removed from deny list") << contact->id();
         contact->setBlocked(false);
     }
 
+    updateMemberships(ChannelInfo::TypeDeny, groupMembersAdded, Contacts(), Contacts(),
+            groupMembersRemoved);
+
     // Perform the needed computation for allKnownContactsChanged
     computeKnownContactsChanges(groupMembersAdded, Contacts(),
             Contacts(), groupMembersRemoved, details);
@@ -1676,22 +1786,57 @@ void ContactManager::Roster::introspectContactListContacts()
 {
     ConnectionPtr conn(contactManager->connection());
 
+    if (lookingUpSelfIdForCache) {
+        // Will be called again once the self ID is known
+        return;
+    }
+
+    if (contactManager->isPersistentCacheEnabled() && !contactManager->attributeCache()) {
+        if (conn->isReady(Connection::FeatureSelfContact)) {
+            contactManager->loadAttributeCache(conn->selfContact()->id());
+        } else if (!selfIdForCacheLookedUp) {
+            debug() << "Looking up the self ID to find the contact attribute cache";
+            lookingUpSelfIdForCache = true;
+            PendingContacts *pc = contactManager->contactsForHandles(
+                    UIntList() << conn->selfHandle());
+            connect(pc,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(gotSelfIdForCache(Tp::PendingOperation*)));
+            return;
+        }
+    }
+
     Client::ConnectionInterfaceContactListInterface *iface =
         conn->interface<Client::ConnectionInterfaceContactListInterface>();
 
     Features features(conn->contactFactory()->features());
     Features supportedFeatures(contactManager->supportedFeatures());
+    ContactManager::AttributeCache *cache = contactManager->attributeCache();
+    bool warmStart = cache && !cache->isEmpty();
+    Features cachedFeatures = ContactManager::AttributeCache::features();
     QSet<QString> interfaces;
+    QSet<QString> cachedInterfaces;
     foreach (const Feature &feature, features) {
         contactManager->ensureTracking(feature);
 
         if (supportedFeatures.contains(feature)) {
             // Only query interfaces which are reported as supported to not get an error
-            interfaces.insert(contactManager->featureToInterface(feature));
+            if (warmStart && cachedFeatures.contains(feature)) {
+                cachedInterfaces.insert(contactManager->featureToInterface(feature));
+            } else {
+                interfaces.insert(contactManager->featureToInterface(feature));
+            }
         }
     }
     interfaces.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST);
 
+    // The cached attributes will be used to build the contacts right away, and fetched again
+    // once that is done
+    cachedInterfacesToRevalidate = cachedInterfaces.subtract(interfaces).toList();
+    if (!cachedInterfacesToRevalidate.isEmpty()) {
+        debug() << "Using cached attributes for" << cachedInterfacesToRevalidate;
+    }
+
     QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(
             iface->GetContactListAttributes(interfaces.toList(), true), contactManager);
     connect(watcher,
@@ -1964,28 +2109,13 @@ void ContactManager::Roster::updateContactsPresenceState()
         return;
     }
 
-    Contacts subscribeContacts;
-    Contacts subscribeContactsRP;
-
-    if (subscribeChannel) {
-        subscribeContacts = subscribeChannel->groupContacts();
-        subscribeContactsRP = subscribeChannel->groupRemotePendingContacts();
-    }
-
-    Contacts publishContacts;
-    Contacts publishContactsLP;
-    if (publishChannel) {
-        publishContacts = publishChannel->groupContacts();
-        publishContactsLP = publishChannel->groupLocalPendingContacts();
-    }
-
-    Contacts contacts = cachedAllKnownContacts;
-    foreach (ContactPtr contact, contacts) {
+    foreach (ContactPtr contact, cachedAllKnownContacts) {
         if (subscribeChannel) {
             // not in "subscribe" -> No, in "subscribe" lp -> Ask, in "subscribe" current -> Yes
-            if (subscribeContacts.contains(contact)) {
+            uint subscribe = membership(contact, ChannelInfo::TypeSubscribe);
+            if (subscribe & MembershipCurrent) {
                 contact->setSubscriptionState(SubscriptionStateYes);
-            } else if (subscribeContactsRP.contains(contact)) {
+            } else if (subscribe & MembershipRemotePending) {
                 contact->setSubscriptionState(SubscriptionStateAsk);
             } else {
                 contact->setSubscriptionState(SubscriptionStateNo);
@@ -1994,9 +2124,10 @@ void ContactManager::Roster::updateContactsPresenceState()
 
         if (publishChannel) {
             // not in "publish" -> No, in "subscribe" rp -> Ask, in "publish" current -> Yes
-            if (publishContacts.contains(contact)) {
+            uint publish = membership(contact, ChannelInfo::TypePublish);
+            if (publish & MembershipCurrent) {
                 contact->setPublishState(SubscriptionStateYes);
-            } else if (publishContactsLP.contains(contact)) {
+            } else if (publish & MembershipLocalPending) {
                 contact->setPublishState(SubscriptionStateAsk,
                         publishChannel->groupLocalPendingContactChangeInfo(contact).message());
             } else {
@@ -2006,39 +2137,96 @@ void ContactManager::Roster::updateContactsPresenceState()
     }
 }
 
+uint ContactManager::Roster::membership(const ContactPtr &contact, uint type) const
+{
+    return (contactListChannelMemberships.value(contact) >> (type * MembershipBits)) &
+        MembershipMask;
+}
+
+void ContactManager::Roster::setMembership(const ContactPtr &contact, uint type, uint membership)
+{
+    uint shift = type * MembershipBits;
+    QHash<ContactPtr, uint>::iterator i = contactListChannelMemberships.find(contact);
+    if (i == contactListChannelMemberships.end()) {
+        if (membership) {
+            contactListChannelMemberships.insert(contact, membership << shift);
+        }
+        return;
+    }
+
+    // A contact is in at most one of the member sets of a channel
+    i.value() = (i.value() & ~(MembershipMask << shift)) | (membership << shift);
+    if (!i.value()) {
+        contactListChannelMemberships.erase(i);
+    }
+}
+
+void ContactManager::Roster::setMemberships(uint type, const ChannelPtr &channel)
+{
+    foreach (const ContactPtr &contact, channel->groupContacts()) {
+        setMembership(contact, type, MembershipCurrent);
+    }
+    foreach (const ContactPtr &contact, channel->groupLocalPendingContacts()) {
+        setMembership(contact, type, MembershipLocalPending);
+    }
+    foreach (const ContactPtr &contact, channel->groupRemotePendingContacts()) {
+        setMembership(contact, type, MembershipRemotePending);
+    }
+}
+
+void ContactManager::Roster::updateMemberships(uint type, const Contacts &added,
+        const Contacts &localPendingAdded, const Contacts &remotePendingAdded,
+        const Contacts &removed)
+{
+    foreach (const ContactPtr &contact, added) {
+        setMembership(contact, type, MembershipCurrent);
+    }
+    foreach (const ContactPtr &contact, localPendingAdded) {
+        setMembership(contact, type, MembershipLocalPending);
+    }
+    foreach (const ContactPtr &contact, remotePendingAdded) {
+        setMembership(contact, type, MembershipRemotePending);
+    }
+    foreach (const ContactPtr &contact, removed) {
+        setMembership(contact, type, 0);
+    }
+}
+
 void ContactManager::Roster::computeKnownContactsChanges(const Tp::Contacts& added,
         const Tp::Contacts& pendingAdded, const Tp::Contacts& remotePendingAdded,
         const Tp::Contacts& removed, const Channel::GroupMemberChangeDetails &details)
 {
-    // First of all, compute the real additions/removals based upon our cache
+    // First of all, compute the real additions/removals based upon our cache, looking only at the
+    // contacts which changed
     Tp::Contacts realAdded;
-    realAdded.unite(added);
-    realAdded.unite(pendingAdded);
-    realAdded.unite(remotePendingAdded);
-    realAdded.subtract(cachedAllKnownContacts);
-    Tp::Contacts realRemoved = removed;
-    realRemoved.intersect(cachedAllKnownContacts);
-
-    // Check if realRemoved have been _really_ removed from all lists
-    foreach (const ChannelInfo &contactListChannel, contactListChannels) {
-        ChannelPtr channel = contactListChannel.channel;
-        if (!channel) {
-            continue;
+    foreach (const Tp::Contacts &contacts,
+            QList<Tp::Contacts>() << added << pendingAdded << remotePendingAdded) {
+        foreach (const ContactPtr &contact, contacts) {
+            if (!cachedAllKnownContacts.contains(contact)) {
+                realAdded.insert(contact);
+            }
         }
-        realRemoved.subtract(channel->groupContacts());
-        realRemoved.subtract(channel->groupLocalPendingContacts());
-        realRemoved.subtract(channel->groupRemotePendingContacts());
     }
 
-    // ...and from the Conn.I.ContactList / Conn.I.ContactBlocking contacts
-    realRemoved.subtract(contactListContacts);
-    realRemoved.subtract(blockedContacts);
+    // Check if the removed contacts have been _really_ removed from all the contact list channels,
+    // and from the Conn.I.ContactList / Conn.I.ContactBlocking contacts
+    Tp::Contacts realRemoved;
+    foreach (const ContactPtr &contact, removed) {
+        if (cachedAllKnownContacts.contains(contact) &&
+                !contactListChannelMemberships.contains(contact) &&
+                !contactListContacts.contains(contact) &&
+                !blockedContacts.contains(contact)) {
+            realRemoved.insert(contact);
+        }
+    }
 
     // Are there any real changes?
     if (!realAdded.isEmpty() || !realRemoved.isEmpty()) {
         // Yes, update our "cache" and emit the signal
         cachedAllKnownContacts.unite(realAdded);
-        cachedAllKnownContacts.subtract(realRemoved);
+        foreach (const ContactPtr &contact, realRemoved) {
+            cachedAllKnownContacts.remove(contact);
+        }
         emit contactManager->allKnownContactsChanged(realAdded, realRemoved, details);
     }
 }
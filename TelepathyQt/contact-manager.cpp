@@ -25,8 +25,11 @@
 
 #include "TelepathyQt/_gen/contact-manager.moc.hpp"
 
+#include "TelepathyQt/contact-attribute-decoder.h"
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/feature-set-internal.h"
 #include "TelepathyQt/future-internal.h"
+#include "TelepathyQt/trace-internal.h"
 
 #include <TelepathyQt/AvatarData>
 #include <TelepathyQt/Connection>
@@ -42,6 +45,7 @@
 #include <TelepathyQt/Utils>
 
 #include <QMap>
+#include <QTimer>
 
 namespace Tp
 {
@@ -52,14 +56,24 @@ struct TP_QT_NO_EXPORT ContactManager::Private
     ~Private();
 
     // avatar specific methods
-    bool buildAvatarFileName(QString token, bool createDir,
-        QString &avatarFileName, QString &mimeTypeFileName);
+    QString buildAvatarPath();
+    ContactManager::AvatarStore *ensureAvatarStore();
+    void requestAvatars(const UIntList &handles);
+    QString buildAttributeCacheFileName(const QString &selfId);
     Features realFeatures(const Features &features);
     QSet<QString> interfacesForFeatures(const Features &features);
 
     ContactManager *parent;
     WeakPtr<Connection> connection;
     ContactManager::Roster *roster;
+    ContactManager::AttributesBatcher *attributesBatcher;
+
+    // persistent attribute cache
+    bool persistentCacheEnabled;
+    ContactManager::AttributeCache *attributeCache;
+
+    ContactAttributeDecoder *attributeDecoder;
+    ContactAttributeDecoder *fullAttributeDecoder;
 
     QHash<uint, WeakPtr<Contact> > contacts;
 
@@ -69,6 +83,11 @@ struct TP_QT_NO_EXPORT ContactManager::Private
     // avatar
     QSet<ContactPtr> requestAvatarsQueue;
     bool requestAvatarsIdle;
+    ContactManager::AvatarStore *avatarStore;
+    // token -> contacts waiting for the token to be looked up on disk
+    QHash<QString, QList<ContactPtr> > avatarProbes;
+    // token -> handles of the contacts waiting for the avatar to be written to disk
+    QHash<QString, UIntList> avatarStores;
 
     // contact info
     PendingRefreshContactInfo *refreshInfoOp;
@@ -78,7 +97,13 @@ ContactManager::Private::Private(ContactManager *parent, Connection *connection)
     : parent(parent),
       connection(connection),
       roster(new ContactManager::Roster(parent)),
+      attributesBatcher(new ContactManager::AttributesBatcher(parent)),
+      persistentCacheEnabled(false),
+      attributeCache(0),
+      attributeDecoder(0),
+      fullAttributeDecoder(0),
       requestAvatarsIdle(false),
+      avatarStore(0),
       refreshInfoOp(0)
 {
 }
@@ -86,11 +111,15 @@ ContactManager::Private::Private(ContactManager *parent, Connection *connection)
 ContactManager::Private::~Private()
 {
     delete refreshInfoOp;
+    delete attributesBatcher;
+    delete attributeCache;
+    delete attributeDecoder;
+    delete fullAttributeDecoder;
+    delete avatarStore;
     delete roster;
 }
 
-bool ContactManager::Private::buildAvatarFileName(QString token, bool createDir,
-        QString &avatarFileName, QString &mimeTypeFileName)
+QString ContactManager::Private::buildAvatarPath()
 {
     QString cacheDir = QString(QLatin1String(qgetenv("XDG_CACHE_HOME")));
     if (cacheDir.isEmpty()) {
@@ -98,17 +127,54 @@ bool ContactManager::Private::buildAvatarFileName(QString token, bool createDir,
     }
 
     ConnectionPtr conn(parent->connection());
-    QString path = QString(QLatin1String("%1/telepathy/avatars/%2/%3")).
+    return QString(QLatin1String("%1/telepathy/avatars/%2/%3")).
         arg(cacheDir).arg(conn->cmName()).arg(conn->protocolName());
+}
 
-    if (createDir && !QDir().mkpath(path)) {
-        return false;
+ContactManager::AvatarStore *ContactManager::Private::ensureAvatarStore()
+{
+    if (!avatarStore) {
+        avatarStore = new ContactManager::AvatarStore;
+        parent->connect(avatarStore,
+                SIGNAL(probed(QString,QStringList,QStringList,QStringList)),
+                SLOT(onAvatarsProbed(QString,QStringList,QStringList,QStringList)));
+        parent->connect(avatarStore,
+                SIGNAL(stored(QString,QString,QString,bool)),
+                SLOT(onAvatarStored(QString,QString,QString,bool)));
+    }
+    return avatarStore;
+}
+
+void ContactManager::Private::requestAvatars(const UIntList &handles)
+{
+    if (handles.isEmpty()) {
+        return;
     }
 
-    avatarFileName = QString(QLatin1String("%1/%2")).arg(path).arg(escapeAsIdentifier(token));
-    mimeTypeFileName = QString(QLatin1String("%1.mime")).arg(avatarFileName);
+    TP_QT_TRACE(Contacts, "Requesting avatar(s) for %1 contact(s)") << handles.size();
 
-    return true;
+    Client::ConnectionInterfaceAvatarsInterface *avatarsInterface =
+        parent->connection()->interface<Client::ConnectionInterfaceAvatarsInterface>();
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(
+        avatarsInterface->RequestAvatars(handles),
+        parent);
+    parent->connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), watcher,
+        SLOT(deleteLater()));
+}
+
+QString ContactManager::Private::buildAttributeCacheFileName(const QString &selfId)
+{
+    QString cacheDir = QString(QLatin1String(qgetenv("XDG_CACHE_HOME")));
+    if (cacheDir.isEmpty()) {
+        cacheDir = QString(QLatin1String("%1/.cache")).arg(QLatin1String(qgetenv("HOME")));
+    }
+
+    // The object path of a connection is up to the CM and may change between connections to the
+    // same account, but the self ID is what identifies the account within the CM and protocol
+    ConnectionPtr conn(parent->connection());
+    return QString(QLatin1String("%1/telepathy/contacts/%2/%3/%4")).
+        arg(cacheDir).arg(escapeAsIdentifier(conn->cmName())).
+        arg(escapeAsIdentifier(conn->protocolName())).arg(escapeAsIdentifier(selfId));
 }
 
 Features ContactManager::Private::realFeatures(const Features &features)
@@ -169,7 +235,8 @@ void ContactManager::PendingRefreshContactInfo::refreshInfo()
         return;
     }
 
-    debug() << "Calling ContactInfo.RefreshContactInfo for" << mToRequest.size() << "handles";
+    TP_QT_TRACE(Contacts, "Calling ContactInfo.RefreshContactInfo for %1 handles") <<
+        mToRequest.size();
     Client::ConnectionInterfaceContactInfoInterface *contactInfoInterface =
         mConn->interface<Client::ConnectionInterfaceContactInfoInterface>();
     Q_ASSERT(contactInfoInterface);
@@ -188,11 +255,165 @@ void ContactManager::PendingRefreshContactInfo::onRefreshInfoFinished(PendingOpe
             op->errorName() << "-" << op->errorMessage();
         setFinishedWithError(op->errorName(), op->errorMessage());
     } else {
-        debug() << "Got reply to ContactInfo.RefreshContactInfo";
+        TP_QT_TRACE(Contacts, "Got reply to ContactInfo.RefreshContactInfo");
         setFinished();
     }
 }
 
+ContactManager::PendingBatchedAttributes::PendingBatchedAttributes(const ConnectionPtr &conn,
+        const UIntList &handles, const QStringList &interfaces)
+    : PendingOperation(conn),
+      mHandles(handles),
+      mInterfaces(interfaces)
+{
+}
+
+ContactManager::PendingBatchedAttributes::~PendingBatchedAttributes()
+{
+}
+
+void ContactManager::PendingBatchedAttributes::setResult(const ReferencedHandles &batchHandles,
+        const ContactAttributesMap &attributes)
+{
+    mBatchHandles = batchHandles;
+
+    foreach (uint handle, mHandles) {
+        ContactAttributesMap::const_iterator i = attributes.constFind(handle);
+        if (i != attributes.constEnd()) {
+            mValidHandles.push_back(handle);
+            mAttributes.insert(handle, i.value());
+        }
+    }
+
+    setFinished();
+}
+
+void ContactManager::PendingBatchedAttributes::setError(const QString &errorName,
+        const QString &errorMessage)
+{
+    setFinishedWithError(errorName, errorMessage);
+}
+
+ContactManager::AttributesBatcher::AttributesBatcher(ContactManager *manager)
+    : QObject(),
+      mManager(manager),
+      mTimer(new QTimer(this)),
+      mInterval(0),
+      mMaxBatchSize(1000),
+      mRequestCount(0),
+      mCallCount(0)
+{
+    mTimer->setSingleShot(true);
+    mTimer->setInterval(mInterval);
+    connect(mTimer, SIGNAL(timeout()), SLOT(flush()));
+}
+
+ContactManager::AttributesBatcher::~AttributesBatcher()
+{
+    foreach (PendingBatchedAttributes *request, mQueuedRequests) {
+        request->setError(TP_QT_ERROR_NOT_AVAILABLE,
+                QLatin1String("ContactManager is being destroyed"));
+    }
+
+    QHash<PendingOperation *, QList<PendingBatchedAttributes *> >::const_iterator i;
+    for (i = mRequestsInFlight.constBegin(); i != mRequestsInFlight.constEnd(); ++i) {
+        foreach (PendingBatchedAttributes *request, i.value()) {
+            request->setError(TP_QT_ERROR_NOT_AVAILABLE,
+                    QLatin1String("ContactManager is being destroyed"));
+        }
+    }
+}
+
+void ContactManager::AttributesBatcher::setInterval(int msec)
+{
+    mInterval = msec;
+    mTimer->setInterval(qMax(msec, 0));
+
+    if (msec < 0) {
+        // Batching disabled, don't let anything already queued wait any longer
+        flush();
+    }
+}
+
+ContactManager::PendingBatchedAttributes *ContactManager::AttributesBatcher::request(
+        const UIntList &handles, const QStringList &interfaces)
+{
+    PendingBatchedAttributes *request = new PendingBatchedAttributes(mManager->connection(),
+            handles, interfaces);
+    ++mRequestCount;
+
+    // Never split a single request across calls, but don't let the batch it joins grow
+    // past the limit either
+    if (mMaxBatchSize > 0 && !mQueuedRequests.isEmpty() &&
+        mQueuedHandles.size() + handles.size() > mMaxBatchSize) {
+        flush();
+    }
+
+    mQueuedRequests.append(request);
+    foreach (uint handle, handles) {
+        mQueuedHandles.insert(handle);
+    }
+    foreach (const QString &interface, interfaces) {
+        mQueuedInterfaces.insert(interface);
+    }
+
+    if (mInterval < 0 || (mMaxBatchSize > 0 && mQueuedHandles.size() >= mMaxBatchSize)) {
+        flush();
+    } else if (!mTimer->isActive()) {
+        mTimer->start();
+    }
+
+    return request;
+}
+
+void ContactManager::AttributesBatcher::flush()
+{
+    mTimer->stop();
+
+    if (mQueuedRequests.isEmpty()) {
+        return;
+    }
+
+    QList<PendingBatchedAttributes *> requests = mQueuedRequests;
+    UIntList handles = mQueuedHandles.toList();
+    QStringList interfaces = mQueuedInterfaces.toList();
+    mQueuedRequests.clear();
+    mQueuedHandles.clear();
+    mQueuedInterfaces.clear();
+
+    ++mCallCount;
+    if (requests.size() > 1) {
+        TP_QT_TRACE(Contacts, "Coalescing %1 contact attribute requests into a single call for "
+                "%2 handles") << requests.size() << handles.size();
+    }
+
+    PendingContactAttributes *attributes =
+        mManager->connection()->lowlevel()->contactAttributes(handles, interfaces, true);
+    mRequestsInFlight.insert(attributes, requests);
+    connect(attributes,
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(onAttributesFinished(Tp::PendingOperation*)));
+}
+
+void ContactManager::AttributesBatcher::onAttributesFinished(PendingOperation *op)
+{
+    PendingContactAttributes *attributes = qobject_cast<PendingContactAttributes *>(op);
+    QList<PendingBatchedAttributes *> requests = mRequestsInFlight.take(op);
+
+    if (attributes->isError()) {
+        foreach (PendingBatchedAttributes *request, requests) {
+            request->setError(attributes->errorName(), attributes->errorMessage());
+        }
+        return;
+    }
+
+    ReferencedHandles validHandles = attributes->validHandles();
+    ContactAttributesMap allAttributes = attributes->attributes();
+    foreach (PendingBatchedAttributes *request, requests) {
+        request->setResult(validHandles, allAttributes);
+    }
+}
+
 /**
  * \class ContactManager
  * \ingroup clientconn
@@ -1022,23 +1243,26 @@ PendingContacts *ContactManager::contactsForHandles(const UIntList &handles,
         }
     }
 
+    FeatureSet realFeatureSet(realFeatures);
+    FeatureSet missingFeatureSet;
     foreach (uint handle, handles) {
         ContactPtr contact = lookupContactByHandle(handle);
         if (contact) {
-            if ((realFeatures - contact->requestedFeatures()).isEmpty()) {
+            if (contact->requestedFeatureSet().contains(realFeatureSet)) {
                 // Contact exists and has all the requested features
                 satisfyingContacts.insert(handle, contact);
             } else {
                 // Contact exists but is missing features
                 otherContacts.insert(handle);
-                missingFeatures.unite(realFeatures - contact->requestedFeatures());
+                missingFeatureSet.unite(realFeatureSet - contact->requestedFeatureSet());
             }
         } else {
             // Contact doesn't exist - we need to get all of the features (same as unite(features))
-            missingFeatures = realFeatures;
+            missingFeatureSet = realFeatureSet;
             otherContacts.insert(handle);
         }
     }
+    missingFeatures = missingFeatureSet.toFeatures();
 
     QSet<QString> interfaces = mPriv->interfacesForFeatures(missingFeatures);
 
@@ -1244,9 +1468,134 @@ PendingOperation *ContactManager::refreshContactInfo(const QList<ContactPtr> &co
     return mPriv->refreshInfoOp;
 }
 
+/**
+ * Return the time, in milliseconds, for which contact attribute requests are held back so they
+ * can be merged with other requests made in the meantime.
+ *
+ * \return The batch interval in milliseconds, or a negative value if batching is disabled.
+ * \sa setContactAttributesBatchInterval()
+ */
+int ContactManager::contactAttributesBatchInterval() const
+{
+    return mPriv->attributesBatcher->interval();
+}
+
+/**
+ * Set the time, in milliseconds, for which contact attribute requests are held back so they
+ * can be merged with other requests made in the meantime.
+ *
+ * Requests for contacts made through contactsForHandles() (and the methods using it, such as
+ * upgradeContacts()) that need to fetch attributes from the connection are queued, and all
+ * requests queued within the interval are sent as a single
+ * Client::ConnectionInterfaceContactsInterface::GetContactAttributes() call for the union of
+ * their handles and interfaces. The result is then distributed back to each PendingContacts.
+ *
+ * The default value of 0 merges the requests made during the same main loop iteration. A
+ * negative value disables batching, making each request result in its own call.
+ *
+ * \param msec The batch interval in milliseconds.
+ * \sa setContactAttributesMaxBatchSize()
+ */
+void ContactManager::setContactAttributesBatchInterval(int msec)
+{
+    mPriv->attributesBatcher->setInterval(msec);
+}
+
+/**
+ * Return the maximum number of handles a single batched contact attributes request may contain.
+ *
+ * \return The maximum batch size, or 0 if batches are unbounded.
+ * \sa setContactAttributesMaxBatchSize()
+ */
+int ContactManager::contactAttributesMaxBatchSize() const
+{
+    return mPriv->attributesBatcher->maxBatchSize();
+}
+
+/**
+ * Set the maximum number of handles a single batched contact attributes request may contain.
+ *
+ * When queueing a request would make the pending batch exceed this size, the pending batch
+ * is sent right away and a new one is started. A single request is never split, so a request
+ * for more handles than the limit is sent on its own.
+ *
+ * The default is 1000 handles. A value of 0 makes batches unbounded.
+ *
+ * \param maxHandles The maximum batch size.
+ * \sa setContactAttributesBatchInterval()
+ */
+void ContactManager::setContactAttributesMaxBatchSize(int maxHandles)
+{
+    mPriv->attributesBatcher->setMaxBatchSize(maxHandles);
+}
+
+/**
+ * Return the number of contact attribute requests made through this ContactManager.
+ *
+ * The difference between this and contactAttributesCallCount() is the number of D-Bus calls
+ * saved by batching.
+ *
+ * \return The number of requests.
+ * \sa contactAttributesCallCount()
+ */
+uint ContactManager::contactAttributesRequestCount() const
+{
+    return mPriv->attributesBatcher->requestCount();
+}
+
+/**
+ * Return the number of GetContactAttributes calls actually made on behalf of the requests
+ * counted by contactAttributesRequestCount().
+ *
+ * \return The number of calls.
+ * \sa contactAttributesRequestCount()
+ */
+uint ContactManager::contactAttributesCallCount() const
+{
+    return mPriv->attributesBatcher->callCount();
+}
+
+/**
+ * Return whether contact attributes are persisted on disk across connections.
+ *
+ * \return \c true if the persistent cache is enabled, \c false otherwise.
+ * \sa setPersistentCacheEnabled()
+ */
+bool ContactManager::isPersistentCacheEnabled() const
+{
+    return mPriv->persistentCacheEnabled;
+}
+
+/**
+ * Set whether contact attributes should be persisted on disk across connections.
+ *
+ * When enabled, the alias, avatar token, capabilities, location and client types of the contacts
+ * in the contact list are stored in a cache file, keyed by connection manager, protocol and
+ * self ID, next to the avatar cache. The next time Connection::FeatureRoster is made ready the
+ * contacts are built right away using the cached attributes, and the attributes are then
+ * fetched again in the background. Contacts whose attributes changed in the meantime are
+ * updated, emitting the usual change notification signals.
+ *
+ * This only has an effect on connections supporting the ContactList interface, and must be
+ * enabled before Connection::FeatureRoster is requested for the warm start to apply.
+ *
+ * The cache is disabled by default.
+ *
+ * \param enabled Whether the persistent cache should be used.
+ */
+void ContactManager::setPersistentCacheEnabled(bool enabled)
+{
+    mPriv->persistentCacheEnabled = enabled;
+
+    if (!enabled) {
+        delete mPriv->attributeCache;
+        mPriv->attributeCache = 0;
+    }
+}
+
 void ContactManager::onAliasesChanged(const AliasPairList &aliases)
 {
-    debug() << "Got AliasesChanged for" << aliases.size() << "contacts";
+    TP_QT_TRACE(Contacts, "Got AliasesChanged for %1 contacts") << aliases.size();
 
     foreach (AliasPair pair, aliases) {
         ContactPtr contact = lookupContactByHandle(pair.handle);
@@ -1266,58 +1615,84 @@ void ContactManager::doRequestAvatars()
     mPriv->requestAvatarsQueue.clear();
     mPriv->requestAvatarsIdle = false;
 
+    QString path = mPriv->buildAvatarPath();
+    AvatarStore *store = mPriv->ensureAvatarStore();
+
     int found = 0;
     UIntList notFound;
+    QStringList probeTokens;
     foreach (const ContactPtr &contact, contacts) {
         if (!contact) {
             continue;
         }
 
-        QString avatarFileName;
-        QString mimeTypeFileName;
-        bool success = (contact->isAvatarTokenKnown() &&
-            mPriv->buildAvatarFileName(contact->avatarToken(), false,
-                avatarFileName, mimeTypeFileName));
-
-        /* Check if the avatar is already in the cache */
-        if (success && QFile::exists(avatarFileName)) {
-            QFile mimeTypeFile(mimeTypeFileName);
-            mimeTypeFile.open(QIODevice::ReadOnly);
-            QString mimeType = QString(QLatin1String(mimeTypeFile.readAll()));
-            mimeTypeFile.close();
+        if (!contact->isAvatarTokenKnown()) {
+            notFound << contact->handle()[0];
+            continue;
+        }
 
+        /* Check if the avatar is known to be in the cache */
+        QString token = contact->avatarToken();
+        AvatarData avatar;
+        if (store->lookup(path, token, &avatar)) {
             found++;
-
-            contact->receiveAvatarData(AvatarData(avatarFileName, mimeType));
-
+            contact->receiveAvatarData(avatar);
             continue;
         }
 
-        notFound << contact->handle()[0];
+        /* Otherwise look for it on disk, once per token */
+        if (!mPriv->avatarProbes.contains(token)) {
+            probeTokens << token;
+        }
+        mPriv->avatarProbes[token].append(contact);
     }
 
     if (found > 0) {
-        debug() << "Avatar(s) found in cache for" << found << "contact(s)";
+        TP_QT_TRACE(Contacts, "Avatar(s) found in memory for %1 contact(s)") << found;
     }
 
-    if (found == contacts.size()) {
-        return;
+    if (!probeTokens.isEmpty()) {
+        store->probe(path, probeTokens);
     }
 
-    debug() << "Requesting avatar(s) for" << contacts.size() - found << "contact(s)";
+    mPriv->requestAvatars(notFound);
+}
 
-    Client::ConnectionInterfaceAvatarsInterface *avatarsInterface =
-        connection()->interface<Client::ConnectionInterfaceAvatarsInterface>();
-    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(
-        avatarsInterface->RequestAvatars(notFound),
-        this);
-    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)), watcher,
-        SLOT(deleteLater()));
+void ContactManager::onAvatarsProbed(const QString &path, const QStringList &tokens,
+        const QStringList &mimeTypes, const QStringList &missingTokens)
+{
+    int found = 0;
+    for (int i = 0; i < tokens.size(); ++i) {
+        AvatarData avatar(AvatarStore::avatarFileName(path, tokens[i]), mimeTypes[i]);
+        foreach (const ContactPtr &contact, mPriv->avatarProbes.take(tokens[i])) {
+            // The token may have changed meanwhile, in which case the new avatar has been
+            // requested already
+            if (contact->avatarToken() == tokens[i]) {
+                found++;
+                contact->receiveAvatarData(avatar);
+            }
+        }
+    }
+
+    if (found > 0) {
+        TP_QT_TRACE(Contacts, "Avatar(s) found in cache for %1 contact(s)") << found;
+    }
+
+    UIntList notFound;
+    foreach (const QString &token, missingTokens) {
+        foreach (const ContactPtr &contact, mPriv->avatarProbes.take(token)) {
+            if (contact->avatarToken() == token) {
+                notFound << contact->handle()[0];
+            }
+        }
+    }
+
+    mPriv->requestAvatars(notFound);
 }
 
 void ContactManager::onAvatarUpdated(uint handle, const QString &token)
 {
-    debug() << "Got AvatarUpdate for contact with handle" << handle;
+    TP_QT_TRACE(Contacts, "Got AvatarUpdate for contact with handle %1") << handle;
 
     ContactPtr contact = lookupContactByHandle(handle);
     if (contact) {
@@ -1328,52 +1703,50 @@ void ContactManager::onAvatarUpdated(uint handle, const QString &token)
 void ContactManager::onAvatarRetrieved(uint handle, const QString &token,
     const QByteArray &data, const QString &mimeType)
 {
-    QString avatarFileName;
-    QString mimeTypeFileName;
-
-    debug() << "Got AvatarRetrieved for contact with handle" << handle;
+    TP_QT_TRACE(Contacts, "Got AvatarRetrieved for contact with handle %1") << handle;
 
-    bool success = mPriv->buildAvatarFileName(token, true, avatarFileName,
-        mimeTypeFileName);
+    ContactPtr contact = lookupContactByHandle(handle);
+    if (contact) {
+        contact->setAvatarToken(token);
+    }
 
-    if (success) {
-        debug() << "Write avatar in cache for handle" << handle;
-        debug() << "Filename:" << avatarFileName;
-        debug() << "MimeType:" << mimeType;
+    QString path = mPriv->buildAvatarPath();
+    AvatarStore *store = mPriv->ensureAvatarStore();
 
-        if (!QFile::exists(mimeTypeFileName)) {
-            QTemporaryFile mimeTypeFile(mimeTypeFileName);
-            if (mimeTypeFile.open()) {
-                mimeTypeFile.write(mimeType.toLatin1());
-                mimeTypeFile.setAutoRemove(false);
-                if (!mimeTypeFile.rename(mimeTypeFileName)) {
-                    mimeTypeFile.remove();
-                }
-            }
+    AvatarData avatar;
+    if (store->lookup(path, token, &avatar)) {
+        if (contact) {
+            contact->receiveAvatarData(AvatarData(avatar.fileName, mimeType));
         }
+        return;
+    }
 
-        if (!QFile::exists(avatarFileName)) {
-            QTemporaryFile avatarFile(avatarFileName);
-            if (avatarFile.open()) {
-                avatarFile.write(data);
-                avatarFile.setAutoRemove(false);
-                if (!avatarFile.rename(avatarFileName)) {
-                    avatarFile.remove();
-                }
-            }
-        }
+    // The avatar is handed to the contact once it has been written to disk, several contacts
+    // sharing the same avatar only get it written once
+    bool storing = mPriv->avatarStores.contains(token);
+    mPriv->avatarStores[token].append(handle);
+    if (!storing) {
+        TP_QT_TRACE(Contacts, "Write avatar in cache for handle %1") << handle;
+        store->store(path, token, data, mimeType);
     }
+}
 
-    ContactPtr contact = lookupContactByHandle(handle);
-    if (contact) {
-        contact->setAvatarToken(token);
-        contact->receiveAvatarData(AvatarData(avatarFileName, mimeType));
+void ContactManager::onAvatarStored(const QString &path, const QString &token,
+        const QString &mimeType, bool success)
+{
+    AvatarData avatar(success ? AvatarStore::avatarFileName(path, token) : QString(),
+            mimeType);
+    foreach (uint handle, mPriv->avatarStores.take(token)) {
+        ContactPtr contact = lookupContactByHandle(handle);
+        if (contact && contact->avatarToken() == token) {
+            contact->receiveAvatarData(avatar);
+        }
     }
 }
 
 void ContactManager::onPresencesChanged(const SimpleContactPresences &presences)
 {
-    debug() << "Got PresencesChanged for" << presences.size() << "contacts";
+    TP_QT_TRACE(Contacts, "Got PresencesChanged for %1 contacts") << presences.size();
 
     foreach (uint handle, presences.keys()) {
         ContactPtr contact = lookupContactByHandle(handle);
@@ -1386,7 +1759,7 @@ void ContactManager::onPresencesChanged(const SimpleContactPresences &presences)
 
 void ContactManager::onCapabilitiesChanged(const ContactCapabilitiesMap &caps)
 {
-    debug() << "Got ContactCapabilitiesChanged for" << caps.size() << "contacts";
+    TP_QT_TRACE(Contacts, "Got ContactCapabilitiesChanged for %1 contacts") << caps.size();
 
     foreach (uint handle, caps.keys()) {
         ContactPtr contact = lookupContactByHandle(handle);
@@ -1399,7 +1772,7 @@ void ContactManager::onCapabilitiesChanged(const ContactCapabilitiesMap &caps)
 
 void ContactManager::onLocationUpdated(uint handle, const QVariantMap &location)
 {
-    debug() << "Got LocationUpdated for contact with handle" << handle;
+    TP_QT_TRACE(Contacts, "Got LocationUpdated for contact with handle %1") << handle;
 
     ContactPtr contact = lookupContactByHandle(handle);
 
@@ -1410,7 +1783,7 @@ void ContactManager::onLocationUpdated(uint handle, const QVariantMap &location)
 
 void ContactManager::onContactInfoChanged(uint handle, const Tp::ContactInfoFieldList &info)
 {
-    debug() << "Got ContactInfoChanged for contact with handle" << handle;
+    TP_QT_TRACE(Contacts, "Got ContactInfoChanged for contact with handle %1") << handle;
 
     ContactPtr contact = lookupContactByHandle(handle);
 
@@ -1421,7 +1794,7 @@ void ContactManager::onContactInfoChanged(uint handle, const Tp::ContactInfoFiel
 
 void ContactManager::onClientTypesUpdated(uint handle, const QStringList &clientTypes)
 {
-    debug() << "Got ClientTypesUpdated for contact with handle" << handle;
+    TP_QT_TRACE(Contacts, "Got ClientTypesUpdated for contact with handle %1") << handle;
 
     ContactPtr contact = lookupContactByHandle(handle);
 
@@ -1578,6 +1951,56 @@ void ContactManager::ensureTracking(const Feature &feature)
     mPriv->tracking[feature] = true;
 }
 
+ContactManager::PendingBatchedAttributes *ContactManager::requestContactAttributes(
+        const UIntList &handles, const QStringList &interfaces)
+{
+    return mPriv->attributesBatcher->request(handles, interfaces);
+}
+
+ContactManager::AttributeCache *ContactManager::attributeCache()
+{
+    return mPriv->attributeCache;
+}
+
+ContactManager::AttributeCache *ContactManager::loadAttributeCache(const QString &selfId)
+{
+    if (!mPriv->persistentCacheEnabled) {
+        return 0;
+    }
+
+    if (!mPriv->attributeCache) {
+        mPriv->attributeCache = new AttributeCache(mPriv->buildAttributeCacheFileName(selfId));
+        mPriv->attributeCache->load();
+    }
+
+    return mPriv->attributeCache;
+}
+
+const ContactAttributeDecoder *ContactManager::attributeDecoder()
+{
+    ConnectionPtr conn(connection());
+
+    // The attribute interfaces are only known once the connection is ready, until then (or when
+    // they can't be known at all) every attribute has to be recognized
+    if (!conn->isReady(Connection::FeatureCore) || conn->status() != ConnectionStatusConnected ||
+            !conn->interfaces().contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACTS)) {
+        if (!mPriv->fullAttributeDecoder) {
+            mPriv->fullAttributeDecoder = new ContactAttributeDecoder();
+        }
+        return mPriv->fullAttributeDecoder;
+    }
+
+    // Comparing the lists is cheap while they share their data, which they do until the
+    // connection gets a new list of interfaces
+    QStringList interfaces = conn->lowlevel()->contactAttributeInterfaces();
+    if (!mPriv->attributeDecoder || mPriv->attributeDecoder->interfaces() != interfaces) {
+        delete mPriv->attributeDecoder;
+        mPriv->attributeDecoder = new ContactAttributeDecoder(interfaces);
+    }
+
+    return mPriv->attributeDecoder;
+}
+
 PendingOperation *ContactManager::introspectRoster()
 {
     return mPriv->roster->introspect();
@@ -44,6 +44,7 @@ namespace Tp
 {
 
 class Connection;
+class ContactAttributeDecoder;
 class PendingContacts;
 class PendingOperation;
 
@@ -129,6 +130,16 @@ public:
 
     PendingOperation *refreshContactInfo(const QList<ContactPtr> &contact);
 
+    int contactAttributesBatchInterval() const;
+    void setContactAttributesBatchInterval(int msec);
+    int contactAttributesMaxBatchSize() const;
+    void setContactAttributesMaxBatchSize(int maxHandles);
+    uint contactAttributesRequestCount() const;
+    uint contactAttributesCallCount() const;
+
+    bool isPersistentCacheEnabled() const;
+    void setPersistentCacheEnabled(bool enabled);
+
 Q_SIGNALS:
     void stateChanged(Tp::ContactListState state);
 
@@ -158,12 +169,24 @@ private Q_SLOTS:
     TP_QT_NO_EXPORT void onContactInfoChanged(uint, const Tp::ContactInfoFieldList &);
     TP_QT_NO_EXPORT void onClientTypesUpdated(uint, const QStringList &);
     TP_QT_NO_EXPORT void doRefreshInfo();
+    TP_QT_NO_EXPORT void onAvatarsProbed(const QString &, const QStringList &,
+            const QStringList &, const QStringList &);
+    TP_QT_NO_EXPORT void onAvatarStored(const QString &, const QString &, const QString &, bool);
 
 private:
+    class AttributeCache;
+    class AttributesBatcher;
+    class AvatarStore;
+    class PendingBatchedAttributes;
     class PendingRefreshContactInfo;
     class Roster;
+    friend class AttributeCache;
+    friend class AttributesBatcher;
+    friend class AvatarStore;
     friend class Channel;
     friend class Connection;
+    friend class Contact;
+    friend class PendingBatchedAttributes;
     friend class PendingContacts;
     friend class PendingRefreshContactInfo;
     friend class Roster;
@@ -181,6 +204,14 @@ private:
     TP_QT_NO_EXPORT static QString featureToInterface(const Feature &feature);
     TP_QT_NO_EXPORT void ensureTracking(const Feature &feature);
 
+    TP_QT_NO_EXPORT PendingBatchedAttributes *requestContactAttributes(const UIntList &handles,
+            const QStringList &interfaces);
+
+    TP_QT_NO_EXPORT AttributeCache *attributeCache();
+    TP_QT_NO_EXPORT AttributeCache *loadAttributeCache(const QString &selfId);
+
+    TP_QT_NO_EXPORT const ContactAttributeDecoder *attributeDecoder();
+
     TP_QT_NO_EXPORT PendingOperation *introspectRoster();
     TP_QT_NO_EXPORT PendingOperation *introspectRosterGroups();
     TP_QT_NO_EXPORT void resetRoster();
@@ -24,7 +24,9 @@
 
 #include "TelepathyQt/_gen/contact.moc.hpp"
 
+#include "TelepathyQt/contact-attribute-decoder.h"
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/feature-set-internal.h"
 #include "TelepathyQt/future-internal.h"
 
 #include <TelepathyQt/AvatarData>
@@ -43,6 +45,19 @@
 namespace Tp
 {
 
+namespace
+{
+
+template<typename T>
+T attributeValue(const ContactAttributeDecoder::Result &decoded,
+        ContactAttributeDecoder::Attribute attribute)
+{
+    const QVariant *value = decoded.value(attribute);
+    return value ? qdbus_cast<T>(*value) : T();
+}
+
+}
+
 struct TP_QT_NO_EXPORT Contact::Private
 {
     Private(Contact *parent, ContactManager *manager,
@@ -68,8 +83,8 @@ struct TP_QT_NO_EXPORT Contact::Private
     ReferencedHandles handle;
     QString id;
 
-    Features requestedFeatures;
-    Features actualFeatures;
+    FeatureSet requestedFeatures;
+    FeatureSet actualFeatures;
 
     QString alias;
     QMap<QString, QString> vcardAddresses;
@@ -321,7 +336,7 @@ Contact::Contact(ContactManager *manager, const ReferencedHandles &handle,
     : Object(),
       mPriv(new Private(this, manager, handle))
 {
-    mPriv->requestedFeatures.unite(requestedFeatures);
+    mPriv->requestedFeatures.unite(FeatureSet(requestedFeatures));
     mPriv->id = qdbus_cast<QString>(attributes[
             TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")]);
 }
@@ -372,7 +387,7 @@ QString Contact::id() const
  */
 Features Contact::requestedFeatures() const
 {
-    return mPriv->requestedFeatures;
+    return mPriv->requestedFeatures.toFeatures();
 }
 
 /**
@@ -382,7 +397,12 @@ Features Contact::requestedFeatures() const
  */
 Features Contact::actualFeatures() const
 {
-    return mPriv->actualFeatures;
+    return mPriv->actualFeatures.toFeatures();
+}
+
+const FeatureSet &Contact::requestedFeatureSet() const
+{
+    return mPriv->requestedFeatures;
 }
 
 /**
@@ -987,24 +1007,24 @@ PendingStringList *Contact::requestClientTypes()
 
 void Contact::augment(const Features &requestedFeatures, const QVariantMap &attributes)
 {
-    mPriv->requestedFeatures.unite(requestedFeatures);
+    mPriv->requestedFeatures.unite(FeatureSet(requestedFeatures));
 
-    mPriv->id = qdbus_cast<QString>(attributes[
-            TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")]);
+    ContactManagerPtr manager = this->manager();
+    ContactAttributeDecoder::Result decoded;
+    manager->attributeDecoder()->decode(attributes, decoded);
+
+    mPriv->id = attributeValue<QString>(decoded, ContactAttributeDecoder::ContactId);
 
-    if (attributes.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
-                QLatin1String("/subscribe"))) {
-        uint subscriptionState = qdbus_cast<uint>(attributes.value(
-                     TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/subscribe")));
+    if (decoded.contains(ContactAttributeDecoder::Subscribe)) {
+        uint subscriptionState = attributeValue<uint>(decoded,
+                ContactAttributeDecoder::Subscribe);
         setSubscriptionState((SubscriptionState) subscriptionState);
     }
 
-    if (attributes.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
-                QLatin1String("/publish"))) {
-        uint publishState = qdbus_cast<uint>(attributes.value(
-                    TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/publish")));
-        QString publishRequest = qdbus_cast<QString>(attributes.value(
-                    TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/publish-request")));
+    if (decoded.contains(ContactAttributeDecoder::Publish)) {
+        uint publishState = attributeValue<uint>(decoded, ContactAttributeDecoder::Publish);
+        QString publishRequest = attributeValue<QString>(decoded,
+                ContactAttributeDecoder::PublishRequest);
         setPublishState((SubscriptionState) publishState, publishRequest);
     }
 
@@ -1016,8 +1036,7 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
         ContactInfoFieldList maybeInfo;
 
         if (feature == FeatureAlias) {
-            maybeAlias = qdbus_cast<QString>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING + QLatin1String("/alias")));
+            maybeAlias = attributeValue<QString>(decoded, ContactAttributeDecoder::Alias);
 
             if (!maybeAlias.isEmpty()) {
                 receiveAlias(maybeAlias);
@@ -1025,17 +1044,16 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
                 mPriv->alias = mPriv->id;
             }
         } else if (feature == FeatureAvatarData) {
-            if (manager()->supportedFeatures().contains(FeatureAvatarData)) {
+            if (manager->supportedFeatures().contains(FeatureAvatarData)) {
                 mPriv->actualFeatures.insert(FeatureAvatarData);
                 mPriv->updateAvatarData();
             }
         } else if (feature == FeatureAvatarToken) {
-            if (attributes.contains(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token"))) {
-                receiveAvatarToken(qdbus_cast<QString>(attributes.value(
-                                TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS + QLatin1String("/token"))));
+            if (decoded.contains(ContactAttributeDecoder::AvatarToken)) {
+                receiveAvatarToken(attributeValue<QString>(decoded,
+                            ContactAttributeDecoder::AvatarToken));
             } else {
-                if (manager()->supportedFeatures().contains(FeatureAvatarToken)) {
+                if (manager->supportedFeatures().contains(FeatureAvatarToken)) {
                     // AvatarToken being supported but not included in the mapping indicates
                     // that the avatar token is not known - however, the feature is working fine
                     mPriv->actualFeatures.insert(FeatureAvatarToken);
@@ -1045,13 +1063,13 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
                 mPriv->avatarToken = QLatin1String("");
             }
         } else if (feature == FeatureCapabilities) {
-            maybeCaps = qdbus_cast<RequestableChannelClassList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_CAPABILITIES + QLatin1String("/capabilities")));
+            maybeCaps = attributeValue<RequestableChannelClassList>(decoded,
+                    ContactAttributeDecoder::Capabilities);
 
             if (!maybeCaps.isEmpty()) {
                 receiveCapabilities(maybeCaps);
             } else {
-                if (manager()->supportedFeatures().contains(FeatureCapabilities) &&
+                if (manager->supportedFeatures().contains(FeatureCapabilities) &&
                     mPriv->requestedFeatures.contains(FeatureCapabilities)) {
                     // Capabilities being supported but not updated in the
                     // mapping indicates that the capabilities is not known -
@@ -1060,13 +1078,13 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
                 }
             }
         } else if (feature == FeatureInfo) {
-            maybeInfo = qdbus_cast<ContactInfoFieldList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_INFO + QLatin1String("/info")));
+            maybeInfo = attributeValue<ContactInfoFieldList>(decoded,
+                    ContactAttributeDecoder::Info);
 
             if (!maybeInfo.isEmpty()) {
                 receiveInfo(maybeInfo);
             } else {
-                if (manager()->supportedFeatures().contains(FeatureInfo) &&
+                if (manager->supportedFeatures().contains(FeatureInfo) &&
                     mPriv->requestedFeatures.contains(FeatureInfo)) {
                     // Info being supported but not updated in the
                     // mapping indicates that the info is not known -
@@ -1075,13 +1093,13 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
                 }
             }
         } else if (feature == FeatureLocation) {
-            maybeLocation = qdbus_cast<QVariantMap>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_LOCATION + QLatin1String("/location")));
+            maybeLocation = attributeValue<QVariantMap>(decoded,
+                    ContactAttributeDecoder::Location);
 
             if (!maybeLocation.isEmpty()) {
                 receiveLocation(maybeLocation);
             } else {
-                if (manager()->supportedFeatures().contains(FeatureLocation) &&
+                if (manager->supportedFeatures().contains(FeatureLocation) &&
                     mPriv->requestedFeatures.contains(FeatureLocation)) {
                     // Location being supported but not updated in the
                     // mapping indicates that the location is not known -
@@ -1090,8 +1108,8 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
                 }
             }
         } else if (feature == FeatureSimplePresence) {
-            maybePresence = qdbus_cast<SimplePresence>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE + QLatin1String("/presence")));
+            maybePresence = attributeValue<SimplePresence>(decoded,
+                    ContactAttributeDecoder::Presence);
 
             if (!maybePresence.status.isEmpty()) {
                 receiveSimplePresence(maybePresence);
@@ -1100,23 +1118,23 @@ void Contact::augment(const Features &requestedFeatures, const QVariantMap &attr
                         QLatin1String("unknown"), QLatin1String(""));
             }
         } else if (feature == FeatureRosterGroups) {
-            QStringList groups = qdbus_cast<QStringList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS + QLatin1String("/groups")));
+            QStringList groups = attributeValue<QStringList>(decoded,
+                    ContactAttributeDecoder::Groups);
             mPriv->groups = groups.toSet();
         } else if (feature == FeatureAddresses) {
-            VCardFieldAddressMap addresses = qdbus_cast<VCardFieldAddressMap>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_ADDRESSING + QLatin1String("/addresses")));
-            QStringList uris = qdbus_cast<QStringList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_ADDRESSING + QLatin1String("/uris")));
+            VCardFieldAddressMap addresses = attributeValue<VCardFieldAddressMap>(decoded,
+                    ContactAttributeDecoder::Addresses);
+            QStringList uris = attributeValue<QStringList>(decoded,
+                    ContactAttributeDecoder::Uris);
             receiveAddresses(addresses, uris);
         } else if (feature == FeatureClientTypes) {
-            QStringList maybeClientTypes = qdbus_cast<QStringList>(attributes.value(
-                        TP_QT_IFACE_CONNECTION_INTERFACE_CLIENT_TYPES + QLatin1String("/client-types")));
+            QStringList maybeClientTypes = attributeValue<QStringList>(decoded,
+                    ContactAttributeDecoder::ClientTypes);
 
             if (!maybeClientTypes.isEmpty()) {
                 receiveClientTypes(maybeClientTypes);
             } else {
-                if (manager()->supportedFeatures().contains(FeatureClientTypes) &&
+                if (manager->supportedFeatures().contains(FeatureClientTypes) &&
                     mPriv->requestedFeatures.contains(FeatureClientTypes)) {
                     // ClientTypes being supported but not updated in the
                     // mapping indicates that the info is not known -
@@ -27,12 +27,14 @@
 #include "TelepathyQt/_gen/dbus-proxy.moc.hpp"
 
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/name-owner-cache-internal.h"
 
 #include <TelepathyQt/Constants>
 
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
 #include <QDBusError>
+#include <QDBusReply>
 #include <QDBusServiceWatcher>
 #include <QTimer>
 
@@ -327,15 +329,21 @@ QString StatefulDBusProxy::uniqueNameFrom(const QDBusConnection &bus, const QStr
     }
 
     // For a stateful interface, it makes no sense to follow name-owner
-    // changes, so we want to bind to the unique name.
+    // changes, so we want to bind to the unique name. The owner is looked up
+    // only once per name, and kept up to date from NameOwnerChanged afterwards.
+    NameOwnerCache *cache = NameOwnerCache::instance();
+    if (cache) {
+        return cache->owner(bus, name, error, message);
+    }
+
+    // No application to keep the cache up to date in, ask the bus every time
     QDBusReply<QString> reply = bus.interface()->serviceOwner(name);
-    if (reply.isValid()) {
-        return reply.value();
-    } else {
+    if (!reply.isValid()) {
         error = reply.error().name();
         message = reply.error().message();
         return QString();
     }
+    return reply.value();
 }
 
 void StatefulDBusProxy::onServiceOwnerChanged(const QString &name, const QString &oldOwner, const QString &newOwner)
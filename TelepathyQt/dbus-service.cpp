@@ -21,6 +21,7 @@
  */
 
 #include <TelepathyQt/DBusService>
+#include "TelepathyQt/dbus-service-internal.h"
 
 #include "TelepathyQt/_gen/dbus-service.moc.hpp"
 
@@ -30,11 +31,62 @@
 #include <TelepathyQt/DBusObject>
 
 #include <QDBusConnection>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <QSet>
 #include <QString>
 
 namespace Tp
 {
 
+namespace
+{
+
+struct BusNames
+{
+    QMutex lock;
+    // (Bus connection name, bus name)
+    QSet<QPair<QString, QString> > names;
+};
+
+Q_GLOBAL_STATIC(BusNames, ownedBusNames)
+
+}
+
+bool OwnedBusNames::contains(const QDBusConnection &dbusConnection, const QString &busName)
+{
+    BusNames *busNames = ownedBusNames();
+    if (!busNames) {
+        return false;
+    }
+
+    QMutexLocker locker(&busNames->lock);
+    return busNames->names.contains(qMakePair(dbusConnection.name(), busName));
+}
+
+void OwnedBusNames::insert(const QDBusConnection &dbusConnection, const QString &busName)
+{
+    BusNames *busNames = ownedBusNames();
+    if (!busNames) {
+        return;
+    }
+
+    QMutexLocker locker(&busNames->lock);
+    busNames->names.insert(qMakePair(dbusConnection.name(), busName));
+}
+
+void OwnedBusNames::remove(const QDBusConnection &dbusConnection, const QString &busName)
+{
+    BusNames *busNames = ownedBusNames();
+    if (!busNames) {
+        return;
+    }
+
+    QMutexLocker locker(&busNames->lock);
+    busNames->names.remove(qMakePair(dbusConnection.name(), busName));
+}
+
 struct TP_QT_NO_EXPORT DBusService::Private
 {
     Private(DBusService *parent, const QDBusConnection &dbusConnection)
@@ -148,6 +200,10 @@ bool DBusService::isRegistered() const
  * A service may only be registered once in its lifetime.
  * Use isRegistered() to find out if it has already been registered or not.
  *
+ * The bus name is only requested from the bus daemon if no other service of this process has
+ * already been registered with it on the same D-Bus connection, so registering several services
+ * under the same bus name costs no bus round trips past the first one.
+ *
  * You normally don't need to use this method directly.
  * Subclasses should provide a simplified version of it.
  *
@@ -164,21 +220,33 @@ bool DBusService::registerObject(const QString &busName, const QString &objectPa
         return true;
     }
 
-    if (!mPriv->dbusObject->dbusConnection().registerService(busName)) {
-        error->set(TP_QT_ERROR_INVALID_ARGUMENT,
-                QString(QLatin1String("Name %1 already in use by another process"))
-                    .arg(busName));
-        warning() << "Unable to register service" << busName <<
-            "- name already registered by another process";
-        return false;
+    QDBusConnection dbusConnection = mPriv->dbusObject->dbusConnection();
+    bool requestedBusName = false;
+    if (!OwnedBusNames::contains(dbusConnection, busName)) {
+        if (!dbusConnection.registerService(busName)) {
+            error->set(TP_QT_ERROR_INVALID_ARGUMENT,
+                    QString(QLatin1String("Name %1 already in use by another process"))
+                        .arg(busName));
+            warning() << "Unable to register service" << busName <<
+                "- name already registered by another process";
+            return false;
+        }
+        OwnedBusNames::insert(dbusConnection, busName);
+        requestedBusName = true;
     }
 
-    if (!mPriv->dbusObject->dbusConnection().registerObject(objectPath, mPriv->dbusObject)) {
+    if (!dbusConnection.registerObject(objectPath, mPriv->dbusObject)) {
         error->set(TP_QT_ERROR_INVALID_ARGUMENT,
                 QString(QLatin1String("Object at path %1 already registered"))
                     .arg(objectPath));
         warning() << "Unable to register object" << objectPath <<
             "- path already registered";
+
+        // Don't keep a name nothing is exported under, unless it was ours already
+        if (requestedBusName) {
+            OwnedBusNames::remove(dbusConnection, busName);
+            dbusConnection.unregisterService(busName);
+        }
         return false;
     }
 
@@ -55,8 +55,8 @@ struct TP_QT_NO_EXPORT DBusTubeChannel::Private
     QHash<QString, Tp::ContactPtr> contactsForBusNames;
     QString address;
 
-    QHash<QUuid, QString> pendingNewBusNamesToAdd;
-    QList<QUuid> pendingNewBusNamesToRemove;
+    QHash<uint, QString> pendingNewBusNamesToAdd;
+    QSet<uint> pendingNewBusNamesToRemove;
 
     QueuedContactFactory *queuedContactFactory;
 };
@@ -66,8 +66,8 @@ DBusTubeChannel::Private::Private(DBusTubeChannel *parent)
           queuedContactFactory(new QueuedContactFactory(parent->connection()->contactManager(), parent))
 {
     parent->connect(queuedContactFactory,
-            SIGNAL(contactsRetrieved(QUuid,QList<Tp::ContactPtr>)),
-            SLOT(onContactsRetrieved(QUuid,QList<Tp::ContactPtr>)));
+            SIGNAL(contactsRetrieved(uint,QList<Tp::ContactPtr>)),
+            SLOT(onContactsRetrieved(uint,QList<Tp::ContactPtr>)));
 
     // Initialize readinessHelper + introspectables here
     readinessHelper = parent->readinessHelper();
@@ -105,8 +105,8 @@ void DBusTubeChannel::Private::extractParticipants(const Tp::DBusTubeParticipant
     for (DBusTubeParticipants::const_iterator i = participants.constBegin();
          i != participants.constEnd();
          ++i) {
-        QUuid uuid = queuedContactFactory->appendNewRequest(UIntList() << i.key());
-        pendingNewBusNamesToAdd.insert(uuid, i.value());
+        uint requestId = queuedContactFactory->appendNewRequest(UIntList() << i.key());
+        pendingNewBusNamesToAdd.insert(requestId, i.value());
     }
 }
 
@@ -401,23 +401,23 @@ void DBusTubeChannel::onDBusNamesChanged(const Tp::DBusTubeParticipants &added,
     for (DBusTubeParticipants::const_iterator i = added.constBegin();
          i != added.constEnd();
          ++i) {
-        QUuid uuid = mPriv->queuedContactFactory->appendNewRequest(UIntList() << i.key());
+        uint requestId = mPriv->queuedContactFactory->appendNewRequest(UIntList() << i.key());
         // Add it to our hash as well
-        mPriv->pendingNewBusNamesToAdd.insert(uuid, i.value());
+        mPriv->pendingNewBusNamesToAdd.insert(requestId, i.value());
     }
 
     foreach (uint handle, removed) {
-        QUuid uuid = mPriv->queuedContactFactory->appendNewRequest(UIntList() << handle);
+        uint requestId = mPriv->queuedContactFactory->appendNewRequest(UIntList() << handle);
         // Add it to pending removed as well
-        mPriv->pendingNewBusNamesToRemove << uuid;
+        mPriv->pendingNewBusNamesToRemove << requestId;
     }
 }
 
-void DBusTubeChannel::onContactsRetrieved(const QUuid &uuid, const QList<ContactPtr> &contacts)
+void DBusTubeChannel::onContactsRetrieved(uint requestId, const QList<ContactPtr> &contacts)
 {
     // Retrieve our hash
-    if (mPriv->pendingNewBusNamesToAdd.contains(uuid)) {
-        QString busName = mPriv->pendingNewBusNamesToAdd.take(uuid);
+    if (mPriv->pendingNewBusNamesToAdd.contains(requestId)) {
+        QString busName = mPriv->pendingNewBusNamesToAdd.take(requestId);
 
         // Add it to our connections hash
         foreach (const Tp::ContactPtr &contact, contacts) {
@@ -428,8 +428,7 @@ void DBusTubeChannel::onContactsRetrieved(const QUuid &uuid, const QList<Contact
                 emit busNameAdded(busName, contact);
             }
         }
-    } else if (mPriv->pendingNewBusNamesToRemove.contains(uuid)) {
-        mPriv->pendingNewBusNamesToRemove.removeOne(uuid);
+    } else if (mPriv->pendingNewBusNamesToRemove.remove(requestId)) {
 
         // Remove it from our connections hash
         foreach (const Tp::ContactPtr &contact, contacts) {
@@ -52,6 +52,10 @@ namespace Tp
  *
  * The default is <code>false</code> ie. no debug output.
  *
+ * The events of the busiest code paths (contact attribute updates, roster changes and the message
+ * queue of text channels) are not part of the debug output, even when it's enabled: they are
+ * traced instead, see \ref tracing. Use enableTracing() and dumpTracedMessages() to get them too.
+ *
  * \param enable Whether debug output should be enabled or not.
  */
 
@@ -28,6 +28,10 @@
 #endif
 
 #include <TelepathyQt/Global>
+#include <TelepathyQt/Types>
+
+#include <QDBusConnection>
+#include <QStringList>
 
 namespace Tp
 {
@@ -41,6 +45,14 @@ typedef void (*DebugCallback)(const QString &libraryName,
                               const QString &msg);
 TP_QT_EXPORT void setDebugCallback(DebugCallback cb);
 
+TP_QT_EXPORT QStringList tracingCategories();
+TP_QT_EXPORT QStringList enabledTracingCategories();
+TP_QT_EXPORT void enableTracing(const QStringList &categories);
+TP_QT_EXPORT DebugMessageList tracedMessages();
+TP_QT_EXPORT void dumpTracedMessages();
+TP_QT_EXPORT bool registerTracingDebugObject(
+        const QDBusConnection &bus = QDBusConnection::sessionBus());
+
 } // Tp
 
 #endif
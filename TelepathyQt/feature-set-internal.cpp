@@ -0,0 +1,129 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "TelepathyQt/feature-set-internal.h"
+
+namespace Tp
+{
+
+FeatureSet::FeatureSet(const Features &features)
+{
+    foreach (const Feature &feature, features) {
+        insert(feature);
+    }
+}
+
+bool FeatureSet::isEmpty() const
+{
+    foreach (quint32 word, mWords) {
+        if (word) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int FeatureSet::size() const
+{
+    int ret = 0;
+    foreach (quint32 word, mWords) {
+        for (; word; word &= word - 1) {
+            ++ret;
+        }
+    }
+    return ret;
+}
+
+/*
+ * Return whether all of the features in \a other are in this set.
+ */
+bool FeatureSet::contains(const FeatureSet &other) const
+{
+    for (int i = 0; i < other.mWords.size(); ++i) {
+        quint32 word = i < mWords.size() ? mWords[i] : 0;
+        if (other.mWords[i] & ~word) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FeatureSet::intersects(const FeatureSet &other) const
+{
+    int words = qMin(mWords.size(), other.mWords.size());
+    for (int i = 0; i < words; ++i) {
+        if (mWords[i] & other.mWords[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+FeatureSet &FeatureSet::unite(const FeatureSet &other)
+{
+    if (other.mWords.size() > mWords.size()) {
+        mWords.resize(other.mWords.size());
+    }
+    for (int i = 0; i < other.mWords.size(); ++i) {
+        mWords[i] |= other.mWords[i];
+    }
+    return *this;
+}
+
+FeatureSet &FeatureSet::subtract(const FeatureSet &other)
+{
+    int words = qMin(mWords.size(), other.mWords.size());
+    for (int i = 0; i < words; ++i) {
+        mWords[i] &= ~other.mWords[i];
+    }
+    return *this;
+}
+
+bool FeatureSet::operator==(const FeatureSet &other) const
+{
+    int words = qMax(mWords.size(), other.mWords.size());
+    for (int i = 0; i < words; ++i) {
+        quint32 word = i < mWords.size() ? mWords[i] : 0;
+        quint32 otherWord = i < other.mWords.size() ? other.mWords[i] : 0;
+        if (word != otherWord) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Features FeatureSet::toFeatures() const
+{
+    Features ret;
+    for (int i = 0; i < mWords.size(); ++i) {
+        for (quint32 word = mWords[i]; word; word &= word - 1) {
+            int bit = 0;
+            while (!(word & (quint32(1) << bit))) {
+                ++bit;
+            }
+            ret.insert(Feature::fromInternedId(i * bitsPerWord + bit));
+        }
+    }
+    return ret;
+}
+
+} // Tp
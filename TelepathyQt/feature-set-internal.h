@@ -0,0 +1,114 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef _TelepathyQt_feature_set_internal_h_HEADER_GUARD_
+#define _TelepathyQt_feature_set_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Feature>
+#include <TelepathyQt/Global>
+
+#include <QDebug>
+#include <QVector>
+
+namespace Tp
+{
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+/*
+ * A set of features, stored as a bit array indexed by the interned id of each feature.
+ *
+ * Membership tests and set arithmetic don't hash or compare any strings, which makes this the
+ * preferred representation for sets which are queried often. Features is used at API boundaries.
+ *
+ * Exported so the tests can use it even if they link dynamically. The header is not installed
+ * though, so this should be considered private API.
+ */
+class TP_QT_EXPORT FeatureSet
+{
+public:
+    FeatureSet() {}
+    explicit FeatureSet(const Features &features);
+
+    bool isEmpty() const;
+    int size() const;
+    void clear() { mWords.clear(); }
+
+    bool contains(const Feature &feature) const
+    {
+        int id = feature.internedId();
+        int word = id / bitsPerWord;
+        return word < mWords.size() && (mWords[word] & bit(id));
+    }
+
+    bool contains(const FeatureSet &other) const;
+    bool intersects(const FeatureSet &other) const;
+
+    void insert(const Feature &feature)
+    {
+        int id = feature.internedId();
+        int word = id / bitsPerWord;
+        if (word >= mWords.size()) {
+            mWords.resize(word + 1);
+        }
+        mWords[word] |= bit(id);
+    }
+
+    void remove(const Feature &feature)
+    {
+        int id = feature.internedId();
+        int word = id / bitsPerWord;
+        if (word < mWords.size()) {
+            mWords[word] &= ~bit(id);
+        }
+    }
+
+    FeatureSet &unite(const FeatureSet &other);
+    FeatureSet &subtract(const FeatureSet &other);
+
+    FeatureSet &operator+=(const FeatureSet &other) { return unite(other); }
+    FeatureSet &operator-=(const FeatureSet &other) { return subtract(other); }
+    FeatureSet operator-(const FeatureSet &other) const { return FeatureSet(*this).subtract(other); }
+
+    bool operator==(const FeatureSet &other) const;
+    bool operator!=(const FeatureSet &other) const { return !(*this == other); }
+
+    Features toFeatures() const;
+
+private:
+    static const int bitsPerWord = 32;
+
+    static quint32 bit(int id) { return quint32(1) << (id % bitsPerWord); }
+
+    QVector<quint32> mWords;
+};
+
+inline QDebug operator<<(QDebug dbg, const FeatureSet &features)
+{
+    return dbg << features.toFeatures();
+}
+
+#endif // DOXYGEN_SHOULD_SKIP_THIS
+
+} // Tp
+
+#endif
@@ -22,14 +22,78 @@
 
 #include <TelepathyQt/Feature>
 
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
 namespace Tp
 {
 
+namespace
+{
+
+/*
+ * Maps each distinct (class name, id) pair to a small integer, in order of first use, so that
+ * FeatureSet can represent sets of features as bit arrays.
+ *
+ * Features are usually constructed once, as static members of the classes they belong to, so
+ * interning them costs a string hash per Feature rather than per set operation.
+ */
+struct FeatureRegistry
+{
+    int intern(const QPair<QString, uint> &key)
+    {
+        QMutexLocker locker(&mutex);
+        QHash<QPair<QString, uint>, int>::const_iterator i = ids.constFind(key);
+        if (i != ids.constEnd()) {
+            return *i;
+        }
+
+        int id = features.size();
+        ids.insert(key, id);
+        features.append(Feature());
+        return id;
+    }
+
+    void remember(int id, const Feature &feature)
+    {
+        QMutexLocker locker(&mutex);
+        if (!features[id].isValid()) {
+            features[id] = feature;
+        }
+    }
+
+    Feature feature(int id)
+    {
+        QMutexLocker locker(&mutex);
+        return features.value(id);
+    }
+
+    QMutex mutex;
+    QHash<QPair<QString, uint>, int> ids;
+    QVector<Feature> features;
+};
+
+FeatureRegistry &registry()
+{
+    static FeatureRegistry registry;
+    return registry;
+}
+
+}
+
 struct TP_QT_NO_EXPORT Feature::Private : public QSharedData
 {
-    Private(bool critical) : critical(critical) {}
+    Private(const QString &className, uint featureId, bool critical)
+        : className(className), featureId(featureId), critical(critical), id(-1) {}
 
+    // The (class name, id) pair id was interned for, as first and second are public and may be
+    // written to afterwards
+    QString className;
+    uint featureId;
     bool critical;
+    int id;
 };
 
 /**
@@ -48,8 +112,11 @@ Feature::Feature()
 
 Feature::Feature(const QString &className, uint id, bool critical)
     : QPair<QString, uint>(className, id),
-      mPriv(new Private(critical))
+      mPriv(new Private(className, id, critical))
 {
+    // Only copy into the registry once the id is set, as copies share the private data
+    mPriv->id = registry().intern(*this);
+    registry().remember(mPriv->id, *this);
 }
 
 Feature::Feature(const Feature &other)
@@ -64,8 +131,9 @@ Feature::~Feature()
 
 Feature &Feature::operator=(const Feature &other)
 {
-    *this = other;
-    this->mPriv = other.mPriv;
+    first = other.first;
+    second = other.second;
+    mPriv = other.mPriv;
     return *this;
 }
 
@@ -78,6 +146,31 @@ bool Feature::isCritical() const
     return mPriv->critical;
 }
 
+/*
+ * Return the small integer identifying the (class name, id) pair of this feature, which is
+ * the same for all features comparing equal.
+ *
+ * The id interned on construction is only used while first and second still hold the pair it was
+ * interned for. Copies share the class name string, so checking that usually doesn't compare any
+ * characters.
+ */
+int Feature::internedId() const
+{
+    if (!isValid() || second != mPriv->featureId || first != mPriv->className) {
+        return registry().intern(*this);
+    }
+
+    return mPriv->id;
+}
+
+/*
+ * Return a feature with the given interned id, which must have been returned by internedId().
+ */
+Feature Feature::fromInternedId(int id)
+{
+    return registry().feature(id);
+}
+
 /**
  * \class Features
  * \ingroup utils
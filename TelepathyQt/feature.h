@@ -53,6 +53,11 @@ public:
     bool isCritical() const;
 
 private:
+    friend class FeatureSet;
+
+    int internedId() const;
+    static Feature fromInternedId(int id);
+
     struct Private;
     friend struct Private;
     QSharedDataPointer<Private> mPriv;
@@ -26,23 +26,53 @@
 
 #include "TelepathyQt/debug-internal.h"
 
+#include "config.h"
+
 #include <TelepathyQt/Connection>
 #include <TelepathyQt/PendingFailure>
 #include <TelepathyQt/PendingVariant>
 #include <TelepathyQt/Types>
 #include <TelepathyQt/types-internal.h>
 
+#include <QFile>
 #include <QIODevice>
+#include <QSocketNotifier>
 #include <QTcpSocket>
 
+#ifdef HAVE_SPLICE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
 namespace Tp
 {
 
+static const int FT_BLOCK_SIZE = 16 * 1024;
+
+#ifdef HAVE_SPLICE
+// Size requested for the pipe data is spliced through, and how much is received at most before
+// returning to the event loop
+static const int FT_PIPE_SIZE = 1024 * 1024;
+static const qint64 FT_MAX_RECEIVE_SIZE = 8 * 1024 * 1024;
+#endif
+
 struct TP_QT_NO_EXPORT IncomingFileTransferChannel::Private
 {
     Private(IncomingFileTransferChannel *parent);
     ~Private();
 
+    bool startSplice();
+    void stopSplice();
+#ifdef HAVE_SPLICE
+    void spliceToFile(QFile *file, loff_t *offset, ssize_t len);
+#endif
+
+    bool takeOverSocket();
+    void releaseSocket();
+    bool receive();
+
     // Public object
     IncomingFileTransferChannel *parent;
 
@@ -54,6 +84,13 @@ struct TP_QT_NO_EXPORT IncomingFileTransferChannel::Private
 
     qulonglong requestedOffset;
     qint64 pos;
+
+    // splice() fast path, used when the output is a regular file. Once requestedOffset has been
+    // reached, the socket is taken over from QTcpSocket and read from socketFd directly.
+    bool canSplice;
+    int pipeFds[2];
+    int socketFd;
+    QSocketNotifier *socketNotifier;
 };
 
 IncomingFileTransferChannel::Private::Private(IncomingFileTransferChannel *parent)
@@ -62,8 +99,13 @@ IncomingFileTransferChannel::Private::Private(IncomingFileTransferChannel *paren
       output(0),
       socket(0),
       requestedOffset(0),
-      pos(0)
+      pos(0),
+      canSplice(false),
+      socketFd(-1),
+      socketNotifier(0)
 {
+    pipeFds[0] = pipeFds[1] = -1;
+
     parent->connect(fileTransferInterface,
             SIGNAL(URIDefined(QString)),
             SLOT(onUriDefined(QString)));
@@ -74,6 +116,192 @@ IncomingFileTransferChannel::Private::Private(IncomingFileTransferChannel *paren
 
 IncomingFileTransferChannel::Private::~Private()
 {
+    releaseSocket();
+    stopSplice();
+}
+
+bool IncomingFileTransferChannel::Private::startSplice()
+{
+#ifdef HAVE_SPLICE
+    QFile *file = qobject_cast<QFile *>(output);
+    if (!file || file->isSequential() || file->handle() == -1) {
+        return false;
+    }
+
+    if (pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        warning() << "Unable to create pipe for splice():" << strerror(errno);
+        pipeFds[0] = pipeFds[1] = -1;
+        return false;
+    }
+
+    // The default pipe size would cap every splice() to 64 KiB, try to make it bigger
+    fcntl(pipeFds[1], F_SETPIPE_SZ, FT_PIPE_SIZE);
+
+    debug() << "Output is a regular file, receiving it with splice()";
+    canSplice = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void IncomingFileTransferChannel::Private::stopSplice()
+{
+#ifdef HAVE_SPLICE
+    canSplice = false;
+
+    for (int i = 0; i < 2; ++i) {
+        if (pipeFds[i] != -1) {
+            ::close(pipeFds[i]);
+            pipeFds[i] = -1;
+        }
+    }
+#endif
+}
+
+#ifdef HAVE_SPLICE
+// Move the len bytes just spliced into the pipe to the file, at offset
+void IncomingFileTransferChannel::Private::spliceToFile(QFile *file, loff_t *offset, ssize_t len)
+{
+    while (len > 0) {
+        ssize_t written = ::splice(pipeFds[0], NULL, file->handle(), offset, len, SPLICE_F_MOVE);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        } else if (written <= 0) {
+            // Don't lose what is already in the pipe, write it and the rest of the file the usual
+            // way
+            warning() << "splice() to file failed:" << strerror(errno) <<
+                "- falling back to copying";
+            file->seek(*offset);
+            char buffer[FT_BLOCK_SIZE];
+            while (len > 0) {
+                ssize_t count = ::read(pipeFds[0], buffer, qMin(len, (ssize_t) sizeof(buffer)));
+                if (count <= 0) {
+                    break;
+                }
+                file->write(buffer, count);
+                len -= count;
+            }
+            stopSplice();
+            return;
+        }
+        len -= written;
+    }
+}
+#endif
+
+/*
+ * Take the socket over from QTcpSocket, so that it can be spliced from.
+ *
+ * QTcpSocket has no way of giving its descriptor away, so a duplicate of it is kept and QTcpSocket
+ * is aborted, which only closes its own descriptor. Nothing else reads from the socket after
+ * that, and socketNotifier is the only notifier watching it.
+ */
+bool IncomingFileTransferChannel::Private::takeOverSocket()
+{
+#ifdef HAVE_SPLICE
+    if (socket->state() != QAbstractSocket::ConnectedState) {
+        return false;
+    }
+
+    int fd = fcntl(socket->socketDescriptor(), F_DUPFD_CLOEXEC, 0);
+    if (fd == -1) {
+        warning() << "Unable to take over the file transfer socket:" << strerror(errno);
+        return false;
+    }
+
+    QObject::disconnect(socket, 0, parent, 0);
+    socket->abort();
+
+    socketFd = fd;
+    socketNotifier = new QSocketNotifier(socketFd, QSocketNotifier::Read, parent);
+    parent->connect(socketNotifier,
+            SIGNAL(activated(int)),
+            SLOT(doTransfer()));
+    return true;
+#else
+    return false;
+#endif
+}
+
+void IncomingFileTransferChannel::Private::releaseSocket()
+{
+#ifdef HAVE_SPLICE
+    if (socketFd == -1) {
+        return;
+    }
+
+    // This may be called from the notifier's own activated() signal
+    socketNotifier->setEnabled(false);
+    socketNotifier->deleteLater();
+    socketNotifier = 0;
+    ::close(socketFd);
+    socketFd = -1;
+#endif
+}
+
+/*
+ * Move the data waiting in the taken over socket to the output file, with splice() unless it
+ * failed before. Returns false once the socket has been closed by the other end or failed.
+ */
+bool IncomingFileTransferChannel::Private::receive()
+{
+#ifdef HAVE_SPLICE
+    QFile *file = qobject_cast<QFile *>(output);
+
+    // Anything written through QFile must hit the file before we write past it
+    file->flush();
+
+    loff_t offset = file->pos();
+    qint64 total = 0;
+    while (total < FT_MAX_RECEIVE_SIZE) {
+        ssize_t len;
+        if (canSplice) {
+            len = ::splice(socketFd, NULL, pipeFds[1], NULL, FT_PIPE_SIZE,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (len == -1 && errno != EINTR && errno != EAGAIN) {
+                warning() << "splice() from socket failed:" << strerror(errno) <<
+                    "- falling back to copying";
+                stopSplice();
+                file->seek(offset);
+                continue;
+            }
+        } else {
+            char buffer[FT_BLOCK_SIZE];
+            len = ::read(socketFd, buffer, sizeof(buffer));
+            if (len > 0) {
+                file->write(buffer, len);
+            }
+        }
+
+        if (len == -1 && errno == EINTR) {
+            continue;
+        } else if (len == -1 && errno == EAGAIN) {
+            break;
+        } else if (len == -1) {
+            warning() << "Reading from the file transfer socket failed:" << strerror(errno);
+            return false;
+        } else if (len == 0) {
+            // EOF
+            return false;
+        }
+
+        if (canSplice) {
+            spliceToFile(file, &offset, len);
+        }
+
+        pos += len;
+        total += len;
+    }
+
+    // splice() doesn't move the file position, so sync it for writes done through QFile
+    if (canSplice) {
+        file->seek(offset);
+    }
+    return true;
+#else
+    return false;
+#endif
 }
 
 /**
@@ -308,6 +536,8 @@ void IncomingFileTransferChannel::connectToHost()
     connect(mPriv->socket, SIGNAL(readyRead()),
             SLOT(doTransfer()));
 
+    mPriv->startSplice();
+
     debug().nospace() << "Connecting to host " <<
         mPriv->addr.address << ":" << mPriv->addr.port << "...";
     mPriv->socket->connectToHost(mPriv->addr.address, mPriv->addr.port);
@@ -334,22 +564,46 @@ void IncomingFileTransferChannel::onSocketError(QAbstractSocket::SocketError err
 
 void IncomingFileTransferChannel::doTransfer()
 {
-    QByteArray data;
+    if (mPriv->socketFd != -1) {
+        if (!mPriv->receive()) {
+            debug() << "Disconnected from host";
+            setFinished();
+        }
+        return;
+    }
+
+    // Write whatever QTcpSocket already read, skipping until we reach requestedOffset
+    char buffer[FT_BLOCK_SIZE];
     while (mPriv->socket->bytesAvailable()) {
-        data = mPriv->socket->readAll();
+        qint64 len = mPriv->socket->read(buffer, sizeof(buffer));
+        if (len <= 0) {
+            break;
+        }
 
-        // skip until we reach requetedOffset and start writing from there
+        char *p = buffer;
         if ((qulonglong) mPriv->pos < mPriv->requestedOffset) {
-            if ((qulonglong) data.length() <= (mPriv->requestedOffset - mPriv->pos)) {
-                break;
-            }
-            data = data.mid(mPriv->requestedOffset - mPriv->pos);
+            qint64 skip = (qint64) qMin(mPriv->requestedOffset - mPriv->pos,
+                    (qulonglong) len);
+            mPriv->pos += skip;
+            p += skip;
+            len -= skip;
         }
 
-        mPriv->output->write(data); // never fails
+        if (len > 0) {
+            mPriv->output->write(p, len); // never fails
+            mPriv->pos += len;
+        }
     }
 
-    mPriv->pos += data.length();
+    // Everything QTcpSocket read has been written, so the rest can be spliced
+    if (mPriv->canSplice && (qulonglong) mPriv->pos >= mPriv->requestedOffset) {
+        if (mPriv->takeOverSocket()) {
+            doTransfer();
+        } else {
+            debug() << "Falling back to copying the file transfer data";
+            mPriv->stopSplice();
+        }
+    }
 }
 
 void IncomingFileTransferChannel::setFinished()
@@ -371,6 +625,9 @@ void IncomingFileTransferChannel::setFinished()
         mPriv->socket->close();
     }
 
+    mPriv->releaseSocket();
+    mPriv->stopSplice();
+
     if (mPriv->output) {
         mPriv->output->close();
     }
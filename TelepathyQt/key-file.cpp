@@ -22,16 +22,21 @@
 
 #include "TelepathyQt/key-file.h"
 
+#include "TelepathyQt/config-index-internal.h"
 #include "TelepathyQt/debug-internal.h"
 
 #include <TelepathyQt/Utils>
 
 #include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
 #include <QtCore/QHash>
 #include <QtCore/QString>
 #include <QtCore/QStringList>
 
+#include <string.h>
+
 namespace Tp
 {
 
@@ -43,6 +48,8 @@ struct TP_QT_NO_EXPORT KeyFile::Private
     void setFileName(const QString &fName);
     void setError(KeyFile::Status status, const QString &reason);
     bool read();
+    bool readCached(const QFileInfo &fileInfo);
+    bool parse(const char *contents, qint64 size);
 
     bool validateKey(const QByteArray &data, int from, int to, QString &result);
 
@@ -92,18 +99,68 @@ void KeyFile::Private::setError(KeyFile::Status st, const QString &reason)
 bool KeyFile::Private::read()
 {
     QFile file(fileName);
-    if (!file.exists()) {
+    QFileInfo fileInfo(file);
+    if (!fileInfo.exists()) {
         setError(KeyFile::NotFoundError,
                  QLatin1String("file does not exist"));
         return false;
     }
 
+    // Files are usually unchanged since some process last parsed them
+    if (readCached(fileInfo)) {
+        return true;
+    }
+
     if (!file.open(QFile::ReadOnly)) {
         setError(KeyFile::AccessError,
                  QLatin1String("cannot open file for readonly access"));
         return false;
     }
 
+    qint64 size = file.size();
+    const char *contents = reinterpret_cast<const char *>(size ? file.map(0, size) : 0);
+    QByteArray buffer;
+    if (!contents) {
+        buffer = file.readAll();
+        contents = buffer.constData();
+        size = buffer.size();
+    }
+
+    if (!parse(contents, size)) {
+        return false;
+    }
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+    out << groups;
+
+    // Saved once the caller is done loading files, see ConfigIndex::instance()
+    ConfigIndex::instance()->insert(fileInfo, data);
+    return true;
+}
+
+bool KeyFile::Private::readCached(const QFileInfo &fileInfo)
+{
+    QByteArray data;
+    if (!ConfigIndex::instance()->lookup(fileInfo, data)) {
+        return false;
+    }
+
+    QHash<QString, QHash<QString, QByteArray> > cachedGroups;
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_4_6);
+    in >> cachedGroups;
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    groups = cachedGroups;
+    return true;
+}
+
+bool KeyFile::Private::parse(const char *contents, qint64 size)
+{
     QByteArray data;
     QByteArray group;
     QString currentGroup;
@@ -111,8 +168,16 @@ bool KeyFile::Private::read()
     QByteArray rawValue;
     int line = 0;
     int idx;
-    while (!file.atEnd()) {
-        data = file.readLine().trimmed();
+    qint64 pos = 0;
+    while (pos < size) {
+        const char *lineStart = contents + pos;
+        const char *lineEnd = static_cast<const char *>(memchr(lineStart, '\n', size - pos));
+        if (!lineEnd) {
+            lineEnd = contents + size;
+        }
+        pos = lineEnd - contents + 1;
+
+        data = QByteArray(lineStart, lineEnd - lineStart).trimmed();
         line++;
 
         if (data.size() == 0) {
@@ -22,6 +22,7 @@
 
 #include "TelepathyQt/manager-file.h"
 
+#include "TelepathyQt/config-index-internal.h"
 #include "TelepathyQt/debug-internal.h"
 #include "TelepathyQt/key-file.h"
 
@@ -93,28 +94,7 @@ ManagerFile::Private::Private(const QString &cmName)
 
 void ManagerFile::Private::init()
 {
-    // TODO: should we cache the configDirs anywhere?
-    QStringList configDirs;
-
-    QString xdgDataHome = QString::fromLocal8Bit(qgetenv("XDG_DATA_HOME"));
-    if (xdgDataHome.isEmpty()) {
-        configDirs << QDir::homePath() + QLatin1String("/.local/share/data/telepathy/managers/");
-    }
-    else {
-        configDirs << xdgDataHome + QLatin1String("/telepathy/managers/");
-    }
-
-    QString xdgDataDirsEnv = QString::fromLocal8Bit(qgetenv("XDG_DATA_DIRS"));
-    if (xdgDataDirsEnv.isEmpty()) {
-        configDirs << QLatin1String("/usr/local/share/telepathy/managers/");
-        configDirs << QLatin1String("/usr/share/telepathy/managers/");
-    }
-    else {
-        QStringList xdgDataDirs = xdgDataDirsEnv.split(QLatin1Char(':'));
-        foreach (const QString xdgDataDir, xdgDataDirs) {
-            configDirs << xdgDataDir + QLatin1String("/telepathy/managers/");
-        }
-    }
+    QStringList configDirs = ConfigIndex::dataDirs(QLatin1String("telepathy/managers"));
 
     foreach (const QString configDir, configDirs) {
         QString fileName = configDir + cmName + QLatin1String(".manager");
@@ -126,6 +106,7 @@ void ManagerFile::Private::init()
                 continue;
             }
             valid = true;
+            ConfigIndex::instance()->sync();
             return;
         }
     }
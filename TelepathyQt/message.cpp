@@ -46,25 +46,34 @@ uint uintOrZeroFromPart(const MessagePartList &parts, uint index, const char *ke
     return valueFromPart(parts, index, key).toUInt();
 }
 
-QString stringOrEmptyFromPart(const MessagePartList &parts, uint index, const char *key)
+QString stringOrEmpty(const QVariant &v)
 {
-    QString s = valueFromPart(parts, index, key).toString();
+    QString s = v.toString();
     if (s.isNull()) {
         s = QLatin1String("");
     }
     return s;
 }
 
-bool booleanFromPart(const MessagePartList &parts, uint index, const char *key,
-            bool assumeIfAbsent)
+QString stringOrEmptyFromPart(const MessagePartList &parts, uint index, const char *key)
+{
+    return stringOrEmpty(valueFromPart(parts, index, key));
+}
+
+bool booleanOr(const QVariant &v, bool assumeIfAbsent)
 {
-    QVariant v = valueFromPart(parts, index, key);
     if (v.isValid() && v.type() == QVariant::Bool) {
         return v.toBool();
     }
     return assumeIfAbsent;
 }
 
+bool booleanFromPart(const MessagePartList &parts, uint index, const char *key,
+            bool assumeIfAbsent)
+{
+    return booleanOr(valueFromPart(parts, index, key), assumeIfAbsent);
+}
+
 MessagePartList partsFromPart(const MessagePartList &parts, uint index, const char *key)
 {
     return qdbus_cast<MessagePartList>(valueFromPart(parts, index, key));
@@ -82,6 +91,9 @@ struct TP_QT_NO_EXPORT Message::Private : public QSharedData
     Private(const MessagePartList &parts);
     ~Private();
 
+    void parseHeader();
+    void parseBody();
+
     uint senderHandle() const;
     QString senderId() const;
     uint pendingId() const;
@@ -89,6 +101,28 @@ struct TP_QT_NO_EXPORT Message::Private : public QSharedData
 
     MessagePartList parts;
 
+    // The header fields the accessors need, looked up once rather than on each call. Anything
+    // changing parts[0] must call parseHeader() again.
+    struct Header
+    {
+        uint sent;
+        uint received;
+        uint messageType;
+        uint senderHandle;
+        uint pendingId;
+        QString senderId;
+        QString senderNickname;
+        QString messageToken;
+        QString supersededToken;
+        QString dbusInterface;
+        bool scrollback;
+        bool rescued;
+    } header;
+
+    // The concatenated text/plain parts. Anything changing the body parts must call parseBody()
+    // again.
+    QString text;
+
     // if the Text interface says "non-text" we still only have the text,
     // because the interface can't tell us anything else...
     bool forceNonText;
@@ -103,30 +137,117 @@ Message::Private::Private(const MessagePartList &parts)
       forceNonText(false),
       sender(0)
 {
+    parseHeader();
+    parseBody();
 }
 
 Message::Private::~Private()
 {
 }
 
+void Message::Private::parseHeader()
+{
+    header.sent = 0;
+    header.received = 0;
+    header.messageType = 0;
+    header.senderHandle = 0;
+    header.pendingId = 0;
+    header.senderId = QLatin1String("");
+    header.senderNickname = QLatin1String("");
+    header.messageToken = QLatin1String("");
+    header.supersededToken = QLatin1String("");
+    header.dbusInterface = QLatin1String("");
+    header.scrollback = false;
+    header.rescued = false;
+
+    if (parts.isEmpty()) {
+        return;
+    }
+
+    const MessagePart &part = parts.at(0);
+    for (MessagePart::const_iterator i = part.constBegin(); i != part.constEnd(); ++i) {
+        const QString &key = i.key();
+        const QVariant value = i.value().variant();
+
+        // FIXME See http://bugs.freedesktop.org/show_bug.cgi?id=21690 for the timestamps
+        if (key == QLatin1String("message-sent")) {
+            header.sent = value.toUInt();
+        } else if (key == QLatin1String("message-received")) {
+            header.received = value.toUInt();
+        } else if (key == QLatin1String("message-type")) {
+            header.messageType = value.toUInt();
+        } else if (key == QLatin1String("message-sender")) {
+            header.senderHandle = value.toUInt();
+        } else if (key == QLatin1String("pending-message-id")) {
+            header.pendingId = value.toUInt();
+        } else if (key == QLatin1String("message-sender-id")) {
+            header.senderId = stringOrEmpty(value);
+        } else if (key == QLatin1String("sender-nickname")) {
+            header.senderNickname = stringOrEmpty(value);
+        } else if (key == QLatin1String("message-token")) {
+            header.messageToken = stringOrEmpty(value);
+        } else if (key == QLatin1String("supersedes")) {
+            header.supersededToken = stringOrEmpty(value);
+        } else if (key == QLatin1String("interface")) {
+            header.dbusInterface = stringOrEmpty(value);
+        } else if (key == QLatin1String("scrollback")) {
+            header.scrollback = booleanOr(value, false);
+        } else if (key == QLatin1String("rescued")) {
+            header.rescued = booleanOr(value, false);
+        }
+    }
+}
+
+void Message::Private::parseBody()
+{
+    // Alternative-groups for which we've already emitted an alternative
+    QSet<QString> altGroupsUsed;
+    text = QString();
+
+    for (int i = 1; i < parts.size(); i++) {
+        const MessagePart &part = parts.at(i);
+        QString contentType = part.value(QLatin1String("content-type")).variant().toString();
+
+        if (contentType == QLatin1String("text/plain")) {
+            QString altGroup = part.value(QLatin1String("alternative")).variant().toString();
+            if (!altGroup.isEmpty()) {
+                if (altGroupsUsed.contains(altGroup)) {
+                    continue;
+                } else {
+                    altGroupsUsed << altGroup;
+                }
+            }
+
+            QVariant content = part.value(QLatin1String("content")).variant();
+            if (content.type() == QVariant::String) {
+                text += content.toString();
+            } else {
+                // O RLY?
+                debug() << "allegedly text/plain part wasn't";
+            }
+        }
+    }
+}
+
 inline uint Message::Private::senderHandle() const
 {
-    return uintOrZeroFromPart(parts, 0, "message-sender");
+    return header.senderHandle;
 }
 
 inline QString Message::Private::senderId() const
 {
-    return stringOrEmptyFromPart(parts, 0, "message-sender-id");
+    return header.senderId;
 }
 
 inline uint Message::Private::pendingId() const
 {
-    return uintOrZeroFromPart(parts, 0, "pending-message-id");
+    return header.pendingId;
 }
 
 void Message::Private::clearSenderHandle()
 {
     parts[0].remove(QLatin1String("message-sender"));
+    header.senderHandle = 0;
 }
 
 /**
@@ -177,6 +298,8 @@ Message::Message(uint timestamp, uint type, const QString &text)
     mPriv->parts[1].insert(QLatin1String("content-type"),
             QDBusVariant(QLatin1String("text/plain")));
     mPriv->parts[1].insert(QLatin1String("content"), QDBusVariant(text));
+    mPriv->parseHeader();
+    mPriv->parseBody();
 }
 
 /**
@@ -194,6 +317,8 @@ Message::Message(ChannelTextMessageType type, const QString &text)
     mPriv->parts[1].insert(QLatin1String("content-type"),
             QDBusVariant(QLatin1String("text/plain")));
     mPriv->parts[1].insert(QLatin1String("content"), QDBusVariant(text));
+    mPriv->parseHeader();
+    mPriv->parseBody();
 }
 
 /**
@@ -240,7 +365,7 @@ Message::~Message()
 QDateTime Message::sent() const
 {
     // FIXME See http://bugs.freedesktop.org/show_bug.cgi?id=21690
-    uint stamp = valueFromPart(mPriv->parts, 0, "message-sent").toUInt();
+    uint stamp = mPriv->header.sent;
     if (stamp != 0) {
         return QDateTime::fromTime_t(stamp);
     } else {
@@ -256,7 +381,7 @@ QDateTime Message::sent() const
  */
 ChannelTextMessageType Message::messageType() const
 {
-    uint raw = valueFromPart(mPriv->parts, 0, "message-type").toUInt();
+    uint raw = mPriv->header.messageType;
 
     if (raw < static_cast<uint>(NUM_CHANNEL_TEXT_MESSAGE_TYPES)) {
         return ChannelTextMessageType(raw);
@@ -307,7 +432,6 @@ bool Message::hasNonTextContent() const
                 texts << altGroup;
             }
         } else {
-            QString alt = stringOrEmptyFromPart(mPriv->parts, i, "alternative");
             if (altGroup.isEmpty()) {
                 // we can't possibly rescue this part by using a text/plain
                 // alternative, because it's not in any alternative group
@@ -331,7 +455,7 @@ bool Message::hasNonTextContent() const
  */
 QString Message::messageToken() const
 {
-    return stringOrEmptyFromPart(mPriv->parts, 0, "message-token");
+    return mPriv->header.messageToken;
 }
 
 /**
@@ -349,7 +473,7 @@ QString Message::messageToken() const
  */
 bool Message::isSpecificToDBusInterface() const
 {
-    return !dbusInterface().isEmpty();
+    return !mPriv->header.dbusInterface.isEmpty();
 }
 
 /**
@@ -361,7 +485,7 @@ bool Message::isSpecificToDBusInterface() const
  */
 QString Message::dbusInterface() const
 {
-    return stringOrEmptyFromPart(mPriv->parts, 0, "interface");
+    return mPriv->header.dbusInterface;
 }
 
 /**
@@ -371,34 +495,7 @@ QString Message::dbusInterface() const
  */
 QString Message::text() const
 {
-    // Alternative-groups for which we've already emitted an alternative
-    QSet<QString> altGroupsUsed;
-    QString text;
-
-    for (int i = 1; i < size(); i++) {
-        QString altGroup = stringOrEmptyFromPart(mPriv->parts, i, "alternative");
-        QString contentType = stringOrEmptyFromPart(mPriv->parts, i, "content-type");
-
-        if (contentType == QLatin1String("text/plain")) {
-            if (!altGroup.isEmpty()) {
-                if (altGroupsUsed.contains(altGroup)) {
-                    continue;
-                } else {
-                    altGroupsUsed << altGroup;
-                }
-            }
-
-            QVariant content = valueFromPart(mPriv->parts, i, "content");
-            if (content.type() == QVariant::String) {
-                text += content.toString();
-            } else {
-                // O RLY?
-                debug() << "allegedly text/plain part wasn't";
-            }
-        }
-    }
-
-    return text;
+    return mPriv->text;
 }
 
 /**
@@ -726,6 +823,7 @@ ReceivedMessage::ReceivedMessage(const MessagePartList &parts,
         mPriv->parts[0].insert(QLatin1String("message-received"),
                 QDBusVariant(static_cast<qlonglong>(
                         QDateTime::currentDateTime().toTime_t())));
+        mPriv->parseHeader();
     }
     mPriv->textChannel = channel;
 }
@@ -765,7 +863,7 @@ ReceivedMessage::~ReceivedMessage()
 QDateTime ReceivedMessage::received() const
 {
     // FIXME See http://bugs.freedesktop.org/show_bug.cgi?id=21690
-    uint stamp = valueFromPart(mPriv->parts, 0, "message-received").toUInt();
+    uint stamp = mPriv->header.received;
     if (stamp != 0) {
         return QDateTime::fromTime_t(stamp);
     } else {
@@ -793,7 +891,7 @@ ContactPtr ReceivedMessage::sender() const
  */
 QString ReceivedMessage::senderNickname() const
 {
-    QString ret = stringOrEmptyFromPart(mPriv->parts, 0, "sender-nickname");
+    QString ret = mPriv->header.senderNickname;
     if (ret.isEmpty() && mPriv->sender) {
         ret = mPriv->sender->alias();
     }
@@ -811,7 +909,7 @@ QString ReceivedMessage::senderNickname() const
  */
 QString ReceivedMessage::supersededToken() const
 {
-    return stringOrEmptyFromPart(mPriv->parts, 0, "supersedes");
+    return mPriv->header.supersededToken;
 }
 
 /**
@@ -826,7 +924,7 @@ QString ReceivedMessage::supersededToken() const
  */
 bool ReceivedMessage::isScrollback() const
 {
-    return booleanFromPart(mPriv->parts, 0, "scrollback", false);
+    return mPriv->header.scrollback;
 }
 
 /**
@@ -840,7 +938,7 @@ bool ReceivedMessage::isScrollback() const
  */
 bool ReceivedMessage::isRescued() const
 {
-    return booleanFromPart(mPriv->parts, 0, "rescued", false);
+    return mPriv->header.rescued;
 }
 
 /**
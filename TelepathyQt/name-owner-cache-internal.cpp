@@ -0,0 +1,326 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TelepathyQt/name-owner-cache-internal.h"
+
+#include "TelepathyQt/_gen/name-owner-cache-internal.moc.hpp"
+
+#include "TelepathyQt/debug-internal.h"
+
+#include <QCoreApplication>
+#include <QDBusConnectionInterface>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusReply>
+#include <QDBusServiceWatcher>
+#include <QThread>
+
+namespace Tp
+{
+
+PendingNameOwner::PendingNameOwner(const QString &name)
+    : PendingOperation(SharedPtr<RefCounted>()),
+      mName(name)
+{
+}
+
+PendingNameOwner::~PendingNameOwner()
+{
+}
+
+/*
+ * NameOwnerCache keeps track of the unique names owning the well-known names StatefulDBusProxy
+ * objects are constructed for, so that constructing several proxies for the same service only
+ * costs a single GetNameOwner call.
+ *
+ * Owners are forgotten as soon as NameOwnerChanged says the name has been released, and updated
+ * when it moves to another connection. Concurrent asynchronous lookups of the same name share a
+ * single call.
+ *
+ * The cache lives in the main thread, which is where its watchers deliver NameOwnerChanged, so it
+ * is only created once a QCoreApplication exists, and deleted again by a post routine when the
+ * application goes away. The blocking owner() lookup may be used from any thread, while resolve()
+ * is meant for the main thread only.
+ *
+ * As the owners are updated by the main thread, a cached owner lags behind the bus by however long
+ * it takes the main thread to get to NameOwnerChanged: until then, looking up a name which has
+ * just changed hands gives the previous owner, and for as long as the main thread doesn't run an
+ * event loop, owners aren't updated at all. That's no worse than the owner changing right after a
+ * GetNameOwner call, which callers have to cope with anyway, and proxies constructed with a stale
+ * owner are invalidated once the name owner change gets to them.
+ */
+
+namespace
+{
+
+struct NameOwnerCacheHolder
+{
+    NameOwnerCacheHolder() : cache(0), deleted(false) {}
+
+    QMutex lock;
+    NameOwnerCache *cache;
+    bool deleted;
+};
+
+Q_GLOBAL_STATIC(NameOwnerCacheHolder, nameOwnerCacheHolder)
+
+void deleteNameOwnerCache()
+{
+    NameOwnerCacheHolder *holder = nameOwnerCacheHolder();
+    if (holder) {
+        QMutexLocker locker(&holder->lock);
+        delete holder->cache;
+        holder->cache = 0;
+        holder->deleted = true;
+    }
+}
+
+}
+
+/*
+ * Return the cache, creating it on first use, or 0 if there is no QCoreApplication (yet, or
+ * anymore) for it to live in.
+ */
+NameOwnerCache *NameOwnerCache::instance()
+{
+    QCoreApplication *app = QCoreApplication::instance();
+    NameOwnerCacheHolder *holder = nameOwnerCacheHolder();
+    if (!app || !holder) {
+        return 0;
+    }
+
+    QMutexLocker locker(&holder->lock);
+    if (!holder->cache && !holder->deleted) {
+        holder->cache = new NameOwnerCache;
+        holder->cache->moveToThread(app->thread());
+        qAddPostRoutine(deleteNameOwnerCache);
+    }
+    return holder->cache;
+}
+
+NameOwnerCache::NameOwnerCache()
+    : QObject()
+{
+}
+
+NameOwnerCache::~NameOwnerCache()
+{
+}
+
+QString NameOwnerCache::cachedOwner(const QDBusConnection &bus, const QString &name) const
+{
+    if (name.startsWith(QLatin1String(":"))) {
+        return name;
+    }
+
+    QMutexLocker locker(&mLock);
+    return cachedOwnerLocked(bus, name);
+}
+
+QString NameOwnerCache::cachedOwnerLocked(const QDBusConnection &bus, const QString &name) const
+{
+    if (name.startsWith(QLatin1String(":"))) {
+        return name;
+    }
+
+    QHash<BusId, Bus>::const_iterator i = mBuses.constFind(busId(bus));
+    if (i == mBuses.constEnd()) {
+        return QString();
+    }
+    return i->owners.value(name);
+}
+
+/*
+ * Return the unique name owning \a name, blocking on a GetNameOwner call if it isn't known yet.
+ */
+QString NameOwnerCache::owner(const QDBusConnection &bus, const QString &name,
+        QString &error, QString &message)
+{
+    QMutexLocker locker(&mLock);
+
+    QString uniqueName = cachedOwnerLocked(bus, name);
+    if (!uniqueName.isEmpty()) {
+        return uniqueName;
+    }
+
+    // Watch before asking, so a change racing with the call isn't missed
+    watch(bus, name);
+
+    // Don't hold the lock over the call, the main thread may need it to process NameOwnerChanged
+    locker.unlock();
+    QDBusReply<QString> reply = bus.interface()->serviceOwner(name);
+    locker.relock();
+
+    Bus &busData = mBuses[busId(bus)];
+    if (!reply.isValid()) {
+        error = reply.error().name();
+        message = reply.error().message();
+        unwatch(busData, name);
+        return QString();
+    }
+
+    // NameOwnerChanged may have told us about a newer owner already
+    if (!busData.owners.contains(name)) {
+        busData.owners.insert(name, reply.value());
+    }
+    return busData.owners.value(name);
+}
+
+/*
+ * Start looking up the unique name owning \a name without blocking. The returned operation
+ * finishes once the owner is known, sharing the call with any other lookup of the same name
+ * still in flight.
+ */
+PendingNameOwner *NameOwnerCache::resolve(const QDBusConnection &bus, const QString &name)
+{
+    Q_ASSERT(QThread::currentThread() == thread());
+
+    PendingNameOwner *op = new PendingNameOwner(name);
+
+    QMutexLocker locker(&mLock);
+    QString uniqueName = cachedOwnerLocked(bus, name);
+    if (!uniqueName.isEmpty()) {
+        op->mOwner = uniqueName;
+        op->setFinished();
+        return op;
+    }
+
+    Bus &busData = watch(bus, name);
+
+    QDBusPendingCallWatcher *watcher = busData.lookups.value(name);
+    if (!watcher) {
+        debug() << "Looking up the owner of" << name;
+
+        watcher = new QDBusPendingCallWatcher(
+                bus.interface()->asyncCall(QLatin1String("GetNameOwner"), name), this);
+        connect(watcher,
+                SIGNAL(finished(QDBusPendingCallWatcher*)),
+                SLOT(onLookupFinished(QDBusPendingCallWatcher*)));
+        busData.lookups.insert(name, watcher);
+
+        Lookup &lookup = mLookups[watcher];
+        lookup.busId = busId(bus);
+        lookup.name = name;
+    }
+
+    mLookups[watcher].waiters.append(op);
+    return op;
+}
+
+void NameOwnerCache::onServiceOwnerChanged(const QString &name, const QString &oldOwner,
+        const QString &newOwner)
+{
+    Q_UNUSED(oldOwner);
+
+    QMutexLocker locker(&mLock);
+    QDBusServiceWatcher *watcher = qobject_cast<QDBusServiceWatcher *>(sender());
+    if (!mWatchers.contains(watcher)) {
+        return;
+    }
+
+    Bus &busData = mBuses[mWatchers.value(watcher)];
+    if (newOwner.isEmpty()) {
+        // Stop watching until someone looks the name up again, connection bus names in particular
+        // are seldom reused
+        busData.owners.remove(name);
+        unwatch(busData, name);
+    } else {
+        busData.owners.insert(name, newOwner);
+    }
+}
+
+void NameOwnerCache::onLookupFinished(QDBusPendingCallWatcher *watcher)
+{
+    QMutexLocker locker(&mLock);
+    Lookup lookup = mLookups.take(watcher);
+    Bus &busData = mBuses[lookup.busId];
+    busData.lookups.remove(lookup.name);
+
+    QDBusPendingReply<QString> reply = *watcher;
+    if (reply.isError()) {
+        debug().nospace() << "Looking up the owner of " << lookup.name << " failed: " <<
+            reply.error().name() << ": " << reply.error().message();
+        unwatch(busData, lookup.name);
+        locker.unlock();
+        foreach (PendingNameOwner *op, lookup.waiters) {
+            op->setFinishedWithError(reply.error());
+        }
+    } else {
+        // NameOwnerChanged may have told us about a newer owner already
+        if (!busData.owners.contains(lookup.name)) {
+            busData.owners.insert(lookup.name, reply.value());
+        }
+        QString uniqueName = busData.owners.value(lookup.name);
+        locker.unlock();
+        foreach (PendingNameOwner *op, lookup.waiters) {
+            op->mOwner = uniqueName;
+            op->setFinished();
+        }
+    }
+
+    watcher->deleteLater();
+}
+
+NameOwnerCache::BusId NameOwnerCache::busId(const QDBusConnection &bus)
+{
+    return BusId(bus.name(), bus.baseService());
+}
+
+NameOwnerCache::Bus &NameOwnerCache::watch(const QDBusConnection &bus, const QString &name)
+{
+    Bus &busData = mBuses[busId(bus)];
+
+    if (!busData.watcher) {
+        // The first lookup may happen in any thread, but the signals must reach the main thread
+        busData.watcher = new QDBusServiceWatcher();
+        busData.watcher->moveToThread(thread());
+        busData.watcher->setParent(this);
+        busData.watcher->setConnection(bus);
+        busData.watcher->setWatchMode(QDBusServiceWatcher::WatchForOwnerChange);
+        connect(busData.watcher,
+                SIGNAL(serviceOwnerChanged(QString,QString,QString)),
+                SLOT(onServiceOwnerChanged(QString,QString,QString)));
+        mWatchers.insert(busData.watcher, busId(bus));
+    }
+
+    if (!busData.watchedNames.contains(name)) {
+        busData.watcher->addWatchedService(name);
+        busData.watchedNames.insert(name);
+    }
+
+    return busData;
+}
+
+/*
+ * Stop watching \a name, unless its owner is known or it is still being looked up.
+ */
+void NameOwnerCache::unwatch(Bus &busData, const QString &name)
+{
+    if (busData.owners.contains(name) || busData.lookups.contains(name)) {
+        return;
+    }
+
+    if (busData.watchedNames.remove(name)) {
+        busData.watcher->removeWatchedService(name);
+    }
+}
+
+} // Tp
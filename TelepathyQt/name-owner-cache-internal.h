@@ -0,0 +1,123 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_name_owner_cache_internal_h_HEADER_GUARD_
+#define _TelepathyQt_name_owner_cache_internal_h_HEADER_GUARD_
+
+#include <TelepathyQt/Global>
+#include <TelepathyQt/PendingOperation>
+
+#include <QDBusConnection>
+#include <QDBusPendingCall>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QPair>
+#include <QSet>
+#include <QString>
+
+class QDBusPendingCallWatcher;
+class QDBusServiceWatcher;
+
+namespace Tp
+{
+
+#ifndef DOXYGEN_SHOULD_SKIP_THIS
+
+class TP_QT_NO_EXPORT PendingNameOwner : public PendingOperation
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(PendingNameOwner)
+
+public:
+    PendingNameOwner(const QString &name);
+    ~PendingNameOwner();
+
+    QString name() const { return mName; }
+    QString owner() const { return mOwner; }
+
+private:
+    friend class NameOwnerCache;
+
+    QString mName;
+    QString mOwner;
+};
+
+class TP_QT_NO_EXPORT NameOwnerCache : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(NameOwnerCache)
+
+public:
+    static NameOwnerCache *instance();
+
+    NameOwnerCache();
+    ~NameOwnerCache();
+
+    QString cachedOwner(const QDBusConnection &bus, const QString &name) const;
+    QString owner(const QDBusConnection &bus, const QString &name,
+            QString &error, QString &message);
+    PendingNameOwner *resolve(const QDBusConnection &bus, const QString &name);
+
+private Q_SLOTS:
+    void onServiceOwnerChanged(const QString &name, const QString &oldOwner,
+            const QString &newOwner);
+    void onLookupFinished(QDBusPendingCallWatcher *watcher);
+
+private:
+    typedef QPair<QString, QString> BusId;
+
+    struct Lookup
+    {
+        BusId busId;
+        QString name;
+        QList<PendingNameOwner *> waiters;
+    };
+
+    struct Bus
+    {
+        Bus() : watcher(0) {}
+
+        QDBusServiceWatcher *watcher;
+        QSet<QString> watchedNames;
+        QHash<QString, QString> owners;
+        QHash<QString, QDBusPendingCallWatcher *> lookups;
+    };
+
+    static BusId busId(const QDBusConnection &bus);
+    QString cachedOwnerLocked(const QDBusConnection &bus, const QString &name) const;
+    Bus &watch(const QDBusConnection &bus, const QString &name);
+    void unwatch(Bus &busData, const QString &name);
+
+    // Guards the members below, as owner() is called from whatever thread proxies are constructed
+    // in while the watchers deliver their signals to the main thread
+    mutable QMutex mLock;
+    QHash<BusId, Bus> mBuses;
+    QHash<QDBusServiceWatcher *, BusId> mWatchers;
+    QHash<QDBusPendingCallWatcher *, Lookup> mLookups;
+};
+
+#endif // DOXYGEN_SHOULD_SKIP_THIS
+
+} // Tp
+
+#endif
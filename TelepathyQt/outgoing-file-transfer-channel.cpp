@@ -26,25 +26,48 @@
 
 #include "TelepathyQt/debug-internal.h"
 
+#include "config.h"
+
 #include <TelepathyQt/Connection>
 #include <TelepathyQt/PendingFailure>
 #include <TelepathyQt/PendingVariant>
 #include <TelepathyQt/Types>
 #include <TelepathyQt/types-internal.h>
 
+#include <QFile>
 #include <QIODevice>
+#include <QSocketNotifier>
 #include <QTcpSocket>
 
+#ifdef HAVE_SENDFILE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
 namespace Tp
 {
 
 static const int FT_BLOCK_SIZE = 16 * 1024;
 
+#ifdef HAVE_SENDFILE
+// When sending straight from a file, the chunk size starts at FT_MIN_CHUNK_SIZE and doubles
+// every time the socket accepts a whole chunk
+static const qint64 FT_MIN_CHUNK_SIZE = 64 * 1024;
+static const qint64 FT_MAX_CHUNK_SIZE = 4 * 1024 * 1024;
+#endif
+
 struct TP_QT_NO_EXPORT OutgoingFileTransferChannel::Private
 {
     Private(OutgoingFileTransferChannel *parent);
     ~Private();
 
+    bool takeOverSocket();
+    void releaseSocket();
+    bool send();
+
     // Public object
     OutgoingFileTransferChannel *parent;
 
@@ -56,6 +79,13 @@ struct TP_QT_NO_EXPORT OutgoingFileTransferChannel::Private
     SocketAddressIPv4 addr;
 
     qint64 pos;
+
+    // sendfile() fast path, used when the input is a regular file. The socket is taken over from
+    // QTcpSocket and written to socketFd directly.
+    int socketFd;
+    QSocketNotifier *socketNotifier;
+    bool canSendFile;
+    qint64 chunkSize;
 };
 
 OutgoingFileTransferChannel::Private::Private(OutgoingFileTransferChannel *parent)
@@ -63,12 +93,137 @@ OutgoingFileTransferChannel::Private::Private(OutgoingFileTransferChannel *paren
       fileTransferInterface(parent->interface<Client::ChannelTypeFileTransferInterface>()),
       input(0),
       socket(0),
-      pos(0)
+      pos(0),
+      socketFd(-1),
+      socketNotifier(0),
+      canSendFile(false),
+      chunkSize(0)
 {
 }
 
 OutgoingFileTransferChannel::Private::~Private()
 {
+    releaseSocket();
+}
+
+/*
+ * Take the socket over from QTcpSocket, so that it can be sent to with sendfile().
+ *
+ * QTcpSocket has no way of giving its descriptor away, so a duplicate of it is kept and QTcpSocket
+ * is aborted, which only closes its own descriptor. This is done before anything is written
+ * through QTcpSocket, and socketNotifier is the only notifier watching the socket afterwards.
+ */
+bool OutgoingFileTransferChannel::Private::takeOverSocket()
+{
+#ifdef HAVE_SENDFILE
+    QFile *file = qobject_cast<QFile *>(input);
+    if (!file || file->isSequential() || file->handle() == -1 ||
+        socket->state() != QAbstractSocket::ConnectedState) {
+        return false;
+    }
+
+    int fd = fcntl(socket->socketDescriptor(), F_DUPFD_CLOEXEC, 0);
+    if (fd == -1) {
+        warning() << "Unable to take over the file transfer socket:" << strerror(errno);
+        return false;
+    }
+
+    debug() << "Input is a regular file, sending it with sendfile()";
+
+    QObject::disconnect(socket, 0, parent, 0);
+    socket->abort();
+
+    socketFd = fd;
+    socketNotifier = new QSocketNotifier(socketFd, QSocketNotifier::Write, parent);
+    socketNotifier->setEnabled(false);
+    parent->connect(socketNotifier,
+            SIGNAL(activated(int)),
+            SLOT(doTransfer()));
+    canSendFile = true;
+    chunkSize = FT_MIN_CHUNK_SIZE;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void OutgoingFileTransferChannel::Private::releaseSocket()
+{
+#ifdef HAVE_SENDFILE
+    if (socketFd == -1) {
+        return;
+    }
+
+    // This may be called from the notifier's own activated() signal
+    socketNotifier->setEnabled(false);
+    socketNotifier->deleteLater();
+    socketNotifier = 0;
+    ::close(socketFd);
+    socketFd = -1;
+#endif
+}
+
+/*
+ * Send a chunk of the input file to the taken over socket, with sendfile() unless it failed
+ * before. Returns false once the whole file has been sent or the socket failed.
+ */
+bool OutgoingFileTransferChannel::Private::send()
+{
+#ifdef HAVE_SENDFILE
+    int fileFd = qobject_cast<QFile *>(input)->handle();
+    off_t offset = pos;
+    ssize_t len;
+
+    if (canSendFile) {
+        do {
+            len = sendfile(socketFd, fileFd, &offset, chunkSize);
+        } while (len == -1 && errno == EINTR);
+
+        if (len == -1 && errno != EAGAIN) {
+            // Some file systems don't support sendfile(), carry on the usual way
+            warning() << "sendfile() failed:" << strerror(errno) << "- falling back to copying";
+            canSendFile = false;
+        }
+    }
+
+    if (!canSendFile) {
+        // Partial writes are fine, the next read starts from wherever they stopped
+        char buffer[FT_BLOCK_SIZE];
+        do {
+            len = pread(fileFd, buffer, sizeof(buffer), pos);
+        } while (len == -1 && errno == EINTR);
+
+        if (len > 0) {
+            ssize_t count = len;
+            do {
+                len = ::write(socketFd, buffer, count);
+            } while (len == -1 && errno == EINTR);
+
+            if (len > 0) {
+                offset = pos + len;
+            }
+        }
+    }
+
+    if (len > 0) {
+        if (canSendFile && len == chunkSize && chunkSize < FT_MAX_CHUNK_SIZE) {
+            chunkSize *= 2;
+        }
+        pos = offset;
+        return true;
+    } else if (len == 0) {
+        // EOF
+        return false;
+    } else if (errno == EAGAIN) {
+        chunkSize = qMax(chunkSize / 2, FT_MIN_CHUNK_SIZE);
+        return true;
+    }
+
+    warning() << "Sending the file transfer data failed:" << strerror(errno);
+    return false;
+#else
+    return false;
+#endif
 }
 
 /**
@@ -261,6 +416,11 @@ void OutgoingFileTransferChannel::onSocketConnected()
         }
     }
 
+    // sendfile() reads from an explicit offset, so it is only used if the seek above worked
+    if ((qulonglong) mPriv->pos == initialOffset()) {
+        mPriv->takeOverSocket();
+    }
+
     debug() << "Starting transfer...";
     doTransfer();
 }
@@ -281,6 +441,18 @@ void OutgoingFileTransferChannel::onInputAboutToClose()
 {
     debug() << "Input closed";
 
+#ifdef HAVE_SENDFILE
+    // send the rest of the file before it goes away
+    if (mPriv->socketFd != -1) {
+        int flags = fcntl(mPriv->socketFd, F_GETFL);
+        fcntl(mPriv->socketFd, F_SETFL, flags & ~O_NONBLOCK);
+        while (mPriv->send()) {
+        }
+        setFinished();
+        return;
+    }
+#endif
+
     // read all remaining data from input device and write to output device
     if (isConnected()) {
         QByteArray data;
@@ -293,6 +465,17 @@ void OutgoingFileTransferChannel::onInputAboutToClose()
 
 void OutgoingFileTransferChannel::doTransfer()
 {
+    if (mPriv->socketFd != -1) {
+        // One chunk per wakeup, so big files don't starve the event loop
+        mPriv->socketNotifier->setEnabled(false);
+        if (!mPriv->send()) {
+            setFinished();
+            return;
+        }
+        mPriv->socketNotifier->setEnabled(true);
+        return;
+    }
+
     // read FT_BLOCK_SIZE each time, as input can be a QFile, we don't want to
     // block reading the whole file
     char buffer[FT_BLOCK_SIZE];
@@ -345,6 +528,8 @@ void OutgoingFileTransferChannel::setFinished()
         return;
     }
 
+    mPriv->releaseSocket();
+
     if (mPriv->socket) {
         disconnect(mPriv->socket, SIGNAL(connected()),
                    this, SLOT(onSocketConnected()));
@@ -60,10 +60,10 @@ public:
     QueuedContactFactory(ContactManagerPtr contactManager, QObject* parent = 0);
     ~QueuedContactFactory();
 
-    QUuid appendNewRequest(const UIntList &handles);
+    uint appendNewRequest(const UIntList &handles);
 
 Q_SIGNALS:
-    void contactsRetrieved(QUuid uuid, QList<Tp::ContactPtr> contacts);
+    void contactsRetrieved(uint requestId, QList<Tp::ContactPtr> contacts);
     void queueCompleted();
 
 private Q_SLOTS:
@@ -72,13 +72,18 @@ private Q_SLOTS:
 
 private:
     struct Entry {
-        QUuid uuid;
+        uint id;
         UIntList handles;
     };
 
+    void finishBatch(const QHash<uint, ContactPtr> &contacts);
+
     bool m_isProcessing;
+    bool m_isScheduled;
+    uint m_nextRequestId;
     ContactManagerPtr m_manager;
     QQueue<Entry> m_queue;
+    QList<Entry> m_batch;
 };
 
 struct TP_QT_NO_EXPORT PendingOpenTube::Private
@@ -100,9 +105,11 @@ struct TP_QT_NO_EXPORT OutgoingStreamTubeChannel::Private
 
     QHash<uint, Tp::ContactPtr> contactsForConnections;
     QHash<QPair<QHostAddress, quint16>, uint> connectionsForSourceAddresses;
+    // The reverse of connectionsForSourceAddresses
+    QHash<uint, QPair<QHostAddress, quint16> > sourceAddressesForConnections;
     QHash<uchar, uint> connectionsForCredentials;
 
-    QHash<QUuid, QPair<uint, QDBusVariant> > pendingNewConnections;
+    QHash<uint, QPair<uint, QDBusVariant> > pendingNewConnections;
 
     struct ClosedConnection {
         uint id;
@@ -112,7 +119,7 @@ struct TP_QT_NO_EXPORT OutgoingStreamTubeChannel::Private
         ClosedConnection(uint id, const QString &error, const QString &message)
             : id(id), error(error), message(message) {}
     };
-    QHash<QUuid, ClosedConnection> pendingClosedConnections;
+    QHash<uint, ClosedConnection> pendingClosedConnections;
 
     QueuedContactFactory *queuedContactFactory;
 };
@@ -32,9 +32,11 @@
 #include <TelepathyQt/ContactManager>
 #include <TelepathyQt/PendingContacts>
 #include <TelepathyQt/PendingFailure>
+#include <TelepathyQt/ReadinessHelper>
 #include <TelepathyQt/Types>
 
 #include <QHostAddress>
+#include <QSet>
 #include <QTcpServer>
 #include <QLocalServer>
 
@@ -119,6 +121,8 @@ void PendingOpenTube::onTubeStateChanged(TubeChannelState state)
 QueuedContactFactory::QueuedContactFactory(Tp::ContactManagerPtr contactManager, QObject* parent)
     : QObject(parent),
       m_isProcessing(false),
+      m_isScheduled(false),
+      m_nextRequestId(0),
       m_manager(contactManager)
 {
 }
@@ -129,8 +133,10 @@ QueuedContactFactory::~QueuedContactFactory()
 
 void QueuedContactFactory::processNextRequest()
 {
+    m_isScheduled = false;
+
     if (m_isProcessing) {
-        // Return, nothing to do
+        // Return, the current batch will pick up whatever got queued meanwhile when it finishes
         return;
     }
 
@@ -142,43 +148,87 @@ void QueuedContactFactory::processNextRequest()
 
     m_isProcessing = true;
 
-    Entry entry = m_queue.dequeue();
+    // Drain everything queued so far into a single batch, so that a burst of requests doesn't
+    // cost a contact lookup round trip for each of them
+    UIntList handles;
+    QSet<uint> seenHandles;
+    while (!m_queue.isEmpty()) {
+        Entry entry = m_queue.dequeue();
+        foreach (uint handle, entry.handles) {
+            if (!seenHandles.contains(handle)) {
+                seenHandles.insert(handle);
+                handles << handle;
+            }
+        }
+        m_batch << entry;
+    }
+
+    if (handles.isEmpty()) {
+        // Only requests without handles (used for ordering), no need to look anything up
+        finishBatch(QHash<uint, ContactPtr>());
+        return;
+    }
 
     // TODO: pass id hints to ContactManager if we ever gain support to retrieve contact ids
     //       from NewRemoteConnection.
-    PendingContacts *pc = m_manager->contactsForHandles(entry.handles);
-    pc->setProperty("__TpQt__QueuedContactFactoryUuid", entry.uuid.toString());
+    PendingContacts *pc = m_manager->contactsForHandles(handles);
     connect(pc, SIGNAL(finished(Tp::PendingOperation*)),
             this, SLOT(onPendingContactsFinished(Tp::PendingOperation*)));
 }
 
-QUuid QueuedContactFactory::appendNewRequest(const Tp::UIntList &handles)
+uint QueuedContactFactory::appendNewRequest(const Tp::UIntList &handles)
 {
     // Create a new entry
     Entry entry;
-    entry.uuid = QUuid::createUuid();
+    entry.id = m_nextRequestId++;
     entry.handles = handles;
     m_queue.enqueue(entry);
 
-    // Enqueue a process request in the event loop
-    QTimer::singleShot(0, this, SLOT(processNextRequest()));
+    // Enqueue a process request in the event loop, unless one is already pending, in which case
+    // this entry will be part of the same batch
+    if (!m_isScheduled) {
+        m_isScheduled = true;
+        QTimer::singleShot(0, this, SLOT(processNextRequest()));
+    }
 
-    // Return the UUID
-    return entry.uuid;
+    // Return the request id
+    return entry.id;
 }
 
 void QueuedContactFactory::onPendingContactsFinished(PendingOperation *op)
 {
     PendingContacts *pc = qobject_cast<PendingContacts*>(op);
 
-    QUuid uuid = QUuid(pc->property("__TpQt__QueuedContactFactoryUuid").toString());
+    QHash<uint, ContactPtr> contacts;
+    foreach (const ContactPtr &contact, pc->contacts()) {
+        contacts.insert(contact->handle()[0], contact);
+    }
+
+    finishBatch(contacts);
+}
+
+void QueuedContactFactory::finishBatch(const QHash<uint, ContactPtr> &contacts)
+{
+    // Signal the requests in the order they were made, so the users see their events in order
+    QList<Entry> batch = m_batch;
+    m_batch.clear();
+
+    foreach (const Entry &entry, batch) {
+        QList<ContactPtr> entryContacts;
+        foreach (uint handle, entry.handles) {
+            ContactPtr contact = contacts.value(handle);
+            if (contact) {
+                entryContacts << contact;
+            }
+        }
 
-    emit contactsRetrieved(uuid, pc->contacts());
+        emit contactsRetrieved(entry.id, entryContacts);
+    }
 
     // No longer processing
     m_isProcessing = false;
 
-    // Go for next one
+    // Go for next batch
     processNextRequest();
 }
 
@@ -252,9 +302,9 @@ OutgoingStreamTubeChannel::OutgoingStreamTubeChannel(const ConnectionPtr &connec
       mPriv(new Private(this))
 {
     connect(mPriv->queuedContactFactory,
-            SIGNAL(contactsRetrieved(QUuid,QList<Tp::ContactPtr>)),
+            SIGNAL(contactsRetrieved(uint,QList<Tp::ContactPtr>)),
             this,
-            SLOT(onContactsRetrieved(QUuid,QList<Tp::ContactPtr>)));
+            SLOT(onContactsRetrieved(uint,QList<Tp::ContactPtr>)));
 }
 
 /**
@@ -620,7 +670,7 @@ QHash<QPair<QHostAddress, quint16>, uint> OutgoingStreamTubeChannel::connections
     }
 
     if (isValid() || !isDroppingConnections() ||
-            !requestedFeatures().contains(StreamTubeChannel::FeatureConnectionMonitoring)) {
+            !readinessHelper()->isRequested(StreamTubeChannel::FeatureConnectionMonitoring)) {
         if (!isReady(StreamTubeChannel::FeatureConnectionMonitoring)) {
             warning() << "StreamTubeChannel::FeatureConnectionMonitoring must be ready before "
                 "   calling connectionsForSourceAddresses";
@@ -637,6 +687,19 @@ QHash<QPair<QHostAddress, quint16>, uint> OutgoingStreamTubeChannel::connections
     return mPriv->connectionsForSourceAddresses;
 }
 
+/*
+ * Return the source address of the connection \a connectionId, or a null address if it's not known.
+ *
+ * Unlike looking it up in connectionsForSourceAddresses(), this doesn't need to go through the
+ * whole map. Used by StreamTubeServer, which already checks that the connection addresses are
+ * being tracked.
+ */
+QPair<QHostAddress, quint16> OutgoingStreamTubeChannel::sourceAddressForConnection(
+        uint connectionId) const
+{
+    return mPriv->sourceAddressesForConnections.value(connectionId);
+}
+
 /**
  * Return a map from a credential byte to the corresponding connections ids.
  *
@@ -669,7 +732,7 @@ QHash<uchar, uint> OutgoingStreamTubeChannel::connectionsForCredentials() const
     }
 
     if (isValid() || !isDroppingConnections() ||
-            !requestedFeatures().contains(StreamTubeChannel::FeatureConnectionMonitoring)) {
+            !readinessHelper()->isRequested(StreamTubeChannel::FeatureConnectionMonitoring)) {
         if (!isReady(StreamTubeChannel::FeatureConnectionMonitoring)) {
             warning() << "StreamTubeChannel::FeatureConnectionMonitoring must be ready before "
                 "calling OutgoingStreamTubeChannel::connectionsForCredentials()";
@@ -700,7 +763,7 @@ QHash<uchar, uint> OutgoingStreamTubeChannel::connectionsForCredentials() const
 QHash<uint, ContactPtr> OutgoingStreamTubeChannel::contactsForConnections() const
 {
     if (isValid() || !isDroppingConnections() ||
-            !requestedFeatures().contains(StreamTubeChannel::FeatureConnectionMonitoring)) {
+            !readinessHelper()->isRequested(StreamTubeChannel::FeatureConnectionMonitoring)) {
         if (!isReady(StreamTubeChannel::FeatureConnectionMonitoring)) {
             warning() << "StreamTubeChannel::FeatureConnectionMonitoring must be ready before "
                 "calling contactsForConnections";
@@ -723,14 +786,14 @@ void OutgoingStreamTubeChannel::onNewRemoteConnection(
         uint connectionId)
 {
     // Request the handles from our queued contact factory
-    QUuid uuid = mPriv->queuedContactFactory->appendNewRequest(UIntList() << contactId);
+    uint requestId = mPriv->queuedContactFactory->appendNewRequest(UIntList() << contactId);
 
     // Add a pending connection
-    mPriv->pendingNewConnections.insert(uuid, qMakePair(connectionId, parameter));
+    mPriv->pendingNewConnections.insert(requestId, qMakePair(connectionId, parameter));
 }
 
 void OutgoingStreamTubeChannel::onContactsRetrieved(
-        const QUuid &uuid,
+        uint requestId,
         const QList<Tp::ContactPtr> &contacts)
 {
     if (!isValid()) {
@@ -738,10 +801,10 @@ void OutgoingStreamTubeChannel::onContactsRetrieved(
         return;
     }
 
-    if (!mPriv->pendingNewConnections.contains(uuid)) {
-        if (mPriv->pendingClosedConnections.contains(uuid)) {
+    if (!mPriv->pendingNewConnections.contains(requestId)) {
+        if (mPriv->pendingClosedConnections.contains(requestId)) {
             // closed connection
-            Private::ClosedConnection conn = mPriv->pendingClosedConnections.take(uuid);
+            Private::ClosedConnection conn = mPriv->pendingClosedConnections.take(requestId);
 
             // First, do removeConnection() so connectionClosed is emitted, and anybody connected to it
             // (like StreamTubeServer) has a chance to recover the source address / contact
@@ -750,12 +813,17 @@ void OutgoingStreamTubeChannel::onContactsRetrieved(
             // Remove stuff from our hashes
             mPriv->contactsForConnections.remove(conn.id);
 
-            QHash<QPair<QHostAddress, quint16>, uint>::iterator srcAddrIter =
-                mPriv->connectionsForSourceAddresses.begin();
-            while (srcAddrIter != mPriv->connectionsForSourceAddresses.end()) {
-                if (srcAddrIter.value() == conn.id) {
-                    srcAddrIter = mPriv->connectionsForSourceAddresses.erase(srcAddrIter);
-                } else {
+            if (mPriv->sourceAddressesForConnections.contains(conn.id)) {
+                QPair<QHostAddress, quint16> srcAddr =
+                    mPriv->sourceAddressesForConnections.take(conn.id);
+                QHash<QPair<QHostAddress, quint16>, uint>::iterator srcAddrIter =
+                    mPriv->connectionsForSourceAddresses.find(srcAddr);
+                while (srcAddrIter != mPriv->connectionsForSourceAddresses.end() &&
+                        srcAddrIter.key() == srcAddr) {
+                    if (srcAddrIter.value() == conn.id) {
+                        mPriv->connectionsForSourceAddresses.erase(srcAddrIter);
+                        break;
+                    }
                     ++srcAddrIter;
                 }
             }
@@ -777,7 +845,7 @@ void OutgoingStreamTubeChannel::onContactsRetrieved(
     }
 
     // new connection
-    QPair<uint, QDBusVariant> connectionProperties = mPriv->pendingNewConnections.take(uuid);
+    QPair<uint, QDBusVariant> connectionProperties = mPriv->pendingNewConnections.take(requestId);
 
     // Add it to our connections hash
     foreach (const Tp::ContactPtr &contact, contacts) {
@@ -811,6 +879,7 @@ void OutgoingStreamTubeChannel::onContactsRetrieved(
     if (address.first != QHostAddress::Null) {
         // We can map it to a source address as well
         mPriv->connectionsForSourceAddresses.insertMulti(address, connectionProperties.first);
+        mPriv->sourceAddressesForConnections.insert(connectionProperties.first, address);
     }
 
     // Time for us to emit the signal
@@ -824,10 +893,10 @@ void OutgoingStreamTubeChannel::onConnectionClosed(uint connectionId,
 {
     // Insert a fake request to our queued contact factory to make the close events properly ordered
     // with new connection events
-    QUuid uuid = mPriv->queuedContactFactory->appendNewRequest(UIntList());
+    uint requestId = mPriv->queuedContactFactory->appendNewRequest(UIntList());
 
     // Add a pending connection close
-    mPriv->pendingClosedConnections.insert(uuid,
+    mPriv->pendingClosedConnections.insert(requestId,
             Private::ClosedConnection(connectionId, errorName, errorMessage));
 }
 
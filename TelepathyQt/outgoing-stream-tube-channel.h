@@ -72,12 +72,16 @@ protected:
 private Q_SLOTS:
     TP_QT_NO_EXPORT void onNewRemoteConnection(uint contactId,
             const QDBusVariant &parameter, uint connectionId);
-    TP_QT_NO_EXPORT void onContactsRetrieved(const QUuid &uuid,
+    TP_QT_NO_EXPORT void onContactsRetrieved(uint requestId,
             const QList<Tp::ContactPtr> &contacts);
     TP_QT_NO_EXPORT void onConnectionClosed(uint connectionId,
             const QString &errorName, const QString &errorMessage);
 
 private:
+    friend class StreamTubeServer;
+    TP_QT_NO_EXPORT QPair<QHostAddress, quint16> sourceAddressForConnection(
+            uint connectionId) const;
+
     struct Private;
     friend struct PendingOpenTube;
     friend struct Private;
@@ -26,6 +26,7 @@
 #include "TelepathyQt/_gen/pending-contacts.moc.hpp"
 #include "TelepathyQt/_gen/pending-contacts-internal.moc.hpp"
 
+#include "TelepathyQt/contact-manager-internal.h"
 #include "TelepathyQt/debug-internal.h"
 
 #include <TelepathyQt/Connection>
@@ -196,9 +197,8 @@ PendingContacts::PendingContacts(const ContactManagerPtr &manager,
     if (!otherContacts.isEmpty()) {
         ConnectionPtr conn = manager->connection();
         if (conn->interfaces().contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACTS)) {
-            PendingContactAttributes *attributes =
-                conn->lowlevel()->contactAttributes(otherContacts.toList(),
-                        interfaces, true);
+            PendingOperation *attributes =
+                manager->requestContactAttributes(otherContacts.toList(), interfaces);
 
             connect(attributes,
                     SIGNAL(finished(Tp::PendingOperation*)),
@@ -481,8 +481,8 @@ QStringList PendingContacts::invalidUris() const
 
 void PendingContacts::onAttributesFinished(PendingOperation *operation)
 {
-    PendingContactAttributes *pendingAttributes =
-        qobject_cast<PendingContactAttributes *>(operation);
+    ContactManager::PendingBatchedAttributes *pendingAttributes =
+        qobject_cast<ContactManager::PendingBatchedAttributes *>(operation);
 
     if (pendingAttributes->isError()) {
         debug() << "PendingAttrs error" << pendingAttributes->errorName()
@@ -491,7 +491,8 @@ void PendingContacts::onAttributesFinished(PendingOperation *operation)
         return;
     }
 
-    ReferencedHandles validHandles = pendingAttributes->validHandles();
+    ReferencedHandles validHandles(mPriv->manager->connection(), HandleTypeContact,
+            pendingAttributes->validHandles());
     ContactAttributesMap attributes = pendingAttributes->attributes();
 
     foreach (uint handle, mPriv->handles) {
@@ -23,6 +23,7 @@
 #include <TelepathyQt/ProfileManager>
 
 #include "TelepathyQt/_gen/profile-manager.moc.hpp"
+#include "TelepathyQt/config-index-internal.h"
 #include "TelepathyQt/debug-internal.h"
 
 #include <TelepathyQt/ConnectionManager>
@@ -32,8 +33,10 @@
 #include <TelepathyQt/Profile>
 #include <TelepathyQt/ReadinessHelper>
 
+#include <QDateTime>
 #include <QFile>
 #include <QFileInfo>
+#include <QFileSystemWatcher>
 #include <QString>
 #include <QStringList>
 
@@ -47,17 +50,31 @@ struct TP_QT_NO_EXPORT ProfileManager::Private
     static void introspectMain(Private *self);
     static void introspectFakeProfiles(Private *self);
 
+    bool loadProfiles();
+
+    struct ProfileFile
+    {
+        ProfileFile() : mtime(0), size(0) {}
+
+        qint64 mtime;
+        qint64 size;
+        ProfilePtr profile;
+    };
+
     ProfileManager *parent;
     ReadinessHelper *readinessHelper;
     QDBusConnection bus;
     QHash<QString, ProfilePtr> profiles;
+    QHash<QString /* fileName */, ProfileFile> profileFiles;
+    QFileSystemWatcher *watcher;
     QList<ConnectionManagerPtr> cms;
 };
 
 ProfileManager::Private::Private(ProfileManager *parent, const QDBusConnection &bus)
     : parent(parent),
       readinessHelper(parent->readinessHelper()),
-      bus(bus)
+      bus(bus),
+      watcher(0)
 {
     ReadinessHelper::Introspectables introspectables;
 
@@ -82,9 +99,42 @@ ProfileManager::Private::Private(ProfileManager *parent, const QDBusConnection &
 
 void ProfileManager::Private::introspectMain(ProfileManager::Private *self)
 {
-    QStringList searchDirs = Profile::searchDirs();
+    self->loadProfiles();
+
+    // Only directories which exist can be watched, so profile directories created later on
+    // won't be noticed
+    self->watcher = new QFileSystemWatcher(self->parent);
+    foreach (const QString &searchDir, Profile::searchDirs()) {
+        if (QFileInfo(searchDir).isDir()) {
+            self->watcher->addPath(searchDir);
+        }
+    }
+    self->watcher->addPaths(self->profileFiles.keys());
+    self->parent->connect(self->watcher,
+            SIGNAL(directoryChanged(QString)),
+            SLOT(onProfilesChanged(QString)));
+    self->parent->connect(self->watcher,
+            SIGNAL(fileChanged(QString)),
+            SLOT(onProfilesChanged(QString)));
+
+    self->readinessHelper->setIntrospectCompleted(FeatureCore, true);
+}
+
+/*
+ * (Re)build the profiles map from the .profile files in the search dirs, in order of precedence.
+ *
+ * Files which didn't change since the last time this was called keep their Profile object, so
+ * only new and modified files get parsed again. Fake profiles are kept unless a profile file for
+ * the same service shows up.
+ *
+ * Return whether the profiles map changed.
+ */
+bool ProfileManager::Private::loadProfiles()
+{
+    QHash<QString, ProfilePtr> newProfiles;
+    QHash<QString, ProfileFile> newProfileFiles;
 
-    foreach (const QString searchDir, searchDirs) {
+    foreach (const QString searchDir, Profile::searchDirs()) {
         QDir dir(searchDir);
         dir.setFilter(QDir::Files);
 
@@ -99,13 +149,23 @@ void ProfileManager::Private::introspectMain(ProfileManager::Private *self)
             QString fileName = fi.absoluteFilePath();
             QString serviceName = fi.baseName();
 
-            if (self->profiles.contains(serviceName)) {
+            if (newProfiles.contains(serviceName)) {
                 debug() << "Profile for service" << serviceName << "already "
                     "exists. Ignoring profile file:" << fileName;
                 continue;
             }
 
-            ProfilePtr profile = Profile::createForFileName(fileName);
+            ProfileFile profileFile = profileFiles.value(fileName);
+            qint64 mtime = fi.lastModified().toMSecsSinceEpoch();
+            if (!profileFile.profile || profileFile.mtime != mtime ||
+                    profileFile.size != fi.size()) {
+                profileFile.mtime = mtime;
+                profileFile.size = fi.size();
+                profileFile.profile = Profile::createForFileName(fileName);
+            }
+            newProfileFiles.insert(fileName, profileFile);
+
+            ProfilePtr profile = profileFile.profile;
             if (!profile->isValid()) {
                 continue;
             }
@@ -116,13 +176,42 @@ void ProfileManager::Private::introspectMain(ProfileManager::Private *self)
                 continue;
             }
 
-            debug() << "Found profile for service" << serviceName <<
-                "- profile file:" << fileName;
-            self->profiles.insert(serviceName, profile);
+            if (profiles.value(serviceName) != profile) {
+                debug() << "Found profile for service" << serviceName <<
+                    "- profile file:" << fileName;
+            }
+            newProfiles.insert(serviceName, profile);
         }
     }
 
-    self->readinessHelper->setIntrospectCompleted(FeatureCore, true);
+    foreach (const ProfilePtr &profile, profiles) {
+        if (profile->isFake() && !newProfiles.contains(profile->serviceName())) {
+            newProfiles.insert(profile->serviceName(), profile);
+        }
+    }
+
+    ConfigIndex *index = ConfigIndex::instance();
+    foreach (const QString &fileName, profileFiles.keys()) {
+        if (!newProfileFiles.contains(fileName) && !QFile::exists(fileName)) {
+            index->remove(fileName);
+        }
+    }
+    index->sync();
+
+    if (watcher) {
+        // Files replaced by renaming a new one over them lose their watch, so check all of them
+        QStringList watched = watcher->files();
+        foreach (const QString &fileName, newProfileFiles.keys()) {
+            if (!watched.contains(fileName)) {
+                watcher->addPath(fileName);
+            }
+        }
+    }
+
+    bool changed = (newProfiles != profiles);
+    profiles = newProfiles;
+    profileFiles = newProfileFiles;
+    return changed;
 }
 
 void ProfileManager::Private::introspectFakeProfiles(ProfileManager::Private *self)
@@ -139,6 +228,9 @@ void ProfileManager::Private::introspectFakeProfiles(ProfileManager::Private *se
  *
  * \brief The ProfileManager class provides helper methods to retrieve Profile
  * objects.
+ *
+ * Once FeatureCore is ready, the profile files are watched and reloaded when they change, which
+ * is signalled by profilesChanged().
  */
 
 /**
@@ -329,4 +421,23 @@ void ProfileManager::onCMsReady(Tp::PendingOperation *op)
     mPriv->readinessHelper->setIntrospectCompleted(FeatureFakeProfiles, true);
 }
 
+void ProfileManager::onProfilesChanged(const QString &path)
+{
+    debug() << "Profiles changed in" << path << "- reloading modified profile files";
+    if (mPriv->loadProfiles()) {
+        emit profilesChanged();
+    }
+}
+
+/**
+ * \fn void ProfileManager::profilesChanged()
+ *
+ * Emitted when profiles() changes because profile files were added, removed or modified.
+ *
+ * Profile objects are never modified in place: a modified profile file results in a new Profile
+ * object replacing the old one, so previously returned profiles keep describing the file as it
+ * was when they were read. Files are only watched once FeatureCore is ready, and profile
+ * directories which didn't exist at that point are not watched.
+ */
+
 } // Tp
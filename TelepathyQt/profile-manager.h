@@ -58,9 +58,13 @@ public:
     QList<ProfilePtr> profilesForProtocol(const QString &protocolName) const;
     ProfilePtr profileForService(const QString &serviceName) const;
 
+Q_SIGNALS:
+    void profilesChanged();
+
 private Q_SLOTS:
     TP_QT_NO_EXPORT void onCmNamesRetrieved(Tp::PendingOperation *op);
     TP_QT_NO_EXPORT void onCMsReady(Tp::PendingOperation *op);
+    TP_QT_NO_EXPORT void onProfilesChanged(const QString &path);
 
 private:
     ProfileManager(const QDBusConnection &bus);
@@ -22,6 +22,7 @@
 
 #include <TelepathyQt/Profile>
 
+#include "TelepathyQt/config-index-internal.h"
 #include "TelepathyQt/debug-internal.h"
 #include "TelepathyQt/manager-file.h"
 
@@ -29,6 +30,7 @@
 #include <TelepathyQt/ProtocolParameter>
 #include <TelepathyQt/Utils>
 
+#include <QDataStream>
 #include <QFile>
 #include <QFileInfo>
 #include <QStringList>
@@ -49,6 +51,8 @@ struct TP_QT_NO_EXPORT Profile::Private
 
     void lookupProfile();
     bool parse(QFile *file);
+    bool readCached(const QFileInfo &fileInfo);
+    void writeCached(const QFileInfo &fileInfo);
     void invalidate();
 
     struct Data
@@ -494,6 +498,11 @@ bool Profile::Private::parse(QFile *file)
 
     fake = false;
     QFileInfo fi(file->fileName());
+    if (readCached(fi)) {
+        valid = true;
+        return true;
+    }
+
     XmlHandler xmlHandler(serviceName, allowNonIMType, &data);
 
     QXmlSimpleReader xmlReader;
@@ -509,10 +518,113 @@ bool Profile::Private::parse(QFile *file)
         return false;
     }
 
+    writeCached(fi);
     valid = true;
     return true;
 }
 
+bool Profile::Private::readCached(const QFileInfo &fileInfo)
+{
+    QByteArray cached;
+    if (!ConfigIndex::instance()->lookup(fileInfo, cached)) {
+        return false;
+    }
+
+    QDataStream in(cached);
+    in.setVersion(QDataStream::Qt_4_6);
+
+    Data cachedData;
+    quint32 count;
+    in >> cachedData.type >> cachedData.provider >> cachedData.name >> cachedData.iconName >>
+        cachedData.cmName >> cachedData.protocolName;
+
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString name, signature, label;
+        QVariant value;
+        bool mandatory;
+        in >> name >> signature >> value >> label >> mandatory;
+        cachedData.parameters.append(Profile::Parameter(name, QDBusSignature(signature), value,
+                    label, mandatory));
+    }
+
+    in >> cachedData.allowOtherPresences >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString id, label, iconName, message;
+        bool disabled;
+        in >> id >> label >> iconName >> message >> disabled;
+        cachedData.presences.append(Profile::Presence(id, label, iconName, message, disabled));
+    }
+
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        RequestableChannelClass rcc;
+        in >> rcc.fixedProperties >> rcc.allowedProperties;
+        cachedData.unsupportedChannelClassSpecs.append(RequestableChannelClassSpec(rcc));
+    }
+
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    // The same file may have been parsed by someone accepting other types of profiles
+    if (cachedData.type != QLatin1String("IM") && !allowNonIMType) {
+        return false;
+    }
+
+    data = cachedData;
+    return true;
+}
+
+void Profile::Private::writeCached(const QFileInfo &fileInfo)
+{
+    // Parameter values are parsed according to their D-Bus signature, and QDataStream doesn't
+    // know how to write the D-Bus specific types
+    foreach (const Profile::Parameter &param, data.parameters) {
+        if (param.value().isValid() && param.value().userType() >= QMetaType::User) {
+            return;
+        }
+    }
+    foreach (const RequestableChannelClassSpec &spec, data.unsupportedChannelClassSpecs) {
+        foreach (const QVariant &value, spec.fixedProperties()) {
+            if (value.userType() >= QMetaType::User) {
+                return;
+            }
+        }
+    }
+
+    QByteArray cached;
+    QDataStream out(&cached, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_4_6);
+
+    out << data.type << data.provider << data.name << data.iconName << data.cmName <<
+        data.protocolName;
+
+    out << quint32(data.parameters.size());
+    foreach (const Profile::Parameter &param, data.parameters) {
+        out << param.name() << param.dbusSignature().signature() << param.value() <<
+            param.label() << param.isMandatory();
+    }
+
+    out << data.allowOtherPresences << quint32(data.presences.size());
+    foreach (const Profile::Presence &presence, data.presences) {
+        QString message;
+        if (presence.canHaveStatusMessage()) {
+            message = QLatin1String("true");
+        }
+        out << presence.id() << presence.label() << presence.iconName() << message <<
+            presence.isDisabled();
+    }
+
+    out << quint32(data.unsupportedChannelClassSpecs.size());
+    foreach (const RequestableChannelClassSpec &spec, data.unsupportedChannelClassSpecs) {
+        RequestableChannelClass rcc = spec.bareClass();
+        out << rcc.fixedProperties << rcc.allowedProperties;
+    }
+
+    ConfigIndex::instance()->insert(fileInfo, cached);
+}
+
 void Profile::Private::invalidate()
 {
     valid = false;
@@ -846,27 +958,7 @@ void Profile::setFileName(const QString &fileName)
 
 QStringList Profile::searchDirs()
 {
-    QStringList ret;
-
-    QString xdgDataHome = QString::fromLocal8Bit(qgetenv("XDG_DATA_HOME"));
-    if (xdgDataHome.isEmpty()) {
-        ret << QDir::homePath() + QLatin1String("/.local/share/data/telepathy/profiles/");
-    } else {
-        ret << xdgDataHome + QLatin1String("/telepathy/profiles/");
-    }
-
-    QString xdgDataDirsEnv = QString::fromLocal8Bit(qgetenv("XDG_DATA_DIRS"));
-    if (xdgDataDirsEnv.isEmpty()) {
-        ret << QLatin1String("/usr/local/share/telepathy/profiles/");
-        ret << QLatin1String("/usr/share/telepathy/profiles/");
-    } else {
-        QStringList xdgDataDirs = xdgDataDirsEnv.split(QLatin1Char(':'));
-        foreach (const QString xdgDataDir, xdgDataDirs) {
-            ret << xdgDataDir + QLatin1String("/telepathy/profiles/");
-        }
-    }
-
-    return ret;
+    return ConfigIndex::dataDirs(QLatin1String("telepathy/profiles"));
 }
 
 
@@ -25,6 +25,7 @@
 #include "TelepathyQt/_gen/readiness-helper.moc.hpp"
 
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/feature-set-internal.h"
 
 #include <TelepathyQt/Constants>
 #include <TelepathyQt/DBusProxy>
@@ -49,6 +50,7 @@ struct TP_QT_NO_EXPORT ReadinessHelper::Introspectable::Private : public QShared
             bool critical)
         : makesSenseForStatuses(makesSenseForStatuses),
         dependsOnFeatures(dependsOnFeatures),
+        dependsOnFeatureSet(dependsOnFeatures),
         dependsOnInterfaces(dependsOnInterfaces),
         introspectFunc(introspectFunc),
         introspectFuncData(introspectFuncData),
@@ -56,6 +58,7 @@ struct TP_QT_NO_EXPORT ReadinessHelper::Introspectable::Private : public QShared
 
     QSet<uint> makesSenseForStatuses;
     Features dependsOnFeatures;
+    FeatureSet dependsOnFeatureSet;
     QStringList dependsOnInterfaces;
     IntrospectFunc introspectFunc;
     void *introspectFuncData;
@@ -107,9 +110,17 @@ struct TP_QT_NO_EXPORT ReadinessHelper::Private
     void setIntrospectCompleted(const Feature &feature, bool success,
             const QString &errorName = QString(),
             const QString &errorMessage = QString());
+    void completeFeature(const Feature &feature, bool success,
+            const QString &errorName, const QString &errorMessage);
+    void scheduleIteration();
     void iterateIntrospection();
-    Features depsFor(const Feature &feature); // Recursive dependencies for a feature
+    bool hasMissingDeps(const Feature &feature) const;
 
+    void buildGraph();
+    const Features &addDeps(const Feature &feature);
+
+    void trackOperation(PendingReady *operation);
+    void retrackOperations();
     void abortOperations(const QString &errorName, const QString &errorMessage);
 
     ReadinessHelper *parent;
@@ -119,15 +130,31 @@ struct TP_QT_NO_EXPORT ReadinessHelper::Private
     QStringList interfaces;
     Introspectables introspectables;
     QSet<uint> supportedStatuses;
-    Features supportedFeatures;
-    Features satisfiedFeatures;
-    Features requestedFeatures;
-    Features missingFeatures;
-    Features pendingFeatures;
-    Features inFlightFeatures;
+    FeatureSet supportedFeatures;
+    FeatureSet satisfiedFeatures;
+    FeatureSet requestedFeatures;
+    FeatureSet missingFeatures;
+    FeatureSet pendingFeatures;
+    FeatureSet inFlightFeatures;
     QHash<Feature, QPair<QString, QString> > missingFeaturesErrors;
     QList<PendingReady *> pendingOperations;
 
+    // The feature dependency graph, rebuilt whenever introspectables are added
+    QHash<Feature, Features> deps; // Recursive dependencies of each feature
+    QHash<Feature, FeatureSet> depSets; // The same, for checking them against the sets above
+    QHash<Feature, QList<Feature> > dependents; // Features directly depending on each feature
+
+    // Pending features which may have become ready to introspect, or missing
+    QList<Feature> featuresToVisit;
+    bool iterationScheduled;
+    bool iterating;
+
+    // The operations waiting for each feature not completed yet, and how many features each of
+    // them is still waiting for
+    QHash<Feature, QList<PendingReady *> > operationsByFeature;
+    QHash<PendingReady *, int> operationsRemaining;
+    QList<PendingReady *> operationsToFinish;
+
     bool pendingStatusChange;
     uint pendingStatus;
 };
@@ -142,6 +169,8 @@ ReadinessHelper::Private::Private(
       proxy(0),
       currentStatus(currentStatus),
       introspectables(introspectables),
+      iterationScheduled(false),
+      iterating(false),
       pendingStatusChange(false),
       pendingStatus(-1)
 {
@@ -151,8 +180,10 @@ ReadinessHelper::Private::Private(
         Introspectable introspectable = i.value();
         Q_ASSERT(introspectable.mPriv->introspectFunc != 0);
         supportedStatuses += introspectable.mPriv->makesSenseForStatuses;
-        supportedFeatures += feature;
+        supportedFeatures.insert(feature);
     }
+
+    buildGraph();
 }
 
 ReadinessHelper::Private::Private(
@@ -165,6 +196,8 @@ ReadinessHelper::Private::Private(
       proxy(proxy),
       currentStatus(currentStatus),
       introspectables(introspectables),
+      iterationScheduled(false),
+      iterating(false),
       pendingStatusChange(false),
       pendingStatus(-1)
 {
@@ -176,8 +209,10 @@ ReadinessHelper::Private::Private(
         Introspectable introspectable = i.value();
         Q_ASSERT(introspectable.mPriv->introspectFunc != 0);
         supportedStatuses += introspectable.mPriv->makesSenseForStatuses;
-        supportedFeatures += feature;
+        supportedFeatures.insert(feature);
     }
+
+    buildGraph();
 }
 
 ReadinessHelper::Private::~Private()
@@ -200,12 +235,14 @@ void ReadinessHelper::Private::setCurrentStatus(uint newStatus)
 
         // Make all features that were requested for the new status pending again
         pendingFeatures = requestedFeatures;
+        retrackOperations();
 
         // becomeReady ensures that the recursive dependencies of the requested features are already
         // in the requested set, so we don't have to re-add them here
 
         if (supportedStatuses.contains(currentStatus)) {
-            QTimer::singleShot(0, parent, SLOT(iterateIntrospection()));
+            featuresToVisit = pendingFeatures.toFeatures().toList();
+            scheduleIteration();
         } else {
             emit parent->statusReady(currentStatus);
         }
@@ -239,27 +276,60 @@ void ReadinessHelper::Private::setIntrospectCompleted(const Feature &feature,
     Q_ASSERT(pendingFeatures.contains(feature));
     Q_ASSERT(inFlightFeatures.contains(feature));
 
+    inFlightFeatures.remove(feature);
+    completeFeature(feature, success, errorName, errorMessage);
+
+    if (!success && errorName.isEmpty()) {
+        warning() << "ReadinessHelper::setIntrospectCompleted: Feature" <<
+            feature << "introspection failed but no error message was given";
+    }
+
+    scheduleIteration();
+}
+
+void ReadinessHelper::Private::completeFeature(const Feature &feature, bool success,
+        const QString &errorName, const QString &errorMessage)
+{
     if (success) {
         satisfiedFeatures.insert(feature);
-    }
-    else {
+    } else {
         missingFeatures.insert(feature);
         missingFeaturesErrors.insert(feature,
                 QPair<QString, QString>(errorName, errorMessage));
-        if (errorName.isEmpty()) {
-            warning() << "ReadinessHelper::setIntrospectCompleted: Feature" <<
-                feature << "introspection failed but no error message was given";
-        }
     }
 
     pendingFeatures.remove(feature);
-    inFlightFeatures.remove(feature);
 
+    // Only the features depending on this one can have become ready to introspect (or missing)
+    featuresToVisit += dependents.value(feature);
+
+    // And only the operations waiting for it can be finished now
+    foreach (PendingReady *operation, operationsByFeature.take(feature)) {
+        if (--operationsRemaining[operation] == 0) {
+            operationsToFinish.append(operation);
+        }
+    }
+}
+
+void ReadinessHelper::Private::scheduleIteration()
+{
+    // Everything becoming ready while iterating is handled in the same iteration
+    if (iterating || iterationScheduled) {
+        return;
+    }
+
+    iterationScheduled = true;
     QTimer::singleShot(0, parent, SLOT(iterateIntrospection()));
 }
 
 void ReadinessHelper::Private::iterateIntrospection()
 {
+    iterationScheduled = false;
+
+    if (iterating) {
+        return;
+    }
+
     if (proxy && !proxy->isValid()) {
         debug() << "ReadinessHelper: not iterating as the proxy is invalidated";
         return;
@@ -280,81 +350,42 @@ void ReadinessHelper::Private::iterateIntrospection()
         return;
     }
 
-    // Flag the currently pending reverse dependencies of any previously discovered missing features
-    // as missing
-    foreach (const Feature &feature, pendingFeatures) {
-        if (!depsFor(feature).intersect(missingFeatures).isEmpty()) {
-            missingFeatures.insert(feature);
-            missingFeaturesErrors.insert(feature,
-                    QPair<QString, QString>(TP_QT_ERROR_NOT_AVAILABLE,
-                        QLatin1String("Feature depends on other features that are not available")));
-        }
-    }
-
-    const Features completedFeatures = satisfiedFeatures + missingFeatures;
+    iterating = true;
 
-    // check if any pending operations for becomeReady should finish now
-    // based on their requested features having nothing more than what
-    // satisfiedFeatures + missingFeatures has
-    QString errorName;
-    QString errorMessage;
-    foreach (PendingReady *operation, pendingOperations) {
-        if ((operation->requestedFeatures() - completedFeatures).isEmpty()) {
-            if (parent->isReady(operation->requestedFeatures(), &errorName, &errorMessage)) {
-                operation->setFinished();
-            } else {
-                operation->setFinishedWithError(errorName, errorMessage);
-            }
-
-            // Remove the operation from tracking, so we don't double-finish it
-            //
-            // Qt foreach makes a copy of the container, which will be detached at this point, so
-            // this is perfectly safe
-            pendingOperations.removeOne(operation);
+    // Introspect every feature whose dependencies are satisfied, including the ones unblocked by
+    // features completed synchronously along the way, in a single pass
+    while (!featuresToVisit.isEmpty()) {
+        if ((proxy && !proxy->isValid()) || pendingStatusChange) {
+            iterating = false;
+            return;
         }
-    }
-
-    if ((requestedFeatures - completedFeatures).isEmpty()) {
-        // Otherwise, we'd emit statusReady with currentStatus although we are supposed to be
-        // introspecting the pendingStatus and only when that is complete, emit statusReady
-        Q_ASSERT(!pendingStatusChange);
 
-        // all requested features satisfied or missing
-        emit parent->statusReady(currentStatus);
-        return;
-    }
-
-    // update pendingFeatures with the difference of requested and
-    // satisfied + missing
-    pendingFeatures -= completedFeatures;
-
-    // find out which features don't have dependencies that are still pending
-    Features readyToIntrospect;
-    foreach (const Feature &feature, pendingFeatures) {
-        // missing doesn't have to be considered here anymore
-        if ((introspectables[feature].mPriv->dependsOnFeatures - satisfiedFeatures).isEmpty()) {
-            readyToIntrospect.insert(feature);
+        Feature feature = featuresToVisit.takeFirst();
+        if (!pendingFeatures.contains(feature) || inFlightFeatures.contains(feature)) {
+            continue;
         }
-    }
 
-    // now readyToIntrospect should contain all the features which have
-    // all their feature dependencies satisfied
-    foreach (const Feature &feature, readyToIntrospect) {
-        if (inFlightFeatures.contains(feature)) {
+        // Flag the pending reverse dependencies of missing features as missing
+        if (hasMissingDeps(feature)) {
+            completeFeature(feature, false, TP_QT_ERROR_NOT_AVAILABLE,
+                    QLatin1String("Feature depends on other features that are not available"));
             continue;
         }
 
-        inFlightFeatures.insert(feature);
-
-        Introspectable introspectable = introspectables[feature];
+        Introspectable introspectable = introspectables.value(feature);
+        if (!satisfiedFeatures.contains(introspectable.mPriv->dependsOnFeatureSet)) {
+            // Will be visited again once the dependencies it's waiting for complete
+            continue;
+        }
 
         if (!introspectable.mPriv->makesSenseForStatuses.contains(currentStatus)) {
             // No-op satisfy features for which nothing has to be done in
             // the current state
-            setIntrospectCompleted(feature, true);
-            return; // will be called with a single-shot soon again
+            completeFeature(feature, true, QString(), QString());
+            continue;
         }
 
+        bool interfacesPresent = true;
         foreach (const QString &interface, introspectable.mPriv->dependsOnInterfaces) {
             if (!interfaces.contains(interface)) {
                 // If a feature is ready to introspect and depends on a interface
@@ -362,30 +393,115 @@ void ReadinessHelper::Private::iterateIntrospection()
                 debug() << "feature" << feature << "depends on interfaces" <<
                     introspectable.mPriv->dependsOnInterfaces << ", but interface" << interface <<
                     "is not present";
-                setIntrospectCompleted(feature, false,
-                        TP_QT_ERROR_NOT_AVAILABLE,
-                        QLatin1String("Feature depend on interfaces that are not available"));
-                return; // will be called with a single-shot soon again
+                interfacesPresent = false;
+                break;
             }
         }
+        if (!interfacesPresent) {
+            completeFeature(feature, false, TP_QT_ERROR_NOT_AVAILABLE,
+                    QLatin1String("Feature depend on interfaces that are not available"));
+            continue;
+        }
+
+        inFlightFeatures.insert(feature);
 
         // yes, with the dependency info, we can even parallelize
         // introspection of several features at once, reducing total round trip
         // time considerably with many independent features!
         (*(introspectable.mPriv->introspectFunc))(introspectable.mPriv->introspectFuncData);
     }
+
+    iterating = false;
+
+    // finish the pending operations for becomeReady whose requested features have all been
+    // satisfied or found missing
+    QString errorName;
+    QString errorMessage;
+    QList<PendingReady *> operations = operationsToFinish;
+    operationsToFinish.clear();
+    foreach (PendingReady *operation, operations) {
+        // Remove the operation from tracking, so we don't double-finish it
+        pendingOperations.removeOne(operation);
+        operationsRemaining.remove(operation);
+
+        if (parent->isReady(operation->requestedFeatures(), &errorName, &errorMessage)) {
+            operation->setFinished();
+        } else {
+            operation->setFinishedWithError(errorName, errorMessage);
+        }
+    }
+
+    if (pendingFeatures.isEmpty()) {
+        // Otherwise, we'd emit statusReady with currentStatus although we are supposed to be
+        // introspecting the pendingStatus and only when that is complete, emit statusReady
+        Q_ASSERT(!pendingStatusChange);
+
+        // all requested features satisfied or missing
+        emit parent->statusReady(currentStatus);
+    }
+}
+
+bool ReadinessHelper::Private::hasMissingDeps(const Feature &feature) const
+{
+    return missingFeatures.intersects(depSets.value(feature));
+}
+
+void ReadinessHelper::Private::buildGraph()
+{
+    deps.clear();
+    depSets.clear();
+    dependents.clear();
+
+    for (Introspectables::const_iterator i = introspectables.constBegin();
+            i != introspectables.constEnd(); ++i) {
+        depSets.insert(i.key(), FeatureSet(addDeps(i.key())));
+        foreach (const Feature &dep, i.value().mPriv->dependsOnFeatures) {
+            dependents[dep].append(i.key());
+        }
+    }
 }
 
-Features ReadinessHelper::Private::depsFor(const Feature &feature)
+const Features &ReadinessHelper::Private::addDeps(const Feature &feature)
 {
-    Features deps;
+    QHash<Feature, Features>::const_iterator i = deps.constFind(feature);
+    if (i != deps.constEnd()) {
+        return i.value();
+    }
+
+    Features featureDeps;
+    foreach (const Feature &dep, introspectables.value(feature).mPriv->dependsOnFeatures) {
+        featureDeps += dep;
+        featureDeps += addDeps(dep);
+    }
+
+    return deps.insert(feature, featureDeps).value();
+}
 
-    foreach (Feature dep, introspectables[feature].mPriv->dependsOnFeatures) {
-        deps += dep;
-        deps += depsFor(dep);
+void ReadinessHelper::Private::trackOperation(PendingReady *operation)
+{
+    int remaining = 0;
+    foreach (const Feature &feature, operation->requestedFeatures()) {
+        if (!satisfiedFeatures.contains(feature) && !missingFeatures.contains(feature)) {
+            operationsByFeature[feature].append(operation);
+            ++remaining;
+        }
     }
 
-    return deps;
+    operationsRemaining.insert(operation, remaining);
+    if (remaining == 0) {
+        operationsToFinish.append(operation);
+    }
+}
+
+void ReadinessHelper::Private::retrackOperations()
+{
+    operationsByFeature.clear();
+    operationsRemaining.clear();
+    operationsToFinish.clear();
+
+    foreach (PendingReady *operation, pendingOperations) {
+        trackOperation(operation);
+    }
 }
 
 void ReadinessHelper::Private::abortOperations(const QString &errorName,
@@ -395,6 +511,10 @@ void ReadinessHelper::Private::abortOperations(const QString &errorName,
         operation->setFinishedWithError(errorName, errorMessage);
     }
     pendingOperations.clear();
+
+    operationsByFeature.clear();
+    operationsRemaining.clear();
+    operationsToFinish.clear();
 }
 
 /**
@@ -453,10 +573,12 @@ void ReadinessHelper::addIntrospectables(const Introspectables &introspectables)
             Introspectable introspectable = i.value();
             mPriv->introspectables.insert(feature, introspectable);
             mPriv->supportedStatuses += introspectable.mPriv->makesSenseForStatuses;
-            mPriv->supportedFeatures += feature;
+            mPriv->supportedFeatures.insert(feature);
         }
     }
 
+    mPriv->buildGraph();
+
     debug() << "ReadinessHelper: new supportedStatuses =" << mPriv->supportedStatuses;
     debug() << "ReadinessHelper: new supportedFeatures =" << mPriv->supportedFeatures;
 }
@@ -500,17 +622,36 @@ void ReadinessHelper::setInterfaces(const QStringList &interfaces)
 
 Features ReadinessHelper::requestedFeatures() const
 {
-    return mPriv->requestedFeatures;
+    return mPriv->requestedFeatures.toFeatures();
 }
 
 Features ReadinessHelper::actualFeatures() const
 {
-    return mPriv->satisfiedFeatures;
+    return mPriv->satisfiedFeatures.toFeatures();
 }
 
 Features ReadinessHelper::missingFeatures() const
 {
-    return mPriv->missingFeatures;
+    return mPriv->missingFeatures.toFeatures();
+}
+
+/*
+ * The single feature counterparts of requestedFeatures(), actualFeatures() and missingFeatures(),
+ * which test the feature sets directly rather than building a Features to look it up in.
+ */
+bool ReadinessHelper::isRequested(const Feature &feature) const
+{
+    return mPriv->requestedFeatures.contains(feature);
+}
+
+bool ReadinessHelper::isSatisfied(const Feature &feature) const
+{
+    return mPriv->satisfiedFeatures.contains(feature);
+}
+
+bool ReadinessHelper::isMissing(const Feature &feature) const
+{
+    return mPriv->missingFeatures.contains(feature);
 }
 
 bool ReadinessHelper::isReady(const Feature &feature,
@@ -604,8 +745,7 @@ PendingReady *ReadinessHelper::becomeReady(const Features &requestedFeatures)
         }
     }
 
-    Features supportedFeatures = mPriv->supportedFeatures;
-    if (supportedFeatures.intersect(requestedFeatures) != requestedFeatures) {
+    if (!mPriv->supportedFeatures.contains(FeatureSet(requestedFeatures))) {
         warning() << "ReadinessHelper::becomeReady called with invalid features: requestedFeatures =" <<
             requestedFeatures << "- supportedFeatures =" << mPriv->supportedFeatures;
         PendingReady *operation = new PendingReady(SharedPtr<RefCounted>(mPriv->object),
@@ -634,18 +774,26 @@ PendingReady *ReadinessHelper::becomeReady(const Features &requestedFeatures)
     // Insert the dependencies of the requested features too
     Features requestedWithDeps = requestedFeatures;
     foreach (const Feature &feature, requestedFeatures) {
-        requestedWithDeps.unite(mPriv->depsFor(feature));
+        requestedWithDeps.unite(mPriv->deps.value(feature));
     }
 
-    mPriv->requestedFeatures += requestedWithDeps;
-    mPriv->pendingFeatures += requestedWithDeps; // will be updated in iterateIntrospection
+    mPriv->requestedFeatures += FeatureSet(requestedWithDeps);
+    foreach (const Feature &feature, requestedWithDeps) {
+        if (!mPriv->satisfiedFeatures.contains(feature) &&
+            !mPriv->missingFeatures.contains(feature) &&
+            !mPriv->pendingFeatures.contains(feature)) {
+            mPriv->pendingFeatures.insert(feature);
+            mPriv->featuresToVisit.append(feature);
+        }
+    }
 
     operation = new PendingReady(SharedPtr<RefCounted>(mPriv->object), requestedFeatures);
     mPriv->pendingOperations.append(operation);
+    mPriv->trackOperation(operation);
     // Only we finish these PendingReadys, so we don't need destroyed or finished handling for them
     // - we already know when that happens, as we caused it!
 
-    QTimer::singleShot(0, this, SLOT(iterateIntrospection()));
+    mPriv->scheduleIteration();
 
     return operation;
 }
@@ -677,6 +825,7 @@ void ReadinessHelper::onProxyInvalidated(DBusProxy *proxy,
     // clear satisfied and missing features as we have public methods to get them
     mPriv->satisfiedFeatures.clear();
     mPriv->missingFeatures.clear();
+    mPriv->featuresToVisit.clear();
 
     mPriv->abortOperations(errorName, errorMessage);
 }
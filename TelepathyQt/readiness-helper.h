@@ -99,6 +99,10 @@ public:
     Features actualFeatures() const;
     Features missingFeatures() const;
 
+    bool isRequested(const Feature &feature) const;
+    bool isSatisfied(const Feature &feature) const;
+    bool isMissing(const Feature &feature) const;
+
     bool isReady(const Feature &feature,
             QString *errorName = 0, QString *errorMessage = 0) const;
     bool isReady(const Features &features,
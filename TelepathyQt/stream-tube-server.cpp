@@ -337,10 +337,87 @@ struct StreamTubeServer::Private
     ParametersGenerator *generator;
     QScopedPointer<FixedParametersGenerator> fixedGenerator;
 
+    typedef QPair<QHostAddress /* sourceAddress */, quint16 /* sourcePort */> SourceAddress;
+
+    struct TcpConnection
+    {
+        SourceAddress srcAddr;
+        RemoteContact contact;
+    };
+
+    void addTcpConnection(TubeWrapper *wrapper, uint conn, const SourceAddress &srcAddr,
+            const ContactPtr &contact);
+    bool takeTcpConnection(TubeWrapper *wrapper, uint conn, TcpConnection *tcpConn);
+    void removeTcpConnections(TubeWrapper *wrapper);
+    void removeFromIndex(const TcpConnection &tcpConn);
+
     QHash<StreamTubeChannelPtr, TubeWrapper *> tubes;
 
+    // Maintained incrementally as connections come and go, so that tcpConnections() doesn't have
+    // to walk every tube; the per-tube hashes are needed to find the entries to remove when a
+    // connection is closed or its tube goes away
+    QHash<SourceAddress, RemoteContact> tcpConnections;
+    QHash<TubeWrapper *, QHash<uint, TcpConnection> > tubeTcpConnections;
 };
 
+void StreamTubeServer::Private::addTcpConnection(TubeWrapper *wrapper, uint conn,
+        const SourceAddress &srcAddr, const ContactPtr &contact)
+{
+    TcpConnection tcpConn;
+    tcpConn.srcAddr = srcAddr;
+    tcpConn.contact = RemoteContact(wrapper->mAcc, contact);
+
+    if (srcAddr.first.isNull()) {
+        // Connections through backends which don't support SocketAccessControlPort all share the
+        // null source address
+        tcpConnections.insertMulti(srcAddr, tcpConn.contact);
+    } else {
+        tcpConnections.insert(srcAddr, tcpConn.contact);
+    }
+
+    tubeTcpConnections[wrapper].insert(conn, tcpConn);
+}
+
+bool StreamTubeServer::Private::takeTcpConnection(TubeWrapper *wrapper, uint conn,
+        TcpConnection *tcpConn)
+{
+    QHash<TubeWrapper *, QHash<uint, TcpConnection> >::iterator tubeIter =
+        tubeTcpConnections.find(wrapper);
+    if (tubeIter == tubeTcpConnections.end() || !tubeIter->contains(conn)) {
+        return false;
+    }
+
+    *tcpConn = tubeIter->take(conn);
+    if (tubeIter->isEmpty()) {
+        tubeTcpConnections.erase(tubeIter);
+    }
+
+    removeFromIndex(*tcpConn);
+    return true;
+}
+
+void StreamTubeServer::Private::removeTcpConnections(TubeWrapper *wrapper)
+{
+    foreach (const TcpConnection &tcpConn, tubeTcpConnections.take(wrapper)) {
+        removeFromIndex(tcpConn);
+    }
+}
+
+void StreamTubeServer::Private::removeFromIndex(const TcpConnection &tcpConn)
+{
+    // Only remove the entry if it's still ours, as a source address might have been reused for a
+    // connection over some other tube already
+    QHash<SourceAddress, RemoteContact>::iterator i = tcpConnections.find(tcpConn.srcAddr);
+    while (i != tcpConnections.end() && i.key() == tcpConn.srcAddr) {
+        if (i.value().account() == tcpConn.contact.account()
+                && i.value().contact() == tcpConn.contact.contact()) {
+            tcpConnections.erase(i);
+            return;
+        }
+        ++i;
+    }
+}
+
 StreamTubeServer::TubeWrapper::TubeWrapper(const AccountPtr &acc,
         const OutgoingStreamTubeChannelPtr &tube, const QHostAddress &exportedAddr,
         quint16 exportedPort, const QVariantMap &params, StreamTubeServer *parent)
@@ -871,6 +948,10 @@ QList<StreamTubeServer::Tube> StreamTubeServer::tubes() const
  * The mapping is only populated if connection monitoring was requested when creating the server (so
  * monitorsConnections() returns \c true).
  *
+ * The mapping is kept up to date as connections are made and closed, so calling this is cheap
+ * regardless of the number of tubes and connections, as is looking up the contact for the source
+ * address of a single accepted socket in the result.
+ *
  * \return The connections in a mapping with pairs of their source host addresses and ports as keys
  * and structures containing pointers to the account and remote contacts they're from as values.
  */
@@ -878,47 +959,12 @@ QHash<QPair<QHostAddress, quint16>,
     StreamTubeServer::RemoteContact>
     StreamTubeServer::tcpConnections() const
 {
-    QHash<QPair<QHostAddress /* sourceAddress */, quint16 /* sourcePort */>, RemoteContact> conns;
     if (!monitorsConnections()) {
         warning() << "StreamTubeServer::tcpConnections() used, but connection monitoring is disabled";
-        return conns;
-    }
-
-    foreach (const Tube &tube, tubes()) {
-        // Ignore invalid and non-Open tubes to prevent a few useless warnings in corner cases where
-        // a tube is still being opened, or has been invalidated but we haven't processed that event
-        // yet.
-        if (!tube.channel()->isValid() || tube.channel()->state() != TubeChannelStateOpen) {
-            continue;
-        }
-
-        if (tube.channel()->addressType() != SocketAddressTypeIPv4 &&
-                tube.channel()->addressType() != SocketAddressTypeIPv6) {
-            continue;
-        }
-
-        QHash<QPair<QHostAddress,quint16>, uint> srcAddrConns =
-            tube.channel()->connectionsForSourceAddresses();
-        QHash<uint, ContactPtr> connContacts =
-            tube.channel()->contactsForConnections();
-
-        QPair<QHostAddress, quint16> srcAddr;
-        foreach (srcAddr, srcAddrConns.keys()) {
-            ContactPtr contact = connContacts.take(srcAddrConns.value(srcAddr));
-            conns.insert(srcAddr, RemoteContact(tube.account(), contact));
-        }
-
-        // The remaining values in our copy of connContacts are those which didn't have a
-        // corresponding source address, probably because the service doesn't properly implement
-        // Port AC
-        foreach (const ContactPtr &contact, connContacts.values()) {
-            // Insert them with an invalid source address as the key
-            conns.insertMulti(qMakePair(QHostAddress(QHostAddress::Null), quint16(0)),
-                    RemoteContact(tube.account(), contact));
-        }
+        return QHash<QPair<QHostAddress, quint16>, RemoteContact>();
     }
 
-    return conns;
+    return mPriv->tcpConnections;
 }
 
 void StreamTubeServer::onInvokedForTube(
@@ -993,6 +1039,7 @@ void StreamTubeServer::onOfferFinished(
         wrapper->mTube->disconnect(this);
         emit tubeClosed(wrapper->mAcc, wrapper->mTube, op->errorName(), op->errorMessage());
         mPriv->tubes.remove(wrapper->mTube);
+        mPriv->removeTcpConnections(wrapper);
         wrapper->deleteLater();
     } else {
         debug() << "Tube" << tube->objectPath() << "offered successfully";
@@ -1017,6 +1064,7 @@ void StreamTubeServer::onTubeInvalidated(
 
     emit tubeClosed(wrapper->mAcc, wrapper->mTube, error, message);
     mPriv->tubes.remove(tube);
+    mPriv->removeTcpConnections(wrapper);
     delete wrapper;
 }
 
@@ -1028,14 +1076,12 @@ void StreamTubeServer::onNewConnection(
 
     if (wrapper->mTube->addressType() == SocketAddressTypeIPv4
             || wrapper->mTube->addressType() == SocketAddressTypeIPv6) {
-        QHash<QPair<QHostAddress,quint16>, uint> srcAddrConns =
-            wrapper->mTube->connectionsForSourceAddresses();
-        QHash<uint, Tp::ContactPtr> connContacts =
-            wrapper->mTube->contactsForConnections();
-
-        QPair<QHostAddress, quint16> srcAddr = srcAddrConns.key(conn);
-        emit newTcpConnection(srcAddr.first, srcAddr.second, wrapper->mAcc,
-                connContacts.value(conn), wrapper->mTube);
+        QPair<QHostAddress, quint16> srcAddr = wrapper->mTube->sourceAddressForConnection(conn);
+        ContactPtr contact = wrapper->mTube->contactsForConnections().value(conn);
+
+        mPriv->addTcpConnection(wrapper, conn, srcAddr, contact);
+        emit newTcpConnection(srcAddr.first, srcAddr.second, wrapper->mAcc, contact,
+                wrapper->mTube);
     } else {
         // No UNIX socket should ever have been offered yet
         Q_ASSERT(false);
@@ -1052,14 +1098,16 @@ void StreamTubeServer::onConnectionClosed(
 
     if (wrapper->mTube->addressType() == SocketAddressTypeIPv4
             || wrapper->mTube->addressType() == SocketAddressTypeIPv6) {
-        QHash<QPair<QHostAddress,quint16>, uint> srcAddrConns =
-            wrapper->mTube->connectionsForSourceAddresses();
-        QHash<uint, Tp::ContactPtr> connContacts =
-            wrapper->mTube->contactsForConnections();
-
-        QPair<QHostAddress, quint16> srcAddr = srcAddrConns.key(conn);
-        emit tcpConnectionClosed(srcAddr.first, srcAddr.second, wrapper->mAcc,
-                connContacts.value(conn), error, message, wrapper->mTube);
+        Private::TcpConnection tcpConn;
+        if (!mPriv->takeTcpConnection(wrapper, conn, &tcpConn)) {
+            // Not signaled as new yet, so the tube is the only place to recover it from
+            tcpConn.srcAddr = wrapper->mTube->sourceAddressForConnection(conn);
+            tcpConn.contact = RemoteContact(wrapper->mAcc,
+                    wrapper->mTube->contactsForConnections().value(conn));
+        }
+
+        emit tcpConnectionClosed(tcpConn.srcAddr.first, tcpConn.srcAddr.second, wrapper->mAcc,
+                tcpConn.contact.contact(), error, message, wrapper->mTube);
     } else {
         // No UNIX socket should ever have been offered yet
         Q_ASSERT(false);
@@ -25,6 +25,7 @@
 #include "TelepathyQt/_gen/text-channel.moc.hpp"
 
 #include "TelepathyQt/debug-internal.h"
+#include "TelepathyQt/trace-internal.h"
 
 #include <TelepathyQt/Connection>
 #include <TelepathyQt/ConnectionLowlevel>
@@ -37,12 +38,16 @@
 #include <TelepathyQt/ReferencedHandles>
 
 #include <QDateTime>
+#include <QLinkedList>
+#include <QVector>
 
 namespace Tp
 {
 
 struct TP_QT_NO_EXPORT TextChannel::Private
 {
+    typedef QLinkedList<ReceivedMessage> MessageList;
+
     Private(TextChannel *parent);
     ~Private();
 
@@ -57,6 +62,12 @@ struct TP_QT_NO_EXPORT TextChannel::Private
     void processMessageQueue();
     void processChatStateQueue();
 
+    void appendMessage(const ReceivedMessage &message);
+    void removeMessages(uint pendingId);
+    bool forgetMessage(const ReceivedMessage &message);
+    void eraseMessage(MessageList::iterator i);
+    void enforceMessageQueueLimit();
+
     void contactLost(uint handle);
     void contactFound(ContactPtr contact);
 
@@ -83,6 +94,9 @@ struct TP_QT_NO_EXPORT TextChannel::Private
     bool initialMessagesReceived;
     struct MessageEvent
     {
+        MessageEvent()
+            : isMessage(false), message(), removed(0)
+        { }
         MessageEvent(const ReceivedMessage &message)
             : isMessage(true), message(message),
                 removed(0)
@@ -95,8 +109,37 @@ struct TP_QT_NO_EXPORT TextChannel::Private
         ReceivedMessage message;
         uint removed;
     };
-    QList<ReceivedMessage> messages;
-    QList<MessageEvent *> incompleteMessages;
+
+    // Ring buffer of the events not processed yet, whose slots are reused as events are processed
+    struct MessageEventQueue
+    {
+        MessageEventQueue()
+            : head(0), count(0)
+        { }
+
+        bool isEmpty() const { return count == 0; }
+        int size() const { return count; }
+        MessageEvent &at(int i) { return events[(head + i) % events.size()]; }
+
+        void enqueue(const MessageEvent &event);
+        void dequeue();
+
+        QVector<MessageEvent> events;
+        int head;
+        int count;
+    };
+
+    // Received messages in order, indexed by pending message ID (which should be unique, but
+    // isn't guaranteed to be)
+    MessageList messages;
+    QMultiHash<uint, MessageList::iterator> messagesByPendingId;
+    mutable QList<ReceivedMessage> messageQueue;
+    mutable bool messageQueueValid;
+    int messageQueueLimit;
+    MessageQueueOverflowPolicy messageQueueOverflowPolicy;
+    int scrollbackMessages;
+
+    MessageEventQueue incompleteMessages;
     QHash<QDBusPendingCallWatcher *, UIntList> acknowledgeBatches;
 
     // FeatureChatState
@@ -125,7 +168,11 @@ TextChannel::Private::Private(TextChannel *parent)
       gotProperties(false),
       messagePartSupport(0),
       deliveryReportingSupport(0),
-      initialMessagesReceived(false)
+      initialMessagesReceived(false),
+      messageQueueValid(true),
+      messageQueueLimit(0),
+      messageQueueOverflowPolicy(MessageQueueOverflowForgetOldest),
+      scrollbackMessages(0)
 {
     ReadinessHelper::Introspectables introspectables;
 
@@ -166,10 +213,6 @@ TextChannel::Private::Private(TextChannel *parent)
 
 TextChannel::Private::~Private()
 {
-    foreach (MessageEvent *e, incompleteMessages) {
-        delete e;
-    }
-
     foreach (ChatStateEvent *e, chatStateQueue) {
         delete e;
     }
@@ -290,8 +333,8 @@ void TextChannel::Private::enableChatStateNotifications(
 
 void TextChannel::Private::updateInitialMessages()
 {
-    if (!readinessHelper->requestedFeatures().contains(FeatureMessageQueue) ||
-        readinessHelper->isReady(Features() << FeatureMessageQueue)) {
+    if (!readinessHelper->isRequested(FeatureMessageQueue) ||
+        readinessHelper->isReady(FeatureMessageQueue)) {
         return;
     }
 
@@ -312,8 +355,8 @@ void TextChannel::Private::updateInitialMessages()
 
 void TextChannel::Private::updateCapabilities()
 {
-    if (!readinessHelper->requestedFeatures().contains(FeatureMessageCapabilities) ||
-        readinessHelper->isReady(Features() << FeatureMessageCapabilities)) {
+    if (!readinessHelper->isRequested(FeatureMessageCapabilities) ||
+        readinessHelper->isReady(FeatureMessageCapabilities)) {
         return;
     }
 
@@ -345,12 +388,11 @@ void TextChannel::Private::processMessageQueue()
     // unique, so we need to process them in the correct order relative
     // to incoming messages
     while (!incompleteMessages.isEmpty()) {
-        const MessageEvent *e = incompleteMessages.first();
-        debug() << "MessageEvent:" << reinterpret_cast<const void *>(e);
+        const MessageEvent &e = incompleteMessages.at(0);
 
-        if (e->isMessage) {
-            if (e->message.senderHandle() != 0 &&
-                    !e->message.sender()) {
+        if (e.isMessage) {
+            if (e.message.senderHandle() != 0 &&
+                    !e.message.sender()) {
                 // the message doesn't have a sender Contact, but needs one.
                 // We'll have to stop processing here, and come back to it
                 // when we have more Contact objects
@@ -358,31 +400,25 @@ void TextChannel::Private::processMessageQueue()
             }
 
             // if we reach here, the message is ready
-            debug() << "Message is usable, copying to main queue";
-            messages << e->message;
-            emit parent->messageReceived(e->message);
+            TP_QT_TRACE(Messages, "Message %1 from %2 is usable, copying to main queue") <<
+                e.message.pendingId() << e.message.senderId();
+            ReceivedMessage message = e.message;
+            incompleteMessages.dequeue();
+            appendMessage(message);
+            emit parent->messageReceived(message);
+            enforceMessageQueueLimit();
         } else {
-            // forget about the message(s) with ID e->removed (there should be
+            // forget about the message(s) with ID e.removed (there should be
             // at most one under normal circumstances)
-            int i = 0;
-            while (i < messages.size()) {
-                if (messages.at(i).pendingId() == e->removed) {
-                    ReceivedMessage removedMessage = messages.at(i);
-                    messages.removeAt(i);
-                    emit parent->pendingMessageRemoved(removedMessage);
-                } else {
-                    i++;
-                }
-            }
+            uint removed = e.removed;
+            incompleteMessages.dequeue();
+            removeMessages(removed);
         }
-
-        debug() << "Dropping first event";
-        delete incompleteMessages.takeFirst();
     }
 
     if (incompleteMessages.isEmpty()) {
-        if (readinessHelper->requestedFeatures().contains(FeatureMessageQueue) &&
-            !readinessHelper->isReady(Features() << FeatureMessageQueue)) {
+        if (readinessHelper->isRequested(FeatureMessageQueue) &&
+            !readinessHelper->isReady(FeatureMessageQueue)) {
             debug() << "incompleteMessages empty for the first time: "
                 "FeatureMessageQueue is now ready";
             readinessHelper->setIntrospectCompleted(FeatureMessageQueue, true);
@@ -393,12 +429,13 @@ void TextChannel::Private::processMessageQueue()
     // What Contact objects do we need in order to proceed, ignoring those
     // for which we've already sent a request?
     HandleIdentifierMap contactsRequired;
-    foreach (const MessageEvent *e, incompleteMessages) {
-        if (e->isMessage) {
-            uint handle = e->message.senderHandle();
-            if (handle != 0 && !e->message.sender()
+    for (int i = 0; i < incompleteMessages.size(); ++i) {
+        const MessageEvent &e = incompleteMessages.at(i);
+        if (e.isMessage) {
+            uint handle = e.message.senderHandle();
+            if (handle != 0 && !e.message.sender()
                     && !awaitingContacts.contains(handle)) {
-                contactsRequired.insert(handle, e->message.senderId());
+                contactsRequired.insert(handle, e.message.senderId());
             }
         }
     }
@@ -407,6 +444,8 @@ void TextChannel::Private::processMessageQueue()
         return;
     }
 
+    TP_QT_TRACE(Messages, "Requesting %1 message sender contact(s)") << contactsRequired.size();
+
     ConnectionPtr conn = parent->connection();
     conn->lowlevel()->injectContactIds(contactsRequired);
 
@@ -422,7 +461,8 @@ void TextChannel::Private::processChatStateQueue()
 {
     while (!chatStateQueue.isEmpty()) {
         const ChatStateEvent *e = chatStateQueue.first();
-        debug() << "ChatStateEvent:" << reinterpret_cast<const void *>(e);
+        TP_QT_TRACE(Messages, "Processing chat state %1 of handle %2") <<
+            e->state << e->contactHandle;
 
         if (e->contact.isNull()) {
             // the chat state Contact object wasn't retrieved yet, but needs
@@ -436,7 +476,6 @@ void TextChannel::Private::processChatStateQueue()
         // if we reach here, the Contact object is ready
         emit parent->chatStateChanged(e->contact, (ChannelChatState) e->state);
 
-        debug() << "Dropping first event";
         delete chatStateQueue.takeFirst();
     }
 
@@ -464,14 +503,112 @@ void TextChannel::Private::processChatStateQueue()
     awaitingContacts |= contactsRequired;
 }
 
+void TextChannel::Private::appendMessage(const ReceivedMessage &message)
+{
+    messagesByPendingId.insert(message.pendingId(), messages.insert(messages.end(), message));
+    if (message.isScrollback()) {
+        ++scrollbackMessages;
+    }
+    messageQueueValid = false;
+}
+
+void TextChannel::Private::removeMessages(uint pendingId)
+{
+    // values() returns the most recently inserted messages first
+    QList<MessageList::iterator> removed = messagesByPendingId.values(pendingId);
+    messagesByPendingId.remove(pendingId);
+
+    for (int i = removed.size() - 1; i >= 0; --i) {
+        ReceivedMessage removedMessage = *removed[i];
+        eraseMessage(removed[i]);
+        emit parent->pendingMessageRemoved(removedMessage);
+    }
+}
+
+bool TextChannel::Private::forgetMessage(const ReceivedMessage &message)
+{
+    QMultiHash<uint, MessageList::iterator>::iterator i =
+        messagesByPendingId.find(message.pendingId());
+    while (i != messagesByPendingId.end() && i.key() == message.pendingId()) {
+        if (*i.value() == message) {
+            eraseMessage(i.value());
+            messagesByPendingId.erase(i);
+            return true;
+        }
+        ++i;
+    }
+    return false;
+}
+
+void TextChannel::Private::eraseMessage(MessageList::iterator i)
+{
+    if (i->isScrollback()) {
+        --scrollbackMessages;
+    }
+    messages.erase(i);
+    messageQueueValid = false;
+}
+
+void TextChannel::Private::enforceMessageQueueLimit()
+{
+    if (messageQueueLimit <= 0) {
+        return;
+    }
+
+    while (messages.size() > messageQueueLimit) {
+        MessageList::iterator oldest = messages.begin();
+        if (messageQueueOverflowPolicy == MessageQueueOverflowForgetScrollback &&
+                scrollbackMessages > 0) {
+            // Scrollback is usually delivered first, so this doesn't go far
+            for (MessageList::iterator i = messages.begin(); i != messages.end(); ++i) {
+                if (i->isScrollback()) {
+                    oldest = i;
+                    break;
+                }
+            }
+        }
+
+        ReceivedMessage forgotten = *oldest;
+        forgetMessage(forgotten);
+        emit parent->pendingMessageRemoved(forgotten);
+    }
+}
+
+void TextChannel::Private::MessageEventQueue::enqueue(const MessageEvent &event)
+{
+    if (count == events.size()) {
+        // Full, unroll the pending events into a buffer twice as large
+        QVector<MessageEvent> grown(qMax(16, events.size() * 2));
+        for (int i = 0; i < count; ++i) {
+            grown[i] = at(i);
+        }
+        events = grown;
+        head = 0;
+    }
+
+    events[(head + count) % events.size()] = event;
+    ++count;
+}
+
+void TextChannel::Private::MessageEventQueue::dequeue()
+{
+    Q_ASSERT(count > 0);
+
+    // Don't keep the message alive until the slot is reused
+    events[head] = MessageEvent();
+    head = (head + 1) % events.size();
+    --count;
+}
+
 void TextChannel::Private::contactLost(uint handle)
 {
     // we're not going to get a Contact object for this handle, so mark the
     // messages from that handle as "unknown sender"
-    foreach (MessageEvent *e, incompleteMessages) {
-        if (e->isMessage && e->message.senderHandle() == handle
-                && !e->message.sender()) {
-            e->message.clearSenderHandle();
+    for (int i = 0; i < incompleteMessages.size(); ++i) {
+        MessageEvent &e = incompleteMessages.at(i);
+        if (e.isMessage && e.message.senderHandle() == handle
+                && !e.message.sender()) {
+            e.message.clearSenderHandle();
         }
     }
 
@@ -489,10 +626,11 @@ void TextChannel::Private::contactFound(ContactPtr contact)
 {
     uint handle = contact->handle().at(0);
 
-    foreach (MessageEvent *e, incompleteMessages) {
-        if (e->isMessage && e->message.senderHandle() == handle
-                && !e->message.sender()) {
-            e->message.setSender(contact);
+    for (int i = 0; i < incompleteMessages.size(); ++i) {
+        MessageEvent &e = incompleteMessages.at(i);
+        if (e.isMessage && e.message.senderHandle() == handle
+                && !e.message.sender()) {
+            e.message.setSender(contact);
         }
     }
 
@@ -515,6 +653,28 @@ void TextChannel::Private::contactFound(ContactPtr contact)
  * See \ref async_model, \ref shared_ptr
  */
 
+/**
+ * \enum TextChannel::MessageQueueOverflowPolicy
+ *
+ * Specifies which message is forgotten when a message is received while the message queue holds
+ * messageQueueLimit() messages already.
+ *
+ * \sa setMessageQueueLimit()
+ */
+
+/**
+ * \var TextChannel::MessageQueueOverflowPolicy TextChannel::MessageQueueOverflowForgetOldest
+ *
+ * Forget the oldest message in the queue.
+ */
+
+/**
+ * \var TextChannel::MessageQueueOverflowPolicy TextChannel::MessageQueueOverflowForgetScrollback
+ *
+ * Forget the oldest scrollback message in the queue, or the oldest message if there is no
+ * scrollback in the queue.
+ */
+
 /**
  * Feature representing the core that needs to become ready to make the
  * TextChannel object usable.
@@ -825,7 +985,64 @@ DeliveryReportingSupportFlags TextChannel::deliveryReportingSupport() const
  */
 QList<ReceivedMessage> TextChannel::messageQueue() const
 {
-    return mPriv->messages;
+    if (!mPriv->messageQueueValid) {
+        mPriv->messageQueue.clear();
+        mPriv->messageQueue.reserve(mPriv->messages.size());
+        foreach (const ReceivedMessage &message, mPriv->messages) {
+            mPriv->messageQueue << message;
+        }
+        mPriv->messageQueueValid = true;
+    }
+    return mPriv->messageQueue;
+}
+
+/**
+ * Return the maximum number of messages kept in messageQueue(), or 0 if it is unbounded.
+ *
+ * \return The message queue limit.
+ * \sa setMessageQueueLimit(), messageQueueOverflowPolicy()
+ */
+int TextChannel::messageQueueLimit() const
+{
+    return mPriv->messageQueueLimit;
+}
+
+/**
+ * Return which messages are forgotten when more than messageQueueLimit() messages are queued.
+ *
+ * \return The overflow policy as #MessageQueueOverflowPolicy.
+ * \sa setMessageQueueLimit(), messageQueueLimit()
+ */
+TextChannel::MessageQueueOverflowPolicy TextChannel::messageQueueOverflowPolicy() const
+{
+    return mPriv->messageQueueOverflowPolicy;
+}
+
+/**
+ * Bound the number of messages kept in messageQueue() to \a limit.
+ *
+ * Whenever a message is received while the queue is full, a message is forgotten as if forget()
+ * had been called for it, and the pendingMessageRemoved() signal is emitted. With
+ * #MessageQueueOverflowForgetOldest, the oldest message is forgotten. With
+ * #MessageQueueOverflowForgetScrollback, the oldest scrollback message is forgotten, or the oldest
+ * message if there is no scrollback left in the queue.
+ *
+ * This is meant for clients which are not the main handler for a channel, such as observers,
+ * which never acknowledge messages. Forgotten messages are not acknowledged, so they keep using
+ * memory in the CM process.
+ *
+ * If the queue holds more than \a limit messages already, the excess is forgotten immediately.
+ *
+ * \param limit The maximum number of messages to keep, or 0 to keep all of them, which is the
+ *              default.
+ * \param policy Which messages to forget when the limit is reached.
+ * \sa messageQueueLimit(), messageQueueOverflowPolicy(), forget()
+ */
+void TextChannel::setMessageQueueLimit(int limit, MessageQueueOverflowPolicy policy)
+{
+    mPriv->messageQueueLimit = qMax(limit, 0);
+    mPriv->messageQueueOverflowPolicy = policy;
+    mPriv->enforceMessageQueueLimit();
 }
 
 /**
@@ -936,7 +1153,7 @@ void TextChannel::forget(const QList<ReceivedMessage> &messages)
     foreach (const ReceivedMessage &m, messages) {
         if (!m.isFromChannel(TextChannelPtr(this))) {
             warning() << "message did not come from this channel, ignoring";
-        } else if (mPriv->messages.removeOne(m)) {
+        } else if (mPriv->forgetMessage(m)) {
             emit pendingMessageRemoved(m);
         }
     }
@@ -1108,8 +1325,8 @@ void TextChannel::onMessageReceived(const MessagePartList &parts)
         return;
     }
 
-    mPriv->incompleteMessages << new Private::MessageEvent(
-            ReceivedMessage(parts, TextChannelPtr(this)));
+    mPriv->incompleteMessages.enqueue(Private::MessageEvent(
+            ReceivedMessage(parts, TextChannelPtr(this))));
     mPriv->processMessageQueue();
 }
 
@@ -1119,7 +1336,7 @@ void TextChannel::onPendingMessagesRemoved(const UIntList &ids)
         return;
     }
     foreach (uint id, ids) {
-        mPriv->incompleteMessages << new Private::MessageEvent(id);
+        mPriv->incompleteMessages.enqueue(Private::MessageEvent(id));
     }
     mPriv->processMessageQueue();
 }
@@ -1177,7 +1394,7 @@ void TextChannel::onTextReceived(uint id, uint timestamp, uint sender,
         m.setForceNonText();
     }
 
-    mPriv->incompleteMessages << new Private::MessageEvent(m);
+    mPriv->incompleteMessages.enqueue(Private::MessageEvent(m));
     mPriv->processMessageQueue();
 }
 
@@ -1256,13 +1473,13 @@ void TextChannel::gotProperties(QDBusPendingCallWatcher *watcher)
             reply.error().message();
 
         ReadinessHelper *readinessHelper = mPriv->readinessHelper;
-        if (readinessHelper->requestedFeatures().contains(FeatureMessageQueue) &&
-            !readinessHelper->isReady(Features() << FeatureMessageQueue)) {
+        if (readinessHelper->isRequested(FeatureMessageQueue) &&
+            !readinessHelper->isReady(FeatureMessageQueue)) {
             readinessHelper->setIntrospectCompleted(FeatureMessageQueue, false, reply.error());
         }
 
-        if (readinessHelper->requestedFeatures().contains(FeatureMessageCapabilities) &&
-            !readinessHelper->isReady(Features() << FeatureMessageCapabilities)) {
+        if (readinessHelper->isRequested(FeatureMessageCapabilities) &&
+            !readinessHelper->isReady(FeatureMessageCapabilities)) {
             readinessHelper->setIntrospectCompleted(FeatureMessageCapabilities, false, reply.error());
         }
         return;
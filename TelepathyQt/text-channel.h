@@ -43,6 +43,11 @@ class TP_QT_EXPORT TextChannel : public Channel
     Q_DISABLE_COPY(TextChannel)
 
 public:
+    enum MessageQueueOverflowPolicy {
+        MessageQueueOverflowForgetOldest,
+        MessageQueueOverflowForgetScrollback
+    };
+
     static const Feature FeatureCore;
     static const Feature FeatureMessageQueue;
     static const Feature FeatureMessageCapabilities;
@@ -67,6 +72,10 @@ public:
 
     // requires FeatureMessageQueue
     QList<ReceivedMessage> messageQueue() const;
+    int messageQueueLimit() const;
+    MessageQueueOverflowPolicy messageQueueOverflowPolicy() const;
+    void setMessageQueueLimit(int limit,
+            MessageQueueOverflowPolicy policy = MessageQueueOverflowForgetOldest);
 
     // requires FeatureChatState
     ChannelChatState chatState(const ContactPtr &contact) const;
@@ -0,0 +1,191 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TelepathyQt_trace_internal_h_HEADER_GUARD_
+#define _TelepathyQt_trace_internal_h_HEADER_GUARD_
+
+#include <QtCore/QObject>
+#include <QtDBus/QtDBus>
+
+#include <TelepathyQt/Global>
+#include <TelepathyQt/Types>
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QString>
+#include <QTimer>
+
+namespace Tp
+{
+
+/*
+ * Tracing of the library's hot paths.
+ *
+ * Unlike debug(), a trace point doesn't build a QString: when its category is disabled it costs a
+ * single branch, without even evaluating its arguments, and when enabled it copies the format
+ * string pointer and the arguments as a fixed size binary record into a ring buffer owned by the
+ * calling thread. Records are only formatted when they are read, by tracedMessages(), by
+ * dumpTracedMessages() or through the D-Bus Debug interface. Trace points don't reach the debug
+ * output even when enableDebug() is set, so use debug() for anything that must show up there.
+ *
+ *     TP_QT_TRACE(Contacts, "Got PresencesChanged for %1 contacts") << presences.size();
+ *
+ * The format must be a string literal. Arguments fill its %1, %2... placeholders in order; at most
+ * Trace::maxArgs of them are recorded, and the text of string arguments is truncated once
+ * Trace::textSize characters are used by the record.
+ */
+#define TP_QT_TRACE(category, format) \
+    if (Q_LIKELY(!Tp::Trace::isEnabled(Tp::Trace::category))) {} \
+    else Tp::Trace::Record(Tp::Trace::category, format)
+
+namespace Trace
+{
+
+enum Category
+{
+    Contacts = 0,
+    Roster,
+    Messages,
+    NumCategories
+};
+
+enum
+{
+    maxArgs = 4,
+    textSize = 48,
+    bufferSize = 1024
+};
+
+TP_QT_NO_EXPORT extern QBasicAtomicInt enabledCategories;
+
+inline bool isEnabled(Category category)
+{
+#if QT_VERSION >= 0x050000
+    return enabledCategories.load() & (1 << category);
+#else
+    return enabledCategories & (1 << category);
+#endif
+}
+
+TP_QT_NO_EXPORT QString categoryName(Category category);
+
+struct TP_QT_NO_EXPORT Entry
+{
+    enum ArgType
+    {
+        Int,
+        UInt,
+        Text
+    };
+
+    QString formatted() const;
+
+    qint64 nsecs;
+    const char *format;
+    quint8 category;
+    quint8 argCount;
+    quint8 textUsed;
+    quint8 argTypes[maxArgs];
+    // integers, or for Text arguments the offset of their first character in text followed by
+    // their length in the high 32 bits
+    quint64 args[maxArgs];
+    QChar text[textSize];
+};
+
+class TP_QT_NO_EXPORT Record
+{
+public:
+    Record(Category category, const char *format);
+    ~Record();
+
+    Record &operator<<(int value) { return addArg(Entry::Int, static_cast<qint64>(value)); }
+    Record &operator<<(uint value) { return addArg(Entry::UInt, value); }
+    Record &operator<<(qint64 value) { return addArg(Entry::Int, value); }
+    Record &operator<<(quint64 value) { return addArg(Entry::UInt, value); }
+    Record &operator<<(bool value) { return addArg(Entry::UInt, value ? 1 : 0); }
+    Record &operator<<(const QString &value);
+    Record &operator<<(const char *value) { return *this << QString::fromLatin1(value); }
+
+private:
+    Q_DISABLE_COPY(Record)
+
+    Record &addArg(Entry::ArgType type, quint64 value);
+
+    Entry mEntry;
+};
+
+/*
+ * Implements org.freedesktop.Telepathy.Debug on top of the trace buffers. While Enabled is set,
+ * every category is traced and the new records are signalled in batches, so that the threads
+ * tracing never have to go through D-Bus themselves.
+ */
+class TP_QT_NO_EXPORT DebugAdaptor : public QDBusAbstractAdaptor
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.freedesktop.Telepathy.Debug")
+    Q_CLASSINFO("D-Bus Introspection", ""
+"  <interface name=\"org.freedesktop.Telepathy.Debug\" >\n"
+"    <property name=\"Enabled\" type=\"b\" access=\"readwrite\" />\n"
+"    <method name=\"GetMessages\" >\n"
+"      <arg direction=\"out\" type=\"a(dsus)\" name=\"Messages\" />\n"
+"    </method>\n"
+"    <signal name=\"NewDebugMessage\" >\n"
+"      <arg type=\"d\" name=\"time\" />\n"
+"      <arg type=\"s\" name=\"domain\" />\n"
+"      <arg type=\"u\" name=\"level\" />\n"
+"      <arg type=\"s\" name=\"message\" />\n"
+"    </signal>\n"
+"  </interface>\n"
+        "")
+
+    Q_PROPERTY(bool Enabled READ Enabled WRITE SetEnabled)
+
+public:
+    // How often the new records are signalled while Enabled is set
+    static const int signalInterval = 100;
+
+    DebugAdaptor(QObject *parent);
+    virtual ~DebugAdaptor();
+
+    bool Enabled() const { return mEnabled; }
+    void SetEnabled(bool enabled);
+
+public Q_SLOTS: // Methods
+    Tp::DebugMessageList GetMessages();
+
+Q_SIGNALS: // Signals
+    void NewDebugMessage(double time, const QString &domain, uint level, const QString &message);
+
+private Q_SLOTS:
+    void signalNewMessages();
+
+private:
+    bool mEnabled;
+    int mCategoriesBeforeEnabled;
+    QTimer mTimer;
+    QHash<const void *, uint> mCursors;
+};
+
+} // Trace
+
+} // Tp
+
+#endif
@@ -0,0 +1,486 @@
+/**
+ * This file is part of TelepathyQt
+ *
+ * @copyright Copyright (C) 2013 Collabora Ltd. <http://www.collabora.co.uk/>
+ * @license LGPL 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "TelepathyQt/trace-internal.h"
+
+#include "TelepathyQt/_gen/trace-internal.moc.hpp"
+
+#include "TelepathyQt/debug-internal.h"
+
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/Debug>
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThreadStorage>
+#include <QtAlgorithms>
+
+#include <string.h>
+
+/**
+ * \defgroup tracing Tracing support
+ * \ingroup debug
+ *
+ * Besides the debug output, the library can trace the events of its busiest code paths (contact
+ * attribute updates, roster changes and the message queue of text channels) with very little
+ * overhead. Tracing is organized in categories, returned by tracingCategories(), which are all
+ * disabled by default. A disabled category costs a single check per trace point, and an enabled
+ * one stores compact records in a fixed size buffer per thread, which keeps the most recent
+ * events only. The records are turned into text when they are read, with tracedMessages() or
+ * dumpTracedMessages().
+ *
+ * These events are not written to the debug output as they happen, whether or not enableDebug()
+ * was called, so their categories need to be enabled with enableTracing() to be seen at all.
+ *
+ * The records can also be read through the \telepathy_spec Debug interface, as implemented by the
+ * object registerTracingDebugObject() registers, so that DebugReceiver and the other tools using
+ * that interface can inspect a running process.
+ */
+
+namespace Tp
+{
+
+namespace Trace
+{
+
+QBasicAtomicInt enabledCategories = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+namespace
+{
+
+const char *const categoryNames[NumCategories] = {
+    "contacts",
+    "roster",
+    "messages"
+};
+
+/*
+ * The records of a single thread.
+ *
+ * Only the owning thread writes them: it fills the entry following the newest one and then
+ * publishes it by storing the new count with release semantics. Readers take the count with
+ * acquire semantics and copy the entries before it, but never the oldest slot, which is the next
+ * one to be overwritten. Once done, they discard whatever the owner might have overwritten in the
+ * meantime, according to the count at that point.
+ */
+struct Buffer
+{
+    Buffer();
+    ~Buffer();
+
+    uint written;
+    QAtomicInt published;
+    Entry entries[bufferSize];
+};
+
+class Registry
+{
+public:
+    Registry()
+        : epochMSecs(QDateTime::currentDateTime().toMSecsSinceEpoch())
+    {
+        timer.start();
+    }
+
+    QList<Entry> entries(QHash<const void *, uint> *cursors = 0);
+    QHash<const void *, uint> cursors();
+
+    QMutex mutex;
+    QList<Buffer *> buffers;
+    QElapsedTimer timer;
+    qint64 epochMSecs;
+    // Registered by registerTracingDebugObject(), for the lifetime of the process
+    QList<QObject *> debugObjects;
+};
+
+Q_GLOBAL_STATIC(Registry, registry)
+Q_GLOBAL_STATIC(QThreadStorage<Buffer *>, threadBuffers)
+
+Buffer::Buffer()
+    : written(0),
+      published(0)
+{
+    QMutexLocker locker(&registry()->mutex);
+    registry()->buffers.append(this);
+}
+
+Buffer::~Buffer()
+{
+    // The registry may be gone already if the main thread's buffer is destroyed on exit
+    Registry *r = registry();
+    if (r) {
+        QMutexLocker locker(&r->mutex);
+        r->buffers.removeOne(this);
+    }
+}
+
+Buffer *threadBuffer()
+{
+    QThreadStorage<Buffer *> *storage = threadBuffers();
+    if (!storage->hasLocalData()) {
+        storage->setLocalData(new Buffer);
+    }
+    return storage->localData();
+}
+
+bool entryLessThan(const Entry &a, const Entry &b)
+{
+    return a.nsecs < b.nsecs;
+}
+
+QList<Entry> Registry::entries(QHash<const void *, uint> *cursors)
+{
+    QMutexLocker locker(&mutex);
+
+    QList<Entry> ret;
+    QHash<const void *, uint> newCursors;
+    foreach (Buffer *buffer, buffers) {
+        // uint arithmetic, so that the counts wrapping around doesn't matter
+        uint end = buffer->published.fetchAndAddOrdered(0);
+        uint available = qMin(end, static_cast<uint>(bufferSize - 1));
+        if (cursors && cursors->contains(buffer)) {
+            available = qMin(available, end - cursors->value(buffer));
+        }
+        uint begin = end - available;
+
+        QList<Entry> copied;
+        for (uint i = begin; i != end; ++i) {
+            copied.append(buffer->entries[i % bufferSize]);
+        }
+
+        uint endAfterCopy = buffer->published.fetchAndAddOrdered(0);
+        int overwritten = static_cast<int>(endAfterCopy - begin) - (bufferSize - 1);
+        if (overwritten > 0) {
+            copied = copied.mid(overwritten);
+        }
+
+        ret << copied;
+        newCursors.insert(buffer, end);
+    }
+
+    if (cursors) {
+        *cursors = newCursors;
+    }
+
+    qStableSort(ret.begin(), ret.end(), entryLessThan);
+    return ret;
+}
+
+QHash<const void *, uint> Registry::cursors()
+{
+    QMutexLocker locker(&mutex);
+
+    QHash<const void *, uint> ret;
+    foreach (Buffer *buffer, buffers) {
+        ret.insert(buffer, buffer->published.fetchAndAddOrdered(0));
+    }
+    return ret;
+}
+
+DebugMessage toDebugMessage(const Entry &entry)
+{
+    DebugMessage msg;
+    msg.timestamp = registry()->epochMSecs / 1000.0 + entry.nsecs / 1000000000.0;
+    msg.domain = QLatin1String("tp-qt/") +
+        categoryName(static_cast<Category>(entry.category));
+    msg.level = DebugLevelDebug;
+    msg.message = entry.formatted();
+    return msg;
+}
+
+DebugMessageList toDebugMessages(const QList<Entry> &entries)
+{
+    DebugMessageList ret;
+    foreach (const Entry &entry, entries) {
+        ret << toDebugMessage(entry);
+    }
+    return ret;
+}
+
+}
+
+QString categoryName(Category category)
+{
+    return QLatin1String(categoryNames[category]);
+}
+
+QString Entry::formatted() const
+{
+    QString strings[maxArgs];
+    for (int i = 0; i < argCount; ++i) {
+        switch (argTypes[i]) {
+            case Int:
+                strings[i] = QString::number(static_cast<qlonglong>(args[i]));
+                break;
+            case UInt:
+                strings[i] = QString::number(static_cast<qulonglong>(args[i]));
+                break;
+            case Text:
+                strings[i] = QString(text + static_cast<uint>(args[i]),
+                        static_cast<int>(args[i] >> 32));
+                break;
+        }
+    }
+
+    // Substitute all the arguments at once, so that a text argument containing something like %2
+    // doesn't get substituted in turn
+    QString format = QLatin1String(this->format);
+    switch (argCount) {
+        case 1:
+            return format.arg(strings[0]);
+        case 2:
+            return format.arg(strings[0], strings[1]);
+        case 3:
+            return format.arg(strings[0], strings[1], strings[2]);
+        case 4:
+            return format.arg(strings[0], strings[1], strings[2], strings[3]);
+        default:
+            return format;
+    }
+}
+
+Record::Record(Category category, const char *format)
+{
+    mEntry.nsecs = registry()->timer.nsecsElapsed();
+    mEntry.format = format;
+    mEntry.category = category;
+    mEntry.argCount = 0;
+    mEntry.textUsed = 0;
+}
+
+Record::~Record()
+{
+    // The entry is only copied into the buffer now, so that trace points hit while evaluating
+    // the arguments of this one don't get mixed up with it
+    Buffer *buffer = threadBuffer();
+    buffer->entries[buffer->written % bufferSize] = mEntry;
+    buffer->published.fetchAndStoreRelease(++buffer->written);
+}
+
+Record &Record::operator<<(const QString &value)
+{
+    if (mEntry.argCount == maxArgs) {
+        return *this;
+    }
+
+    uint offset = mEntry.textUsed;
+    int length = qMin(value.length(), textSize - static_cast<int>(offset));
+    memcpy(mEntry.text + offset, value.constData(), length * sizeof(QChar));
+    mEntry.textUsed += length;
+    return addArg(Entry::Text, offset | (static_cast<quint64>(length) << 32));
+}
+
+Record &Record::addArg(Entry::ArgType type, quint64 value)
+{
+    if (mEntry.argCount < maxArgs) {
+        mEntry.argTypes[mEntry.argCount] = type;
+        mEntry.args[mEntry.argCount] = value;
+        ++mEntry.argCount;
+    }
+    return *this;
+}
+
+DebugAdaptor::DebugAdaptor(QObject *parent)
+    : QDBusAbstractAdaptor(parent),
+      mEnabled(false),
+      mCategoriesBeforeEnabled(0)
+{
+    mTimer.setInterval(signalInterval);
+    connect(&mTimer, SIGNAL(timeout()), SLOT(signalNewMessages()));
+}
+
+DebugAdaptor::~DebugAdaptor()
+{
+}
+
+void DebugAdaptor::SetEnabled(bool enabled)
+{
+    if (enabled == mEnabled) {
+        return;
+    }
+
+    mEnabled = enabled;
+    if (enabled) {
+        mCategoriesBeforeEnabled = enabledCategories.fetchAndStoreOrdered(
+                (1 << NumCategories) - 1);
+        // Only what is traced from now on is signalled
+        mCursors = registry()->cursors();
+        mTimer.start();
+    } else {
+        mTimer.stop();
+        signalNewMessages();
+        mCursors.clear();
+        // Leave the categories alone if they were changed meanwhile by someone else
+        enabledCategories.testAndSetOrdered((1 << NumCategories) - 1, mCategoriesBeforeEnabled);
+    }
+}
+
+DebugMessageList DebugAdaptor::GetMessages()
+{
+    return tracedMessages();
+}
+
+void DebugAdaptor::signalNewMessages()
+{
+    foreach (const Entry &entry, registry()->entries(&mCursors)) {
+        DebugMessage msg = toDebugMessage(entry);
+        emit NewDebugMessage(msg.timestamp, msg.domain, msg.level, msg.message);
+    }
+}
+
+} // Trace
+
+/**
+ * \ingroup tracing
+ *
+ * Return the names of the tracing categories.
+ *
+ * \return The names of the categories, which can be passed to enableTracing().
+ * \sa enabledTracingCategories()
+ */
+QStringList tracingCategories()
+{
+    QStringList ret;
+    for (int i = 0; i < Trace::NumCategories; ++i) {
+        ret << Trace::categoryName(static_cast<Trace::Category>(i));
+    }
+    return ret;
+}
+
+/**
+ * \ingroup tracing
+ *
+ * Return the names of the tracing categories which are enabled.
+ *
+ * \return The names of the enabled categories.
+ * \sa enableTracing()
+ */
+QStringList enabledTracingCategories()
+{
+    QStringList ret;
+    for (int i = 0; i < Trace::NumCategories; ++i) {
+        Trace::Category category = static_cast<Trace::Category>(i);
+        if (Trace::isEnabled(category)) {
+            ret << Trace::categoryName(category);
+        }
+    }
+    return ret;
+}
+
+/**
+ * \ingroup tracing
+ *
+ * Set which tracing categories are enabled, replacing the previous set. The records already
+ * traced are kept.
+ *
+ * Enabling the Debug interface of the object registered by registerTracingDebugObject() enables
+ * all the categories, until it's disabled again.
+ *
+ * \param categories The names of the categories to enable, as returned by tracingCategories(),
+ *                   or an empty list to disable tracing.
+ */
+void enableTracing(const QStringList &categories)
+{
+    int mask = 0;
+    foreach (const QString &name, categories) {
+        int index = tracingCategories().indexOf(name);
+        if (index < 0) {
+            warning() << "enableTracing: unknown tracing category" << name;
+            continue;
+        }
+        mask |= 1 << index;
+    }
+    Trace::enabledCategories.fetchAndStoreOrdered(mask);
+}
+
+/**
+ * \ingroup tracing
+ *
+ * Return the records currently held by the trace buffers of all the threads, oldest first.
+ *
+ * Each buffer only keeps the most recent events of its thread, and is discarded when the thread
+ * finishes.
+ *
+ * \return The records, in the format of the \telepathy_spec Debug interface. Their domain is
+ *         "tp-qt/" followed by the name of their category.
+ * \sa dumpTracedMessages()
+ */
+DebugMessageList tracedMessages()
+{
+    return Trace::toDebugMessages(Trace::registry()->entries());
+}
+
+/**
+ * \ingroup tracing
+ *
+ * Write the records returned by tracedMessages() to the debug output, as set with
+ * setDebugCallback(), regardless of whether enableDebug() was called. If the library is not
+ * compiled with debug support enabled, this has no effect.
+ */
+void dumpTracedMessages()
+{
+    foreach (const DebugMessage &msg, tracedMessages()) {
+        Debug(QtDebugMsg) << qPrintable(QString(QLatin1String("[%1] %2: %3"))
+                .arg(QDateTime::fromMSecsSinceEpoch(static_cast<qint64>(msg.timestamp * 1000))
+                    .toString(QLatin1String("hh:mm:ss.zzz")))
+                .arg(msg.domain)
+                .arg(msg.message));
+    }
+}
+
+/**
+ * \ingroup tracing
+ *
+ * Register an object implementing the \telepathy_spec Debug interface on top of the trace
+ * buffers, at the path given by #TP_QT_DEBUG_OBJECT_PATH, so that the traced events can be
+ * inspected with DebugReceiver or the other tools using that interface.
+ *
+ * Its GetMessages method returns tracedMessages(). While monitoring is enabled through its
+ * Enabled property, every tracing category is enabled and the new records are signalled with
+ * NewDebugMessage every few tenths of a second.
+ *
+ * The object lives in the calling thread, and stays registered for the lifetime of the process.
+ *
+ * \param bus The bus to register the object on.
+ * \return \c true if the object was registered, \c false if another object already uses the
+ *         path.
+ */
+bool registerTracingDebugObject(const QDBusConnection &bus)
+{
+    Tp::registerTypes();
+
+    QObject *object = new QObject();
+    new Trace::DebugAdaptor(object);
+    if (!bus.registerObject(TP_QT_DEBUG_OBJECT_PATH, object)) {
+        warning() << "Unable to register the tracing Debug object: objectPath" <<
+            TP_QT_DEBUG_OBJECT_PATH << "already registered";
+        delete object;
+        return false;
+    }
+
+    QMutexLocker locker(&Trace::registry()->mutex);
+    Trace::registry()->debugObjects.append(object);
+    return true;
+}
+
+} // Tp
@@ -102,6 +102,14 @@
 #       and optional argument a set of additional libraries the target will link to. Please remember that you need to
 #       set up the DBus environment by calling TPQT_SETUP_DBUS_TEST_ENVIRONMENT BEFORE you call this macro.
 #
+# macro TPQT_ADD_DBUS_BENCHMARK (name [libraries ...])
+#       This macro takes care of building a benchmark requiring DBus emulation, contained in a single source file
+#       named ${name}.cpp and linked to tp-qt-benchmarks and to the additional libraries given as the second and
+#       optional argument. The benchmark is not built by default nor added to the CTest suite, but built and run by
+#       the "benchmarks" target, which has to be created BEFORE calling this macro, and which writes the results to
+#       bench-${name}.json in the current binary directory. As with TPQT_ADD_DBUS_UNIT_TEST, TPQT_SETUP_DBUS_TEST_ENVIRONMENT
+#       has to be called BEFORE this macro.
+#
 # macro _TPQT_ADD_CHECK_TARGETS (fancyName name command [args])
 #       This is an internal macro which is meant to be used by TPQT_ADD_DBUS_UNIT_TEST and TPQT_ADD_GENERIC_UNIT_TEST.
 #       It takes care of generating a check target for each test method available (currently normal execution, valgrind and
@@ -424,6 +432,19 @@ macro(tpqt_add_dbus_unit_test _fancyName _name)
     _tpqt_add_check_targets(${_fancyName} ${_name} ${with_session_bus} ${CMAKE_CURRENT_BINARY_DIR}/test-${_name})
 endmacro(tpqt_add_dbus_unit_test _fancyName _name)
 
+macro(tpqt_add_dbus_benchmark _name)
+    tpqt_generate_moc_i(${_name}.cpp ${CMAKE_CURRENT_BINARY_DIR}/_gen/${_name}.cpp.moc.hpp)
+    add_executable(bench-${_name} EXCLUDE_FROM_ALL ${_name}.cpp ${CMAKE_CURRENT_BINARY_DIR}/_gen/${_name}.cpp.moc.hpp)
+    target_link_libraries(bench-${_name} tp-qt-benchmarks ${QT_QTCORE_LIBRARY} ${QT_QTDBUS_LIBRARY} ${QT_QTNETWORK_LIBRARY} ${QT_QTXML_LIBRARY} ${QT_QTTEST_LIBRARY} telepathy-qt${QT_VERSION_MAJOR} tp-qt-tests ${TP_QT_EXECUTABLE_LINKER_FLAGS} ${ARGN})
+
+    add_custom_target(run-bench-${_name}
+        COMMAND ${SH} ${CMAKE_CURRENT_BINARY_DIR}/runDbusTest.sh ${CMAKE_CURRENT_BINARY_DIR}/bench-${_name}
+        WORKING_DIRECTORY ${CMAKE_CURRENT_BINARY_DIR}
+        COMMENT "Running benchmark \"${_name}\"")
+    add_dependencies(run-bench-${_name} bench-${_name})
+    add_dependencies(benchmarks run-bench-${_name})
+endmacro(tpqt_add_dbus_benchmark _name)
+
 macro(_tpqt_add_check_targets _fancyName _name _runnerScript)
     set_tests_properties(${_fancyName}
         PROPERTIES
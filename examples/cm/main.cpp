@@ -18,11 +18,12 @@ int main(int argc, char **argv)
     Tp::enableDebug(true);
     Tp::enableWarnings(true);
 
-    BaseProtocolPtr proto = BaseProtocol::create<Protocol>(
-            QDBusConnection::sessionBus(),
-            QLatin1String("example-proto"));
+    QString cmName = QLatin1String("TpQtExampleCM");
+    BaseProtocolPtr proto = BaseProtocolPtr(new Protocol(
+            QDBusConnection::sessionBus(), cmName,
+            QLatin1String("example-proto")));
     BaseConnectionManagerPtr cm = BaseConnectionManager::create(
-            QDBusConnection::sessionBus(), QLatin1String("TpQtExampleCM"));
+            QDBusConnection::sessionBus(), cmName);
     cm->addProtocol(proto);
     cm->registerObject();
 
@@ -34,8 +34,36 @@
 
 using namespace Tp;
 
-Protocol::Protocol(const QDBusConnection &dbusConnection, const QString &name)
-    : BaseProtocol(dbusConnection, name)
+namespace
+{
+
+class Connection : public BaseConnection
+{
+public:
+    Connection(const QDBusConnection &dbusConnection, const QString &cmName,
+            const QString &protocolName, const QVariantMap &parameters)
+        : BaseConnection(dbusConnection, cmName, protocolName, parameters)
+    {
+        setConnectCallback(memFun(this, &Connection::doConnect));
+    }
+
+private:
+    void doConnect(Tp::DBusError *error)
+    {
+        Q_UNUSED(error);
+
+        // There is no server to talk to, so we're connected right away
+        setSelfContact(1, parameters().value(QLatin1String("example-param")).toString());
+        setStatus(ConnectionStatusConnected, ConnectionStatusReasonRequested);
+    }
+};
+
+}
+
+Protocol::Protocol(const QDBusConnection &dbusConnection, const QString &cmName,
+        const QString &name)
+    : BaseProtocol(dbusConnection, name),
+      cmName(cmName)
 {
     setParameters(ProtocolParameterList() <<
             ProtocolParameter(QLatin1String("example-param"),
@@ -88,8 +116,12 @@ Protocol::~Protocol()
 
 BaseConnectionPtr Protocol::createConnection(const QVariantMap &parameters, Tp::DBusError *error)
 {
-    error->set(QLatin1String("CreateConnection.Error.Test"), QLatin1String(""));
-    return BaseConnectionPtr();
+    if (parameters.value(QLatin1String("example-param")).toString().isEmpty()) {
+        error->set(TP_QT_ERROR_INVALID_ARGUMENT, QLatin1String("example-param is required"));
+        return BaseConnectionPtr();
+    }
+
+    return BaseConnection::create<Connection>(cmName, name(), parameters, dbusConnection());
 }
 
 QString Protocol::identifyAccount(const QVariantMap &parameters, Tp::DBusError *error)
@@ -31,7 +31,7 @@ class Protocol : public Tp::BaseProtocol
     Q_DISABLE_COPY(Protocol)
 
 public:
-    Protocol(const QDBusConnection &dbusConnection, const QString &name);
+    Protocol(const QDBusConnection &dbusConnection, const QString &cmName, const QString &name);
     virtual ~Protocol();
 
 private:
@@ -44,6 +44,8 @@ private:
             Tp::DBusError *error);
     QString normalizeContactUri(const QString &uri, Tp::DBusError *error);
 
+    QString cmName;
+
     Tp::BaseProtocolAddressingInterfacePtr addrIface;
     Tp::BaseProtocolAvatarsInterfacePtr avatarsIface;
     Tp::BaseProtocolPresenceInterfacePtr presenceIface;
@@ -0,0 +1,171 @@
+#include <tests/benchmarks/benchmark.h>
+#include <tests/lib/test-thread-helper.h>
+
+#define TP_QT_ENABLE_LOWLEVEL_API
+
+#include <examples/cm/protocol.h>
+
+#include <TelepathyQt/BaseConnectionManager>
+#include <TelepathyQt/BaseProtocol>
+#include <TelepathyQt/Connection>
+#include <TelepathyQt/ConnectionManager>
+#include <TelepathyQt/ConnectionManagerLowlevel>
+#include <TelepathyQt/DBusError>
+#include <TelepathyQt/PendingConnection>
+#include <TelepathyQt/PendingReady>
+
+using namespace Tp;
+
+namespace
+{
+
+const int connectionCount = 500;
+
+}
+
+class BenchBaseCM : public Benchmark
+{
+    Q_OBJECT
+
+public:
+    BenchBaseCM(QObject *parent = 0)
+        : Benchmark(QLatin1String("base-cm"), parent),
+          mThreadHelper(0)
+    { }
+
+private:
+    static void createCM(BaseConnectionManagerPtr &cm, const QString &cmName,
+            bool sharedBusName);
+    static void createOwnBusNameCM(BaseConnectionManagerPtr &cm);
+    static void createSharedBusNameCM(BaseConnectionManagerPtr &cm);
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void benchConnect_data();
+    void benchConnect();
+
+    void cleanup();
+    void cleanupTestCase();
+
+private:
+    TestThreadHelper<BaseConnectionManagerPtr> *mThreadHelper;
+};
+
+void BenchBaseCM::createCM(BaseConnectionManagerPtr &cm, const QString &cmName,
+        bool sharedBusName)
+{
+    cm = BaseConnectionManager::create(cmName);
+    cm->setSharedBusNameEnabled(sharedBusName);
+
+    BaseProtocolPtr protocol = BaseProtocolPtr(new Protocol(QDBusConnection::sessionBus(),
+            cmName, QLatin1String("example-proto")));
+    QVERIFY(cm->addProtocol(protocol));
+
+    Tp::DBusError err;
+    QVERIFY(cm->registerObject(&err));
+    QVERIFY(!err.isValid());
+}
+
+void BenchBaseCM::createOwnBusNameCM(BaseConnectionManagerPtr &cm)
+{
+    createCM(cm, QLatin1String("benchcm"), false);
+}
+
+void BenchBaseCM::createSharedBusNameCM(BaseConnectionManagerPtr &cm)
+{
+    createCM(cm, QLatin1String("benchcmshared"), true);
+}
+
+void BenchBaseCM::initTestCase()
+{
+    initTestCaseImpl();
+}
+
+void BenchBaseCM::init()
+{
+    initImpl();
+    mThreadHelper = new TestThreadHelper<BaseConnectionManagerPtr>();
+}
+
+void BenchBaseCM::benchConnect_data()
+{
+    QTest::addColumn<bool>("sharedBusName");
+
+    QTest::newRow("own-bus-name") << false;
+    QTest::newRow("shared-bus-name") << true;
+}
+
+void BenchBaseCM::benchConnect()
+{
+    QFETCH(bool, sharedBusName);
+
+    QString cmName;
+    if (sharedBusName) {
+        cmName = QLatin1String("benchcmshared");
+        TEST_THREAD_HELPER_EXECUTE(mThreadHelper, &BenchBaseCM::createSharedBusNameCM);
+    } else {
+        cmName = QLatin1String("benchcm");
+        TEST_THREAD_HELPER_EXECUTE(mThreadHelper, &BenchBaseCM::createOwnBusNameCM);
+    }
+
+    ConnectionManagerPtr cliCM = ConnectionManager::create(cmName);
+    QVERIFY(connect(cliCM->becomeReady(),
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+
+    QVariantMap parameters;
+    parameters.insert(QLatin1String("example-param"), QLatin1String("me@example.com"));
+
+    // Each connection is requested and connected in turn, so that the time per connection is the
+    // latency a single client would see
+    QList<ConnectionPtr> connections;
+    startMeasurement();
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < connectionCount; ++i) {
+            PendingConnection *pc = cliCM->lowlevel()->requestConnection(
+                    QLatin1String("example-proto"), parameters);
+            QVERIFY(connect(pc,
+                        SIGNAL(finished(Tp::PendingOperation*)),
+                        SLOT(expectSuccessfulCall(Tp::PendingOperation*))));
+            QCOMPARE(mLoop->exec(), 0);
+
+            ConnectionPtr conn = pc->connection();
+            Client::ConnectionInterface connIface(conn->dbusConnection(), conn->busName(),
+                    conn->objectPath());
+            QDBusPendingReply<> reply = connIface.Connect();
+            reply.waitForFinished();
+            QVERIFY(!reply.isError());
+
+            connections << conn;
+        }
+    }
+    stopMeasurement(QLatin1String("connect/") + QLatin1String(QTest::currentDataTag()),
+            connectionCount);
+
+    if (sharedBusName) {
+        QCOMPARE(connections.first()->busName(),
+                TP_QT_CONNECTION_MANAGER_BUS_NAME_BASE + cmName);
+        QCOMPARE(connections.last()->busName(), connections.first()->busName());
+    } else {
+        QVERIFY(connections.last()->busName() != connections.first()->busName());
+    }
+    QVERIFY(connections.last()->objectPath() != connections.first()->objectPath());
+}
+
+void BenchBaseCM::cleanup()
+{
+    delete mThreadHelper;
+    mThreadHelper = 0;
+    cleanupImpl();
+}
+
+void BenchBaseCM::cleanupTestCase()
+{
+    cleanupTestCaseImpl();
+}
+
+QTEST_MAIN(BenchBaseCM)
+#include "_gen/base-cm.cpp.moc.hpp"
@@ -0,0 +1,210 @@
+#include "tests/benchmarks/benchmark.h"
+
+#include "config-version.h"
+
+#include <cstdlib>
+#include <new>
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QTextStream>
+
+#include <TelepathyQt/Debug>
+
+#include <dbus/dbus.h>
+#include <dbus/dbus-glib-lowlevel.h>
+
+namespace
+{
+
+// Counts the C++ heap allocations of the whole process, including the ones done by Qt and
+// Telepathy-Qt; the allocations of the GLib services behind the test connections aren't counted
+QAtomicInt allocationCount;
+
+DBusHandlerResult countMessage(DBusConnection *, DBusMessage *, void *data)
+{
+    ++*static_cast<quint64 *>(data);
+
+    // The monitor only eavesdrops, so don't let libdbus answer the method calls it sees
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+QString jsonString(const QString &str)
+{
+    QString ret = str;
+    ret.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+    ret.replace(QLatin1Char('"'), QLatin1String("\\\""));
+    return QLatin1Char('"') + ret + QLatin1Char('"');
+}
+
+}
+
+#if __cplusplus >= 201103L
+void *operator new(std::size_t size)
+#else
+void *operator new(std::size_t size) throw(std::bad_alloc)
+#endif
+{
+    allocationCount.fetchAndAddRelaxed(1);
+
+    void *ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+#if __cplusplus >= 201103L
+void operator delete(void *ptr) noexcept
+#else
+void operator delete(void *ptr) throw()
+#endif
+{
+    std::free(ptr);
+}
+
+Benchmark::Benchmark(const QString &name, QObject *parent)
+    : Test(parent),
+      mName(name),
+      mBusMonitor(0),
+      mDBusMessages(0),
+      mDBusMessagesAtStart(0),
+      mAllocationsAtStart(0)
+{
+}
+
+Benchmark::~Benchmark()
+{
+    if (mBusMonitor) {
+        dbus_connection_close(mBusMonitor);
+        dbus_connection_unref(mBusMonitor);
+    }
+}
+
+void Benchmark::initTestCaseImpl()
+{
+    Test::initTestCaseImpl();
+
+    // Printing the debug output would take longer than most of what is measured
+    Tp::enableDebug(false);
+
+    DBusError error;
+    dbus_error_init(&error);
+
+    mBusMonitor = dbus_bus_get_private(DBUS_BUS_SESSION, &error);
+    if (!mBusMonitor) {
+        qWarning() << "Couldn't connect the bus monitor:" << error.message;
+        dbus_error_free(&error);
+        QFAIL("No bus monitor");
+    }
+    dbus_connection_set_exit_on_disconnect(mBusMonitor, FALSE);
+
+    // The test session bus allows eavesdropping, see tests/dbus-1/session.conf.in
+    dbus_bus_add_match(mBusMonitor, "eavesdrop='true'", &error);
+    if (dbus_error_is_set(&error)) {
+        qWarning() << "Couldn't eavesdrop on the bus:" << error.message;
+        dbus_error_free(&error);
+        QFAIL("No bus monitor");
+    }
+
+    dbus_connection_add_filter(mBusMonitor, countMessage, &mDBusMessages, 0);
+    dbus_connection_setup_with_g_main(mBusMonitor, 0);
+}
+
+void Benchmark::cleanupTestCaseImpl()
+{
+    QVERIFY(writeResults());
+
+    Test::cleanupTestCaseImpl();
+}
+
+/*
+ * Start measuring the wall time, D-Bus messages and allocations of a scenario. This is meant to be
+ * called right before the QBENCHMARK block, once the test objects have been set up.
+ */
+void Benchmark::startMeasurement()
+{
+    syncBusMonitor();
+
+    mDBusMessagesAtStart = mDBusMessages;
+    mAllocationsAtStart = allocationCount.fetchAndAddRelaxed(0);
+    mTimer.start();
+}
+
+/*
+ * Stop the measurement started by startMeasurement() and record it for \a scenario, which handled
+ * \a items contacts, messages or channels.
+ */
+void Benchmark::stopMeasurement(const QString &scenario, quint64 items)
+{
+    Measurement measurement;
+    measurement.scenario = scenario;
+    measurement.items = items;
+    measurement.wallTimeMSecs = mTimer.elapsed();
+    // The counter wraps around at 32 bits, which is fine as long as a single scenario does fewer
+    // allocations than that
+    measurement.allocations = static_cast<quint32>(allocationCount.fetchAndAddRelaxed(0))
+        - mAllocationsAtStart;
+
+    syncBusMonitor();
+    measurement.dbusMessages = mDBusMessages - mDBusMessagesAtStart;
+
+    qDebug().nospace() << mName << "/" << scenario << ": " << items << " items, "
+        << measurement.wallTimeMSecs << " ms, " << measurement.dbusMessages << " D-Bus messages, "
+        << measurement.allocations << " allocations";
+
+    mMeasurements.append(measurement);
+}
+
+/*
+ * Make sure the monitor has seen all of the messages the bus has routed so far. The bus delivers
+ * messages in order, so once it has answered a call made now, the copies of the earlier messages are
+ * queued on the monitor connection already and just need to be dispatched.
+ */
+void Benchmark::syncBusMonitor()
+{
+    char *id = dbus_bus_get_id(mBusMonitor, 0);
+    dbus_free(id);
+
+    while (dbus_connection_dispatch(mBusMonitor) == DBUS_DISPATCH_DATA_REMAINS) {
+    }
+}
+
+bool Benchmark::writeResults() const
+{
+    QString fileName = QString::fromLocal8Bit(qgetenv("TP_QT_BENCHMARK_RESULTS"));
+    if (fileName.isEmpty()) {
+        fileName = QString(QLatin1String("bench-%1.json")).arg(mName);
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qWarning() << "Couldn't write the benchmark results to" << fileName;
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "{\n";
+    out << "    \"benchmark\": " << jsonString(mName) << ",\n";
+    out << "    \"version\": " << jsonString(QLatin1String(PACKAGE_VERSION)) << ",\n";
+    out << "    \"qtVersion\": " << jsonString(QLatin1String(qVersion())) << ",\n";
+    out << "    \"results\": [";
+    for (int i = 0; i < mMeasurements.size(); ++i) {
+        const Measurement &measurement = mMeasurements.at(i);
+        out << (i ? ",\n" : "\n");
+        out << "        {\n";
+        out << "            \"scenario\": " << jsonString(measurement.scenario) << ",\n";
+        out << "            \"items\": " << measurement.items << ",\n";
+        out << "            \"wallTimeMSecs\": " << measurement.wallTimeMSecs << ",\n";
+        out << "            \"dbusMessages\": " << measurement.dbusMessages << ",\n";
+        out << "            \"allocations\": " << measurement.allocations << "\n";
+        out << "        }";
+    }
+    out << "\n    ]\n";
+    out << "}\n";
+
+    qDebug() << "Benchmark results written to" << fileName;
+    return true;
+}
+
+#include "_gen/benchmark.h.moc.hpp"
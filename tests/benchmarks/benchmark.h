@@ -0,0 +1,59 @@
+#ifndef _TelepathyQt_tests_benchmarks_benchmark_h_HEADER_GUARD_
+#define _TelepathyQt_tests_benchmarks_benchmark_h_HEADER_GUARD_
+
+#include <tests/lib/test.h>
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+
+struct DBusConnection;
+
+/*
+ * Base class for the benchmarks.
+ *
+ * Besides the wall time QBENCHMARK reports, each measurement counts the D-Bus messages which went
+ * through the session bus, as seen by an eavesdropping connection, and the C++ heap allocations
+ * done by the process. The measurements are written as JSON to the file named by the
+ * TP_QT_BENCHMARK_RESULTS environment variable, or to bench-<name>.json in the current directory,
+ * so that they can be compared between releases.
+ */
+class Benchmark : public Test
+{
+    Q_OBJECT
+
+public:
+    Benchmark(const QString &name, QObject *parent = 0);
+    virtual ~Benchmark();
+
+protected:
+    void startMeasurement();
+    void stopMeasurement(const QString &scenario, quint64 items);
+
+protected Q_SLOTS:
+    virtual void initTestCaseImpl();
+    virtual void cleanupTestCaseImpl();
+
+private:
+    struct Measurement
+    {
+        QString scenario;
+        quint64 items;
+        qint64 wallTimeMSecs;
+        quint64 dbusMessages;
+        quint64 allocations;
+    };
+
+    void syncBusMonitor();
+    bool writeResults() const;
+
+    QString mName;
+    DBusConnection *mBusMonitor;
+    quint64 mDBusMessages;
+    QElapsedTimer mTimer;
+    quint64 mDBusMessagesAtStart;
+    quint32 mAllocationsAtStart;
+    QList<Measurement> mMeasurements;
+};
+
+#endif // _TelepathyQt_tests_benchmarks_benchmark_h_HEADER_GUARD_
@@ -0,0 +1,252 @@
+#include <tests/benchmarks/benchmark.h>
+
+#include <tests/lib/glib-helpers/test-conn-helper.h>
+
+#include <tests/lib/glib/contacts-conn.h>
+#include <tests/lib/glib/echo2/chan.h>
+
+#include <TelepathyQt/Account>
+#include <TelepathyQt/AccountManager>
+#include <TelepathyQt/AbstractClientObserver>
+#include <TelepathyQt/Channel>
+#include <TelepathyQt/ChannelClassSpec>
+#include <TelepathyQt/ClientObserverInterface>
+#include <TelepathyQt/ClientRegistrar>
+#include <TelepathyQt/Connection>
+#include <TelepathyQt/MethodInvocationContext>
+#include <TelepathyQt/PendingAccount>
+#include <TelepathyQt/PendingReady>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+using namespace Tp;
+using namespace Tp::Client;
+
+namespace
+{
+
+const int channelCount = 1000;
+
+}
+
+class ChannelCounter : public QObject, public AbstractClientObserver
+{
+    Q_OBJECT
+
+public:
+    static AbstractClientPtr create(const ChannelClassSpecList &channelFilter)
+    {
+        return AbstractClientPtr::dynamicCast(SharedPtr<ChannelCounter>(
+                    new ChannelCounter(channelFilter)));
+    }
+
+    ChannelCounter(const ChannelClassSpecList &channelFilter)
+        : AbstractClientObserver(channelFilter),
+          mObserved(0)
+    {
+    }
+
+    ~ChannelCounter()
+    {
+    }
+
+    void observeChannels(const MethodInvocationContextPtr<> &context,
+            const AccountPtr &account,
+            const ConnectionPtr &connection,
+            const QList<ChannelPtr> &channels,
+            const ChannelDispatchOperationPtr &dispatchOperation,
+            const QList<ChannelRequestPtr> &requestsSatisfied,
+            const AbstractClientObserver::ObserverInfo &observerInfo)
+    {
+        Q_UNUSED(account);
+        Q_UNUSED(connection);
+        Q_UNUSED(dispatchOperation);
+        Q_UNUSED(requestsSatisfied);
+        Q_UNUSED(observerInfo);
+
+        mObserved += channels.size();
+        context->setFinished();
+        Q_EMIT channelsObserved(mObserved);
+    }
+
+    int mObserved;
+
+Q_SIGNALS:
+    void channelsObserved(int count);
+};
+
+class BenchClient : public Benchmark
+{
+    Q_OBJECT
+
+public:
+    BenchClient(QObject *parent = 0)
+        : Benchmark(QLatin1String("client"), parent),
+          mConn(0)
+    { }
+
+protected Q_SLOTS:
+    void onChannelsObserved(int count);
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void benchObserveChannels_data();
+    void benchObserveChannels();
+
+    void cleanup();
+    void cleanupTestCase();
+
+private:
+    AccountManagerPtr mAM;
+    AccountPtr mAccount;
+    TestConnHelper *mConn;
+    TpHandle mHandle;
+
+    ClientRegistrarPtr mClientRegistrar;
+    AbstractClientPtr mClientObject;
+    QString mClientBusName;
+    QString mClientObjectPath;
+};
+
+void BenchClient::onChannelsObserved(int count)
+{
+    if (count == channelCount) {
+        mLoop->exit(0);
+    }
+}
+
+void BenchClient::initTestCase()
+{
+    initTestCaseImpl();
+
+    g_type_init();
+    g_set_prgname("bench-client");
+    dbus_g_bus_get(DBUS_BUS_STARTER, 0);
+
+    mAM = AccountManager::create();
+    QVERIFY(connect(mAM->becomeReady(),
+                    SIGNAL(finished(Tp::PendingOperation *)),
+                    SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(mAM->isReady(), true);
+
+    QVariantMap parameters;
+    parameters[QLatin1String("account")] = QLatin1String("foobar");
+    PendingAccount *pacc = mAM->createAccount(QLatin1String("foo"),
+            QLatin1String("bar"), QLatin1String("foobar"), parameters);
+    QVERIFY(connect(pacc,
+                    SIGNAL(finished(Tp::PendingOperation *)),
+                    SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(pacc->account());
+    mAccount = pacc->account();
+
+    mConn = new TestConnHelper(this,
+            TP_TESTS_TYPE_CONTACTS_CONNECTION,
+            "account", "me@example.com",
+            "protocol", "example",
+            NULL);
+    QCOMPARE(mConn->connect(), true);
+
+    TpHandleRepoIface *contactRepo = tp_base_connection_get_handles(
+            TP_BASE_CONNECTION(mConn->service()), TP_HANDLE_TYPE_CONTACT);
+    mHandle = tp_handle_ensure(contactRepo, "someone@localhost", 0, 0);
+
+    mClientRegistrar = ClientRegistrar::create();
+    mClientObject = ChannelCounter::create(ChannelClassSpecList() << ChannelClassSpec::textChat());
+    QVERIFY(mClientRegistrar->registerClient(mClientObject, QLatin1String("bench")));
+    mClientBusName = QLatin1String("org.freedesktop.Telepathy.Client.bench");
+    mClientObjectPath = QLatin1String("/org/freedesktop/Telepathy/Client/bench");
+
+    QVERIFY(connect(dynamic_cast<ChannelCounter *>(mClientObject.data()),
+                SIGNAL(channelsObserved(int)),
+                SLOT(onChannelsObserved(int))));
+}
+
+void BenchClient::init()
+{
+    initImpl();
+}
+
+void BenchClient::benchObserveChannels_data()
+{
+    QTest::addColumn<bool>("streaming");
+
+    QTest::newRow("batched") << false;
+    QTest::newRow("streaming") << true;
+}
+
+void BenchClient::benchObserveChannels()
+{
+    QFETCH(bool, streaming);
+
+    QString dataTag = QLatin1String(QTest::currentDataTag());
+    mClientRegistrar->setStreamingDispatchEnabled(streaming);
+    dynamic_cast<ChannelCounter *>(mClientObject.data())->mObserved = 0;
+
+    // Use new channels for each run, so that none of them are cached by the channel factory
+    QList<ExampleEcho2Channel *> chanServices;
+    ChannelDetailsList channelDetailsList;
+    for (int i = 0; i < channelCount; ++i) {
+        QString chanPath = mConn->objectPath() +
+            QString(QLatin1String("/%1/TextChannel%2")).arg(dataTag).arg(i);
+        chanServices << EXAMPLE_ECHO_2_CHANNEL(g_object_new(
+                    EXAMPLE_TYPE_ECHO_2_CHANNEL,
+                    "connection", mConn->service(),
+                    "object-path", chanPath.toLatin1().constData(),
+                    "handle", mHandle,
+                    NULL));
+
+        QVariantMap properties;
+        properties.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType"),
+                TP_QT_IFACE_CHANNEL_TYPE_TEXT);
+        properties.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType"),
+                (uint) Tp::HandleTypeContact);
+        properties.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle"), mHandle);
+        ChannelDetails channelDetails = { QDBusObjectPath(chanPath), properties };
+        channelDetailsList.append(channelDetails);
+    }
+
+    ClientObserverInterface *observeIface = new ClientObserverInterface(
+            mClientRegistrar->dbusConnection(), mClientBusName, mClientObjectPath, this);
+
+    startMeasurement();
+    QBENCHMARK_ONCE {
+        observeIface->ObserveChannels(QDBusObjectPath(mAccount->objectPath()),
+                QDBusObjectPath(mConn->objectPath()),
+                channelDetailsList,
+                QDBusObjectPath("/"),
+                ObjectPathList(),
+                QVariantMap());
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    stopMeasurement(QLatin1String("observeChannels/") + dataTag, channelCount);
+
+    delete observeIface;
+    Q_FOREACH (ExampleEcho2Channel *chanService, chanServices) {
+        g_object_unref(chanService);
+    }
+}
+
+void BenchClient::cleanup()
+{
+    cleanupImpl();
+}
+
+void BenchClient::cleanupTestCase()
+{
+    mClientRegistrar->unregisterClients();
+    mClientRegistrar.reset();
+
+    if (mConn) {
+        QCOMPARE(mConn->disconnect(), true);
+        delete mConn;
+    }
+
+    cleanupTestCaseImpl();
+}
+
+QTEST_MAIN(BenchClient)
+#include "_gen/client.cpp.moc.hpp"
@@ -0,0 +1,170 @@
+#include <tests/benchmarks/benchmark.h>
+
+#include <tests/lib/glib-helpers/test-conn-helper.h>
+
+#include <tests/lib/glib/contact-list-manager.h>
+#include <tests/lib/glib/contacts-conn.h>
+
+#include <TelepathyQt/ChannelFactory>
+#include <TelepathyQt/Connection>
+#include <TelepathyQt/Contact>
+#include <TelepathyQt/ContactFactory>
+#include <TelepathyQt/ContactManager>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include <QVector>
+
+using namespace Tp;
+
+namespace
+{
+
+const int rosterSize = 10000;
+
+}
+
+class BenchContacts : public Benchmark
+{
+    Q_OBJECT
+
+public:
+    BenchContacts(QObject *parent = 0)
+        : Benchmark(QLatin1String("contacts"), parent),
+          mConn(0)
+    { }
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void benchRosterLoad();
+    void benchUpgradeContacts();
+
+    void cleanup();
+    void cleanupTestCase();
+
+private:
+    TestConnHelper *mConn;
+};
+
+void BenchContacts::initTestCase()
+{
+    initTestCaseImpl();
+
+    g_type_init();
+    g_set_prgname("bench-contacts");
+    dbus_g_bus_get(DBUS_BUS_STARTER, 0);
+
+    // Load the roster with the features a typical contact list UI would want
+    ContactFactoryPtr contactFactory = ContactFactory::create(Features()
+            << Contact::FeatureAlias
+            << Contact::FeatureAvatarToken
+            << Contact::FeatureSimplePresence);
+    mConn = new TestConnHelper(this,
+            ChannelFactory::create(QDBusConnection::sessionBus()),
+            contactFactory,
+            TP_TESTS_TYPE_CONTACTS_CONNECTION,
+            "account", "me@example.com",
+            "protocol", "example",
+            NULL);
+    QCOMPARE(mConn->connect(), true);
+
+    TpTestsContactsConnection *connService = TP_TESTS_CONTACTS_CONNECTION(mConn->service());
+    TpHandleRepoIface *contactRepo = tp_base_connection_get_handles(
+            TP_BASE_CONNECTION(connService), TP_HANDLE_TYPE_CONTACT);
+
+    QVector<TpHandle> handles;
+    QList<QByteArray> aliases;
+    QList<QByteArray> tokens;
+    for (int i = 0; i < rosterSize; ++i) {
+        QByteArray id = "contact" + QByteArray::number(i) + "@example.com";
+        handles << tp_handle_ensure(contactRepo, id.constData(), 0, 0);
+        aliases << "Contact #" + QByteArray::number(i);
+        tokens << "token" + QByteArray::number(i);
+    }
+
+    QVector<const gchar *> aliasPtrs;
+    QVector<const gchar *> tokenPtrs;
+    QVector<const gchar *> messages;
+    QVector<TpTestsContactsConnectionPresenceStatusIndex> statuses;
+    for (int i = 0; i < rosterSize; ++i) {
+        aliasPtrs << aliases.at(i).constData();
+        tokenPtrs << tokens.at(i).constData();
+        messages << "";
+        statuses << (i % 2 ? TP_TESTS_CONTACTS_CONNECTION_STATUS_AVAILABLE
+                           : TP_TESTS_CONTACTS_CONNECTION_STATUS_AWAY);
+    }
+
+    // The client doesn't track any of this yet, so it's all done by the service in one go
+    tp_tests_contacts_connection_change_aliases(connService, rosterSize,
+            handles.constData(), aliasPtrs.constData());
+    tp_tests_contacts_connection_change_avatar_tokens(connService, rosterSize,
+            handles.constData(), tokenPtrs.constData());
+    tp_tests_contacts_connection_change_presences(connService, rosterSize,
+            handles.constData(), statuses.constData(), messages.constData());
+    test_contact_list_manager_request_subscription(
+            tp_tests_contacts_connection_get_contact_list_manager(connService),
+            rosterSize, handles.data(), "");
+}
+
+void BenchContacts::init()
+{
+    initImpl();
+}
+
+void BenchContacts::benchRosterLoad()
+{
+    startMeasurement();
+    QBENCHMARK_ONCE {
+        QVERIFY(mConn->enableFeatures(Features() << Connection::FeatureRoster));
+    }
+    stopMeasurement(QLatin1String("rosterLoad"), rosterSize);
+
+    QCOMPARE(mConn->client()->contactManager()->allKnownContacts().size(), rosterSize);
+}
+
+void BenchContacts::benchUpgradeContacts()
+{
+    QList<ContactPtr> contacts = mConn->client()->contactManager()->allKnownContacts().toList();
+    QCOMPARE(contacts.size(), rosterSize);
+
+    Features features = Features()
+        << Contact::FeatureAlias
+        << Contact::FeatureAvatarData
+        << Contact::FeatureAvatarToken
+        << Contact::FeatureCapabilities
+        << Contact::FeatureInfo
+        << Contact::FeatureLocation
+        << Contact::FeatureSimplePresence
+        << Contact::FeatureAddresses
+        << Contact::FeatureClientTypes
+        << Contact::FeatureRosterGroups;
+
+    QList<ContactPtr> upgraded;
+    startMeasurement();
+    QBENCHMARK_ONCE {
+        upgraded = mConn->upgradeContacts(contacts, features);
+    }
+    stopMeasurement(QLatin1String("upgradeContacts"), contacts.size());
+
+    QCOMPARE(upgraded.size(), contacts.size());
+}
+
+void BenchContacts::cleanup()
+{
+    cleanupImpl();
+}
+
+void BenchContacts::cleanupTestCase()
+{
+    if (mConn) {
+        QCOMPARE(mConn->disconnect(), true);
+        delete mConn;
+    }
+
+    cleanupTestCaseImpl();
+}
+
+QTEST_MAIN(BenchContacts)
+#include "_gen/contacts.cpp.moc.hpp"
@@ -0,0 +1,137 @@
+#include <tests/benchmarks/benchmark.h>
+
+#include <TelepathyQt/Message>
+
+#include <QDateTime>
+
+using namespace Tp;
+
+namespace
+{
+
+const int messageCount = 100000;
+
+// A logger reads each message's fields a few times: to filter it, to store it and to show it
+const int readsPerMessage = 3;
+
+}
+
+class BenchMessage : public Benchmark
+{
+    Q_OBJECT
+
+public:
+    BenchMessage(QObject *parent = 0)
+        : Benchmark(QLatin1String("message"), parent)
+    { }
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void benchConstructMessages();
+    void benchReadMessages();
+
+    void cleanup();
+    void cleanupTestCase();
+
+private:
+    QList<MessagePartList> mParts;
+    QList<Message> mMessages;
+};
+
+void BenchMessage::initTestCase()
+{
+    initTestCaseImpl();
+
+    uint timestamp = QDateTime::currentDateTime().toTime_t();
+    for (int i = 0; i < messageCount; ++i) {
+        MessagePart header;
+        header.insert(QLatin1String("message-token"),
+                QDBusVariant(QString(QLatin1String("token%1")).arg(i)));
+        header.insert(QLatin1String("message-sent"),
+                QDBusVariant(static_cast<qlonglong>(timestamp)));
+        header.insert(QLatin1String("message-received"),
+                QDBusVariant(static_cast<qlonglong>(timestamp)));
+        header.insert(QLatin1String("message-sender"), QDBusVariant(2u));
+        header.insert(QLatin1String("message-sender-id"),
+                QDBusVariant(QLatin1String("someone@localhost")));
+        header.insert(QLatin1String("message-type"),
+                QDBusVariant(static_cast<uint>(ChannelTextMessageTypeNormal)));
+        header.insert(QLatin1String("pending-message-id"), QDBusVariant(static_cast<uint>(i)));
+
+        MessagePart html;
+        html.insert(QLatin1String("alternative"), QDBusVariant(QLatin1String("main")));
+        html.insert(QLatin1String("content-type"), QDBusVariant(QLatin1String("text/html")));
+        html.insert(QLatin1String("content"),
+                QDBusVariant(QLatin1String("<b>Lorem ipsum</b> dolor sit amet")));
+
+        MessagePart text;
+        text.insert(QLatin1String("alternative"), QDBusVariant(QLatin1String("main")));
+        text.insert(QLatin1String("content-type"), QDBusVariant(QLatin1String("text/plain")));
+        text.insert(QLatin1String("content"),
+                QDBusVariant(QLatin1String("Lorem ipsum dolor sit amet")));
+
+        mParts << (MessagePartList() << header << html << text);
+    }
+}
+
+void BenchMessage::init()
+{
+    initImpl();
+}
+
+void BenchMessage::benchConstructMessages()
+{
+    startMeasurement();
+    QBENCHMARK_ONCE {
+        Q_FOREACH (const MessagePartList &parts, mParts) {
+            mMessages << Message(parts);
+        }
+    }
+    stopMeasurement(QLatin1String("constructMessages"), mParts.size());
+
+    QCOMPARE(mMessages.size(), messageCount);
+}
+
+void BenchMessage::benchReadMessages()
+{
+    QCOMPARE(mMessages.size(), messageCount);
+
+    int textLength = 0;
+    startMeasurement();
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < readsPerMessage; ++i) {
+            Q_FOREACH (const Message &message, mMessages) {
+                if (message.isSpecificToDBusInterface() ||
+                        message.messageType() != ChannelTextMessageTypeNormal) {
+                    continue;
+                }
+                if (message.sent().isNull() || message.messageToken().isEmpty()) {
+                    continue;
+                }
+                textLength += message.text().length();
+            }
+        }
+    }
+    stopMeasurement(QLatin1String("readMessages"), mMessages.size() * readsPerMessage);
+
+    QCOMPARE(textLength, messageCount * readsPerMessage *
+            QString(QLatin1String("Lorem ipsum dolor sit amet")).length());
+}
+
+void BenchMessage::cleanup()
+{
+    cleanupImpl();
+}
+
+void BenchMessage::cleanupTestCase()
+{
+    mMessages.clear();
+    mParts.clear();
+
+    cleanupTestCaseImpl();
+}
+
+QTEST_MAIN(BenchMessage)
+#include "_gen/message.cpp.moc.hpp"
@@ -0,0 +1,177 @@
+#include <tests/benchmarks/benchmark.h>
+
+#include <tests/lib/glib-helpers/test-conn-helper.h>
+
+#include <tests/lib/glib/contacts-conn.h>
+#include <tests/lib/glib/echo2/chan.h>
+
+#include <TelepathyQt/Connection>
+#include <TelepathyQt/PendingReady>
+#include <TelepathyQt/ReceivedMessage>
+#include <TelepathyQt/TextChannel>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+using namespace Tp;
+
+namespace
+{
+
+const int messageCount = 50000;
+
+}
+
+class BenchTextChan : public Benchmark
+{
+    Q_OBJECT
+
+public:
+    BenchTextChan(QObject *parent = 0)
+        : Benchmark(QLatin1String("text-chan"), parent),
+          mConn(0), mChanService(0), mSenderHandle(0), mReceived(0)
+    { }
+
+protected Q_SLOTS:
+    void onMessageReceived(const Tp::ReceivedMessage &message);
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void benchReceiveMessages();
+    void benchAcknowledgeMessages();
+
+    void cleanup();
+    void cleanupTestCase();
+
+private:
+    TestConnHelper *mConn;
+    ExampleEcho2Channel *mChanService;
+    TextChannelPtr mChan;
+    TpHandle mSenderHandle;
+    int mReceived;
+};
+
+void BenchTextChan::onMessageReceived(const Tp::ReceivedMessage &message)
+{
+    Q_UNUSED(message);
+
+    if (++mReceived == messageCount) {
+        mLoop->exit(0);
+    }
+}
+
+void BenchTextChan::initTestCase()
+{
+    initTestCaseImpl();
+
+    g_type_init();
+    g_set_prgname("bench-text-chan");
+    dbus_g_bus_get(DBUS_BUS_STARTER, 0);
+
+    mConn = new TestConnHelper(this,
+            TP_TESTS_TYPE_CONTACTS_CONNECTION,
+            "account", "me@example.com",
+            "protocol", "example",
+            NULL);
+    QCOMPARE(mConn->connect(), true);
+
+    TpHandleRepoIface *contactRepo = tp_base_connection_get_handles(
+            TP_BASE_CONNECTION(mConn->service()), TP_HANDLE_TYPE_CONTACT);
+    mSenderHandle = tp_handle_ensure(contactRepo, "someone@localhost", 0, 0);
+
+    // create a Channel by magic, rather than doing D-Bus round-trips for it
+    QString chanPath = mConn->objectPath() + QLatin1String("/MessagesChannel");
+    mChanService = EXAMPLE_ECHO_2_CHANNEL(g_object_new(
+                EXAMPLE_TYPE_ECHO_2_CHANNEL,
+                "connection", mConn->service(),
+                "object-path", chanPath.toLatin1().constData(),
+                "handle", mSenderHandle,
+                NULL));
+
+    mChan = TextChannel::create(mConn->client(), chanPath, QVariantMap());
+    QVERIFY(connect(mChan->becomeReady(TextChannel::FeatureMessageQueue),
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(mChan->isReady(TextChannel::FeatureMessageQueue));
+
+    QVERIFY(connect(mChan.data(),
+                SIGNAL(messageReceived(const Tp::ReceivedMessage &)),
+                SLOT(onMessageReceived(const Tp::ReceivedMessage &))));
+}
+
+void BenchTextChan::init()
+{
+    initImpl();
+}
+
+void BenchTextChan::benchReceiveMessages()
+{
+    TpBaseConnection *baseConn = TP_BASE_CONNECTION(mConn->service());
+    gint64 timestamp = QDateTime::currentDateTime().toTime_t();
+
+    // Both the service queueing and signalling the messages and the client receiving them are
+    // measured, as they share the main loop
+    startMeasurement();
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < messageCount; ++i) {
+            TpMessage *message = tp_cm_message_new(baseConn, 2);
+            tp_cm_message_set_sender(message, mSenderHandle);
+            tp_message_set_uint32(message, 0, "message-type",
+                    TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL);
+            tp_message_set_int64(message, 0, "message-received", timestamp);
+            tp_message_set_string(message, 1, "content-type", "text/plain");
+            tp_message_set_string(message, 1, "content", "Lorem ipsum dolor sit amet");
+            tp_message_mixin_take_received(G_OBJECT(mChanService), message);
+        }
+
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    stopMeasurement(QLatin1String("receiveMessages"), messageCount);
+
+    QCOMPARE(mReceived, messageCount);
+    QCOMPARE(mChan->messageQueue().size(), messageCount);
+}
+
+void BenchTextChan::benchAcknowledgeMessages()
+{
+    QList<ReceivedMessage> messages = mChan->messageQueue();
+    QCOMPARE(messages.size(), messageCount);
+
+    startMeasurement();
+    QBENCHMARK_ONCE {
+        mChan->acknowledge(messages);
+        while (tp_message_mixin_has_pending_messages(G_OBJECT(mChanService), NULL)) {
+            mLoop->processEvents();
+        }
+    }
+    stopMeasurement(QLatin1String("acknowledgeMessages"), messages.size());
+
+    QVERIFY(mChan->messageQueue().isEmpty());
+}
+
+void BenchTextChan::cleanup()
+{
+    cleanupImpl();
+}
+
+void BenchTextChan::cleanupTestCase()
+{
+    mChan.reset();
+
+    if (mConn) {
+        QCOMPARE(mConn->disconnect(), true);
+        delete mConn;
+    }
+
+    if (mChanService != 0) {
+        g_object_unref(mChanService);
+        mChanService = 0;
+    }
+
+    cleanupTestCaseImpl();
+}
+
+QTEST_MAIN(BenchTextChan)
+#include "_gen/text-chan.cpp.moc.hpp"
@@ -0,0 +1,176 @@
+#include <QtTest/QtTest>
+
+#include <TelepathyQt/Channel>
+#include <TelepathyQt/ChannelClassSpec>
+#include <TelepathyQt/ChannelFactory>
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/Debug>
+#include <TelepathyQt/FileTransferChannel>
+#include <TelepathyQt/StreamTubeChannel>
+#include <TelepathyQt/TextChannel>
+
+using namespace Tp;
+
+namespace
+{
+
+QVariantMap immutableProperties(const ChannelClassSpec &channelClass, const QString &targetId)
+{
+    QVariantMap props = channelClass.allProperties();
+    props.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetID"), targetId);
+    props.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle"), uint(qHash(targetId)));
+    props.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".InitiatorID"), targetId);
+    props.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".Interfaces"), QStringList());
+    return props;
+}
+
+}
+
+class TestChannelFactory : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestChannelFactory(QObject *parent = 0);
+
+private Q_SLOTS:
+    void init();
+
+    void testResolve();
+    void testInvalidate();
+
+    void benchmarkResolve();
+
+    void cleanup();
+
+private:
+    ChannelFactoryPtr mFactory;
+};
+
+TestChannelFactory::TestChannelFactory(QObject *parent)
+    : QObject(parent)
+{
+    Tp::enableDebug(false);
+    Tp::enableWarnings(true);
+}
+
+void TestChannelFactory::init()
+{
+    mFactory = ChannelFactory::create(QDBusConnection::sessionBus());
+}
+
+void TestChannelFactory::testResolve()
+{
+    mFactory->addCommonFeatures(Features() << Channel::FeatureCore);
+    mFactory->addFeaturesForTextChats(Features() << TextChannel::FeatureMessageQueue);
+    mFactory->addFeaturesForIncomingStreamTubes(
+            Features() << StreamTubeChannel::FeatureConnectionMonitoring);
+
+    QVariantMap textChat = immutableProperties(ChannelClassSpec::textChat(),
+            QLatin1String("alice"));
+    QCOMPARE(mFactory->featuresFor(ChannelClassSpec(textChat)),
+            Features() << Channel::FeatureCore << TextChannel::FeatureMessageQueue);
+    QVERIFY(mFactory->constructorFor(ChannelClassSpec(textChat)) ==
+            mFactory->constructorForTextChats());
+
+    // Resolved again from the memo, for another channel of the same class
+    textChat = immutableProperties(ChannelClassSpec::textChat(), QLatin1String("bob"));
+    QCOMPARE(mFactory->featuresFor(ChannelClassSpec(textChat)),
+            Features() << Channel::FeatureCore << TextChannel::FeatureMessageQueue);
+
+    QVariantMap room = immutableProperties(ChannelClassSpec::textChatroom(),
+            QLatin1String("room"));
+    QCOMPARE(mFactory->featuresFor(ChannelClassSpec(room)), Features() << Channel::FeatureCore);
+    QVERIFY(mFactory->constructorFor(ChannelClassSpec(room)) ==
+            mFactory->constructorForTextChatrooms());
+
+    QVariantMap tube = immutableProperties(
+            ChannelClassSpec::incomingStreamTube(QLatin1String("vnc")), QLatin1String("carol"));
+    QCOMPARE(mFactory->featuresFor(ChannelClassSpec(tube)),
+            Features() << Channel::FeatureCore << StreamTubeChannel::FeatureConnectionMonitoring);
+    QVERIFY(mFactory->constructorFor(ChannelClassSpec(tube)) ==
+            mFactory->constructorForIncomingStreamTubes());
+
+    ChannelClassSpec unknown(TP_QT_IFACE_CHANNEL_TYPE_TEXT + QLatin1String("Unknown"),
+            HandleTypeContact);
+    QCOMPARE(mFactory->featuresFor(unknown), Features() << Channel::FeatureCore);
+    QVERIFY(mFactory->constructorFor(unknown) == mFactory->fallbackConstructor());
+}
+
+void TestChannelFactory::testInvalidate()
+{
+    ChannelClassSpec textChat(immutableProperties(ChannelClassSpec::textChat(),
+                QLatin1String("alice")));
+    QVERIFY(mFactory->featuresFor(textChat).isEmpty());
+    ChannelFactory::ConstructorConstPtr ctor = mFactory->constructorFor(textChat);
+    QVERIFY(ctor == mFactory->constructorForTextChats());
+
+    mFactory->addFeaturesForTextChats(Features() << TextChannel::FeatureMessageQueue);
+    QCOMPARE(mFactory->featuresFor(textChat), Features() << TextChannel::FeatureMessageQueue);
+
+    mFactory->setSubclassForTextChats<TextChannel>();
+    QVERIFY(mFactory->constructorFor(textChat) != ctor);
+    QVERIFY(mFactory->constructorFor(textChat) == mFactory->constructorForTextChats());
+
+    // More specific classes take precedence
+    QVariantMap requested;
+    requested.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".Requested"), true);
+    mFactory->addFeaturesForTextChats(Features() << TextChannel::FeatureChatState, requested);
+    QCOMPARE(mFactory->featuresFor(textChat), Features() << TextChannel::FeatureMessageQueue);
+
+    ChannelClassSpec requestedTextChat(textChat);
+    requestedTextChat.setRequested(true);
+    QCOMPARE(mFactory->featuresFor(requestedTextChat),
+            Features() << TextChannel::FeatureMessageQueue << TextChannel::FeatureChatState);
+}
+
+void TestChannelFactory::benchmarkResolve()
+{
+    mFactory->addCommonFeatures(Features() << Channel::FeatureCore);
+    mFactory->addFeaturesForTextChats(Features() << TextChannel::FeatureMessageQueue);
+    mFactory->addFeaturesForTextChatrooms(Features() << TextChannel::FeatureMessageQueue);
+    mFactory->addFeaturesForIncomingFileTransfers(Features() << FileTransferChannel::FeatureCore);
+
+    QList<ChannelClassSpec> channelClasses;
+    for (int i = 0; i < 10000; ++i) {
+        QString targetId = QString(QLatin1String("contact%1")).arg(i);
+        switch (i % 4) {
+            case 0:
+                channelClasses << ChannelClassSpec(immutableProperties(
+                            ChannelClassSpec::textChat(), targetId));
+                break;
+            case 1:
+                channelClasses << ChannelClassSpec(immutableProperties(
+                            ChannelClassSpec::textChatroom(), targetId));
+                break;
+            case 2:
+                channelClasses << ChannelClassSpec(immutableProperties(
+                            ChannelClassSpec::incomingFileTransfer(), targetId));
+                break;
+            default:
+                channelClasses << ChannelClassSpec(immutableProperties(
+                            ChannelClassSpec::incomingStreamTube(QLatin1String("vnc")), targetId));
+                break;
+        }
+    }
+
+    int resolved = 0;
+    QBENCHMARK {
+        resolved = 0;
+        foreach (const ChannelClassSpec &channelClass, channelClasses) {
+            if (!mFactory->constructorFor(channelClass).isNull() &&
+                    mFactory->featuresFor(channelClass).contains(Channel::FeatureCore)) {
+                ++resolved;
+            }
+        }
+    }
+    QCOMPARE(resolved, channelClasses.size());
+}
+
+void TestChannelFactory::cleanup()
+{
+    mFactory.reset();
+}
+
+QTEST_MAIN(TestChannelFactory)
+#include "_gen/channel-factory.cpp.moc.hpp"
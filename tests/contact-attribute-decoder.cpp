@@ -0,0 +1,190 @@
+#include <QtTest/QtTest>
+#include <QDBusArgument>
+
+#include <TelepathyQt/Constants>
+
+#include "TelepathyQt/contact-attribute-decoder.h"
+
+using namespace Tp;
+
+class TestContactAttributeDecoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestContactAttributeDecoder(QObject *parent = 0);
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void testDecode();
+    void testInterfaces();
+
+    void benchmarkStringLookup();
+    void benchmarkDecoder();
+
+private:
+    QList<QVariantMap> mContacts;
+};
+
+TestContactAttributeDecoder::TestContactAttributeDecoder(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void TestContactAttributeDecoder::initTestCase()
+{
+    // Roughly what a roster fetched with all the usual features looks like
+    for (int i = 0; i < 1000; ++i) {
+        QVariantMap attributes;
+        QString id = QString(QLatin1String("contact%1@example.com")).arg(i);
+        attributes.insert(TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id"), id);
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                QLatin1String("/subscribe"), (uint) 2);
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                QLatin1String("/publish"), (uint) 2);
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING +
+                QLatin1String("/alias"), QString(QLatin1String("Contact %1")).arg(i));
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS +
+                QLatin1String("/token"), QString::number(i, 16));
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS +
+                QLatin1String("/groups"), QStringList() << QLatin1String("Friends"));
+        attributes.insert(TP_QT_IFACE_CONNECTION_INTERFACE_CLIENT_TYPES +
+                QLatin1String("/client-types"), QStringList() << QLatin1String("pc"));
+        attributes.insert(QLatin1String("org.example.Unknown/attribute"), i);
+        mContacts << attributes;
+    }
+}
+
+void TestContactAttributeDecoder::testDecode()
+{
+    ContactAttributeDecoder decoder;
+    ContactAttributeDecoder::Result decoded;
+    decoder.decode(mContacts[42], decoded);
+
+    QVERIFY(decoded.contains(ContactAttributeDecoder::ContactId));
+    QCOMPARE(decoded.value(ContactAttributeDecoder::ContactId)->toString(),
+            QString(QLatin1String("contact42@example.com")));
+    QVERIFY(decoded.contains(ContactAttributeDecoder::Subscribe));
+    QCOMPARE(decoded.value(ContactAttributeDecoder::Subscribe)->toUInt(), (uint) 2);
+    QVERIFY(decoded.contains(ContactAttributeDecoder::Publish));
+    QVERIFY(!decoded.contains(ContactAttributeDecoder::PublishRequest));
+    QCOMPARE(decoded.value(ContactAttributeDecoder::Alias)->toString(),
+            QString(QLatin1String("Contact 42")));
+    QCOMPARE(decoded.value(ContactAttributeDecoder::AvatarToken)->toString(),
+            QString(QLatin1String("2a")));
+    QCOMPARE(decoded.value(ContactAttributeDecoder::Groups)->toStringList(),
+            QStringList() << QLatin1String("Friends"));
+    QCOMPARE(decoded.value(ContactAttributeDecoder::ClientTypes)->toStringList(),
+            QStringList() << QLatin1String("pc"));
+    QVERIFY(!decoded.contains(ContactAttributeDecoder::Presence));
+    QVERIFY(!decoded.contains(ContactAttributeDecoder::Location));
+    QVERIFY(decoded.value(ContactAttributeDecoder::Capabilities) == 0);
+
+    QCOMPARE(ContactAttributeDecoder::attributeName(ContactAttributeDecoder::Alias),
+            TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING + QLatin1String("/alias"));
+    QCOMPARE(ContactAttributeDecoder::attributeName(ContactAttributeDecoder::PublishRequest),
+            TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST + QLatin1String("/publish-request"));
+}
+
+void TestContactAttributeDecoder::testInterfaces()
+{
+    // Attributes of interfaces the connection doesn't advertise are skipped, but the contact
+    // identifier is always there
+    ContactAttributeDecoder decoder(QStringList() << TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING);
+    QCOMPARE(decoder.interfaces(),
+            QStringList() << TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING);
+
+    ContactAttributeDecoder::Result decoded;
+    decoder.decode(mContacts[0], decoded);
+
+    QVERIFY(decoded.contains(ContactAttributeDecoder::ContactId));
+    QVERIFY(decoded.contains(ContactAttributeDecoder::Alias));
+    QVERIFY(!decoded.contains(ContactAttributeDecoder::Subscribe));
+    QVERIFY(!decoded.contains(ContactAttributeDecoder::AvatarToken));
+    QVERIFY(!decoded.contains(ContactAttributeDecoder::Groups));
+}
+
+// The way Contact::augment() used to look up attributes, building each key on every lookup
+void TestContactAttributeDecoder::benchmarkStringLookup()
+{
+    int found = 0;
+    QBENCHMARK {
+        found = 0;
+        foreach (const QVariantMap &attributes, mContacts) {
+            QString id = qdbus_cast<QString>(attributes[
+                    TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")]);
+            if (attributes.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                        QLatin1String("/subscribe"))) {
+                found += qdbus_cast<uint>(attributes.value(
+                            TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                            QLatin1String("/subscribe"))) ? 1 : 0;
+            }
+            if (attributes.contains(TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                        QLatin1String("/publish"))) {
+                found += qdbus_cast<uint>(attributes.value(
+                            TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                            QLatin1String("/publish"))) ? 1 : 0;
+                qdbus_cast<QString>(attributes.value(
+                            TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_LIST +
+                            QLatin1String("/publish-request")));
+            }
+            found += qdbus_cast<QString>(attributes.value(
+                        TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING +
+                        QLatin1String("/alias"))).isEmpty() ? 0 : 1;
+            if (attributes.contains(TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS +
+                        QLatin1String("/token"))) {
+                found += qdbus_cast<QString>(attributes.value(
+                            TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS +
+                            QLatin1String("/token"))).isEmpty() ? 0 : 1;
+            }
+            found += qdbus_cast<QStringList>(attributes.value(
+                        TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_GROUPS +
+                        QLatin1String("/groups"))).isEmpty() ? 0 : 1;
+            found += qdbus_cast<QStringList>(attributes.value(
+                        TP_QT_IFACE_CONNECTION_INTERFACE_CLIENT_TYPES +
+                        QLatin1String("/client-types"))).isEmpty() ? 0 : 1;
+            found += id.isEmpty() ? 0 : 1;
+        }
+    }
+    QCOMPARE(found, mContacts.size() * 7);
+}
+
+void TestContactAttributeDecoder::benchmarkDecoder()
+{
+    ContactAttributeDecoder decoder;
+    int found = 0;
+    QBENCHMARK {
+        found = 0;
+        foreach (const QVariantMap &attributes, mContacts) {
+            ContactAttributeDecoder::Result decoded;
+            decoder.decode(attributes, decoded);
+
+            QString id = qdbus_cast<QString>(
+                    *decoded.value(ContactAttributeDecoder::ContactId));
+            if (decoded.contains(ContactAttributeDecoder::Subscribe)) {
+                found += qdbus_cast<uint>(
+                        *decoded.value(ContactAttributeDecoder::Subscribe)) ? 1 : 0;
+            }
+            if (decoded.contains(ContactAttributeDecoder::Publish)) {
+                found += qdbus_cast<uint>(
+                        *decoded.value(ContactAttributeDecoder::Publish)) ? 1 : 0;
+            }
+            found += qdbus_cast<QString>(
+                    *decoded.value(ContactAttributeDecoder::Alias)).isEmpty() ? 0 : 1;
+            if (decoded.contains(ContactAttributeDecoder::AvatarToken)) {
+                found += qdbus_cast<QString>(
+                        *decoded.value(ContactAttributeDecoder::AvatarToken)).isEmpty() ? 0 : 1;
+            }
+            found += qdbus_cast<QStringList>(
+                    *decoded.value(ContactAttributeDecoder::Groups)).isEmpty() ? 0 : 1;
+            found += qdbus_cast<QStringList>(
+                    *decoded.value(ContactAttributeDecoder::ClientTypes)).isEmpty() ? 0 : 1;
+            found += id.isEmpty() ? 0 : 1;
+        }
+    }
+    QCOMPARE(found, mContacts.size() * 7);
+}
+
+QTEST_MAIN(TestContactAttributeDecoder)
+#include "_gen/contact-attribute-decoder.cpp.moc.hpp"
@@ -0,0 +1,188 @@
+#include <tests/lib/test.h>
+#include <tests/lib/test-thread-helper.h>
+
+#include <TelepathyQt/Account>
+#include <TelepathyQt/AccountManager>
+#include <TelepathyQt/BaseConnectionManager>
+#include <TelepathyQt/BaseProtocol>
+#include <TelepathyQt/DBusError>
+#include <TelepathyQt/PendingAccount>
+#include <TelepathyQt/PendingReady>
+#include <TelepathyQt/ProtocolInfo>
+#include <TelepathyQt/ProtocolParameter>
+
+using namespace Tp;
+
+class TestAccountConnectionManager : public Test
+{
+    Q_OBJECT
+
+public:
+    TestAccountConnectionManager(QObject *parent = 0)
+        : Test(parent)
+    { }
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void testSharedConnectionManager();
+
+    void cleanup();
+    void cleanupTestCase();
+
+private:
+    static void createCM(BaseConnectionManagerPtr &cm);
+    static void createRestartedCM(BaseConnectionManagerPtr &cm);
+
+    AccountPtr createAccount(const QString &displayName);
+    AccountPtr readyAccount(const QString &objectPath);
+
+    AccountManagerPtr mAM;
+};
+
+// Each CM instance gets its own bus connection, so that disconnecting it releases the CM's name
+// like a CM process exiting would
+static void registerCM(BaseConnectionManagerPtr &cm, const QString &busConnectionName,
+        const ProtocolParameterList &parameters)
+{
+    QDBusConnection bus = QDBusConnection::connectToBus(QDBusConnection::SessionBus,
+            busConnectionName);
+    QVERIFY(bus.isConnected());
+
+    cm = BaseConnectionManager::create(bus, QLatin1String("testcmregistry"));
+    BaseProtocolPtr protocol = BaseProtocol::create(bus, QLatin1String("myprotocol"));
+    protocol->setParameters(parameters);
+    QVERIFY(cm->addProtocol(protocol));
+
+    Tp::DBusError err;
+    QVERIFY(cm->registerObject(&err));
+    QVERIFY(!err.isValid());
+}
+
+void TestAccountConnectionManager::createCM(BaseConnectionManagerPtr &cm)
+{
+    registerCM(cm, QLatin1String("tpqt-test-cm-1"), ProtocolParameterList() <<
+            ProtocolParameter(QLatin1String("account"), QDBusSignature(QLatin1String("s")),
+                ConnMgrParamFlagRequired));
+}
+
+void TestAccountConnectionManager::createRestartedCM(BaseConnectionManagerPtr &cm)
+{
+    registerCM(cm, QLatin1String("tpqt-test-cm-2"), ProtocolParameterList() <<
+            ProtocolParameter(QLatin1String("account"), QDBusSignature(QLatin1String("s")),
+                ConnMgrParamFlagRequired) <<
+            ProtocolParameter(QLatin1String("password"), QDBusSignature(QLatin1String("s")),
+                ConnMgrParamFlagSecret));
+}
+
+void TestAccountConnectionManager::initTestCase()
+{
+    initTestCaseImpl();
+
+    mAM = AccountManager::create();
+    QVERIFY(connect(mAM->becomeReady(),
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectSuccessfulCall(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(mAM->isReady());
+}
+
+void TestAccountConnectionManager::init()
+{
+    initImpl();
+}
+
+AccountPtr TestAccountConnectionManager::createAccount(const QString &displayName)
+{
+    QVariantMap parameters;
+    parameters[QLatin1String("account")] = displayName;
+    PendingAccount *pacc = mAM->createAccount(QLatin1String("testcmregistry"),
+            QLatin1String("myprotocol"), displayName, parameters);
+    connect(pacc,
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    if (mLoop->exec() != 0) {
+        return AccountPtr();
+    }
+    return pacc->account();
+}
+
+// A separate proxy for the account, so its protocol info is introspected afresh
+AccountPtr TestAccountConnectionManager::readyAccount(const QString &objectPath)
+{
+    AccountPtr acc = Account::create(mAM->dbusConnection(), mAM->busName(), objectPath,
+            mAM->connectionFactory(), mAM->channelFactory(), mAM->contactFactory());
+    connect(acc->becomeReady(Account::FeatureCore | Account::FeatureProtocolInfo),
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    if (mLoop->exec() != 0) {
+        return AccountPtr();
+    }
+    return acc;
+}
+
+void TestAccountConnectionManager::testSharedConnectionManager()
+{
+    TestThreadHelper<BaseConnectionManagerPtr> *helper =
+        new TestThreadHelper<BaseConnectionManagerPtr>();
+    TEST_THREAD_HELPER_EXECUTE(helper, &createCM);
+
+    AccountPtr created1 = createAccount(QLatin1String("foo"));
+    QVERIFY(created1);
+    AccountPtr created2 = createAccount(QLatin1String("bar"));
+    QVERIFY(created2);
+
+    AccountPtr acc1 = readyAccount(created1->objectPath());
+    QVERIFY(acc1);
+    QVERIFY(acc1->protocolInfo().isValid());
+    QCOMPARE(acc1->protocolInfo().parameters().size(), 1);
+
+    qDebug() << "Stopping the CM";
+
+    delete helper;
+    QDBusConnection::disconnectFromBus(QLatin1String("tpqt-test-cm-1"));
+    processDBusQueue(acc1.data());
+
+    // The CM can't be introspected anymore, so only the ConnectionManager acc1 made ready can give
+    // acc2 its protocol info
+    AccountPtr acc2 = readyAccount(created2->objectPath());
+    QVERIFY(acc2);
+    QVERIFY(acc2->protocolInfo().isValid());
+    QCOMPARE(acc2->protocolInfo().parameters().size(), 1);
+
+    qDebug() << "Restarting the CM with another parameter";
+
+    helper = new TestThreadHelper<BaseConnectionManagerPtr>();
+    TEST_THREAD_HELPER_EXECUTE(helper, &createRestartedCM);
+    processDBusQueue(acc2.data());
+
+    // The new owner of the CM's name drops the shared ConnectionManager, so the restarted CM is
+    // introspected
+    AccountPtr acc3 = readyAccount(created1->objectPath());
+    QVERIFY(acc3);
+    QVERIFY(acc3->protocolInfo().isValid());
+    QCOMPARE(acc3->protocolInfo().parameters().size(), 2);
+    QVERIFY(acc3->protocolInfo().hasParameter(QLatin1String("password")));
+
+    // The accounts already holding the old ConnectionManager keep it
+    QCOMPARE(acc1->protocolInfo().parameters().size(), 1);
+
+    delete helper;
+    QDBusConnection::disconnectFromBus(QLatin1String("tpqt-test-cm-2"));
+}
+
+void TestAccountConnectionManager::cleanup()
+{
+    cleanupImpl();
+}
+
+void TestAccountConnectionManager::cleanupTestCase()
+{
+    mAM.reset();
+
+    cleanupTestCaseImpl();
+}
+
+QTEST_MAIN(TestAccountConnectionManager)
+#include "_gen/account-connection-manager.cpp.moc.hpp"
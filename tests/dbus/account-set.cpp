@@ -42,6 +42,7 @@ private Q_SLOTS:
 
     void testBasics();
     void testFilters();
+    void testSharedIndex();
 
     void cleanup();
     void cleanupTestCase();
@@ -397,6 +398,48 @@ void TestAccountSet::testFilters()
     }
 }
 
+void TestAccountSet::testSharedIndex()
+{
+    // testFilters left "foo" disabled and "spurious" enabled
+    QCOMPARE(mAM->allAccounts().size(), 2);
+    AccountPtr fooAcc = mAM->accountsByProtocol(QLatin1String("bar"))->accounts().first();
+    AccountPtr spuriousAcc = mAM->accountsByProtocol(QLatin1String("normal"))->accounts().first();
+    QCOMPARE(fooAcc->isEnabled(), false);
+
+    QVariantMap filter;
+    filter.insert(QLatin1String("enabled"), true);
+    filter.insert(QLatin1String("protocolName"), QLatin1String("bar"));
+    AccountSetPtr enabledBarAccounts = mAM->filterAccounts(filter);
+    QVERIFY(connect(enabledBarAccounts.data(),
+                SIGNAL(accountAdded(Tp::AccountPtr)),
+                SLOT(onAccountAdded(Tp::AccountPtr))));
+    QCOMPARE(enabledBarAccounts->accounts().size(), 0);
+
+    AccountSetPtr enabledAccounts = mAM->enabledAccounts();
+    QCOMPARE(pathsForAccounts(enabledAccounts), QStringList() << spuriousAcc->objectPath());
+
+    // Sets going away must stop being notified without affecting the others
+    AccountSetPtr disabledAccounts = mAM->disabledAccounts();
+    QCOMPARE(pathsForAccounts(disabledAccounts), QStringList() << fooAcc->objectPath());
+    disabledAccounts.reset();
+
+    QVERIFY(connect(fooAcc->setEnabled(true),
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+
+    while (!fooAcc->isEnabled()) {
+        mLoop->processEvents();
+    }
+
+    processDBusQueue(mConn->client().data());
+
+    QCOMPARE(mAccountAdded, fooAcc);
+    QCOMPARE(pathsForAccounts(enabledBarAccounts), QStringList() << fooAcc->objectPath());
+    QCOMPARE(enabledAccounts->accounts().size(), 2);
+    QCOMPARE(mAM->disabledAccounts()->accounts().size(), 0);
+}
+
 void TestAccountSet::cleanup()
 {
     cleanupImpl();
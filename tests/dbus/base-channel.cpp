@@ -0,0 +1,175 @@
+#include <tests/lib/test.h>
+
+#include <TelepathyQt/BaseChannel>
+
+#include <QSignalSpy>
+
+using namespace Tp;
+
+class TestBaseChannel : public Test
+{
+    Q_OBJECT
+public:
+    TestBaseChannel(QObject *parent = 0)
+        : Test(parent)
+    { }
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void testGroupMembersChanges();
+
+    void cleanup();
+    void cleanupTestCase();
+};
+
+void TestBaseChannel::initTestCase()
+{
+    initTestCaseImpl();
+}
+
+void TestBaseChannel::init()
+{
+    initImpl();
+}
+
+void TestBaseChannel::testGroupMembersChanges()
+{
+    BaseChannelGroupInterfacePtr groupIface = BaseChannelGroupInterface::create(
+            ChannelGroupFlagMembersChangedDetailed, 1);
+
+    // The adaptee is the only child of the interface until it's registered
+    QObject *adaptee = groupIface->findChild<QObject *>();
+    QVERIFY(adaptee);
+    QSignalSpy membersChangedSpy(adaptee,
+            SIGNAL(membersChanged(QString,Tp::UIntList,Tp::UIntList,Tp::UIntList,Tp::UIntList,uint,uint)));
+    QSignalSpy membersChangedDetailedSpy(adaptee,
+            SIGNAL(membersChangedDetailed(Tp::UIntList,Tp::UIntList,Tp::UIntList,Tp::UIntList,QVariantMap)));
+
+    // By default each change is signalled right away, and the members keep their order
+    QCOMPARE(groupIface->membersChangesLatency(), -1);
+    groupIface->addMembers(UIntList() << 3, QStringList() << QLatin1String("member3"));
+    groupIface->addMembers(UIntList() << 1 << 2,
+            QStringList() << QLatin1String("member1") << QLatin1String("member2"));
+    QCOMPARE(membersChangedSpy.count(), 2);
+    QCOMPARE(qvariant_cast<UIntList>(membersChangedSpy.at(1).at(1)), UIntList() << 1 << 2);
+    groupIface->removeMembers(UIntList() << 1);
+    QCOMPARE(membersChangedSpy.count(), 3);
+    QCOMPARE(qvariant_cast<UIntList>(membersChangedSpy.at(2).at(2)), UIntList() << 1);
+    groupIface->addMembers(UIntList() << 1, QStringList() << QLatin1String("member1"));
+    QCOMPARE(membersChangedSpy.count(), 4);
+    QCOMPARE(membersChangedDetailedSpy.count(), 4);
+    QCOMPARE(qvariant_cast<UIntList>(adaptee->property("members")), UIntList() << 3 << 2 << 1);
+
+    groupIface->removeMembers(UIntList() << 1 << 2 << 3);
+    QCOMPARE(membersChangedSpy.count(), 5);
+    membersChangedSpy.clear();
+    membersChangedDetailedSpy.clear();
+
+    // A big room being joined, one member at a time, with the changes coalesced
+    groupIface->setMembersChangesLatency(0);
+    QCOMPARE(groupIface->membersChangesLatency(), 0);
+    for (uint handle = 1; handle <= 2000; ++handle) {
+        groupIface->addMembers(UIntList() << handle,
+                QStringList() << QString(QLatin1String("member%1")).arg(handle));
+    }
+    // Already a member
+    groupIface->addMembers(UIntList() << 1, QStringList() << QLatin1String("member1"));
+    // Added and removed again before being signalled
+    groupIface->addMembers(UIntList() << 3000, QStringList() << QLatin1String("member3000"));
+    groupIface->removeMembers(UIntList() << 3000);
+    QCOMPARE(membersChangedSpy.count(), 0);
+
+    QTest::qWait(10);
+    QCOMPARE(membersChangedSpy.count(), 1);
+    QCOMPARE(membersChangedDetailedSpy.count(), 1);
+
+    UIntList added = qvariant_cast<UIntList>(membersChangedSpy.at(0).at(1));
+    QCOMPARE(added.size(), 2000);
+    QCOMPARE(added.first(), 1u);
+    QCOMPARE(added.last(), 2000u);
+    QVERIFY(!added.contains(3000));
+    QVERIFY(qvariant_cast<UIntList>(membersChangedSpy.at(0).at(2)).isEmpty());
+
+    QVariantMap details = qvariant_cast<QVariantMap>(membersChangedDetailedSpy.at(0).at(4));
+    HandleIdentifierMap contactIds = qvariant_cast<HandleIdentifierMap>(
+            details.value(QLatin1String("contact-ids")));
+    QCOMPARE(contactIds.size(), 2000);
+    QCOMPARE(contactIds.value(42), QLatin1String("member42"));
+    QVERIFY(!contactIds.contains(3000));
+
+    UIntList members = qvariant_cast<UIntList>(adaptee->property("members"));
+    QCOMPARE(members.size(), 2000);
+
+    // Changes with different details are not merged, and flushMembersChanges() doesn't wait for
+    // the latency to elapse
+    groupIface->setMembersChangesLatency(60000);
+    QCOMPARE(groupIface->membersChangesLatency(), 60000);
+    for (uint handle = 1; handle <= 1000; ++handle) {
+        groupIface->removeMembers(UIntList() << handle, QStringList(), 0,
+                ChannelGroupChangeReasonNone);
+    }
+    groupIface->removeMembers(UIntList() << 1001, QStringList(), 0,
+            ChannelGroupChangeReasonKicked);
+    QCOMPARE(membersChangedSpy.count(), 2);
+
+    groupIface->flushMembersChanges();
+    QCOMPARE(membersChangedSpy.count(), 3);
+    QCOMPARE(membersChangedDetailedSpy.count(), 3);
+
+    UIntList removed = qvariant_cast<UIntList>(membersChangedSpy.at(1).at(2));
+    QCOMPARE(removed.size(), 1000);
+    QCOMPARE(removed.first(), 1u);
+    QCOMPARE(removed.last(), 1000u);
+    QCOMPARE(membersChangedSpy.at(1).at(6).toUInt(), (uint) ChannelGroupChangeReasonNone);
+    removed = qvariant_cast<UIntList>(membersChangedSpy.at(2).at(2));
+    QCOMPARE(removed, UIntList() << 1001);
+    QCOMPARE(membersChangedSpy.at(2).at(6).toUInt(), (uint) ChannelGroupChangeReasonKicked);
+
+    details = qvariant_cast<QVariantMap>(membersChangedDetailedSpy.at(1).at(4));
+    contactIds = qvariant_cast<HandleIdentifierMap>(details.value(QLatin1String("contact-ids")));
+    QCOMPARE(contactIds.value(42), QLatin1String("member42"));
+
+    members = qvariant_cast<UIntList>(adaptee->property("members"));
+    QCOMPARE(members.size(), 999);
+    QCOMPARE(members.first(), 1002u);
+    QCOMPARE(members.last(), 2000u);
+
+    groupIface->flushMembersChanges();
+    QCOMPARE(membersChangedSpy.count(), 3);
+
+    // Within one latency window, a contact added then removed, and a member removed then added
+    // back, are not signalled at all
+    groupIface->addMembers(UIntList() << 5000, QStringList() << QLatin1String("member5000"));
+    groupIface->removeMembers(UIntList() << 5000);
+    groupIface->removeMembers(UIntList() << 1002);
+    groupIface->addMembers(UIntList() << 1002, QStringList() << QLatin1String("member1002"));
+    groupIface->flushMembersChanges();
+    QCOMPARE(membersChangedSpy.count(), 3);
+    members = qvariant_cast<UIntList>(adaptee->property("members"));
+    QCOMPARE(members.size(), 999);
+    QVERIFY(!members.contains(5000));
+    QCOMPARE(members.last(), 1002u);
+
+    // Disabling coalescing signals what is pending
+    groupIface->addMembers(UIntList() << 6000, QStringList() << QLatin1String("member6000"));
+    QCOMPARE(membersChangedSpy.count(), 3);
+    groupIface->setMembersChangesLatency(-1);
+    QCOMPARE(groupIface->membersChangesLatency(), -1);
+    QCOMPARE(membersChangedSpy.count(), 4);
+    QCOMPARE(qvariant_cast<UIntList>(membersChangedSpy.at(3).at(1)), UIntList() << 6000);
+}
+
+void TestBaseChannel::cleanup()
+{
+    cleanupImpl();
+}
+
+void TestBaseChannel::cleanupTestCase()
+{
+    cleanupTestCaseImpl();
+}
+
+QTEST_MAIN(TestBaseChannel)
+#include "_gen/base-channel.cpp.moc.hpp"
@@ -3,8 +3,11 @@
 
 #define TP_QT_ENABLE_LOWLEVEL_API
 
+#include <TelepathyQt/BaseConnection>
 #include <TelepathyQt/BaseConnectionManager>
 #include <TelepathyQt/BaseProtocol>
+#include <TelepathyQt/Connection>
+#include <TelepathyQt/ConnectionLowlevel>
 #include <TelepathyQt/ConnectionManager>
 #include <TelepathyQt/ConnectionManagerLowlevel>
 #include <TelepathyQt/DBusError>
@@ -13,6 +16,48 @@
 
 using namespace Tp;
 
+// Named after the "name" parameter, so that the tests know its bus name and object path upfront
+class NamedConnection : public BaseConnection
+{
+public:
+    NamedConnection(const QDBusConnection &dbusConnection, const QString &cmName,
+            const QString &protocolName, const QVariantMap &parameters)
+        : BaseConnection(dbusConnection, cmName, protocolName, parameters)
+    { }
+
+    QString uniqueName() const
+    {
+        return parameters().value(QLatin1String("name")).toString();
+    }
+};
+
+class NamedConnectionProtocol : public BaseProtocol
+{
+public:
+    NamedConnectionProtocol(const QDBusConnection &dbusConnection, const QString &cmName,
+            const QString &name)
+        : BaseProtocol(dbusConnection, name),
+          mCMName(cmName)
+    {
+        setCreateConnectionCallback(memFun(this, &NamedConnectionProtocol::createConnection));
+    }
+
+private:
+    BaseConnectionPtr createConnection(const QVariantMap &parameters, DBusError *error)
+    {
+        Q_UNUSED(error);
+
+        // Keep the connections around after they are disconnected, like a CM reusing them would
+        BaseConnectionPtr connection = BaseConnection::create<NamedConnection>(mCMName, name(),
+                parameters, dbusConnection());
+        mConnections << connection;
+        return connection;
+    }
+
+    QString mCMName;
+    QList<BaseConnectionPtr> mConnections;
+};
+
 class TestBaseCM : public Test
 {
     Q_OBJECT
@@ -21,12 +66,17 @@ public:
         : Test(parent)
     { }
 
+protected Q_SLOTS:
+    void onConnectionRequested(Tp::PendingOperation *op);
+
 private Q_SLOTS:
     void initTestCase();
     void init();
 
     void testNoProtocols();
     void testProtocols();
+    void testSharedBusName();
+    void testConnectionBusNames();
 
     void cleanup();
     void cleanupTestCase();
@@ -34,8 +84,25 @@ private Q_SLOTS:
 private:
     static void testNoProtocolsCreateCM(BaseConnectionManagerPtr &cm);
     static void testProtocolsCreateCM(BaseConnectionManagerPtr &cm);
+    static void testSharedBusNameCreateCM(BaseConnectionManagerPtr &cm);
+    static void testConnectionBusNamesCreateCM(BaseConnectionManagerPtr &cm);
+
+    ConnectionPtr requestConnection(const ConnectionManagerPtr &cliCM, const QString &name);
+    bool waitForNameOwner(const QString &busName, bool hasOwner);
+
+    QList<ConnectionPtr> mRequestedConnections;
+    QStringList mRequestErrors;
 };
 
+void TestBaseCM::onConnectionRequested(Tp::PendingOperation *op)
+{
+    if (op->isError()) {
+        mRequestErrors << op->errorName();
+    } else {
+        mRequestedConnections << qobject_cast<PendingConnection *>(op)->connection();
+    }
+}
+
 void TestBaseCM::initTestCase()
 {
     initTestCaseImpl();
@@ -157,6 +224,183 @@ void TestBaseCM::testProtocols()
     QCOMPARE(mLastError, TP_QT_ERROR_NOT_IMPLEMENTED);
 }
 
+ConnectionPtr TestBaseCM::requestConnection(const ConnectionManagerPtr &cliCM,
+        const QString &name)
+{
+    QVariantMap parameters;
+    parameters.insert(QLatin1String("name"), name);
+    PendingConnection *pc = cliCM->lowlevel()->requestConnection(
+            QLatin1String("myprotocol"), parameters);
+    connect(pc, SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    if (mLoop->exec() != 0) {
+        return ConnectionPtr();
+    }
+    return pc->connection();
+}
+
+bool TestBaseCM::waitForNameOwner(const QString &busName, bool hasOwner)
+{
+    QDBusConnectionInterface *iface = QDBusConnection::sessionBus().interface();
+    for (int i = 0; i < 100 && iface->isServiceRegistered(busName).value() != hasOwner; ++i) {
+        QTest::qWait(10);
+    }
+    return iface->isServiceRegistered(busName).value() == hasOwner;
+}
+
+void TestBaseCM::testSharedBusNameCreateCM(BaseConnectionManagerPtr &cm)
+{
+    cm = BaseConnectionManager::create(QLatin1String("testcmshared"));
+    QVERIFY(!cm->isSharedBusNameEnabled());
+    QCOMPARE(cm->sharedBusName(),
+            TP_QT_CONNECTION_MANAGER_BUS_NAME_BASE + QLatin1String("testcmshared"));
+    QVERIFY(cm->connectionObjectPathBase().isEmpty());
+
+    cm->setSharedBusNameEnabled(true);
+    cm->setConnectionObjectPathBase(QLatin1String("/org/example/TestCM"));
+
+    QVERIFY(cm->addProtocol(BaseProtocolPtr(new NamedConnectionProtocol(
+                        cm->dbusConnection(), QLatin1String("testcmshared"),
+                        QLatin1String("myprotocol")))));
+
+    Tp::DBusError err;
+    QVERIFY(cm->registerObject(&err));
+    QVERIFY(!err.isValid());
+
+    // The scheme can't change once connections may have been made with it
+    cm->setSharedBusNameEnabled(false);
+    QVERIFY(cm->isSharedBusNameEnabled());
+    cm->setConnectionObjectPathBase(QString());
+    QCOMPARE(cm->connectionObjectPathBase(), QLatin1String("/org/example/TestCM"));
+}
+
+void TestBaseCM::testSharedBusName()
+{
+    TestThreadHelper<BaseConnectionManagerPtr> helper;
+    TEST_THREAD_HELPER_EXECUTE(&helper, &testSharedBusNameCreateCM);
+
+    ConnectionManagerPtr cliCM = ConnectionManager::create(QLatin1String("testcmshared"));
+    PendingReady *pr = cliCM->becomeReady(ConnectionManager::FeatureCore);
+    connect(pr, SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    QCOMPARE(mLoop->exec(), 0);
+
+    // All the connections are exported under the bus name of the CM
+    QString sharedBusName = TP_QT_CONNECTION_MANAGER_BUS_NAME_BASE + QLatin1String("testcmshared");
+    ConnectionPtr conn1 = requestConnection(cliCM, QLatin1String("one"));
+    QVERIFY(!conn1.isNull());
+    QCOMPARE(conn1->busName(), sharedBusName);
+    QCOMPARE(conn1->objectPath(), QLatin1String("/org/example/TestCM/myprotocol/one"));
+
+    ConnectionPtr conn2 = requestConnection(cliCM, QLatin1String("two"));
+    QVERIFY(!conn2.isNull());
+    QCOMPARE(conn2->busName(), sharedBusName);
+    QCOMPARE(conn2->objectPath(), QLatin1String("/org/example/TestCM/myprotocol/two"));
+
+    // Disconnecting a connection doesn't give up the name the others and the CM still use
+    connect(conn1->lowlevel()->requestDisconnect(),
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(waitForNameOwner(sharedBusName, true));
+
+    connect(conn2->lowlevel()->requestDisconnect(),
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    QCOMPARE(mLoop->exec(), 0);
+}
+
+void TestBaseCM::testConnectionBusNamesCreateCM(BaseConnectionManagerPtr &cm)
+{
+    cm = BaseConnectionManager::create(QLatin1String("testcmnames"));
+    QVERIFY(cm->addProtocol(BaseProtocolPtr(new NamedConnectionProtocol(
+                        cm->dbusConnection(), QLatin1String("testcmnames"),
+                        QLatin1String("myprotocol")))));
+
+    Tp::DBusError err;
+    QVERIFY(cm->registerObject(&err));
+    QVERIFY(!err.isValid());
+}
+
+void TestBaseCM::testConnectionBusNames()
+{
+    TestThreadHelper<BaseConnectionManagerPtr> helper;
+    TEST_THREAD_HELPER_EXECUTE(&helper, &testConnectionBusNamesCreateCM);
+
+    ConnectionManagerPtr cliCM = ConnectionManager::create(QLatin1String("testcmnames"));
+    PendingReady *pr = cliCM->becomeReady(ConnectionManager::FeatureCore);
+    connect(pr, SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    QCOMPARE(mLoop->exec(), 0);
+
+    // Each connection gets a bus name of its own
+    QString busName = TP_QT_CONNECTION_BUS_NAME_BASE + QLatin1String("testcmnames.myprotocol.own");
+    ConnectionPtr conn = requestConnection(cliCM, QLatin1String("own"));
+    QVERIFY(!conn.isNull());
+    QCOMPARE(conn->busName(), busName);
+    QCOMPARE(conn->objectPath(),
+            TP_QT_CONNECTION_OBJECT_PATH_BASE + QLatin1String("testcmnames/myprotocol/own"));
+    QVERIFY(waitForNameOwner(busName, true));
+
+    // and gives it up once disconnected
+    connect(conn->lowlevel()->requestDisconnect(),
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(waitForNameOwner(busName, false));
+
+    // A name owned by another process makes the request fail, without blocking the CM
+    QString takenBusName = TP_QT_CONNECTION_BUS_NAME_BASE +
+        QLatin1String("testcmnames.myprotocol.taken");
+    QDBusConnection otherBus = QDBusConnection::connectToBus(QDBusConnection::SessionBus,
+            QLatin1String("tpqt-test-other-bus"));
+    QVERIFY(otherBus.isConnected());
+    QVERIFY(otherBus.registerService(takenBusName));
+
+    QVariantMap parameters;
+    parameters.insert(QLatin1String("name"), QLatin1String("taken"));
+    PendingConnection *pc = cliCM->lowlevel()->requestConnection(
+            QLatin1String("myprotocol"), parameters);
+    connect(pc, SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectFailure(Tp::PendingOperation*)));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(mLastError, TP_QT_ERROR_INVALID_ARGUMENT);
+
+    // The CM keeps serving requests
+    ConnectionPtr conn2 = requestConnection(cliCM, QLatin1String("other"));
+    QVERIFY(!conn2.isNull());
+    connect(conn2->lowlevel()->requestDisconnect(),
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    QCOMPARE(mLoop->exec(), 0);
+
+    // A second request for a connection still waiting for its bus name is turned down right away
+    parameters.insert(QLatin1String("name"), QLatin1String("twice"));
+    mRequestedConnections.clear();
+    mRequestErrors.clear();
+    for (int i = 0; i < 2; ++i) {
+        connect(cliCM->lowlevel()->requestConnection(QLatin1String("myprotocol"), parameters),
+                SIGNAL(finished(Tp::PendingOperation*)),
+                SLOT(onConnectionRequested(Tp::PendingOperation*)));
+    }
+    for (int i = 0; i < 500 && mRequestedConnections.size() + mRequestErrors.size() < 2; ++i) {
+        QTest::qWait(10);
+    }
+    QCOMPARE(mRequestedConnections.size(), 1);
+    QCOMPARE(mRequestErrors, QStringList() << TP_QT_ERROR_NOT_AVAILABLE);
+
+    ConnectionPtr conn3 = mRequestedConnections.first();
+    QVERIFY(!conn3.isNull());
+    connect(conn3->lowlevel()->requestDisconnect(),
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(expectSuccessfulCall(Tp::PendingOperation*)));
+    QCOMPARE(mLoop->exec(), 0);
+    mRequestedConnections.clear();
+
+    otherBus.unregisterService(takenBusName);
+    QDBusConnection::disconnectFromBus(QLatin1String("tpqt-test-other-bus"));
+}
+
 void TestBaseCM::cleanup()
 {
     cleanupImpl();
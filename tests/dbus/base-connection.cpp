@@ -0,0 +1,447 @@
+#include <tests/lib/test.h>
+#include <tests/lib/test-thread-helper.h>
+
+#include <TelepathyQt/BaseChannel>
+#include <TelepathyQt/BaseConnection>
+#include <TelepathyQt/DBusError>
+
+#include <QSignalSpy>
+
+using namespace Tp;
+
+class MatchingConnection : public BaseConnection
+{
+public:
+    MatchingConnection(const QDBusConnection &dbusConnection, const QString &cmName,
+            const QString &protocolName, const QVariantMap &parameters)
+        : BaseConnection(dbusConnection, cmName, protocolName, parameters),
+          matchCalls(0)
+    { }
+
+    // Other IDs the channel targets are known by, which the channel index knows nothing about
+    QHash<QString, QString> aliases;
+    int matchCalls;
+
+protected:
+    bool matchChannel(const BaseChannelPtr &channel, const QVariantMap &request,
+            DBusError *error)
+    {
+        ++matchCalls;
+        QString targetID = request.value(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetID")).toString();
+        if (aliases.contains(targetID)) {
+            return channel->targetID() == aliases.value(targetID);
+        }
+        return BaseConnection::matchChannel(channel, request, error);
+    }
+};
+
+class TestBaseConnection : public Test
+{
+    Q_OBJECT
+public:
+    TestBaseConnection(QObject *parent = 0)
+        : Test(parent)
+    { }
+
+private:
+    static QStringList inspectHandlesCb(uint handleType, const Tp::UIntList &handles,
+            Tp::DBusError *error);
+    static void contactAttributesSvcSideCb(BaseConnectionPtr &conn);
+    static void contactAttributeChangesSvcSideCb(BaseConnectionPtr &conn);
+    static void ensureChannelSvcSideCb(BaseConnectionPtr &conn);
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void contactAttributesSvcSide();
+    void contactAttributeChangesSvcSide();
+    void ensureChannelSvcSide();
+
+    void cleanup();
+    void cleanupTestCase();
+
+private:
+    TestThreadHelper<BaseConnectionPtr> *mThreadHelper;
+};
+
+QStringList TestBaseConnection::inspectHandlesCb(uint handleType, const Tp::UIntList &handles,
+        Tp::DBusError *error)
+{
+    QStringList ids;
+    foreach (uint handle, handles) {
+        if (handleType != Tp::HandleTypeContact || handle == 0 || handle > 100) {
+            error->set(TP_QT_ERROR_INVALID_HANDLE, QLatin1String("Invalid handle"));
+            return QStringList();
+        }
+        ids << QString(QLatin1String("contact%1@example.com")).arg(handle);
+    }
+    return ids;
+}
+
+void TestBaseConnection::initTestCase()
+{
+    initTestCaseImpl();
+}
+
+void TestBaseConnection::init()
+{
+    initImpl();
+    mThreadHelper = new TestThreadHelper<BaseConnectionPtr>();
+}
+
+void TestBaseConnection::contactAttributesSvcSideCb(BaseConnectionPtr &conn)
+{
+    conn = BaseConnection::create(QLatin1String("testcm"), QLatin1String("example"),
+            QVariantMap());
+    conn->setInspectHandlesCallback(ptrFun(&TestBaseConnection::inspectHandlesCb));
+
+    BaseConnectionContactsInterfacePtr contactsIface = BaseConnectionContactsInterface::create();
+    contactsIface->setContactAttributeInterfaces(QStringList()
+            << TP_QT_IFACE_CONNECTION
+            << TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING
+            << TP_QT_IFACE_CONNECTION_INTERFACE_AVATARS
+            << TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE);
+    QVERIFY(conn->plugInterface(contactsIface));
+
+    BaseConnectionAliasingInterfacePtr aliasingIface = BaseConnectionAliasingInterface::create();
+    QVERIFY(conn->plugInterface(aliasingIface));
+    BaseConnectionAvatarsInterfacePtr avatarsIface = BaseConnectionAvatarsInterface::create();
+    QVERIFY(conn->plugInterface(avatarsIface));
+    BaseConnectionSimplePresenceInterfacePtr presenceIface =
+        BaseConnectionSimplePresenceInterface::create();
+    QVERIFY(conn->plugInterface(presenceIface));
+
+    AliasPairList aliases;
+    AliasPair alice = { 1, QLatin1String("Alice") };
+    AliasPair bob = { 2, QLatin1String("Bob") };
+    aliases << alice << bob;
+    aliasingIface->aliasesChanged(aliases);
+    avatarsIface->avatarUpdated(2, QLatin1String("bob-token"));
+
+    SimplePresence available = { ConnectionPresenceTypeAvailable,
+        QLatin1String("available"), QLatin1String("Hi") };
+    SimpleContactPresences presences;
+    presences.insert(1, available);
+    presenceIface->setPresences(presences);
+
+    // The store serves GetContactAttributes as there is no callback for it
+    {
+        Tp::DBusError err;
+        ContactAttributesMap attributes = contactsIface->getContactAttributes(
+                UIntList() << 1 << 2 << 3 << 1000,
+                QStringList()
+                    << TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING
+                    << TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE,
+                &err);
+        QVERIFY(!err.isValid());
+
+        // 1000 is not a valid handle
+        QCOMPARE(attributes.size(), 3);
+
+        QVariantMap attrs = attributes.value(1);
+        QCOMPARE(attrs.size(), 3);
+        QCOMPARE(attrs.value(TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")).toString(),
+                QLatin1String("contact1@example.com"));
+        QCOMPARE(attrs.value(TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING +
+                    QLatin1String("/alias")).toString(),
+                QLatin1String("Alice"));
+        SimplePresence presence = qvariant_cast<SimplePresence>(attrs.value(
+                    TP_QT_IFACE_CONNECTION_INTERFACE_SIMPLE_PRESENCE + QLatin1String("/presence")));
+        QCOMPARE(presence.status, QLatin1String("available"));
+        QCOMPARE(presence.statusMessage, QLatin1String("Hi"));
+
+        // The avatar token wasn't asked for
+        attrs = attributes.value(2);
+        QCOMPARE(attrs.size(), 2);
+        QCOMPARE(attrs.value(TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING +
+                    QLatin1String("/alias")).toString(),
+                QLatin1String("Bob"));
+
+        attrs = attributes.value(3);
+        QCOMPARE(attrs.size(), 1);
+        QCOMPARE(attrs.value(TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")).toString(),
+                QLatin1String("contact3@example.com"));
+    }
+
+    // The interfaces serve their own getters from the store as well
+    {
+        Tp::DBusError err;
+        AliasMap aliasMap = aliasingIface->getAliases(UIntList() << 1 << 2 << 3, &err);
+        QVERIFY(!err.isValid());
+        QCOMPARE(aliasMap.size(), 2);
+        QCOMPARE(aliasMap.value(1), QLatin1String("Alice"));
+        QCOMPARE(aliasMap.value(2), QLatin1String("Bob"));
+
+        AvatarTokenMap tokens = avatarsIface->getKnownAvatarTokens(UIntList() << 1 << 2, &err);
+        QVERIFY(!err.isValid());
+        QCOMPARE(tokens.size(), 1);
+        QCOMPARE(tokens.value(2), QLatin1String("bob-token"));
+
+        presences = presenceIface->getPresences(UIntList() << 1 << 3);
+        QCOMPARE(presences.size(), 2);
+        QCOMPARE(presences.value(1).status, QLatin1String("available"));
+        QCOMPARE(presences.value(3).status, QLatin1String("unknown"));
+    }
+
+    // Custom columns
+    {
+        QVariantMap capabilities;
+        capabilities.insert(QLatin1String("capabilities"),
+                QVariant::fromValue(RequestableChannelClassList()));
+        conn->setContactAttributes(3, TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_CAPABILITIES,
+                capabilities);
+
+        ContactAttributesMap attributes = conn->contactAttributes(UIntList() << 3,
+                QStringList() << TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_CAPABILITIES);
+        QCOMPARE(attributes.size(), 1);
+        QVERIFY(attributes.value(3).contains(
+                    TP_QT_IFACE_CONNECTION_INTERFACE_CONTACT_CAPABILITIES +
+                    QLatin1String("/capabilities")));
+    }
+
+    // Removed contacts only keep the ID, which is looked up again
+    {
+        conn->removeContactAttributes(UIntList() << 1);
+
+        ContactAttributesMap attributes = conn->contactAttributes(UIntList() << 1,
+                QStringList() << TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING);
+        QCOMPARE(attributes.size(), 1);
+        QCOMPARE(attributes.value(1).size(), 1);
+        QCOMPARE(attributes.value(1).value(
+                    TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")).toString(),
+                QLatin1String("contact1@example.com"));
+    }
+
+    // Disconnecting drops the whole store
+    {
+        conn->setStatus(ConnectionStatusConnected, ConnectionStatusReasonRequested);
+        ContactAttributesMap attributes = conn->contactAttributes(UIntList() << 2,
+                QStringList() << TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING);
+        QCOMPARE(attributes.value(2).size(), 2);
+
+        conn->setStatus(ConnectionStatusDisconnected, ConnectionStatusReasonRequested);
+        attributes = conn->contactAttributes(UIntList() << 2,
+                QStringList() << TP_QT_IFACE_CONNECTION_INTERFACE_ALIASING);
+        QCOMPARE(attributes.size(), 1);
+        QCOMPARE(attributes.value(2).size(), 1);
+        QCOMPARE(attributes.value(2).value(
+                    TP_QT_IFACE_CONNECTION + QLatin1String("/contact-id")).toString(),
+                QLatin1String("contact2@example.com"));
+    }
+
+    conn.reset();
+}
+
+void TestBaseConnection::contactAttributesSvcSide()
+{
+    TEST_THREAD_HELPER_EXECUTE(mThreadHelper, &TestBaseConnection::contactAttributesSvcSideCb);
+}
+
+void TestBaseConnection::contactAttributeChangesSvcSideCb(BaseConnectionPtr &conn)
+{
+    conn = BaseConnection::create(QLatin1String("testcm"), QLatin1String("example"),
+            QVariantMap());
+
+    BaseConnectionSimplePresenceInterfacePtr presenceIface =
+        BaseConnectionSimplePresenceInterface::create();
+    QVERIFY(conn->plugInterface(presenceIface));
+
+    // The adaptee is the only child of the interface until it's registered
+    QObject *adaptee = presenceIface->findChild<QObject *>();
+    QVERIFY(adaptee);
+    QSignalSpy spy(adaptee, SIGNAL(presencesChanged(Tp::SimpleContactPresences)));
+
+    SimplePresence available = { ConnectionPresenceTypeAvailable,
+        QLatin1String("available"), QString() };
+    SimplePresence away = { ConnectionPresenceTypeAway, QLatin1String("away"), QString() };
+
+    // By default every change is signalled right away, as it was set
+    QCOMPARE(conn->contactAttributeChangesLatency(), -1);
+    SimpleContactPresences presences;
+    presences.insert(201, available);
+    presences.insert(202, available);
+    presenceIface->setPresences(presences);
+    presenceIface->setPresences(presences);
+    QCOMPARE(spy.count(), 2);
+    QCOMPARE(qvariant_cast<SimpleContactPresences>(spy.at(1).at(0)).size(), 2);
+    spy.clear();
+
+    // Once coalescing, changes done in the same event loop iteration are signalled together
+    conn->setContactAttributeChangesLatency(0);
+    QCOMPARE(conn->contactAttributeChangesLatency(), 0);
+    for (uint handle = 1; handle <= 100; ++handle) {
+        SimpleContactPresences single;
+        single.insert(handle, available);
+        presenceIface->setPresences(single);
+    }
+    presences.clear();
+    presences.insert(1, away);
+    presenceIface->setPresences(presences);
+    QCOMPARE(spy.count(), 0);
+
+    QTest::qWait(10);
+    QCOMPARE(spy.count(), 1);
+    presences = qvariant_cast<SimpleContactPresences>(spy.at(0).at(0));
+    QCOMPARE(presences.size(), 100);
+    QCOMPARE(presences.value(1).status, QLatin1String("away"));
+    QCOMPARE(presences.value(2).status, QLatin1String("available"));
+
+    // flushContactAttributeChanges() doesn't wait for the latency to elapse
+    conn->setContactAttributeChangesLatency(60000);
+    QCOMPARE(conn->contactAttributeChangesLatency(), 60000);
+    presences.clear();
+    presences.insert(2, away);
+    presenceIface->setPresences(presences);
+    QTest::qWait(10);
+    QCOMPARE(spy.count(), 1);
+
+    conn->flushContactAttributeChanges();
+    QCOMPARE(spy.count(), 2);
+    presences = qvariant_cast<SimpleContactPresences>(spy.at(1).at(0));
+    QCOMPARE(presences.size(), 1);
+    QCOMPARE(presences.value(2).status, QLatin1String("away"));
+
+    conn->flushContactAttributeChanges();
+    QCOMPARE(spy.count(), 2);
+
+    // Setting the presences contacts already have isn't signalled
+    presenceIface->setPresences(presences);
+    conn->flushContactAttributeChanges();
+    QCOMPARE(spy.count(), 2);
+
+    // Pending changes are signalled when coalescing gets disabled
+    presences.clear();
+    presences.insert(3, away);
+    presenceIface->setPresences(presences);
+    QCOMPARE(spy.count(), 2);
+    conn->setContactAttributeChangesLatency(-1);
+    QCOMPARE(conn->contactAttributeChangesLatency(), -1);
+    QCOMPARE(spy.count(), 3);
+    presences = qvariant_cast<SimpleContactPresences>(spy.at(2).at(0));
+    QCOMPARE(presences.size(), 1);
+    QCOMPARE(presences.value(3).status, QLatin1String("away"));
+
+    conn.reset();
+}
+
+void TestBaseConnection::contactAttributeChangesSvcSide()
+{
+    TEST_THREAD_HELPER_EXECUTE(mThreadHelper,
+            &TestBaseConnection::contactAttributeChangesSvcSideCb);
+}
+
+void TestBaseConnection::ensureChannelSvcSideCb(BaseConnectionPtr &conn)
+{
+    SharedPtr<MatchingConnection> matchingConn = BaseConnection::create<MatchingConnection>(
+            QLatin1String("testcm"), QLatin1String("example"), QVariantMap());
+    conn = matchingConn;
+
+    BaseChannelPtr chan1 = BaseChannel::create(conn.data(), TP_QT_IFACE_CHANNEL_TYPE_TEXT,
+            HandleTypeContact, 1);
+    chan1->setTargetID(QLatin1String("contact1@example.com"));
+    conn->addChannel(chan1);
+    BaseChannelPtr chan2 = BaseChannel::create(conn.data(), TP_QT_IFACE_CHANNEL_TYPE_TEXT,
+            HandleTypeContact, 2);
+    chan2->setTargetID(QLatin1String("contact2@example.com"));
+    conn->addChannel(chan2);
+
+    QVariantMap request;
+    request.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType"),
+            TP_QT_IFACE_CHANNEL_TYPE_TEXT);
+    request.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType"),
+            static_cast<uint>(HandleTypeContact));
+
+    // Index hits only check the channel with the requested target
+    {
+        QVariantMap byHandle = request;
+        byHandle.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle"), 2u);
+
+        Tp::DBusError err;
+        bool yours = true;
+        QCOMPARE(conn->ensureChannel(byHandle, yours, false, &err), chan2);
+        QVERIFY(!err.isValid());
+        QVERIFY(!yours);
+        QCOMPARE(matchingConn->matchCalls, 1);
+
+        QVariantMap byID = request;
+        byID.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetID"),
+                QLatin1String("contact1@example.com"));
+
+        yours = true;
+        QCOMPARE(conn->ensureChannel(byID, yours, false, &err), chan1);
+        QVERIFY(!err.isValid());
+        QVERIFY(!yours);
+        QCOMPARE(matchingConn->matchCalls, 2);
+    }
+
+    QVariantMap unknownTarget = request;
+    unknownTarget.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandle"), 3u);
+
+    // On a miss the other channels of the type are still checked, and as none matches a new
+    // channel is requested, which fails without a CreateChannel callback
+    {
+        Tp::DBusError err;
+        bool yours = false;
+        QVERIFY(conn->ensureChannel(unknownTarget, yours, false, &err).isNull());
+        QVERIFY(err.isValid());
+        QCOMPARE(err.name(), TP_QT_ERROR_NOT_IMPLEMENTED);
+        QVERIFY(yours);
+        QCOMPARE(matchingConn->matchCalls, 4);
+    }
+
+    // A reimplemented matchChannel() accepting a target the index doesn't know gets to do so
+    {
+        matchingConn->aliases.insert(QLatin1String("alias@example.com"),
+                QLatin1String("contact2@example.com"));
+
+        QVariantMap byAlias = request;
+        byAlias.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetID"),
+                QLatin1String("alias@example.com"));
+
+        Tp::DBusError err;
+        bool yours = true;
+        QCOMPARE(conn->ensureChannel(byAlias, yours, false, &err), chan2);
+        QVERIFY(!err.isValid());
+        QVERIFY(!yours);
+        QVERIFY(matchingConn->matchCalls > 4 && matchingConn->matchCalls <= 6);
+    }
+
+    // Changing the target of a channel re-keys it in the index
+    {
+        chan1->setTargetID(QLatin1String("renamed@example.com"));
+
+        QVariantMap byNewID = request;
+        byNewID.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetID"),
+                QLatin1String("renamed@example.com"));
+
+        int matchCalls = matchingConn->matchCalls;
+        Tp::DBusError err;
+        bool yours = true;
+        QCOMPARE(conn->ensureChannel(byNewID, yours, false, &err), chan1);
+        QVERIFY(!err.isValid());
+        QVERIFY(!yours);
+        QCOMPARE(matchingConn->matchCalls, matchCalls + 1);
+    }
+
+    conn.reset();
+}
+
+void TestBaseConnection::ensureChannelSvcSide()
+{
+    TEST_THREAD_HELPER_EXECUTE(mThreadHelper, &TestBaseConnection::ensureChannelSvcSideCb);
+}
+
+void TestBaseConnection::cleanup()
+{
+    delete mThreadHelper;
+    cleanupImpl();
+}
+
+void TestBaseConnection::cleanupTestCase()
+{
+    cleanupTestCaseImpl();
+}
+
+QTEST_MAIN(TestBaseConnection)
+#include "_gen/base-connection.cpp.moc.hpp"
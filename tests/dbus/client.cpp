@@ -11,8 +11,10 @@
 #include <TelepathyQt/AccountManager>
 #include <TelepathyQt/AbstractClientHandler>
 #include <TelepathyQt/AbstractClientObserver>
+#include <TelepathyQt/AccountFactory>
 #include <TelepathyQt/Channel>
 #include <TelepathyQt/ChannelClassSpec>
+#include <TelepathyQt/ChannelFactory>
 #include <TelepathyQt/ChannelDispatchOperation>
 #include <TelepathyQt/ChannelRequest>
 #include <TelepathyQt/ClientHandlerInterface>
@@ -20,7 +22,9 @@
 #include <TelepathyQt/ClientObserverInterface>
 #include <TelepathyQt/ClientRegistrar>
 #include <TelepathyQt/Connection>
+#include <TelepathyQt/ConnectionFactory>
 #include <TelepathyQt/ConnectionLowlevel>
+#include <TelepathyQt/ContactFactory>
 #include <TelepathyQt/MethodInvocationContext>
 #include <TelepathyQt/PendingAccount>
 #include <TelepathyQt/PendingReady>
@@ -281,6 +285,14 @@ public:
         mHandleChannelsUserActionTime = userActionTime;
         mHandleChannelsHandlerInfo = handlerInfo;
 
+        QStringList paths;
+        Q_FOREACH (const ChannelPtr &channel, channels) {
+            paths << channel->objectPath();
+        }
+        mHandleChannelsLog << paths.join(QLatin1String(","));
+        mHandleChannelsAccounts << account;
+        mHandleChannelsConnections << connection;
+
         Q_FOREACH (const ChannelPtr &channel, channels) {
             connect(channel.data(),
                     SIGNAL(invalidated(Tp::DBusProxy *,
@@ -324,6 +336,10 @@ public:
     QList<ChannelRequestPtr> mHandleChannelsRequestsSatisfied;
     QDateTime mHandleChannelsUserActionTime;
     AbstractClientHandler::HandlerInfo mHandleChannelsHandlerInfo;
+    // The channels of each handleChannels() call, and the account and connection it got
+    QStringList mHandleChannelsLog;
+    QList<AccountPtr> mHandleChannelsAccounts;
+    QList<ConnectionPtr> mHandleChannelsConnections;
     ChannelRequestPtr mAddRequestRequest;
     ChannelRequestPtr mRemoveRequestRequest;
     QString mRemoveRequestErrorName;
@@ -354,6 +370,8 @@ public:
 
     void testObserveChannelsCommon(const AbstractClientPtr &clientObject,
             const QString &clientBusName, const QString &clientObjectPath);
+    bool waitForReply(const QDBusPendingCall &call);
+    bool waitForHandleChannels(MyClient *client, int count);
 
 protected Q_SLOTS:
     void expectSignalEmission();
@@ -366,8 +384,11 @@ private Q_SLOTS:
     void testRegister();
     void testCapabilities();
     void testObserveChannels();
+    void testObserveChannelsStreaming();
     void testAddDispatchOperation();
     void testRequests();
+    void testHandleChannelsStreaming();
+    void testHandleChannelsStreamingChannelFailure();
     void testHandleChannels();
 
     void cleanup();
@@ -705,6 +726,26 @@ void TestClient::testObserveChannels()
             mClientObject2BusName, mClientObject2Path);
 }
 
+void TestClient::testObserveChannelsStreaming()
+{
+    QVERIFY(!mClientRegistrar->isStreamingDispatchEnabled());
+    mClientRegistrar->setStreamingDispatchEnabled(true);
+    QVERIFY(mClientRegistrar->isStreamingDispatchEnabled());
+    mClientRegistrar->resetDispatchLatencyHistograms();
+
+    testObserveChannelsCommon(mClientObject1,
+            mClientObject1BusName, mClientObject1Path);
+
+    uint delivered = 0;
+    Q_FOREACH (uint count, mClientRegistrar->dispatchLatencyHistogram(
+                ClientRegistrar::DispatchStageDelivery)) {
+        delivered += count;
+    }
+    QCOMPARE(delivered, 1U);
+
+    mClientRegistrar->setStreamingDispatchEnabled(false);
+}
+
 void TestClient::testAddDispatchOperation()
 {
     QDBusConnection bus = mClientRegistrar->dbusConnection();
@@ -762,6 +803,187 @@ void TestClient::testAddDispatchOperation()
     QCOMPARE(handledChannels, expectedHandledChannels);
 }
 
+bool TestClient::waitForReply(const QDBusPendingCall &call)
+{
+    for (int i = 0; i < 500 && !call.isFinished(); ++i) {
+        QTest::qWait(10);
+    }
+    return call.isFinished();
+}
+
+bool TestClient::waitForHandleChannels(MyClient *client, int count)
+{
+    for (int i = 0; i < 500 && client->mHandleChannelsLog.size() < count; ++i) {
+        QTest::qWait(10);
+    }
+    return client->mHandleChannelsLog.size() == count;
+}
+
+void TestClient::testHandleChannelsStreaming()
+{
+    mClientRegistrar->setStreamingDispatchEnabled(true);
+    mClientRegistrar->resetDispatchLatencyHistograms();
+
+    // A handler of its own, so the other tests don't see the channel proxies it connects to
+    ChannelClassSpecList filters;
+    filters.append(ChannelClassSpec::textChat());
+    AbstractClientPtr clientObject = MyClient::create(filters, mClientCapabilities);
+    QVERIFY(mClientRegistrar->registerClient(clientObject, QLatin1String("foostreaming")));
+    MyClient *client = dynamic_cast<MyClient*>(clientObject.data());
+
+    QDBusConnection bus = mClientRegistrar->dbusConnection();
+    ClientHandlerInterface *handlerIface = new ClientHandlerInterface(bus,
+            QLatin1String("org.freedesktop.Telepathy.Client.foostreaming"),
+            QLatin1String("/org/freedesktop/Telepathy/Client/foostreaming"), this);
+
+    ChannelDetails text1Details = { QDBusObjectPath(mText1ChanPath), QVariantMap() };
+    ChannelDetails text2Details = { QDBusObjectPath(mText2ChanPath), QVariantMap() };
+
+    // The channels of a dispatch are handled one by one, in the order they were given in
+    QDBusPendingReply<> reply = handlerIface->HandleChannels(
+            QDBusObjectPath(mAccount->objectPath()),
+            QDBusObjectPath(mConn->objectPath()),
+            ChannelDetailsList() << text2Details << text1Details,
+            ObjectPathList(),
+            mUserActionTime,
+            QVariantMap());
+    QVERIFY(waitForReply(reply));
+    QVERIFY(!reply.isError());
+    QVERIFY(waitForHandleChannels(client, 2));
+    QCOMPARE(client->mHandleChannelsLog, QStringList() << mText2ChanPath << mText1ChanPath);
+
+    Tp::ObjectPathList handledChannels;
+    QVERIFY(waitForProperty(handlerIface->requestPropertyHandledChannels(), &handledChannels));
+    QVERIFY(handledChannels.contains(QDBusObjectPath(mText1ChanPath)));
+    QVERIFY(handledChannels.contains(QDBusObjectPath(mText2ChanPath)));
+
+    // Concurrent dispatches for the same account and connection share their proxies
+    client->mHandleChannelsLog.clear();
+    client->mHandleChannelsAccounts.clear();
+    client->mHandleChannelsConnections.clear();
+
+    QDBusPendingReply<> reply1 = handlerIface->HandleChannels(
+            QDBusObjectPath(mAccount->objectPath()),
+            QDBusObjectPath(mConn->objectPath()),
+            ChannelDetailsList() << text1Details,
+            ObjectPathList(),
+            mUserActionTime,
+            QVariantMap());
+    QDBusPendingReply<> reply2 = handlerIface->HandleChannels(
+            QDBusObjectPath(mAccount->objectPath()),
+            QDBusObjectPath(mConn->objectPath()),
+            ChannelDetailsList() << text2Details,
+            ObjectPathList(),
+            mUserActionTime,
+            QVariantMap());
+    QVERIFY(waitForReply(reply1));
+    QVERIFY(!reply1.isError());
+    QVERIFY(waitForReply(reply2));
+    QVERIFY(!reply2.isError());
+    QVERIFY(waitForHandleChannels(client, 2));
+
+    QCOMPARE(client->mHandleChannelsAccounts.size(), 2);
+    QVERIFY(client->mHandleChannelsAccounts.at(0) == client->mHandleChannelsAccounts.at(1));
+    QCOMPARE(client->mHandleChannelsAccounts.at(0)->objectPath(), mAccount->objectPath());
+    QCOMPARE(client->mHandleChannelsConnections.size(), 2);
+    QVERIFY(client->mHandleChannelsConnections.at(0) ==
+            client->mHandleChannelsConnections.at(1));
+    QCOMPARE(client->mHandleChannelsConnections.at(0)->objectPath(), mConn->objectPath());
+
+    uint delivered = 0;
+    Q_FOREACH (uint count, mClientRegistrar->dispatchLatencyHistogram(
+                ClientRegistrar::DispatchStageDelivery)) {
+        delivered += count;
+    }
+    QCOMPARE(delivered, 4U);
+
+    // When the account can't be made ready, the dispatch is refused and nothing is handled
+    client->mHandleChannelsLog.clear();
+    reply = handlerIface->HandleChannels(
+            QDBusObjectPath(QLatin1String("/org/freedesktop/Telepathy/Account/foo/bar/missing")),
+            QDBusObjectPath(mConn->objectPath()),
+            ChannelDetailsList() << text1Details,
+            ObjectPathList(),
+            mUserActionTime,
+            QVariantMap());
+    QVERIFY(waitForReply(reply));
+    QVERIFY(reply.isError());
+    QVERIFY(client->mHandleChannelsLog.isEmpty());
+
+    QVERIFY(mClientRegistrar->unregisterClient(clientObject));
+    mClientRegistrar->setStreamingDispatchEnabled(false);
+}
+
+void TestClient::testHandleChannelsStreamingChannelFailure()
+{
+    guint handle = tp_handle_ensure(mContactRepo, "someone@localhost", 0, 0);
+    QString failingChanPath = mConn->objectPath() + QLatin1String("/TextChannelFailing");
+    QByteArray chanPath(failingChanPath.toLatin1());
+    ExampleEchoChannel *failingChanService = EXAMPLE_ECHO_CHANNEL(g_object_new(
+                EXAMPLE_TYPE_ECHO_CHANNEL,
+                "connection", mConn->service(),
+                "object-path", chanPath.data(),
+                "handle", handle,
+                NULL));
+
+    // Text channels can't be made ready with a feature they don't support, while the channels
+    // given without immutable properties are plain Channels which only need the core feature
+    QDBusConnection bus = mClientRegistrar->dbusConnection();
+    ChannelFactoryPtr chanFactory = ChannelFactory::create(bus);
+    chanFactory->addFeaturesFor(ChannelClassSpec::textChat(),
+            Features() << Feature(QLatin1String("TestClient::Unsupported"), 0));
+    ClientRegistrarPtr registrar = ClientRegistrar::create(bus, AccountFactory::create(bus),
+            ConnectionFactory::create(bus), chanFactory, ContactFactory::create());
+    registrar->setStreamingDispatchEnabled(true);
+
+    ChannelClassSpecList filters;
+    filters.append(ChannelClassSpec::textChat());
+    AbstractClientPtr clientObject = MyClient::create(filters, mClientCapabilities);
+    QVERIFY(registrar->registerClient(clientObject, QLatin1String("foostreamingfailure")));
+    MyClient *client = dynamic_cast<MyClient*>(clientObject.data());
+
+    ClientHandlerInterface *handlerIface = new ClientHandlerInterface(bus,
+            QLatin1String("org.freedesktop.Telepathy.Client.foostreamingfailure"),
+            QLatin1String("/org/freedesktop/Telepathy/Client/foostreamingfailure"), this);
+
+    QVariantMap failingProperties;
+    failingProperties.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".ChannelType"),
+            TP_QT_IFACE_CHANNEL_TYPE_TEXT);
+    failingProperties.insert(TP_QT_IFACE_CHANNEL + QLatin1String(".TargetHandleType"),
+            (uint) Tp::HandleTypeContact);
+    ChannelDetails failingDetails = { QDBusObjectPath(failingChanPath), failingProperties };
+    ChannelDetails text1Details = { QDBusObjectPath(mText1ChanPath), QVariantMap() };
+
+    // The dispatch succeeds for the channel which can be prepared, and the one which can't is
+    // closed instead of being left without a handler
+    QDBusPendingReply<> reply = handlerIface->HandleChannels(
+            QDBusObjectPath(mAccount->objectPath()),
+            QDBusObjectPath(mConn->objectPath()),
+            ChannelDetailsList() << failingDetails << text1Details,
+            ObjectPathList(),
+            mUserActionTime,
+            QVariantMap());
+    QVERIFY(waitForReply(reply));
+    QVERIFY(!reply.isError());
+    QVERIFY(waitForHandleChannels(client, 1));
+    QCOMPARE(client->mHandleChannelsLog, QStringList() << mText1ChanPath);
+
+    gboolean destroyed = FALSE;
+    for (int i = 0; i < 500 && !destroyed; ++i) {
+        QTest::qWait(10);
+        g_object_get(failingChanService, "channel-destroyed", &destroyed, NULL);
+    }
+    QVERIFY(destroyed);
+
+    Tp::ObjectPathList handledChannels;
+    QVERIFY(waitForProperty(handlerIface->requestPropertyHandledChannels(), &handledChannels));
+    QVERIFY(!handledChannels.contains(QDBusObjectPath(failingChanPath)));
+    QCOMPARE(client->mHandleChannelsLog, QStringList() << mText1ChanPath);
+
+    QVERIFY(registrar->unregisterClient(clientObject));
+    g_object_unref(failingChanService);
+}
+
 void TestClient::testHandleChannels()
 {
     QDBusConnection bus = mClientRegistrar->dbusConnection();
@@ -10,6 +10,7 @@
 #include <TelepathyQt/ContactFactory>
 #include <TelepathyQt/ContactManager>
 #include <TelepathyQt/PendingContacts>
+#include <TelepathyQt/Utils>
 
 #include <telepathy-glib/debug.h>
 
@@ -41,6 +42,7 @@ private Q_SLOTS:
     void init();
 
     void testRoster();
+    void testPersistentCache();
 
     void cleanup();
     void cleanupTestCase();
@@ -479,6 +481,79 @@ void TestConnRoster::testRoster()
     }
 }
 
+void TestConnRoster::testPersistentCache()
+{
+    // XDG_CACHE_HOME points to the build tree while running the tests
+    QString cacheFileName;
+    QMap<QString, QString> aliases;
+    uint coldStartCalls = 0;
+    for (int run = 0; run < 2; ++run) {
+        TestConnHelper *conn = new TestConnHelper(this,
+                ChannelFactory::create(QDBusConnection::sessionBus()),
+                ContactFactory::create(Contact::FeatureAlias),
+                EXAMPLE_TYPE_CONTACT_LIST_CONNECTION,
+                "account", "cached@example.com",
+                "protocol", "contactlist",
+                "simulation-delay", 1,
+                NULL);
+        ContactManagerPtr contactManager = conn->client()->contactManager();
+        QVERIFY(!contactManager->isPersistentCacheEnabled());
+        contactManager->setPersistentCacheEnabled(true);
+        QCOMPARE(conn->connect(), true);
+
+        if (run == 0) {
+            // The example CM puts a pointer in the connection object path, which changes every
+            // time, so only the self ID can find the cache again
+            cacheFileName = QString(QLatin1String("%1/telepathy/contacts/%2/%3/%4")).
+                arg(QString::fromLocal8Bit(qgetenv("XDG_CACHE_HOME"))).
+                arg(escapeAsIdentifier(conn->client()->cmName())).
+                arg(escapeAsIdentifier(conn->client()->protocolName())).
+                arg(escapeAsIdentifier(QLatin1String("cached@example.com")));
+            QFile::remove(cacheFileName);
+        }
+
+        uint callCount = contactManager->contactAttributesCallCount();
+        QCOMPARE(conn->enableFeatures(Features() << Connection::FeatureRoster), true);
+        QCOMPARE(contactManager->state(), ContactListStateSuccess);
+        QVERIFY(!contactManager->allKnownContacts().isEmpty());
+
+        // The second time around the aliases come from the cache, before being revalidated
+        Q_FOREACH (const ContactPtr &contact, contactManager->allKnownContacts()) {
+            QVERIFY(contact->actualFeatures().contains(Contact::FeatureAlias));
+            if (run == 0) {
+                aliases.insert(contact->id(), contact->alias());
+            } else {
+                QVERIFY(aliases.contains(contact->id()));
+                QCOMPARE(contact->alias(), aliases.value(contact->id()));
+            }
+        }
+
+        processDBusQueue(conn->client().data());
+        uint calls = contactManager->contactAttributesCallCount() - callCount;
+        if (run == 0) {
+            QVERIFY(QFile::exists(cacheFileName));
+            coldStartCalls = calls;
+        } else {
+            // Only a warm start fetches the attributes it took from the cache again
+            for (int i = 0; i < 100 && calls == coldStartCalls; ++i) {
+                QTest::qWait(10);
+                calls = contactManager->contactAttributesCallCount() - callCount;
+            }
+            QCOMPARE(calls, coldStartCalls + 1);
+            processDBusQueue(conn->client().data());
+
+            Q_FOREACH (const ContactPtr &contact, contactManager->allKnownContacts()) {
+                QCOMPARE(contact->alias(), aliases.value(contact->id()));
+            }
+        }
+
+        QCOMPARE(conn->disconnect(), true);
+        delete conn;
+    }
+
+    QVERIFY(QFile::remove(cacheFileName));
+}
+
 void TestConnRoster::cleanup()
 {
     cleanupImpl();
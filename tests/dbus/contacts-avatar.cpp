@@ -148,6 +148,12 @@ void TestContactsAvatar::createContactWithFakeAvatar(const char *id)
     QCOMPARE(mContacts[0]->avatarToken(), QString(QLatin1String(avatarToken)));
     QCOMPARE(data, QByteArray(avatarData));
     QCOMPARE(avatar.mimeType, QString(QLatin1String(avatarMimeType)));
+
+    /* Older versions read the mime type from a file next to the avatar */
+    QFile mimeTypeFile(avatar.fileName + QLatin1String(".mime"));
+    QVERIFY(mimeTypeFile.open(QIODevice::ReadOnly));
+    QCOMPARE(mimeTypeFile.readAll(), QByteArray(avatarMimeType));
+    mimeTypeFile.close();
 }
 
 void TestContactsAvatar::initTestCase()
@@ -192,6 +198,18 @@ void TestContactsAvatar::testAvatar()
     QByteArray a = tmpDir.toLatin1();
     setenv ("XDG_CACHE_HOME", a.constData(), true);
 
+    /* Leave an index mostly made of superseded lines for avatars which are gone, it should be
+     * compacted when the first avatar is stored */
+    QString avatarPath = QString(QLatin1String("%1/telepathy/avatars/%2/%3"))
+        .arg(tmpDir).arg(mConn->client()->cmName()).arg(mConn->client()->protocolName());
+    QVERIFY(QDir().mkpath(avatarPath));
+    QFile index(avatarPath + QLatin1String("/mime-types"));
+    QVERIFY(index.open(QIODevice::WriteOnly));
+    for (int i = 0; i < 100; ++i) {
+        index.write("stale image/png\n");
+    }
+    index.close();
+
     Client::ConnectionInterfaceAvatarsInterface *connAvatarsInterface =
         mConn->client()->optionalInterface<Client::ConnectionInterfaceAvatarsInterface>();
 
@@ -206,6 +224,13 @@ void TestContactsAvatar::testAvatar()
     createContactWithFakeAvatar("foo");
     QVERIFY(mGotAvatarRetrieved);
 
+    QVERIFY(index.open(QIODevice::ReadOnly));
+    QList<QByteArray> lines = index.readAll().split('\n');
+    index.close();
+    QCOMPARE(lines.size(), 2);
+    QVERIFY(lines[0].endsWith(" fake-avatar-mime-type"));
+    QVERIFY(lines[1].isEmpty());
+
     /* Second time we create a contact, avatar should be in cache now, so
      * AvatarRetrieved should NOT be called */
     mGotAvatarRetrieved = false;
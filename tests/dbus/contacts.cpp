@@ -35,7 +35,7 @@ class TestContacts : public Test
 
 public:
     TestContacts(QObject *parent = 0)
-        : Test(parent), mConnService(0)
+        : Test(parent), mConnService(0), mBatchedPendingCount(0)
     {
     }
 
@@ -43,6 +43,7 @@ protected Q_SLOTS:
     void expectConnReady(Tp::ConnectionStatus, Tp::ConnectionStatusReason);
     void expectConnInvalidated();
     void expectPendingContactsFinished(Tp::PendingOperation *);
+    void expectBatchedContactsFinished(Tp::PendingOperation *);
 
 private Q_SLOTS:
     void initTestCase();
@@ -55,6 +56,7 @@ private Q_SLOTS:
     void testFeatures();
     void testFeaturesNotRequested();
     void testUpgrade();
+    void testBatching();
     void testSelfContactFallback();
 
     void cleanup();
@@ -66,6 +68,8 @@ private:
     ConnectionPtr mConn;
     QList<ContactPtr> mContacts;
     Tp::UIntList mInvalidHandles;
+    int mBatchedPendingCount;
+    QList<ContactPtr> mBatchedContacts;
 };
 
 void TestContacts::expectConnReady(Tp::ConnectionStatus newStatus,
@@ -110,6 +114,19 @@ void TestContacts::expectPendingContactsFinished(PendingOperation *op)
     mLoop->exit(0);
 }
 
+void TestContacts::expectBatchedContactsFinished(PendingOperation *op)
+{
+    TEST_VERIFY_OP(op);
+
+    PendingContacts *pending = qobject_cast<PendingContacts *>(op);
+    mBatchedContacts << pending->contacts();
+    mInvalidHandles << pending->invalidHandles();
+
+    if (--mBatchedPendingCount == 0) {
+        mLoop->exit(0);
+    }
+}
+
 void TestContacts::initTestCase()
 {
     initTestCaseImpl();
@@ -717,6 +734,88 @@ void TestContacts::testUpgrade()
     processDBusQueue(mConn.data());
 }
 
+void TestContacts::testBatching()
+{
+    QStringList ids = QStringList() << QLatin1String("eve")
+        << QLatin1String("frank") << QLatin1String("gina");
+    TpHandleRepoIface *serviceRepo =
+        tp_base_connection_get_handles(TP_BASE_CONNECTION(mConnService), TP_HANDLE_TYPE_CONTACT);
+
+    Tp::UIntList handles;
+    for (int i = 0; i < 3; i++) {
+        handles.push_back(tp_handle_ensure(serviceRepo, ids[i].toLatin1().constData(), NULL, NULL));
+        QVERIFY(handles[i] != 0);
+    }
+
+    ContactManagerPtr manager = mConn->contactManager();
+    QCOMPARE(manager->contactAttributesBatchInterval(), 0);
+    uint requestCount = manager->contactAttributesRequestCount();
+    uint callCount = manager->contactAttributesCallCount();
+
+    // Requests made in the same main loop iteration, with overlapping handles and different
+    // features, should result in a single call
+    QList<PendingContacts *> pendings;
+    pendings << manager->contactsForHandles(Tp::UIntList() << handles[0] << handles[1],
+            Features() << Contact::FeatureAlias);
+    pendings << manager->contactsForHandles(Tp::UIntList() << handles[1] << handles[2],
+            Features() << Contact::FeatureSimplePresence);
+    pendings << manager->contactsForHandles(Tp::UIntList() << handles[2] << 31337);
+
+    mInvalidHandles.clear();
+    mBatchedPendingCount = pendings.size();
+    foreach (PendingContacts *pending, pendings) {
+        QVERIFY(connect(pending,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectBatchedContactsFinished(Tp::PendingOperation*))));
+    }
+    QCOMPARE(mLoop->exec(), 0);
+
+    QCOMPARE(manager->contactAttributesRequestCount(), requestCount + 3);
+    QCOMPARE(manager->contactAttributesCallCount(), callCount + 1);
+
+    // Each request still sees only the handles it asked for, invalid ones included
+    QCOMPARE(mBatchedContacts.size(), 5);
+    QCOMPARE(mInvalidHandles, Tp::UIntList() << 31337);
+
+    foreach (const ContactPtr &contact, mBatchedContacts) {
+        QVERIFY(handles.contains(contact->handle()[0]));
+        if (contact->handle()[0] == handles[1]) {
+            QVERIFY(contact->actualFeatures().contains(Contact::FeatureAlias));
+            QVERIFY(contact->actualFeatures().contains(Contact::FeatureSimplePresence));
+        }
+    }
+
+    // With batching disabled every request gets its own call
+    manager->setContactAttributesBatchInterval(-1);
+    mBatchedContacts.clear();
+    callCount = manager->contactAttributesCallCount();
+    pendings.clear();
+    pendings << manager->contactsForHandles(Tp::UIntList() << handles[0],
+            Features() << Contact::FeatureAvatarToken);
+    pendings << manager->contactsForHandles(Tp::UIntList() << handles[1],
+            Features() << Contact::FeatureAvatarToken);
+
+    mInvalidHandles.clear();
+    mBatchedPendingCount = pendings.size();
+    foreach (PendingContacts *pending, pendings) {
+        QVERIFY(connect(pending,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectBatchedContactsFinished(Tp::PendingOperation*))));
+    }
+    QCOMPARE(mLoop->exec(), 0);
+
+    QCOMPARE(manager->contactAttributesCallCount(), callCount + 2);
+    QCOMPARE(mBatchedContacts.size(), 2);
+
+    manager->setContactAttributesBatchInterval(0);
+
+    // Make the contacts go out of scope, starting releasing their handles, and finish that
+    mBatchedContacts.clear();
+    mInvalidHandles.clear();
+    mLoop->processEvents();
+    processDBusQueue(mConn.data());
+}
+
 void TestContacts::testSelfContactFallback()
 {
     gchar *name;
@@ -0,0 +1,262 @@
+#include <tests/lib/test.h>
+
+#include <tests/lib/glib-helpers/test-conn-helper.h>
+
+#include <tests/lib/glib/file-transfer-chan.h>
+#include <tests/lib/glib/simple-conn.h>
+
+#include <TelepathyQt/Connection>
+#include <TelepathyQt/FileTransferChannel>
+#include <TelepathyQt/IncomingFileTransferChannel>
+#include <TelepathyQt/OutgoingFileTransferChannel>
+#include <TelepathyQt/PendingReady>
+
+#include <telepathy-glib/telepathy-glib.h>
+
+#include <QBuffer>
+#include <QFile>
+#include <QTemporaryFile>
+
+using namespace Tp;
+
+class TestFileTransferChan : public Test
+{
+    Q_OBJECT
+
+public:
+    TestFileTransferChan(QObject *parent = 0)
+        : Test(parent),
+          mConn(0), mChanService(0)
+    { }
+
+protected Q_SLOTS:
+    void onStateChanged(Tp::FileTransferState state);
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+
+    void testReceiveToFile();
+    void testReceiveToBuffer();
+    void testSendFromFile();
+    void testSendFromBuffer();
+
+    void cleanup();
+    void cleanupTestCase();
+
+private:
+    void createChannel(bool requested);
+    void receive(QIODevice *output);
+    void send(QIODevice *input);
+
+    TestConnHelper *mConn;
+    TpTestsFileTransferChannel *mChanService;
+    FileTransferChannelPtr mChan;
+
+    QByteArray mData;
+};
+
+void TestFileTransferChan::onStateChanged(Tp::FileTransferState state)
+{
+    if (state == FileTransferStateCompleted) {
+        mLoop->exit(0);
+    } else if (state == FileTransferStateCancelled) {
+        mLoop->exit(1);
+    }
+}
+
+void TestFileTransferChan::createChannel(bool requested)
+{
+    QString chanPath = QString(QLatin1String("%1/FileTransferChannel")).arg(mConn->objectPath());
+
+    TpHandleRepoIface *contactRepo = tp_base_connection_get_handles(
+            TP_BASE_CONNECTION(mConn->service()), TP_HANDLE_TYPE_CONTACT);
+    TpHandle handle = tp_handle_ensure(contactRepo, "bob", NULL, NULL);
+    TpHandle initiatorHandle = requested ?
+        tp_base_connection_get_self_handle(TP_BASE_CONNECTION(mConn->service())) : handle;
+
+    mChanService = TP_TESTS_FILE_TRANSFER_CHANNEL(g_object_new(
+            TP_TESTS_TYPE_FILE_TRANSFER_CHANNEL,
+            "connection", mConn->service(),
+            "handle", handle,
+            "requested", requested,
+            "object-path", chanPath.toLatin1().constData(),
+            "initiator-handle", initiatorHandle,
+            "size", (guint64) mData.size(),
+            NULL));
+
+    if (requested) {
+        mChan = OutgoingFileTransferChannel::create(mConn->client(), chanPath, QVariantMap());
+    } else {
+        tp_tests_file_transfer_channel_set_content(mChanService, mData.constData(),
+                mData.size());
+        mChan = IncomingFileTransferChannel::create(mConn->client(), chanPath, QVariantMap());
+    }
+
+    QVERIFY(connect(mChan->becomeReady(FileTransferChannel::FeatureCore),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(mChan->isReady(FileTransferChannel::FeatureCore), true);
+    QCOMPARE(mChan->state(), FileTransferStatePending);
+    QCOMPARE(mChan->size(), (qulonglong) mData.size());
+}
+
+void TestFileTransferChan::receive(QIODevice *output)
+{
+    createChannel(false);
+    IncomingFileTransferChannelPtr chan = IncomingFileTransferChannelPtr::qObjectCast(mChan);
+    QVERIFY(chan);
+
+    QVERIFY(connect(chan->acceptFile(0, output),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+
+    // The state only changes to Completed once everything has been written to output
+    QVERIFY(connect(chan.data(),
+                SIGNAL(stateChanged(Tp::FileTransferState,Tp::FileTransferStateChangeReason)),
+                SLOT(onStateChanged(Tp::FileTransferState))));
+    if (chan->state() != FileTransferStateCompleted) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    QCOMPARE(chan->state(), FileTransferStateCompleted);
+    QVERIFY(!output->isOpen());
+}
+
+void TestFileTransferChan::send(QIODevice *input)
+{
+    createChannel(true);
+    OutgoingFileTransferChannelPtr chan = OutgoingFileTransferChannelPtr::qObjectCast(mChan);
+    QVERIFY(chan);
+
+    QVERIFY(connect(chan->provideFile(input),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+
+    // The service only reports Completed once we have closed the socket, and the state only
+    // changes to it once we are done sending
+    QVERIFY(connect(chan.data(),
+                SIGNAL(stateChanged(Tp::FileTransferState,Tp::FileTransferStateChangeReason)),
+                SLOT(onStateChanged(Tp::FileTransferState))));
+    if (chan->state() != FileTransferStateCompleted) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    QCOMPARE(chan->state(), FileTransferStateCompleted);
+
+    gsize len;
+    const gchar *received = tp_tests_file_transfer_channel_get_received(mChanService, &len);
+    QCOMPARE((int) len, mData.size());
+    QVERIFY(QByteArray::fromRawData(received, len) == mData);
+}
+
+void TestFileTransferChan::initTestCase()
+{
+    initTestCaseImpl();
+
+    g_type_init();
+    g_set_prgname("file-transfer-chan");
+    tp_debug_set_flags("all");
+    dbus_g_bus_get(DBUS_BUS_STARTER, 0);
+
+    mConn = new TestConnHelper(this,
+            TP_TESTS_TYPE_SIMPLE_CONNECTION,
+            "account", "me@example.com",
+            "protocol", "example",
+            NULL);
+    QCOMPARE(mConn->connect(), true);
+
+    // Big enough for the transfers to take many socket notifications, whichever path is used
+    qsrand(42);
+    mData.resize(4 * 1024 * 1024 + 123);
+    for (int i = 0; i < mData.size(); ++i) {
+        mData[i] = (char) (qrand() & 0xff);
+    }
+}
+
+void TestFileTransferChan::init()
+{
+    initImpl();
+}
+
+void TestFileTransferChan::testReceiveToFile()
+{
+    // A regular file as output makes the incoming channel use splice(), where available
+    QTemporaryFile file;
+    QVERIFY(file.open());
+
+    receive(&file);
+
+    QFile received(file.fileName());
+    QVERIFY(received.open(QIODevice::ReadOnly));
+    QCOMPARE(received.size(), (qint64) mData.size());
+    QVERIFY(received.readAll() == mData);
+}
+
+void TestFileTransferChan::testReceiveToBuffer()
+{
+    QBuffer buffer;
+    QVERIFY(buffer.open(QIODevice::WriteOnly));
+
+    receive(&buffer);
+
+    QCOMPARE(buffer.data().size(), mData.size());
+    QVERIFY(buffer.data() == mData);
+}
+
+void TestFileTransferChan::testSendFromFile()
+{
+    // A regular file as input makes the outgoing channel use sendfile(), where available
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QCOMPARE(file.write(mData), (qint64) mData.size());
+    QVERIFY(file.flush());
+    QVERIFY(file.seek(0));
+
+    send(&file);
+}
+
+void TestFileTransferChan::testSendFromBuffer()
+{
+    QBuffer buffer(&mData);
+    QVERIFY(buffer.open(QIODevice::ReadOnly));
+
+    send(&buffer);
+}
+
+void TestFileTransferChan::cleanup()
+{
+    cleanupImpl();
+
+    if (mChan && mChan->isValid()) {
+        qDebug() << "waiting for the channel to become invalidated";
+
+        QVERIFY(connect(mChan.data(),
+                SIGNAL(invalidated(Tp::DBusProxy*,QString,QString)),
+                mLoop,
+                SLOT(quit())));
+        tp_base_channel_close(TP_BASE_CHANNEL(mChanService));
+        QCOMPARE(mLoop->exec(), 0);
+    }
+
+    mChan.reset();
+
+    if (mChanService != 0) {
+        g_object_unref(mChanService);
+        mChanService = 0;
+    }
+
+    mLoop->processEvents();
+}
+
+void TestFileTransferChan::cleanupTestCase()
+{
+    QCOMPARE(mConn->disconnect(), true);
+    delete mConn;
+
+    cleanupTestCaseImpl();
+}
+
+QTEST_MAIN(TestFileTransferChan)
+#include "_gen/file-transfer-chan.cpp.moc.hpp"
@@ -2,6 +2,7 @@
 
 #include <tests/lib/glib-helpers/test-conn-helper.h>
 
+#include <tests/lib/glib/contacts-conn.h>
 #include <tests/lib/glib/simple-conn.h>
 
 #define TP_QT_ENABLE_LOWLEVEL_API
@@ -32,6 +33,8 @@ private Q_SLOTS:
     void init();
 
     void testRequestAndRelease();
+    void testInvalidHandleType();
+    void benchmarkRefUnref();
 
     void cleanup();
     void cleanupTestCase();
@@ -111,6 +114,65 @@ void TestHandles::testRequestAndRelease()
     processDBusQueue(mConn->client().data());
 }
 
+void TestHandles::testInvalidHandleType()
+{
+    HandleType invalidType = static_cast<HandleType>(NUM_HANDLE_TYPES);
+
+    // Requests for an out of range handle type fail without touching the handle tracking
+    QVERIFY(connect(mConn->client()->lowlevel()->requestHandles(invalidType,
+                        QStringList() << QLatin1String("alice")),
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectFailure(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(mLastError, TP_QT_ERROR_INVALID_ARGUMENT);
+
+    QVERIFY(connect(mConn->client()->lowlevel()->referenceHandles(invalidType,
+                        UIntList() << 1),
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectFailure(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(mLastError, TP_QT_ERROR_INVALID_ARGUMENT);
+}
+
+void TestHandles::benchmarkRefUnref()
+{
+    // The simple connection has immortal handles, for which no references are tracked at all
+    TestConnHelper *conn = new TestConnHelper(this,
+            TP_TESTS_TYPE_LEGACY_CONTACTS_CONNECTION,
+            "account", "me@example.com",
+            "protocol", "legacy",
+            NULL);
+    QCOMPARE(conn->connect(), true);
+    QVERIFY(!conn->client()->lowlevel()->hasImmortalHandles());
+
+    QStringList ids;
+    for (int i = 0; i < 100000; ++i) {
+        ids << QString(QLatin1String("contact%1")).arg(i);
+    }
+
+    PendingHandles *pending = conn->client()->lowlevel()->requestHandles(Tp::HandleTypeContact, ids);
+    QVERIFY(connect(pending,
+                    SIGNAL(finished(Tp::PendingOperation*)),
+                    SLOT(expectPendingHandlesFinished(Tp::PendingOperation*))));
+    QCOMPARE(mLoop->exec(), 0);
+    ReferencedHandles handles = mHandles;
+    mHandles = ReferencedHandles();
+    QCOMPARE(handles.size(), ids.size());
+
+    QBENCHMARK {
+        // mid() gives a copy which holds its own reference to each handle, dropped right away
+        ReferencedHandles copy = handles.mid(0);
+        QCOMPARE(copy.size(), handles.size());
+    }
+
+    handles = ReferencedHandles();
+    mLoop->processEvents();
+    processDBusQueue(conn->client().data());
+
+    QCOMPARE(conn->disconnect(), true);
+    delete conn;
+}
+
 void TestHandles::cleanup()
 {
     cleanupImpl();
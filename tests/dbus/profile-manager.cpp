@@ -1,5 +1,9 @@
 #include <QtTest/QtTest>
 
+#include <QDir>
+#include <QFile>
+#include <QSignalSpy>
+
 #include <TelepathyQt/PendingReady>
 #include <TelepathyQt/ProfileManager>
 
@@ -13,8 +17,40 @@ class TestProfileManager : public Test
 
 private Q_SLOTS:
     void testProfileManager();
+    void testProfilesChanged();
 };
 
+static bool writeProfile(const QString &fileName, const QString &serviceName, const QString &name)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        return false;
+    }
+
+    QString contents = QString(QLatin1String(
+        "<service xmlns=\"http://telepathy.freedesktop.org/wiki/service-profile-v1\"\n"
+        "         id=\"%1\"\n"
+        "         type=\"IM\"\n"
+        "         manager=\"testprofilecm\"\n"
+        "         protocol=\"testprofileproto\">\n"
+        "  <name>%2</name>\n"
+        "</service>\n")).arg(serviceName).arg(name);
+    return file.write(contents.toUtf8()) >= 0;
+}
+
+static bool waitForProfileName(const ProfileManagerPtr &pm, const QString &serviceName,
+        const QString &name)
+{
+    for (int i = 0; i < 500; ++i) {
+        ProfilePtr profile = pm->profileForService(serviceName);
+        if (name.isNull() ? profile.isNull() : (!profile.isNull() && profile->name() == name)) {
+            return true;
+        }
+        QTest::qWait(10);
+    }
+    return false;
+}
+
 void TestProfileManager::testProfileManager()
 {
     ProfileManagerPtr pm = ProfileManager::create(QDBusConnection::sessionBus());
@@ -81,6 +117,66 @@ void TestProfileManager::testProfileManager()
     mLoop->processEvents();
 }
 
+void TestProfileManager::testProfilesChanged()
+{
+    QByteArray oldDataHome = qgetenv("XDG_DATA_HOME");
+    QString dataHome = QString::fromLocal8Bit(::getenv("abs_top_builddir")) +
+        QLatin1String("/tests/profile-manager-changed");
+    QString profilesDir = dataHome + QLatin1String("/telepathy/profiles/");
+    QVERIFY(QDir().mkpath(profilesDir));
+    QString firstFileName = profilesDir + QLatin1String("test-profile-first.profile");
+    QString secondFileName = profilesDir + QLatin1String("test-profile-second.profile");
+    QVERIFY(writeProfile(firstFileName, QLatin1String("test-profile-first"),
+                QLatin1String("First")));
+    qputenv("XDG_DATA_HOME", QFile::encodeName(dataHome));
+
+    ProfileManagerPtr pm = ProfileManager::create(QDBusConnection::sessionBus());
+    QVERIFY(connect(pm->becomeReady(),
+                    SIGNAL(finished(Tp::PendingOperation *)),
+                    SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(pm->isReady(), true);
+
+    ProfilePtr first = pm->profileForService(QLatin1String("test-profile-first"));
+    QVERIFY(!first.isNull());
+    QCOMPARE(first->name(), QLatin1String("First"));
+    QVERIFY(pm->profileForService(QLatin1String("test-profile-second")).isNull());
+
+    QSignalSpy spy(pm.data(), SIGNAL(profilesChanged()));
+
+    // A modified file replaces its profile, the old Profile object is left alone
+    QVERIFY(writeProfile(firstFileName, QLatin1String("test-profile-first"),
+                QLatin1String("First modified")));
+    QVERIFY(waitForProfileName(pm, QLatin1String("test-profile-first"),
+                QLatin1String("First modified")));
+    QCOMPARE(first->name(), QLatin1String("First"));
+    QVERIFY(spy.count() > 0);
+
+    // New files are picked up from the watched directory
+    spy.clear();
+    QVERIFY(writeProfile(secondFileName, QLatin1String("test-profile-second"),
+                QLatin1String("Second")));
+    QVERIFY(waitForProfileName(pm, QLatin1String("test-profile-second"),
+                QLatin1String("Second")));
+    QVERIFY(spy.count() > 0);
+
+    // And removed ones dropped
+    spy.clear();
+    QVERIFY(QFile::remove(firstFileName));
+    QVERIFY(waitForProfileName(pm, QLatin1String("test-profile-first"), QString()));
+    QVERIFY(spy.count() > 0);
+    QCOMPARE(pm->profileForService(QLatin1String("test-profile-second"))->name(),
+            QLatin1String("Second"));
+
+    pm.reset();
+    qputenv("XDG_DATA_HOME", oldDataHome);
+    QVERIFY(QFile::remove(secondFileName));
+    QVERIFY(QDir().rmpath(profilesDir));
+
+    // Allow the PendingReadys to delete themselves
+    mLoop->processEvents();
+}
+
 QTEST_MAIN(TestProfileManager)
 
 #include "_gen/profile-manager.cpp.moc.hpp"
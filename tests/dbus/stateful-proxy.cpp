@@ -73,6 +73,7 @@ private Q_SLOTS:
 
     void testBasics();
     void testNameOwnerChanged();
+    void testOwnerMoved();
 
     void cleanup();
     void cleanupTestCase();
@@ -293,6 +294,42 @@ void TestStatefulProxy::testNameOwnerChanged()
     QCOMPARE(mProxy->invalidationMessage(), mSignalledInvalidationMessage);
 }
 
+void TestStatefulProxy::testOwnerMoved()
+{
+    mProxy = new MyStatefulDBusProxy(QDBusConnection::sessionBus(),
+            wellKnownName(), objectPath());
+    QCOMPARE(mProxy->busName(), uniqueName());
+
+    // Looking the owner up again is answered from the cache
+    QCOMPARE(StatefulDBusProxy::uniqueNameFrom(QDBusConnection::sessionBus(), wellKnownName()),
+            uniqueName());
+
+    QVERIFY(connect(mProxy, SIGNAL(invalidated(
+                        Tp::DBusProxy *,
+                        const QString &, const QString &)),
+                this, SLOT(expectInvalidated(
+                        Tp::DBusProxy *,
+                        const QString &, const QString &))));
+    QVERIFY(QDBusConnection::sessionBus().unregisterService(wellKnownName()));
+    QCOMPARE(mLoop->exec(), EXPECT_INVALIDATED_SUCCESS);
+    QCOMPARE(mInvalidated, 1);
+
+    // The cached owner must have been forgotten along with the name
+    QDBusConnection otherBus = QDBusConnection::connectToBus(
+            QDBusConnection::SessionBus, QLatin1String("another owner"));
+    QVERIFY(otherBus.registerService(wellKnownName()));
+
+    MyStatefulDBusProxy *otherProxy = new MyStatefulDBusProxy(QDBusConnection::sessionBus(),
+            wellKnownName(), objectPath());
+    QVERIFY(otherProxy->isValid());
+    QCOMPARE(otherProxy->busName(), otherBus.baseService());
+    delete otherProxy;
+
+    QVERIFY(otherBus.unregisterService(wellKnownName()));
+    QDBusConnection::disconnectFromBus(QLatin1String("another owner"));
+    QVERIFY(QDBusConnection::sessionBus().registerService(wellKnownName()));
+}
+
 void TestStatefulProxy::cleanup()
 {
     if (mProxy) {
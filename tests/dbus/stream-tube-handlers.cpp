@@ -1161,7 +1161,11 @@ void TestStreamTubeHandlers::testServerConnMonitoring()
     QCOMPARE(mClosedServerConnectionPort, quint16(3));
     QCOMPARE(mClosedServerConnectionContact, mNewServerConnectionContact);
     QCOMPARE(mServerConnectionCloseError, QString(TP_QT_ERROR_DISCONNECTED));
-    QCOMPARE(server->tcpConnections().size(), 1);
+    conns = server->tcpConnections();
+    QCOMPARE(conns.size(), 1);
+    QVERIFY(!conns.contains(qMakePair(expectedAddress, quint16(3))));
+    QCOMPARE(conns.value(qMakePair(expectedAddress, quint16(2))).contact()->id(),
+            QLatin1String("second"));
 
     // Now, close the tube and verify we're signaled about that
     QVERIFY(mServerClosedTube.isNull());
@@ -10,11 +10,17 @@
 #include <tests/lib/glib/echo2/chan.h>
 
 #include <TelepathyQt/Connection>
+#include <TelepathyQt/Debug>
+#include <TelepathyQt/DebugReceiver>
 #include <TelepathyQt/Message>
+#include <TelepathyQt/PendingDebugMessageList>
 #include <TelepathyQt/PendingReady>
 #include <TelepathyQt/ReceivedMessage>
 #include <TelepathyQt/TextChannel>
 
+#include <QDateTime>
+
+#include <telepathy-glib/cm-message.h>
 #include <telepathy-glib/debug.h>
 
 using namespace Tp;
@@ -50,6 +56,7 @@ protected Q_SLOTS:
             Tp::MessageSendingFlags, const QString &);
     void onChatStateChanged(const Tp::ContactPtr &contact,
             Tp::ChannelChatState state);
+    void onNewDebugMessage(const Tp::DebugMessage &message);
 
 private Q_SLOTS:
     void initTestCase();
@@ -57,6 +64,9 @@ private Q_SLOTS:
 
     void testMessages();
     void testLegacyText();
+    void testMessageQueueLimit();
+    void testMessageQueueLimitScrollback();
+    void testTracing();
 
     void cleanup();
     void cleanupTestCase();
@@ -64,6 +74,8 @@ private Q_SLOTS:
 private:
     void commonTest(bool withMessages);
     void sendText(const char *text);
+    void receiveText(const char *text, bool scrollback);
+    static bool hasTracedMessageReceived(const DebugMessageList &messages);
 
     TestConnHelper *mConn;
     TpHandleRepoIface *mContactRepo;
@@ -79,6 +91,7 @@ private:
     bool mGotChatStateChanged;
     ContactPtr mChatStateChangedContact;
     ChannelChatState mChatStateChangedState;
+    DebugMessageList mNewDebugMessages;
 };
 
 void TestTextChan::onMessageReceived(const ReceivedMessage &message)
@@ -109,6 +122,23 @@ void TestTextChan::onChatStateChanged(const Tp::ContactPtr &contact,
     mChatStateChangedState = state;
 }
 
+void TestTextChan::onNewDebugMessage(const Tp::DebugMessage &message)
+{
+    mNewDebugMessages << message;
+}
+
+bool TestTextChan::hasTracedMessageReceived(const DebugMessageList &messages)
+{
+    foreach (const DebugMessage &message, messages) {
+        if (message.domain == QLatin1String("tp-qt/messages") &&
+                message.message.startsWith(QLatin1String("Message ")) &&
+                message.message.endsWith(QLatin1String("is usable, copying to main queue"))) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void TestTextChan::sendText(const char *text)
 {
     qDebug() << "sending message:" << text;
@@ -120,6 +150,22 @@ void TestTextChan::sendText(const char *text)
     qDebug() << "message send mainloop finished";
 }
 
+void TestTextChan::receiveText(const char *text, bool scrollback)
+{
+    qDebug() << "receiving message:" << text;
+    TpMessage *message = tp_cm_message_new(TP_BASE_CONNECTION(mConn->service()), 2);
+    tp_cm_message_set_sender(message, mContact->handle()[0]);
+    tp_message_set_uint32(message, 0, "message-type", TP_CHANNEL_TEXT_MESSAGE_TYPE_NORMAL);
+    tp_message_set_int64(message, 0, "message-received",
+            QDateTime::currentDateTime().toTime_t());
+    if (scrollback) {
+        tp_message_set_boolean(message, 0, "scrollback", TRUE);
+    }
+    tp_message_set_string(message, 1, "content-type", "text/plain");
+    tp_message_set_string(message, 1, "content", text);
+    tp_message_mixin_take_received(G_OBJECT(mMessagesChanService), message);
+}
+
 void TestTextChan::initTestCase()
 {
     initTestCaseImpl();
@@ -534,6 +580,208 @@ void TestTextChan::testLegacyText()
     commonTest(false);
 }
 
+void TestTextChan::testMessageQueueLimit()
+{
+    mChan = TextChannel::create(mConn->client(), mTextChanPath, QVariantMap());
+
+    QVERIFY(connect(mChan->becomeReady(TextChannel::FeatureMessageQueue),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(mChan->isReady(TextChannel::FeatureMessageQueue));
+
+    QCOMPARE(mChan->messageQueueLimit(), 0);
+    mChan->setMessageQueueLimit(2);
+    QCOMPARE(mChan->messageQueueLimit(), 2);
+    QCOMPARE(mChan->messageQueueOverflowPolicy(), TextChannel::MessageQueueOverflowForgetOldest);
+
+    QVERIFY(connect(mChan.data(),
+                SIGNAL(messageReceived(const Tp::ReceivedMessage &)),
+                SLOT(onMessageReceived(const Tp::ReceivedMessage &))));
+    QVERIFY(connect(mChan.data(),
+                SIGNAL(pendingMessageRemoved(const Tp::ReceivedMessage &)),
+                SLOT(onMessageRemoved(const Tp::ReceivedMessage &))));
+
+    sendText("One");
+    sendText("Two");
+    sendText("Three");
+
+    while (received.size() != 3) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+
+    // The oldest message was forgotten to make room for the last one
+    QCOMPARE(mChan->messageQueue().size(), 2);
+    QVERIFY(mChan->messageQueue().at(0) == received.at(1));
+    QVERIFY(mChan->messageQueue().at(1) == received.at(2));
+    QCOMPARE(removed.size(), 1);
+    QVERIFY(removed.at(0) == received.at(0));
+
+    // Lowering the limit forgets the excess right away
+    mChan->setMessageQueueLimit(1);
+    QCOMPARE(mChan->messageQueue().size(), 1);
+    QVERIFY(mChan->messageQueue().at(0) == received.at(2));
+    QCOMPARE(removed.size(), 2);
+    QVERIFY(removed.at(1) == received.at(1));
+
+    // Forgotten messages are still pending in the CM, so acknowledge all of them
+    mChan->acknowledge(received);
+    QCOMPARE(mChan->messageQueue().size(), 0);
+    QCOMPARE(removed.size(), 3);
+
+    while (tp_text_mixin_has_pending_messages(G_OBJECT(mTextChanService), 0)) {
+        QTest::qWait(1);
+    }
+}
+
+void TestTextChan::testMessageQueueLimitScrollback()
+{
+    mChan = TextChannel::create(mConn->client(), mMessagesChanPath, QVariantMap());
+
+    QVERIFY(connect(mChan->becomeReady(TextChannel::FeatureMessageQueue),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(mChan->isReady(TextChannel::FeatureMessageQueue));
+
+    mChan->setMessageQueueLimit(2, TextChannel::MessageQueueOverflowForgetScrollback);
+    QCOMPARE(mChan->messageQueueLimit(), 2);
+    QCOMPARE(mChan->messageQueueOverflowPolicy(),
+            TextChannel::MessageQueueOverflowForgetScrollback);
+
+    QVERIFY(connect(mChan.data(),
+                SIGNAL(messageReceived(const Tp::ReceivedMessage &)),
+                SLOT(onMessageReceived(const Tp::ReceivedMessage &))));
+    QVERIFY(connect(mChan.data(),
+                SIGNAL(pendingMessageRemoved(const Tp::ReceivedMessage &)),
+                SLOT(onMessageRemoved(const Tp::ReceivedMessage &))));
+
+    receiveText("Live", false);
+    receiveText("Scrollback", true);
+    receiveText("Newer live", false);
+
+    while (received.size() != 3) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    QVERIFY(!received.at(0).isScrollback());
+    QVERIFY(received.at(1).isScrollback());
+
+    // The scrollback message was forgotten even though it is newer than the first live one
+    QCOMPARE(mChan->messageQueue().size(), 2);
+    QVERIFY(mChan->messageQueue().at(0) == received.at(0));
+    QVERIFY(mChan->messageQueue().at(1) == received.at(2));
+    QCOMPARE(removed.size(), 1);
+    QVERIFY(removed.at(0) == received.at(1));
+
+    // Without any scrollback left in the queue the oldest message goes
+    receiveText("Newest live", false);
+
+    while (received.size() != 4) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+
+    QCOMPARE(mChan->messageQueue().size(), 2);
+    QVERIFY(mChan->messageQueue().at(0) == received.at(2));
+    QVERIFY(mChan->messageQueue().at(1) == received.at(3));
+    QCOMPARE(removed.size(), 2);
+    QVERIFY(removed.at(1) == received.at(0));
+
+    mChan->acknowledge(received);
+    QCOMPARE(mChan->messageQueue().size(), 0);
+
+    while (tp_message_mixin_has_pending_messages(G_OBJECT(mMessagesChanService), 0)) {
+        QTest::qWait(1);
+    }
+}
+
+void TestTextChan::testTracing()
+{
+    mChan = TextChannel::create(mConn->client(), mTextChanPath, QVariantMap());
+
+    QVERIFY(connect(mChan->becomeReady(TextChannel::FeatureMessageQueue),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(mChan->isReady(TextChannel::FeatureMessageQueue));
+
+    QVERIFY(connect(mChan.data(),
+                SIGNAL(messageReceived(const Tp::ReceivedMessage &)),
+                SLOT(onMessageReceived(const Tp::ReceivedMessage &))));
+
+    QCOMPARE(tracingCategories(), QStringList() << QLatin1String("contacts") <<
+            QLatin1String("roster") << QLatin1String("messages"));
+    QVERIFY(enabledTracingCategories().isEmpty());
+
+    // Nothing is traced while the categories are disabled
+    DebugMessageList traced = tracedMessages();
+    sendText("Untraced");
+    while (received.size() != 1) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    QCOMPARE(tracedMessages().size(), traced.size());
+
+    enableTracing(QStringList() << QLatin1String("messages") << QLatin1String("unknown"));
+    QCOMPARE(enabledTracingCategories(), QStringList() << QLatin1String("messages"));
+
+    sendText("Traced");
+    while (received.size() != 2) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    traced = tracedMessages();
+    QVERIFY(hasTracedMessageReceived(traced));
+    for (int i = 1; i < traced.size(); ++i) {
+        QVERIFY(traced.at(i - 1).timestamp <= traced.at(i).timestamp);
+    }
+
+    // The same records are available through the Debug interface
+    QVERIFY(registerTracingDebugObject());
+    QVERIFY(!registerTracingDebugObject());
+
+    DebugReceiverPtr receiver = DebugReceiver::create(QDBusConnection::sessionBus().baseService());
+    QVERIFY(connect(receiver->becomeReady(),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+
+    PendingDebugMessageList *pendingMessages = receiver->fetchMessages();
+    QVERIFY(connect(pendingMessages,
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(hasTracedMessageReceived(pendingMessages->result()));
+
+    // Monitoring traces every category, and signals what is traced from then on
+    enableTracing(QStringList());
+    QVERIFY(connect(receiver.data(),
+                SIGNAL(newDebugMessage(const Tp::DebugMessage &)),
+                SLOT(onNewDebugMessage(const Tp::DebugMessage &))));
+    QVERIFY(connect(receiver->setMonitoringEnabled(true),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QCOMPARE(enabledTracingCategories(), tracingCategories());
+
+    sendText("Monitored");
+    while (received.size() != 3) {
+        QCOMPARE(mLoop->exec(), 0);
+    }
+    for (int i = 0; i < 500 && !hasTracedMessageReceived(mNewDebugMessages); ++i) {
+        QTest::qWait(10);
+    }
+    QVERIFY(hasTracedMessageReceived(mNewDebugMessages));
+
+    QVERIFY(connect(receiver->setMonitoringEnabled(false),
+                SIGNAL(finished(Tp::PendingOperation *)),
+                SLOT(expectSuccessfulCall(Tp::PendingOperation *))));
+    QCOMPARE(mLoop->exec(), 0);
+    QVERIFY(enabledTracingCategories().isEmpty());
+
+    mChan->acknowledge(received);
+    while (tp_text_mixin_has_pending_messages(G_OBJECT(mTextChanService), 0)) {
+        QTest::qWait(1);
+    }
+}
+
 void TestTextChan::cleanup()
 {
     received.clear();
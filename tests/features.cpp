@@ -4,6 +4,7 @@
 #include <TelepathyQt/Debug>
 #include <TelepathyQt/Feature>
 #include <TelepathyQt/Types>
+#include "TelepathyQt/feature-set-internal.h"
 
 using namespace Tp;
 
@@ -29,6 +30,10 @@ public:
 
 private Q_SLOTS:
     void testFeaturesHash();
+    void testFeatureAssignment();
+    void testFeatureMutation();
+    void testFeatureSet();
+    void testFeatureSetArithmetic();
 };
 
 TestFeatures::TestFeatures(QObject *parent)
@@ -68,6 +73,154 @@ void TestFeatures::testFeaturesHash()
     QVERIFY(qHash(fs1.toSet()) != qHash(fs2.toSet()));
 }
 
+void TestFeatures::testFeatureAssignment()
+{
+    Feature critical(QLatin1String("TestFeatures"), 0, true);
+    Feature feature;
+    QVERIFY(!feature.isValid());
+
+    feature = critical;
+    QVERIFY(feature.isValid());
+    QVERIFY(feature.isCritical());
+    QCOMPARE(feature, critical);
+
+    feature = Feature(QLatin1String("TestFeatures"), 1);
+    QVERIFY(!feature.isCritical());
+    QCOMPARE(feature.first, QString(QLatin1String("TestFeatures")));
+    QCOMPARE(feature.second, 1U);
+
+    // Features constructed separately for the same class and id are still the same feature
+    Features features;
+    features << Feature(QLatin1String("TestFeatures"), 1) << feature << critical;
+    QCOMPARE(features.size(), 2);
+}
+
+void TestFeatures::testFeatureMutation()
+{
+    Feature original(QLatin1String("TestFeatures"), 2);
+    Feature other(QLatin1String("TestFeatures"), 3);
+
+    // Writing to the pair makes the feature equal to another one, which the sets must agree with
+    Feature mutated(original);
+    mutated.second = 3;
+    QCOMPARE(mutated, other);
+
+    FeatureSet set;
+    set.insert(mutated);
+    QVERIFY(set.contains(other));
+    QVERIFY(!set.contains(original));
+    QCOMPARE(set.toFeatures(), Features() << other);
+
+    // The feature it was copied from is left alone
+    set.clear();
+    set.insert(original);
+    QVERIFY(set.contains(original));
+    QVERIFY(!set.contains(mutated));
+
+    // Including for features which were never interned
+    Feature unknown(original);
+    unknown.first = QLatin1String("TestFeaturesUnknown");
+    QVERIFY(!set.contains(unknown));
+    set.insert(unknown);
+    QVERIFY(set.contains(Feature(QLatin1String("TestFeaturesUnknown"), 2)));
+    QCOMPARE(set.size(), 2);
+}
+
+void TestFeatures::testFeatureSet()
+{
+    FeatureSet set;
+    QVERIFY(set.isEmpty());
+    QCOMPARE(set.size(), 0);
+    QVERIFY(set.toFeatures().isEmpty());
+
+    // Enough features to need more than one word of bits
+    Features features;
+    for (uint i = 0; i < 100; ++i) {
+        features << Feature(QLatin1String("TestFeatureSet"), i);
+    }
+
+    Feature first(QLatin1String("TestFeatureSet"), 0);
+    Feature last(QLatin1String("TestFeatureSet"), 99);
+    set.insert(last);
+    QVERIFY(!set.isEmpty());
+    QCOMPARE(set.size(), 1);
+    QVERIFY(set.contains(last));
+    QVERIFY(!set.contains(first));
+
+    set.insert(first);
+    set.insert(first);
+    QCOMPARE(set.size(), 2);
+    QCOMPARE(set.toFeatures(), Features() << first << last);
+
+    set.remove(last);
+    QCOMPARE(set.size(), 1);
+    QVERIFY(!set.contains(last));
+
+    // Removing a feature whose bit is past the end of the array is fine
+    FeatureSet small;
+    small.remove(last);
+    QVERIFY(small.isEmpty());
+
+    FeatureSet all(features);
+    QCOMPARE(all.size(), 100);
+    QCOMPARE(all.toFeatures(), features);
+    QCOMPARE(FeatureSet(all.toFeatures()), all);
+
+    // Invalid features are interned by their pair, like the valid ones
+    Feature invalid;
+    QVERIFY(!all.contains(invalid));
+    set.insert(invalid);
+    QVERIFY(set.contains(Feature()));
+}
+
+void TestFeatures::testFeatureSetArithmetic()
+{
+    Features lowFeatures, highFeatures;
+    for (uint i = 0; i < 10; ++i) {
+        lowFeatures << Feature(QLatin1String("TestFeatureSetArithmetic"), i);
+    }
+    for (uint i = 10; i < 80; ++i) {
+        highFeatures << Feature(QLatin1String("TestFeatureSetArithmetic"), i);
+    }
+
+    FeatureSet low(lowFeatures);
+    FeatureSet high(highFeatures);
+    FeatureSet empty;
+
+    QVERIFY(!low.intersects(high));
+    QVERIFY(!high.intersects(low));
+    QVERIFY(!low.intersects(empty));
+    QVERIFY(low.contains(empty));
+    QVERIFY(!empty.contains(low));
+
+    FeatureSet both(low);
+    both += high;
+    QCOMPARE(both.size(), 80);
+    Features bothFeatures(lowFeatures);
+    bothFeatures.unite(highFeatures);
+    QCOMPARE(both.toFeatures(), bothFeatures);
+    QVERIFY(both.contains(low));
+    QVERIFY(both.contains(high));
+    QVERIFY(!low.contains(both));
+    QVERIFY(both.intersects(low));
+    QVERIFY(high.intersects(both));
+
+    QCOMPARE(both - high, low);
+    QCOMPARE(both - low, high);
+    QVERIFY((low - both).isEmpty());
+
+    FeatureSet fewer(both);
+    fewer -= low;
+    fewer -= high;
+    QVERIFY(fewer.isEmpty());
+
+    // Sets with trailing empty words are equal to the ones without
+    QCOMPARE(fewer, empty);
+    QCOMPARE(empty, fewer);
+    QVERIFY(fewer != low);
+    QVERIFY(low != high);
+}
+
 QTEST_MAIN(TestFeatures)
 
 #include "_gen/features.cpp.moc.hpp"
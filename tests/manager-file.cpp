@@ -2,6 +2,7 @@
 
 #include <TelepathyQt/Constants>
 #include <TelepathyQt/Debug>
+#include "TelepathyQt/config-index-internal.h"
 #include "TelepathyQt/manager-file.h"
 
 using namespace Tp;
@@ -50,6 +51,7 @@ public:
 
 private Q_SLOTS:
     void testManagerFile();
+    void testManagerFileChanged();
 };
 
 TestManagerFile::TestManagerFile(QObject *parent)
@@ -227,6 +229,53 @@ void TestManagerFile::testManagerFile()
              QStringList() << QString());
 }
 
+void TestManagerFile::testManagerFileChanged()
+{
+    QByteArray xdgDataHome = qgetenv("XDG_DATA_HOME");
+    QString buildDir = QString::fromLocal8Bit(qgetenv("abs_top_builddir"));
+    QVERIFY(!buildDir.isEmpty());
+    QString dataHome = buildDir + QLatin1String("/tests/manager-file-changed");
+    QString managersDir = dataHome + QLatin1String("/telepathy/managers");
+    QVERIFY(QDir().mkpath(managersDir));
+    qputenv("XDG_DATA_HOME", dataHome.toLocal8Bit());
+
+    QFile file(managersDir + QLatin1String("/test-manager-file-changed.manager"));
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write("[Protocol foo]\nparam-account = s required\n");
+    file.close();
+
+    ConfigIndex *index = ConfigIndex::instance();
+    uint hits = index->hits();
+
+    ManagerFile managerFile(QLatin1String("test-manager-file-changed"));
+    QCOMPARE(managerFile.isValid(), true);
+    QCOMPARE(managerFile.protocols(), QStringList() << QLatin1String("foo"));
+    QCOMPARE(index->hits(), hits);
+
+    // Read again from the index instead of parsing the file
+    ManagerFile cachedManagerFile(QLatin1String("test-manager-file-changed"));
+    QCOMPARE(cachedManagerFile.isValid(), true);
+    QCOMPARE(cachedManagerFile.protocols(), QStringList() << QLatin1String("foo"));
+    QVERIFY(containsParam(cachedManagerFile.parameters(QLatin1String("foo")), "account"));
+    QCOMPARE(index->hits(), hits + 1);
+
+    // A modified file is not served from the index
+    QVERIFY(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write("[Protocol bar]\nparam-account = s required\nparam-password = s secret\n");
+    file.close();
+
+    ManagerFile changedManagerFile(QLatin1String("test-manager-file-changed"));
+    QCOMPARE(changedManagerFile.isValid(), true);
+    QCOMPARE(changedManagerFile.protocols(), QStringList() << QLatin1String("bar"));
+    QVERIFY(containsParam(changedManagerFile.parameters(QLatin1String("bar")), "password"));
+    QCOMPARE(index->hits(), hits + 1);
+
+    QVERIFY(file.remove());
+    QVERIFY(QDir().rmpath(managersDir));
+    QVERIFY(!QDir(dataHome).exists());
+    qputenv("XDG_DATA_HOME", xdgDataHome);
+}
+
 QTEST_MAIN(TestManagerFile)
 
 #include "_gen/manager-file.cpp.moc.hpp"
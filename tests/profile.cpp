@@ -1,5 +1,7 @@
 #include <QtTest/QtTest>
 
+#include <utime.h>
+
 #include <TelepathyQt/Debug>
 #include <TelepathyQt/Profile>
 
@@ -14,6 +16,7 @@ public:
 
 private Q_SLOTS:
     void testProfile();
+    void testProfileCache();
 };
 
 TestProfile::TestProfile(QObject *parent)
@@ -130,6 +133,62 @@ void TestProfile::testProfile()
     QCOMPARE(profile->iconName().isEmpty(), true);
 }
 
+static bool writeProfile(const QString &fileName, const QString &name)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        return false;
+    }
+
+    QString contents = QString(QLatin1String(
+        "<service xmlns=\"http://telepathy.freedesktop.org/wiki/service-profile-v1\"\n"
+        "         id=\"test-profile-cached\"\n"
+        "         type=\"IM\"\n"
+        "         manager=\"testprofilecm\"\n"
+        "         protocol=\"testprofileproto\">\n"
+        "  <name>%1</name>\n"
+        "</service>\n")).arg(name);
+    if (file.write(contents.toUtf8()) < 0) {
+        return false;
+    }
+    file.close();
+
+    // Give all versions of the file the same modification time, so only the size tells them apart
+    struct utimbuf times;
+    times.actime = times.modtime = 1000000000;
+    return utime(QFile::encodeName(fileName).constData(), &times) == 0;
+}
+
+void TestProfile::testProfileCache()
+{
+    QString dirName = QString::fromLocal8Bit(::getenv("abs_top_builddir")) +
+        QLatin1String("/tests/profile-cache");
+    QVERIFY(QDir().mkpath(dirName));
+    QString fileName = dirName + QLatin1String("/test-profile-cached.profile");
+
+    QVERIFY(writeProfile(fileName, QLatin1String("Cached")));
+    ProfilePtr profile = Profile::createForFileName(fileName);
+    QCOMPARE(profile->isValid(), true);
+    QCOMPARE(profile->name(), QLatin1String("Cached"));
+
+    // Same size and modification time: the parsed contents are served from the index
+    QVERIFY(writeProfile(fileName, QLatin1String("Cachee")));
+    profile = Profile::createForFileName(fileName);
+    QCOMPARE(profile->isValid(), true);
+    QCOMPARE(profile->name(), QLatin1String("Cached"));
+    QCOMPARE(profile->cmName(), QLatin1String("testprofilecm"));
+    QCOMPARE(profile->protocolName(), QLatin1String("testprofileproto"));
+
+    // A different size invalidates the cached contents
+    QVERIFY(writeProfile(fileName, QLatin1String("Changed name")));
+    profile = Profile::createForFileName(fileName);
+    QCOMPARE(profile->isValid(), true);
+    QCOMPARE(profile->name(), QLatin1String("Changed name"));
+
+    QVERIFY(QFile::remove(fileName));
+    QVERIFY(QDir().rmdir(dirName));
+}
+
 QTEST_MAIN(TestProfile)
 
 #include "_gen/profile.cpp.moc.hpp"
@@ -0,0 +1,247 @@
+#include <QtTest/QtTest>
+
+#include <TelepathyQt/Constants>
+#include <TelepathyQt/Debug>
+#include <TelepathyQt/Feature>
+#include <TelepathyQt/PendingReady>
+#include <TelepathyQt/ReadinessHelper>
+#include <TelepathyQt/RefCounted>
+#include <TelepathyQt/SharedPtr>
+
+using namespace Tp;
+
+namespace {
+
+class Object : public RefCounted
+{
+};
+
+const uint StatusIdle = 0;
+const uint StatusActive = 1;
+
+}
+
+class TestReadinessHelper : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestReadinessHelper(QObject *parent = 0);
+
+protected Q_SLOTS:
+    void onFinished(Tp::PendingOperation *op);
+
+private Q_SLOTS:
+    void init();
+
+    void testNoOpChain();
+    void testMissingDependency();
+    void testIncremental();
+
+    void cleanup();
+
+private:
+    struct IntrospectData
+    {
+        TestReadinessHelper *test;
+        Feature feature;
+    };
+
+    static void introspect(void *data);
+    ReadinessHelper::Introspectable introspectable(const QSet<uint> &statuses,
+            const Features &dependsOn, const Feature &feature,
+            const QStringList &dependsOnInterfaces = QStringList());
+    void processEvents();
+    PendingReady *becomeReady(ReadinessHelper *helper, const Features &features);
+
+    SharedPtr<Object> mObject;
+    QList<IntrospectData *> mIntrospectData;
+    QList<Feature> mIntrospected;
+    QList<PendingOperation *> mFinished;
+    QList<PendingOperation *> mFailed;
+};
+
+TestReadinessHelper::TestReadinessHelper(QObject *parent)
+    : QObject(parent)
+{
+    Tp::enableDebug(false);
+    Tp::enableWarnings(true);
+}
+
+void TestReadinessHelper::introspect(void *data)
+{
+    IntrospectData *introspectData = static_cast<IntrospectData *>(data);
+    introspectData->test->mIntrospected.append(introspectData->feature);
+}
+
+ReadinessHelper::Introspectable TestReadinessHelper::introspectable(const QSet<uint> &statuses,
+        const Features &dependsOn, const Feature &feature, const QStringList &dependsOnInterfaces)
+{
+    IntrospectData *data = new IntrospectData;
+    data->test = this;
+    data->feature = feature;
+    mIntrospectData.append(data);
+
+    return ReadinessHelper::Introspectable(statuses, dependsOn, dependsOnInterfaces,
+            &TestReadinessHelper::introspect, data);
+}
+
+void TestReadinessHelper::onFinished(Tp::PendingOperation *op)
+{
+    mFinished.append(op);
+    if (op->isError()) {
+        mFailed.append(op);
+    }
+}
+
+PendingReady *TestReadinessHelper::becomeReady(ReadinessHelper *helper, const Features &features)
+{
+    PendingReady *op = helper->becomeReady(features);
+    connect(op,
+            SIGNAL(finished(Tp::PendingOperation*)),
+            SLOT(onFinished(Tp::PendingOperation*)));
+    return op;
+}
+
+void TestReadinessHelper::processEvents()
+{
+    // One turn for the introspection iteration, one for the PendingReady to signal
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+}
+
+void TestReadinessHelper::init()
+{
+    mObject = SharedPtr<Object>(new Object);
+    mIntrospected.clear();
+    mFinished.clear();
+    mFailed.clear();
+}
+
+void TestReadinessHelper::testNoOpChain()
+{
+    // A long chain of features with nothing to do in the current status is satisfied in a single
+    // iteration rather than one main loop turn per feature
+    ReadinessHelper::Introspectables introspectables;
+    Feature previous;
+    for (uint i = 0; i < 1000; ++i) {
+        Feature feature(QLatin1String("TestReadinessHelper"), i);
+        introspectables[feature] = introspectable(QSet<uint>() << StatusActive,
+                i ? Features() << previous : Features(), feature);
+        previous = feature;
+    }
+
+    ReadinessHelper *helper = new ReadinessHelper(mObject.data(), StatusIdle, introspectables);
+    QSignalSpy statusReadySpy(helper, SIGNAL(statusReady(uint)));
+
+    PendingReady *op = becomeReady(helper, Features() << previous);
+    processEvents();
+
+    QVERIFY(mFinished.contains(op));
+    QVERIFY(!mFailed.contains(op));
+    QCOMPARE(helper->actualFeatures().size(), 1000);
+    QVERIFY(helper->missingFeatures().isEmpty());
+    QCOMPARE(statusReadySpy.count(), 1);
+    QVERIFY(mIntrospected.isEmpty());
+
+    delete helper;
+}
+
+void TestReadinessHelper::testMissingDependency()
+{
+    Feature featureA(QLatin1String("TestReadinessHelper"), 0);
+    Feature featureB(QLatin1String("TestReadinessHelper"), 1);
+    Feature featureC(QLatin1String("TestReadinessHelper"), 2);
+    Feature featureD(QLatin1String("TestReadinessHelper"), 3);
+
+    ReadinessHelper::Introspectables introspectables;
+    introspectables[featureA] = introspectable(QSet<uint>() << StatusIdle, Features(), featureA,
+            QStringList() << QLatin1String("org.example.Missing"));
+    introspectables[featureB] = introspectable(QSet<uint>() << StatusIdle,
+            Features() << featureA, featureB);
+    introspectables[featureC] = introspectable(QSet<uint>() << StatusIdle,
+            Features() << featureB, featureC);
+    introspectables[featureD] = introspectable(QSet<uint>() << StatusActive, Features(), featureD);
+
+    ReadinessHelper *helper = new ReadinessHelper(mObject.data(), StatusIdle, introspectables);
+
+    PendingReady *op = becomeReady(helper, Features() << featureC << featureD);
+    processEvents();
+
+    QVERIFY(mFinished.contains(op));
+    QVERIFY(!mFailed.contains(op));
+    QCOMPARE(helper->missingFeatures(), Features() << featureA << featureB << featureC);
+    QCOMPARE(helper->actualFeatures(), Features() << featureD);
+    QVERIFY(mIntrospected.isEmpty());
+
+    QString errorName;
+    QVERIFY(helper->isReady(featureC, &errorName));
+    QVERIFY(!helper->actualFeatures().contains(featureC));
+
+    delete helper;
+}
+
+void TestReadinessHelper::testIncremental()
+{
+    Feature featureA(QLatin1String("TestReadinessHelper"), 0, true);
+    Feature featureB(QLatin1String("TestReadinessHelper"), 1);
+    Feature featureC(QLatin1String("TestReadinessHelper"), 2);
+
+    ReadinessHelper::Introspectables introspectables;
+    introspectables[featureA] = introspectable(QSet<uint>() << StatusIdle, Features(), featureA);
+    introspectables[featureB] = introspectable(QSet<uint>() << StatusIdle,
+            Features() << featureA, featureB);
+    introspectables[featureC] = introspectable(QSet<uint>() << StatusIdle,
+            Features() << featureA, featureC);
+
+    ReadinessHelper *helper = new ReadinessHelper(mObject.data(), StatusIdle, introspectables);
+
+    PendingReady *opA = becomeReady(helper, Features() << featureA);
+    PendingReady *opB = becomeReady(helper, Features() << featureB);
+    PendingReady *opC = becomeReady(helper, Features() << featureC);
+    processEvents();
+
+    // Only the feature without dependencies is introspected to begin with
+    QCOMPARE(mIntrospected, QList<Feature>() << featureA);
+    QVERIFY(!mFinished.contains(opA));
+
+    // Completing it unblocks both of its dependents at once, and only finishes the operation
+    // which was waiting for it
+    helper->setIntrospectCompleted(featureA, true);
+    processEvents();
+
+    QVERIFY(mFinished.contains(opA));
+    QVERIFY(!mFailed.contains(opA));
+    QVERIFY(!mFinished.contains(opB));
+    QVERIFY(!mFinished.contains(opC));
+    QCOMPARE(mIntrospected.size(), 3);
+    QVERIFY(mIntrospected.contains(featureB));
+    QVERIFY(mIntrospected.contains(featureC));
+
+    helper->setIntrospectCompleted(featureC, false, QLatin1String("org.example.Error"),
+            QLatin1String("Failed"));
+    processEvents();
+
+    QVERIFY(mFinished.contains(opC));
+    QVERIFY(!mFinished.contains(opB));
+
+    helper->setIntrospectCompleted(featureB, true);
+    processEvents();
+
+    QVERIFY(mFinished.contains(opB));
+    QVERIFY(!mFailed.contains(opB));
+    QCOMPARE(helper->actualFeatures(), Features() << featureA << featureB);
+    QCOMPARE(helper->missingFeatures(), Features() << featureC);
+
+    delete helper;
+}
+
+void TestReadinessHelper::cleanup()
+{
+    qDeleteAll(mIntrospectData);
+    mIntrospectData.clear();
+    mObject.reset();
+}
+
+QTEST_MAIN(TestReadinessHelper)
+#include "_gen/readiness-helper.cpp.moc.hpp"